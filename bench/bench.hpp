@@ -0,0 +1,151 @@
+#pragma once
+
+#include <batch_renderer.hpp>
+#include <bindless_heap.hpp>
+#include <device_selector.hpp>
+#include <jobs.hpp>
+#include <memory_allocator.hpp>
+#include <timeline.hpp>
+#include <upload.hpp>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace bench {
+
+// The CPU records one frame while the GPU renders the previous one.
+constexpr uint32_t framesInFlight = 2;
+
+struct BenchOptions {
+    uint32_t width = 1920;
+    uint32_t height = 1080;
+    uint32_t frames = 100;
+    // Rendered before measuring, so that caches, pools and instance buffers
+    // have reached their steady state.
+    uint32_t warmupFrames = 10;
+};
+
+struct BenchBuffer {
+    vk::Buffer buffer;
+    // Set for host-visible buffers, which are persistently mapped.
+    void* mapped = nullptr;
+    vk::DeviceSize size = 0;
+};
+
+// The device, queues and offscreen target shared by all scenes. Only a
+// graphics queue and, if the device has one, a transfer queue are used, and
+// nothing is presented, so the benchmark runs without a window system.
+class BenchContext {
+public:
+    BenchContext(const rr::DeviceCandidate& candidate, BenchOptions options);
+    ~BenchContext();
+
+    BenchContext(const BenchContext&) = delete;
+    BenchContext& operator=(const BenchContext&) = delete;
+
+    // Buffers live until releaseSceneResources.
+    BenchBuffer createBuffer(
+        vk::DeviceSize size, vk::BufferUsageFlags usage, bool hostVisible);
+    // Uploads through the upload service and waits until the graphics queue
+    // can use the data. For scene setup only.
+    void upload(
+        vk::Buffer buffer,
+        std::span<const std::byte> data,
+        vk::AccessFlags dstAccess,
+        vk::PipelineStageFlags dstStage);
+    // Waits for the device and frees the buffers and bindless handles of
+    // the previous scene.
+    void releaseSceneResources();
+
+    // A pipeline for the offscreen render pass with the bindless heap's
+    // layout. Variants differ in blend state, like the materials of a scene;
+    // variant 0 does not blend.
+    vk::raii::Pipeline createPipeline(
+        std::span<const uint32_t> vertexCode,
+        std::span<const uint32_t> fragmentCode,
+        const rr::BatchVertexInput& vertexInput,
+        uint32_t variant = 0) const;
+
+    BenchOptions options;
+    vk::raii::PhysicalDevice physicalDevice {nullptr};
+    vk::PhysicalDeviceProperties properties;
+    uint32_t graphicsQueueFamily = 0;
+    uint32_t transferQueueFamily = 0;
+    bool drawIndirectCount = false;
+    bool multiDrawIndirect = false;
+
+    vk::raii::Device device {nullptr};
+    rr::TimelineSync sync;
+    rr::QueueId graphicsQueue = 0;
+    rr::QueueId transferQueue = 0;
+    rr::MemoryAllocator allocator;
+    rr::BindlessHeap heap;
+    rr::UploadService uploads;
+
+    // Cleared at the start of every frame and kept in the color attachment
+    // layout between frames.
+    vk::Format colorFormat = vk::Format::eR8G8B8A8Unorm;
+    vk::raii::Image colorImage {nullptr};
+    rr::MemoryAllocation colorMemory;
+    vk::raii::ImageView colorView {nullptr};
+    vk::raii::RenderPass renderPass {nullptr};
+    vk::raii::Framebuffer framebuffer {nullptr};
+
+private:
+    struct SceneBuffer {
+        vk::raii::Buffer buffer {nullptr};
+        rr::MemoryAllocation memory;
+    };
+
+    vk::raii::CommandPool _setupPool {nullptr};
+    std::deque<SceneBuffer> _sceneBuffers;
+};
+
+struct SceneFrame {
+    uint32_t frameContext = 0;
+    uint64_t frame = 0;
+    vk::CommandBuffer commandBuffer;
+    // For secondary command buffers executed in the render pass.
+    vk::CommandBufferInheritanceInfo inheritance;
+    // Points the frame's graphics submission waits for, e.g. uploads.
+    std::vector<rr::TimelineWait> waits;
+};
+
+// A workload rendered for a fixed number of frames.
+class Scene {
+public:
+    virtual ~Scene() = default;
+
+    // Called once the frame context's previous submission has completed;
+    // records work outside the render pass, e.g. uploads and culling.
+    virtual void beginFrame(SceneFrame& frame);
+    // If true, render records secondary command buffers only.
+    virtual bool secondaryCommandBuffers() const;
+    virtual void render(SceneFrame& frame) = 0;
+    // Records work after the render pass, e.g. barriers for host reads of
+    // what the frame wrote.
+    virtual void endFrame(SceneFrame& frame);
+    // Writes the scene's own counters as a JSON object.
+    virtual void writeStats(std::ostream& out) const;
+};
+
+struct SceneInfo {
+    std::string_view name;
+    std::string_view description;
+    // Of the scene's main item: triangles, draws, pipelines and so on.
+    uint32_t defaultCount = 0;
+    std::unique_ptr<Scene> (*create)(
+        BenchContext& context, rr::JobSystem& jobs, uint32_t count);
+};
+
+std::span<const SceneInfo> sceneInfos();
+
+} // namespace bench
@@ -0,0 +1,456 @@
+#include "bench.hpp"
+
+#include <gpu_culling.hpp>
+
+#include <array>
+
+namespace bench {
+
+namespace {
+
+vk::raii::Device createDevice(
+    const vk::raii::PhysicalDevice& physicalDevice,
+    uint32_t graphicsQueueFamily,
+    uint32_t transferQueueFamily,
+    bool drawIndirectCount,
+    bool multiDrawIndirect)
+{
+    auto extensionNames = std::vector<const char*>{};
+    if (drawIndirectCount) {
+        extensionNames.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
+
+    auto enabledFeatures = vk::StructureChain<
+        vk::PhysicalDeviceFeatures2,
+        vk::PhysicalDeviceTimelineSemaphoreFeatures,
+        vk::PhysicalDeviceDescriptorIndexingFeatures>{};
+    enabledFeatures.get<vk::PhysicalDeviceFeatures2>()
+        .features.multiDrawIndirect = multiDrawIndirect;
+    // Required by the device selection, for GpuCuller.
+    enabledFeatures.get<vk::PhysicalDeviceFeatures2>()
+        .features.drawIndirectFirstInstance = vk::True;
+    enabledFeatures.get<vk::PhysicalDeviceTimelineSemaphoreFeatures>()
+        .timelineSemaphore = vk::True;
+    rr::enableBindlessFeatures(
+        enabledFeatures.get<vk::PhysicalDeviceFeatures2>().features,
+        enabledFeatures.get<vk::PhysicalDeviceDescriptorIndexingFeatures>());
+
+    float queuePriority = 1.f;
+    auto queueCreateInfos = std::vector<vk::DeviceQueueCreateInfo>{};
+    for (uint32_t family : {graphicsQueueFamily, transferQueueFamily}) {
+        if (!queueCreateInfos.empty() &&
+                queueCreateInfos.front().queueFamilyIndex == family) {
+            continue;
+        }
+        queueCreateInfos.push_back(vk::DeviceQueueCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::DeviceQueueCreateFlags{},
+            .queueFamilyIndex = family,
+            .queueCount = 1,
+            .pQueuePriorities = &queuePriority,
+        });
+    }
+
+    auto device = physicalDevice.createDevice(vk::DeviceCreateInfo{
+        .pNext = &enabledFeatures.get<vk::PhysicalDeviceFeatures2>(),
+        .flags = vk::DeviceCreateFlags{},
+        .queueCreateInfoCount = (uint32_t)queueCreateInfos.size(),
+        .pQueueCreateInfos = queueCreateInfos.data(),
+        .enabledLayerCount = 0,
+        .ppEnabledLayerNames = nullptr,
+        .enabledExtensionCount = (uint32_t)extensionNames.size(),
+        .ppEnabledExtensionNames = extensionNames.data(),
+        .pEnabledFeatures = nullptr,
+    });
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(*device);
+    return device;
+}
+
+} // namespace
+
+BenchContext::BenchContext(
+    const rr::DeviceCandidate& candidate, BenchOptions options)
+    : options(options)
+    , physicalDevice(candidate.physicalDevice)
+    , properties(candidate.properties)
+    , graphicsQueueFamily(candidate.graphicsQueueFamily)
+    , transferQueueFamily(rr::findTransferQueueFamily(physicalDevice)
+        .value_or(candidate.graphicsQueueFamily))
+    , drawIndirectCount(rr::drawIndirectCountSupported(physicalDevice))
+    , multiDrawIndirect(physicalDevice.getFeatures().multiDrawIndirect)
+    , device(createDevice(
+        physicalDevice,
+        graphicsQueueFamily,
+        transferQueueFamily,
+        drawIndirectCount,
+        multiDrawIndirect))
+    , sync(device)
+    , graphicsQueue(sync.addQueue(device.getQueue(graphicsQueueFamily, 0)))
+    , transferQueue(sync.addQueue(device.getQueue(transferQueueFamily, 0)))
+    , allocator(physicalDevice, device, rr::MemoryAllocator::Options{})
+    , heap(physicalDevice, device)
+    , uploads(
+        physicalDevice,
+        device,
+        allocator,
+        sync,
+        rr::UploadServiceOptions{
+            .stagingSize = 64 * 1024 * 1024,
+            .transferQueueFamily = transferQueueFamily,
+            .graphicsQueueFamily = graphicsQueueFamily,
+            .transferQueue = transferQueue,
+        })
+{
+    auto extent = vk::Extent3D{
+        .width = options.width,
+        .height = options.height,
+        .depth = 1,
+    };
+    colorImage = device.createImage(vk::ImageCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::ImageCreateFlags{},
+        .imageType = vk::ImageType::e2D,
+        .format = colorFormat,
+        .extent = extent,
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = vk::SampleCountFlagBits::e1,
+        .tiling = vk::ImageTiling::eOptimal,
+        .usage = vk::ImageUsageFlagBits::eColorAttachment,
+        .sharingMode = vk::SharingMode::eExclusive,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = nullptr,
+        .initialLayout = vk::ImageLayout::eUndefined,
+    });
+    colorMemory = allocator.allocateForImage(
+        *colorImage,
+        rr::ResourceKind::Optimal,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    colorView = device.createImageView(vk::ImageViewCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::ImageViewCreateFlags{},
+        .image = *colorImage,
+        .viewType = vk::ImageViewType::e2D,
+        .format = colorFormat,
+        .components = vk::ComponentMapping{},
+        .subresourceRange = vk::ImageSubresourceRange{
+            .aspectMask = vk::ImageAspectFlagBits::eColor,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    });
+
+    auto colorAttachment = vk::AttachmentDescription{
+        .flags = vk::AttachmentDescriptionFlags{},
+        .format = colorFormat,
+        .samples = vk::SampleCountFlagBits::e1,
+        .loadOp = vk::AttachmentLoadOp::eClear,
+        .storeOp = vk::AttachmentStoreOp::eStore,
+        .stencilLoadOp = vk::AttachmentLoadOp::eDontCare,
+        .stencilStoreOp = vk::AttachmentStoreOp::eDontCare,
+        // The previous contents are cleared anyway.
+        .initialLayout = vk::ImageLayout::eUndefined,
+        .finalLayout = vk::ImageLayout::eColorAttachmentOptimal,
+    };
+    auto colorAttachmentReference = vk::AttachmentReference{
+        .attachment = 0,
+        .layout = vk::ImageLayout::eColorAttachmentOptimal,
+    };
+    auto subpass = vk::SubpassDescription{
+        .flags = vk::SubpassDescriptionFlags{},
+        .pipelineBindPoint = vk::PipelineBindPoint::eGraphics,
+        .inputAttachmentCount = 0,
+        .pInputAttachments = nullptr,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &colorAttachmentReference,
+        .pResolveAttachments = nullptr,
+        .pDepthStencilAttachment = nullptr,
+        .preserveAttachmentCount = 0,
+        .pPreserveAttachments = nullptr,
+    };
+    // Every frame writes the same image; order the writes of consecutive
+    // frames.
+    auto dependency = vk::SubpassDependency{
+        .srcSubpass = VK_SUBPASS_EXTERNAL,
+        .dstSubpass = 0,
+        .srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        .dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        .srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite,
+        .dstAccessMask = vk::AccessFlagBits::eColorAttachmentWrite,
+        .dependencyFlags = vk::DependencyFlags{},
+    };
+    renderPass = device.createRenderPass(vk::RenderPassCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::RenderPassCreateFlags{},
+        .attachmentCount = 1,
+        .pAttachments = &colorAttachment,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+        .dependencyCount = 1,
+        .pDependencies = &dependency,
+    });
+
+    vk::ImageView attachment = *colorView;
+    framebuffer = device.createFramebuffer(vk::FramebufferCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::FramebufferCreateFlags{},
+        .renderPass = *renderPass,
+        .attachmentCount = 1,
+        .pAttachments = &attachment,
+        .width = options.width,
+        .height = options.height,
+        .layers = 1,
+    });
+
+    _setupPool = device.createCommandPool(vk::CommandPoolCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::CommandPoolCreateFlagBits::eTransient,
+        .queueFamilyIndex = graphicsQueueFamily,
+    });
+}
+
+BenchContext::~BenchContext()
+{
+    releaseSceneResources();
+    framebuffer.clear();
+    colorView.clear();
+    colorImage.clear();
+    allocator.free(colorMemory);
+}
+
+BenchBuffer BenchContext::createBuffer(
+    vk::DeviceSize size, vk::BufferUsageFlags usage, bool hostVisible)
+{
+    if (!hostVisible) {
+        usage |= vk::BufferUsageFlagBits::eTransferDst;
+    }
+    SceneBuffer& sceneBuffer = _sceneBuffers.emplace_back();
+    sceneBuffer.buffer = device.createBuffer(vk::BufferCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::BufferCreateFlags{},
+        .size = size,
+        .usage = usage,
+        .sharingMode = vk::SharingMode::eExclusive,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = nullptr,
+    });
+    if (hostVisible) {
+        sceneBuffer.memory = allocator.allocateForBuffer(
+            *sceneBuffer.buffer,
+            vk::MemoryPropertyFlagBits::eHostVisible |
+                vk::MemoryPropertyFlagBits::eHostCoherent,
+            vk::MemoryPropertyFlagBits::eDeviceLocal);
+    } else {
+        sceneBuffer.memory = allocator.allocateForBuffer(
+            *sceneBuffer.buffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    }
+    return BenchBuffer{
+        .buffer = *sceneBuffer.buffer,
+        .mapped = sceneBuffer.memory.mapped,
+        .size = size,
+    };
+}
+
+void BenchContext::upload(
+    vk::Buffer buffer,
+    std::span<const std::byte> data,
+    vk::AccessFlags dstAccess,
+    vk::PipelineStageFlags dstStage)
+{
+    uploads.uploadBuffer(buffer, 0, data, dstAccess, dstStage);
+    auto submission = uploads.flush();
+    if (!submission) {
+        return;
+    }
+
+    auto commandBuffers = device.allocateCommandBuffers(
+        vk::CommandBufferAllocateInfo{
+            .pNext = nullptr,
+            .commandPool = *_setupPool,
+            .level = vk::CommandBufferLevel::ePrimary,
+            .commandBufferCount = 1,
+        });
+    vk::CommandBuffer commandBuffer = *commandBuffers.front();
+    commandBuffer.begin(vk::CommandBufferBeginInfo{
+        .pNext = nullptr,
+        .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+        .pInheritanceInfo = nullptr,
+    });
+    submission->recordAcquire(commandBuffer);
+    commandBuffer.end();
+
+    auto wait = submission->wait();
+    sync.wait(sync.submit(graphicsQueue, rr::TimelineSubmitInfo{
+        .commandBuffers = std::span{&commandBuffer, 1},
+        .waits = std::span{&wait, 1},
+        .binaryWaits = {},
+        .binarySignals = {},
+    }));
+    uploads.collect();
+}
+
+void BenchContext::releaseSceneResources()
+{
+    sync.waitIdle();
+    for (SceneBuffer& sceneBuffer : _sceneBuffers) {
+        sceneBuffer.buffer.clear();
+        allocator.free(sceneBuffer.memory);
+    }
+    _sceneBuffers.clear();
+    heap.collect(UINT64_MAX);
+    uploads.collect();
+}
+
+vk::raii::Pipeline BenchContext::createPipeline(
+    std::span<const uint32_t> vertexCode,
+    std::span<const uint32_t> fragmentCode,
+    const rr::BatchVertexInput& vertexInput,
+    uint32_t variant) const
+{
+    auto createModule = [this] (std::span<const uint32_t> code) {
+        return device.createShaderModule(vk::ShaderModuleCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::ShaderModuleCreateFlags{},
+            .codeSize = code.size_bytes(),
+            .pCode = code.data(),
+        });
+    };
+    vk::raii::ShaderModule vertexModule = createModule(vertexCode);
+    vk::raii::ShaderModule fragmentModule = createModule(fragmentCode);
+    vk::PipelineShaderStageCreateInfo stages[] {
+        vk::PipelineShaderStageCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::PipelineShaderStageCreateFlags{},
+            .stage = vk::ShaderStageFlagBits::eVertex,
+            .module = *vertexModule,
+            .pName = "main",
+            .pSpecializationInfo = nullptr,
+        },
+        vk::PipelineShaderStageCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::PipelineShaderStageCreateFlags{},
+            .stage = vk::ShaderStageFlagBits::eFragment,
+            .module = *fragmentModule,
+            .pName = "main",
+            .pSpecializationInfo = nullptr,
+        },
+    };
+
+    auto vertexInputState = vertexInput.createInfo();
+    auto inputAssemblyState = vk::PipelineInputAssemblyStateCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineInputAssemblyStateCreateFlags{},
+        .topology = vk::PrimitiveTopology::eTriangleList,
+        .primitiveRestartEnable = vk::False,
+    };
+    auto viewport = vk::Viewport{
+        .x = 0.f,
+        .y = 0.f,
+        .width = (float)options.width,
+        .height = (float)options.height,
+        .minDepth = 0.f,
+        .maxDepth = 1.f,
+    };
+    auto scissor = vk::Rect2D{
+        .offset = vk::Offset2D{.x = 0, .y = 0},
+        .extent = vk::Extent2D{
+            .width = options.width,
+            .height = options.height,
+        },
+    };
+    auto viewportState = vk::PipelineViewportStateCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineViewportStateCreateFlags{},
+        .viewportCount = 1,
+        .pViewports = &viewport,
+        .scissorCount = 1,
+        .pScissors = &scissor,
+    };
+    auto rasterizationState = vk::PipelineRasterizationStateCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineRasterizationStateCreateFlags{},
+        .depthClampEnable = vk::False,
+        .rasterizerDiscardEnable = vk::False,
+        .polygonMode = vk::PolygonMode::eFill,
+        .cullMode = vk::CullModeFlagBits::eNone,
+        .frontFace = vk::FrontFace::eCounterClockwise,
+        .depthBiasEnable = vk::False,
+        .depthBiasConstantFactor = 0.f,
+        .depthBiasClamp = 0.f,
+        .depthBiasSlopeFactor = 0.f,
+        .lineWidth = 1.f,
+    };
+    auto multisampleState = vk::PipelineMultisampleStateCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineMultisampleStateCreateFlags{},
+        .rasterizationSamples = vk::SampleCountFlagBits::e1,
+        .sampleShadingEnable = vk::False,
+        .minSampleShading = 1.f,
+        .pSampleMask = nullptr,
+        .alphaToCoverageEnable = vk::False,
+        .alphaToOneEnable = vk::False,
+    };
+
+    constexpr vk::BlendFactor blendFactors[] {
+        vk::BlendFactor::eOne,
+        vk::BlendFactor::eSrcAlpha,
+        vk::BlendFactor::eOneMinusSrcAlpha,
+        vk::BlendFactor::eDstColor,
+    };
+    constexpr vk::BlendOp blendOps[] {
+        vk::BlendOp::eAdd,
+        vk::BlendOp::eSubtract,
+        vk::BlendOp::eReverseSubtract,
+        vk::BlendOp::eMin,
+        vk::BlendOp::eMax,
+    };
+    auto colorBlendAttachmentState = vk::PipelineColorBlendAttachmentState{
+        .blendEnable = variant > 0,
+        .srcColorBlendFactor = blendFactors[variant % 4],
+        .dstColorBlendFactor = blendFactors[variant / 4 % 4],
+        .colorBlendOp = blendOps[variant / 16 % 5],
+        .srcAlphaBlendFactor = vk::BlendFactor::eOne,
+        .dstAlphaBlendFactor = vk::BlendFactor::eZero,
+        .alphaBlendOp = vk::BlendOp::eAdd,
+        .colorWriteMask =
+            vk::ColorComponentFlagBits::eR |
+            vk::ColorComponentFlagBits::eG |
+            vk::ColorComponentFlagBits::eB |
+            vk::ColorComponentFlagBits::eA,
+    };
+    auto colorBlendState = vk::PipelineColorBlendStateCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineColorBlendStateCreateFlags{},
+        .logicOpEnable = vk::False,
+        .logicOp = vk::LogicOp::eCopy,
+        .attachmentCount = 1,
+        .pAttachments = &colorBlendAttachmentState,
+        .blendConstants = std::array{0.f, 0.f, 0.f, 0.f},
+    };
+
+    auto pipelineInfo = vk::GraphicsPipelineCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineCreateFlags{},
+        .stageCount = 2,
+        .pStages = stages,
+        .pVertexInputState = &vertexInputState,
+        .pInputAssemblyState = &inputAssemblyState,
+        .pTessellationState = nullptr,
+        .pViewportState = &viewportState,
+        .pRasterizationState = &rasterizationState,
+        .pMultisampleState = &multisampleState,
+        .pDepthStencilState = nullptr,
+        .pColorBlendState = &colorBlendState,
+        .pDynamicState = nullptr,
+        .layout = heap.pipelineLayout(),
+        .renderPass = *renderPass,
+        .subpass = 0,
+        .basePipelineHandle = nullptr,
+        .basePipelineIndex = -1,
+    };
+    return device.createGraphicsPipeline(nullptr, pipelineInfo);
+}
+
+} // namespace bench
@@ -0,0 +1,549 @@
+#include "bench.hpp"
+
+#include <device_selector.hpp>
+#include <error.hpp>
+#include <gpu_profiler.hpp>
+#include <jobs.hpp>
+#include <li.hpp>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+// Counts operator new calls, so runs report how much the renderer allocates
+// on the heap per frame. Driver allocations do not go through it.
+std::atomic<uint64_t> hostAllocations = 0;
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    hostAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size > 0 ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::string_view usage =
+R"(usage: rr_renderbench [options]
+
+Renders scripted scenes to an offscreen target and writes frame time
+percentiles, the CPU and GPU split and allocation counts as JSON.
+
+  --scene NAME       run this scene; repeat for several (default: all)
+  --list             list the scenes and their default counts
+  --count N          size of every scene, e.g. the number of sprites
+  --frames N         measured frames per scene (default: 100)
+  --warmup N         frames rendered before measuring (default: 10)
+  --threads LIST     comma-separated job system thread counts to run
+                     every scene with; 0 is one per core (default: 0)
+  --width N          offscreen target width (default: 1920)
+  --height N         offscreen target height (default: 1080)
+  --device NAME      device UUID or name substring (default: RR_DEVICE,
+                     else the best device)
+  --output FILE      write the JSON here instead of stdout
+  --validation       enable VK_LAYER_KHRONOS_validation
+)";
+
+struct Arguments {
+    bench::BenchOptions options;
+    std::vector<std::string> scenes;
+    std::optional<uint32_t> count;
+    std::vector<uint32_t> threadCounts;
+    std::string device;
+    std::string output;
+    bool validation = false;
+    bool list = false;
+    bool help = false;
+};
+
+uint32_t parseCount(std::string_view option, std::string_view value)
+{
+    uint32_t result = 0;
+    auto [end, error] =
+        std::from_chars(value.data(), value.data() + value.size(), result);
+    if (error != std::errc{} || end != value.data() + value.size()) {
+        throw rr::Error{} << option << ": not a number: " << value;
+    }
+    return result;
+}
+
+Arguments parseArguments(int argc, char** argv)
+{
+    auto arguments = Arguments{};
+    for (int i = 1; i < argc; i++) {
+        auto option = std::string_view{argv[i]};
+        auto value = [&] {
+            if (i + 1 >= argc) {
+                throw rr::Error{} << option << " needs a value";
+            }
+            return std::string_view{argv[++i]};
+        };
+
+        if (option == "--scene") {
+            arguments.scenes.emplace_back(value());
+        } else if (option == "--list") {
+            arguments.list = true;
+        } else if (option == "--count") {
+            arguments.count = parseCount(option, value());
+        } else if (option == "--frames") {
+            arguments.options.frames = parseCount(option, value());
+        } else if (option == "--warmup") {
+            arguments.options.warmupFrames = parseCount(option, value());
+        } else if (option == "--threads") {
+            std::string_view list = value();
+            while (!list.empty()) {
+                size_t comma = std::min(list.find(','), list.size());
+                arguments.threadCounts.push_back(
+                    parseCount(option, list.substr(0, comma)));
+                list.remove_prefix(std::min(comma + 1, list.size()));
+            }
+        } else if (option == "--width") {
+            arguments.options.width = parseCount(option, value());
+        } else if (option == "--height") {
+            arguments.options.height = parseCount(option, value());
+        } else if (option == "--device") {
+            arguments.device = value();
+        } else if (option == "--output") {
+            arguments.output = value();
+        } else if (option == "--validation") {
+            arguments.validation = true;
+        } else if (option == "--help" || option == "-h") {
+            arguments.help = true;
+        } else {
+            throw rr::Error{} << "unknown option: " << option;
+        }
+    }
+
+    if (arguments.options.frames == 0) {
+        throw rr::Error{} << "--frames must be at least 1";
+    }
+    if (arguments.options.width == 0 || arguments.options.height == 0) {
+        throw rr::Error{} << "the target size must not be zero";
+    }
+    if (arguments.threadCounts.empty()) {
+        arguments.threadCounts.push_back(0);
+    }
+    return arguments;
+}
+
+const bench::SceneInfo& findScene(std::string_view name)
+{
+    for (const bench::SceneInfo& info : bench::sceneInfos()) {
+        if (info.name == name) {
+            return info;
+        }
+    }
+    throw rr::Error{} << "unknown scene: " << name;
+}
+
+double milliseconds(Clock::duration duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void writeJsonString(std::ostream& out, std::string_view s)
+{
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if ((unsigned char)c < 0x20) {
+            out << ' ';
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+// Nearest-rank percentiles.
+void writeSummary(std::ostream& out, std::vector<double> values)
+{
+    if (values.empty()) {
+        out << "null";
+        return;
+    }
+    std::ranges::sort(values);
+    auto percentile = [&values] (double p) {
+        auto rank = (size_t)std::ceil(p / 100.0 * (double)values.size());
+        return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+    };
+    double sum = 0.0;
+    for (double value : values) {
+        sum += value;
+    }
+    out << "{\"mean\":" << sum / (double)values.size() <<
+        ",\"min\":" << values.front() <<
+        ",\"p50\":" << percentile(50.0) <<
+        ",\"p90\":" << percentile(90.0) <<
+        ",\"p95\":" << percentile(95.0) <<
+        ",\"p99\":" << percentile(99.0) <<
+        ",\"max\":" << values.back() << "}";
+}
+
+// Renders the scene for the warmup and measured frames and writes the
+// measured frames' results as a JSON object.
+//
+// frame_ms is the time between frame starts, wait_ms the part spent waiting
+// for the frame context's previous submission, and cpu_ms the time spent
+// preparing, recording and submitting the frame. gpu_ms comes from
+// timestamps around the frame's command buffer.
+void runScene(
+    bench::BenchContext& context,
+    rr::JobSystem& jobs,
+    const bench::SceneInfo& info,
+    uint32_t count,
+    std::ostream& out)
+{
+    auto setupBegin = Clock::now();
+    std::unique_ptr<bench::Scene> scene = info.create(context, jobs, count);
+    double setupMilliseconds = milliseconds(Clock::now() - setupBegin);
+
+    const bench::BenchOptions& options = context.options;
+    uint32_t totalFrames = options.warmupFrames + options.frames;
+    auto profiler = rr::GpuProfiler{
+        context.physicalDevice,
+        context.device,
+        context.graphicsQueueFamily,
+        bench::framesInFlight,
+        16,
+        totalFrames};
+
+    auto commandPool = context.device.createCommandPool(
+        vk::CommandPoolCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+            .queueFamilyIndex = context.graphicsQueueFamily,
+        });
+    auto commandBuffers = context.device.allocateCommandBuffers(
+        vk::CommandBufferAllocateInfo{
+            .pNext = nullptr,
+            .commandPool = *commandPool,
+            .level = vk::CommandBufferLevel::ePrimary,
+            .commandBufferCount = bench::framesInFlight,
+        });
+    auto done = std::vector<rr::TimelinePoint>(bench::framesInFlight);
+
+    auto beginInfo = vk::CommandBufferBeginInfo{
+        .pNext = nullptr,
+        .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+        .pInheritanceInfo = nullptr,
+    };
+    auto clearValue = vk::ClearValue{
+        .color = vk::ClearColorValue{std::array{0.f, 0.f, 0.f, 1.f}},
+    };
+    auto renderPassBeginInfo = vk::RenderPassBeginInfo{
+        .pNext = nullptr,
+        .renderPass = *context.renderPass,
+        .framebuffer = *context.framebuffer,
+        .renderArea = vk::Rect2D{
+            .offset = vk::Offset2D{.x = 0, .y = 0},
+            .extent = vk::Extent2D{
+                .width = options.width,
+                .height = options.height,
+            },
+        },
+        .clearValueCount = 1,
+        .pClearValues = &clearValue,
+    };
+    vk::SubpassContents contents = scene->secondaryCommandBuffers() ?
+        vk::SubpassContents::eSecondaryCommandBuffers :
+        vk::SubpassContents::eInline;
+
+    auto frameMilliseconds = std::vector<double>{};
+    auto waitMilliseconds = std::vector<double>{};
+    auto cpuMilliseconds = std::vector<double>{};
+    auto memoryBefore = rr::MemoryStats{};
+    uint64_t hostAllocationsBefore = 0;
+    Clock::time_point previousBegin;
+
+    for (uint32_t f = 0; f < totalFrames; f++) {
+        auto frameBegin = Clock::now();
+        if (f == options.warmupFrames) {
+            memoryBefore = context.allocator.stats();
+            hostAllocationsBefore = hostAllocations.load();
+        } else if (f > options.warmupFrames) {
+            frameMilliseconds.push_back(
+                milliseconds(frameBegin - previousBegin));
+        }
+        previousBegin = frameBegin;
+
+        uint32_t frameContext = f % bench::framesInFlight;
+        context.sync.wait(done[frameContext]);
+        context.uploads.collect();
+        auto recordBegin = Clock::now();
+
+        vk::CommandBuffer commandBuffer = *commandBuffers[frameContext];
+        commandBuffer.reset();
+        commandBuffer.begin(beginInfo);
+        profiler.beginFrame(frameContext, commandBuffer);
+        uint32_t frameScope =
+            profiler.beginScope(commandBuffer, std::string{info.name});
+
+        auto frame = bench::SceneFrame{
+            .frameContext = frameContext,
+            .frame = f,
+            .commandBuffer = commandBuffer,
+            .inheritance = vk::CommandBufferInheritanceInfo{
+                .pNext = nullptr,
+                .renderPass = *context.renderPass,
+                .subpass = 0,
+                .framebuffer = *context.framebuffer,
+                .occlusionQueryEnable = vk::False,
+                .queryFlags = vk::QueryControlFlags{},
+                .pipelineStatistics = vk::QueryPipelineStatisticFlags{},
+            },
+            .waits = {},
+        };
+        scene->beginFrame(frame);
+        commandBuffer.beginRenderPass(renderPassBeginInfo, contents);
+        scene->render(frame);
+        commandBuffer.endRenderPass();
+        scene->endFrame(frame);
+
+        profiler.endScope(commandBuffer, frameScope);
+        commandBuffer.end();
+        done[frameContext] = context.sync.submit(
+            context.graphicsQueue,
+            rr::TimelineSubmitInfo{
+                .commandBuffers = std::span{&commandBuffer, 1},
+                .waits = frame.waits,
+                .binaryWaits = {},
+                .binarySignals = {},
+            });
+
+        if (f >= options.warmupFrames) {
+            waitMilliseconds.push_back(milliseconds(recordBegin - frameBegin));
+            cpuMilliseconds.push_back(milliseconds(Clock::now() - recordBegin));
+        }
+    }
+    context.sync.waitIdle();
+    frameMilliseconds.push_back(milliseconds(Clock::now() - previousBegin));
+    uint64_t frameHostAllocations =
+        hostAllocations.load() - hostAllocationsBefore;
+    auto memoryAfter = context.allocator.stats();
+
+    // Timings arrive when a frame context is used again; begin one more
+    // frame on each context to collect the last ones.
+    for (uint32_t i = 0; i < bench::framesInFlight; i++) {
+        vk::CommandBuffer commandBuffer = *commandBuffers[i];
+        commandBuffer.reset();
+        commandBuffer.begin(beginInfo);
+        profiler.beginFrame(i, commandBuffer);
+        commandBuffer.end();
+    }
+    auto gpuMilliseconds = std::vector<double>{};
+    for (const rr::GpuFrameResult& result : profiler.history()) {
+        if (result.frame >= options.warmupFrames &&
+                result.frame < totalFrames) {
+            gpuMilliseconds.push_back(result.gpuMilliseconds);
+        }
+    }
+
+    out << "{\"scene\":";
+    writeJsonString(out, info.name);
+    out << ",\"count\":" << count <<
+        ",\"threads\":" << jobs.threadCount() <<
+        ",\"setup_ms\":" << setupMilliseconds <<
+        ",\"frame_ms\":";
+    writeSummary(out, frameMilliseconds);
+    out << ",\"wait_ms\":";
+    writeSummary(out, waitMilliseconds);
+    out << ",\"cpu_ms\":";
+    writeSummary(out, cpuMilliseconds);
+    out << ",\"gpu_ms\":";
+    writeSummary(out, gpuMilliseconds);
+    out << ",\"host_allocations_per_frame\":" <<
+        (double)frameHostAllocations / options.frames <<
+        ",\"device_allocations\":{" <<
+        "\"allocations\":" <<
+        memoryAfter.allocations - memoryBefore.allocations <<
+        ",\"frees\":" << memoryAfter.frees - memoryBefore.frees <<
+        ",\"device_memory_allocations\":" <<
+        memoryAfter.deviceMemoryAllocations -
+            memoryBefore.deviceMemoryAllocations <<
+        ",\"device_memory_frees\":" <<
+        memoryAfter.deviceMemoryFrees - memoryBefore.deviceMemoryFrees <<
+        ",\"failed\":" <<
+        memoryAfter.failedAllocations - memoryBefore.failedAllocations <<
+        "},\"stats\":";
+    scene->writeStats(out);
+    out << "}";
+
+    double p50 = 0.0;
+    if (!frameMilliseconds.empty()) {
+        std::ranges::sort(frameMilliseconds);
+        p50 = frameMilliseconds[(frameMilliseconds.size() - 1) / 2];
+    }
+    std::cerr << info.name << " (" << count << ", " << jobs.threadCount() <<
+        " threads): " << p50 << " ms median frame\n";
+
+    scene.reset();
+    context.releaseSceneResources();
+}
+
+int run(const Arguments& arguments)
+{
+    auto vulkanContext = vk::raii::Context{};
+
+    // The versioned name is the one installed without development packages,
+    // as on CI machines.
+    auto vulkanLibrary = rr::DynamicLibrary{"libvulkan.so.1"};
+    auto dynamicGetProcAddr =
+        vulkanLibrary.getProcAddress<PFN_vkGetInstanceProcAddr>(
+            "vkGetInstanceProcAddr");
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(dynamicGetProcAddr);
+
+    auto enabledLayerNames = std::vector<const char*>{};
+    if (arguments.validation) {
+        enabledLayerNames.push_back("VK_LAYER_KHRONOS_validation");
+    }
+    auto applicationInfo = vk::ApplicationInfo{
+        .pNext = nullptr,
+        .pApplicationName = "rr_renderbench",
+        .applicationVersion = VK_MAKE_VERSION(0, 1, 0),
+        .pEngineName = "weewee",
+        .engineVersion = VK_MAKE_VERSION(0, 1, 0),
+        .apiVersion = VK_API_VERSION_1_2,
+    };
+    // No surface extensions: nothing is presented, so no display server is
+    // needed.
+    auto instance = vk::raii::Instance{vulkanContext, vk::InstanceCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::InstanceCreateFlags{},
+        .pApplicationInfo = &applicationInfo,
+        .enabledLayerCount = (uint32_t)enabledLayerNames.size(),
+        .ppEnabledLayerNames = enabledLayerNames.data(),
+        .enabledExtensionCount = 0,
+        .ppEnabledExtensionNames = nullptr,
+    }};
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(*instance);
+
+    auto requirements = rr::DeviceRequirements{
+        .optionalExtensions = {VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME},
+    };
+    std::string deviceOverride = arguments.device;
+    if (deviceOverride.empty()) {
+        if (const char* device = std::getenv("RR_DEVICE")) {
+            deviceOverride = device;
+        }
+    }
+    auto candidate =
+        rr::selectPhysicalDevice(instance, requirements, deviceOverride);
+    std::cerr << "device: " << candidate.properties.deviceName << " (" <<
+        vk::to_string(candidate.properties.deviceType) << ")\n";
+
+    auto context = bench::BenchContext{candidate, arguments.options};
+
+    auto scenes = std::vector<const bench::SceneInfo*>{};
+    if (arguments.scenes.empty()) {
+        for (const bench::SceneInfo& info : bench::sceneInfos()) {
+            scenes.push_back(&info);
+        }
+    }
+    for (const std::string& name : arguments.scenes) {
+        scenes.push_back(&findScene(name));
+    }
+
+    auto file = std::ofstream{};
+    if (!arguments.output.empty()) {
+        file.open(arguments.output);
+        if (!file) {
+            throw rr::Error{} << "cannot write " << arguments.output;
+        }
+    }
+    std::ostream& out = arguments.output.empty() ? std::cout : file;
+
+    const vk::PhysicalDeviceProperties& dp = candidate.properties;
+    out << "{\"device\":{\"name\":";
+    writeJsonString(out, dp.deviceName.data());
+    out << ",\"type\":";
+    writeJsonString(out, vk::to_string(dp.deviceType));
+    out << ",\"uuid\":";
+    writeJsonString(out, rr::uuidString(candidate.uuid));
+    out << ",\"api_version\":\"" << VK_API_VERSION_MAJOR(dp.apiVersion) <<
+        "." << VK_API_VERSION_MINOR(dp.apiVersion) <<
+        "." << VK_API_VERSION_PATCH(dp.apiVersion) <<
+        "\",\"driver_version\":" << dp.driverVersion <<
+        "},\"width\":" << arguments.options.width <<
+        ",\"height\":" << arguments.options.height <<
+        ",\"frames\":" << arguments.options.frames <<
+        ",\"warmup_frames\":" << arguments.options.warmupFrames <<
+        ",\"runs\":[\n";
+
+    bool first = true;
+    for (uint32_t threadCount : arguments.threadCounts) {
+        auto jobs = rr::JobSystem{threadCount};
+        for (const bench::SceneInfo* info : scenes) {
+            out << (first ? "" : ",\n");
+            first = false;
+            runScene(
+                context,
+                jobs,
+                *info,
+                arguments.count.value_or(info->defaultCount),
+                out);
+        }
+    }
+    out << "\n]}\n";
+    return 0;
+}
+
+} // namespace
+
+VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
+
+int main(int argc, char** argv)
+{
+    try {
+        auto arguments = parseArguments(argc, argv);
+        if (arguments.help) {
+            std::cout << usage;
+            return 0;
+        }
+        if (arguments.list) {
+            for (const bench::SceneInfo& info : bench::sceneInfos()) {
+                std::cout << info.name << " (" << info.defaultCount <<
+                    "): " << info.description << "\n";
+            }
+            return 0;
+        }
+        return run(arguments);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,457 @@
+#include <error.hpp>
+#include <math.hpp>
+#include <math_batch.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::string_view usage =
+R"(usage: rr_mathbench [options]
+
+Times the batch math kernels at every SIMD level the CPU supports against
+the same work done one element at a time on arrays of the scalar types
+(aos), and prints the best time per element and the speedup over aos. The
+outputs of every level are checked against the scalar kernels'.
+
+  --count N          elements per batch (default: 10000)
+  --runs N           timed runs per kernel and level (default: 200)
+)";
+
+struct Arguments {
+    uint32_t count = 10000;
+    uint32_t runs = 200;
+    bool help = false;
+};
+
+uint32_t parseCount(std::string_view option, std::string_view value)
+{
+    uint32_t result = 0;
+    auto [end, error] =
+        std::from_chars(value.data(), value.data() + value.size(), result);
+    if (error != std::errc{} || end != value.data() + value.size()) {
+        throw rr::Error{} << option << ": not a number: " << value;
+    }
+    return result;
+}
+
+Arguments parseArguments(int argc, char** argv)
+{
+    auto arguments = Arguments{};
+    for (int i = 1; i < argc; i++) {
+        auto option = std::string_view{argv[i]};
+        auto value = [&] {
+            if (i + 1 >= argc) {
+                throw rr::Error{} << option << " needs a value";
+            }
+            return std::string_view{argv[++i]};
+        };
+
+        if (option == "--count") {
+            arguments.count = parseCount(option, value());
+        } else if (option == "--runs") {
+            arguments.runs = parseCount(option, value());
+        } else if (option == "--help" || option == "-h") {
+            arguments.help = true;
+        } else {
+            throw rr::Error{} << "unknown option: " << option;
+        }
+    }
+
+    if (arguments.count == 0 || arguments.runs == 0) {
+        throw rr::Error{} << "--count and --runs must be at least 1";
+    }
+    return arguments;
+}
+
+// The same data as SoA batches and as arrays of the scalar types. The
+// hierarchy has four levels, each twice the size of the one above, with
+// parents picked at random and ordered as a breadth-first traversal would.
+struct Data {
+    size_t count = 0;
+    rr::Mat4 viewProjection;
+
+    rr::TransformBatch transforms;
+    rr::Mat4Batch local;
+    rr::Mat4Batch world;
+    rr::Mat4Batch out;
+    rr::AabbBatch boxes;
+    rr::AabbBatch worldBoxes;
+    rr::Aabb bounds;
+
+    struct Transform {
+        rr::Vec3 translation;
+        rr::Quat rotation;
+        rr::Vec3 scale;
+    };
+    std::vector<Transform> aosTransforms;
+    std::vector<rr::Mat4> aosLocal;
+    std::vector<rr::Mat4> aosWorld;
+    std::vector<rr::Mat4> aosOut;
+    std::vector<rr::Aabb> aosBoxes;
+    std::vector<rr::Aabb> aosWorldBoxes;
+
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> levelOffsets;
+};
+
+Data createData(size_t count)
+{
+    auto data = Data{};
+    data.count = count;
+    data.viewProjection =
+        rr::perspective(1.f, 16.f / 9.f, 0.1f, 1000.f) *
+        rr::lookAt(
+            rr::Vec3{0.f, 10.f, 30.f}, rr::Vec3{}, rr::Vec3{0.f, 1.f, 0.f});
+    data.transforms = rr::TransformBatch{count};
+    data.local = rr::Mat4Batch{count};
+    data.world = rr::Mat4Batch{count};
+    data.out = rr::Mat4Batch{count};
+    data.boxes = rr::AabbBatch{count};
+    data.worldBoxes = rr::AabbBatch{count};
+    data.aosTransforms.resize(count);
+    data.aosLocal.resize(count);
+    data.aosWorld.resize(count);
+    data.aosOut.resize(count);
+    data.aosBoxes.resize(count);
+    data.aosWorldBoxes.resize(count);
+
+    auto random = std::mt19937{1};
+    auto uniform = std::uniform_real_distribution<float>{-1.f, 1.f};
+    auto vec3 = [&] {
+        return rr::Vec3{uniform(random), uniform(random), uniform(random)};
+    };
+    for (size_t i = 0; i < count; i++) {
+        rr::Vec3 translation = vec3() * 10.f;
+        rr::Quat rotation = rr::normalize(rr::Quat{
+            uniform(random), uniform(random), uniform(random),
+            uniform(random)});
+        rr::Vec3 scale = vec3() * 0.5f + rr::Vec3{1.f, 1.f, 1.f};
+        data.transforms.set(i, translation, rotation, scale);
+        data.aosTransforms[i] = Data::Transform{
+            .translation = translation,
+            .rotation = rotation,
+            .scale = scale,
+        };
+
+        rr::Vec3 center = vec3();
+        rr::Vec3 extent = vec3() * 0.5f + rr::Vec3{1.f, 1.f, 1.f};
+        auto box = rr::Aabb{
+            .min = center - extent,
+            .max = center + extent,
+        };
+        data.boxes.set(i, box);
+        data.aosBoxes[i] = box;
+    }
+
+    size_t levelSize = std::max<size_t>(count / 15, 1);
+    data.parents.assign(count, 0);
+    data.levelOffsets.push_back(0);
+    for (size_t level = 0; level < 4; level++) {
+        size_t begin = data.levelOffsets.back();
+        if (begin == count) {
+            break;
+        }
+        size_t end = level == 3 ? count : std::min(begin + levelSize, count);
+        if (level > 0) {
+            size_t parentBegin = data.levelOffsets[level - 1];
+            auto pick = std::uniform_int_distribution<size_t>{
+                parentBegin, begin - 1};
+            for (size_t i = begin; i < end; i++) {
+                data.parents[i] = (uint32_t)pick(random);
+            }
+            std::sort(
+                data.parents.begin() + begin, data.parents.begin() + end);
+        }
+        data.levelOffsets.push_back((uint32_t)end);
+        levelSize *= 2;
+    }
+
+    rr::composeTransforms(
+        data.transforms.soa(), data.local.soa(), data.count);
+    for (size_t i = 0; i < count; i++) {
+        data.aosLocal[i] = data.local.get(i);
+    }
+    rr::composeHierarchy(
+        data.parents, data.levelOffsets, data.local.soa(), data.world.soa());
+    for (size_t i = 0; i < count; i++) {
+        data.aosWorld[i] = data.world.get(i);
+    }
+    return data;
+}
+
+struct Kernel {
+    std::string_view name;
+    std::function<void(Data&)> aos;
+    std::function<void(Data&)> batch;
+    // The batch kernel's output, to compare between levels.
+    std::function<std::vector<float>(const Data&)> output;
+};
+
+std::vector<float> matrices(const rr::Mat4Batch& batch)
+{
+    auto values = std::vector<float>{};
+    for (size_t i = 0; i < batch.size(); i++) {
+        rr::Mat4 m = batch.get(i);
+        values.insert(values.end(), m.m, m.m + 16);
+    }
+    return values;
+}
+
+std::vector<float> boxes(const rr::AabbBatch& batch)
+{
+    auto values = std::vector<float>{};
+    for (size_t i = 0; i < batch.size(); i++) {
+        rr::Aabb box = batch.get(i);
+        values.insert(values.end(), {
+            box.min.x, box.min.y, box.min.z,
+            box.max.x, box.max.y, box.max.z,
+        });
+    }
+    return values;
+}
+
+std::vector<Kernel> kernels()
+{
+    return {
+        Kernel{
+            .name = "compose",
+            .aos = [](Data& data) {
+                for (size_t i = 0; i < data.count; i++) {
+                    const Data::Transform& t = data.aosTransforms[i];
+                    data.aosOut[i] =
+                        rr::compose(t.translation, t.rotation, t.scale);
+                }
+            },
+            .batch = [](Data& data) {
+                rr::composeTransforms(
+                    data.transforms.soa(), data.out.soa(), data.count);
+            },
+            .output = [](const Data& data) { return matrices(data.out); },
+        },
+        Kernel{
+            .name = "multiply",
+            .aos = [](Data& data) {
+                for (size_t i = 0; i < data.count; i++) {
+                    data.aosOut[i] = data.aosWorld[i] * data.aosLocal[i];
+                }
+            },
+            .batch = [](Data& data) {
+                rr::multiplyMatrices(
+                    data.world.soa(), data.local.soa(), data.out.soa(),
+                    data.count);
+            },
+            .output = [](const Data& data) { return matrices(data.out); },
+        },
+        Kernel{
+            .name = "transform",
+            .aos = [](Data& data) {
+                for (size_t i = 0; i < data.count; i++) {
+                    data.aosOut[i] = data.viewProjection * data.aosWorld[i];
+                }
+            },
+            .batch = [](Data& data) {
+                rr::transformMatrices(
+                    data.viewProjection, data.world.soa(), data.out.soa(),
+                    data.count);
+            },
+            .output = [](const Data& data) { return matrices(data.out); },
+        },
+        Kernel{
+            .name = "hierarchy",
+            .aos = [](Data& data) {
+                uint32_t roots = data.levelOffsets[1];
+                for (size_t i = 0; i < data.count; i++) {
+                    data.aosOut[i] = i < roots ? data.aosLocal[i] :
+                        data.aosOut[data.parents[i]] * data.aosLocal[i];
+                }
+            },
+            .batch = [](Data& data) {
+                rr::composeHierarchy(
+                    data.parents, data.levelOffsets, data.local.soa(),
+                    data.out.soa());
+            },
+            .output = [](const Data& data) { return matrices(data.out); },
+        },
+        Kernel{
+            .name = "aabbs",
+            .aos = [](Data& data) {
+                for (size_t i = 0; i < data.count; i++) {
+                    const rr::Mat4& m = data.aosWorld[i];
+                    const rr::Aabb& box = data.aosBoxes[i];
+                    rr::Vec3 center = (box.min + box.max) * 0.5f;
+                    rr::Vec3 extent = (box.max - box.min) * 0.5f;
+                    rr::Vec3 c = rr::transformPoint(m, center);
+                    auto e = rr::Vec3{
+                        std::abs(m(0, 0)) * extent.x +
+                            std::abs(m(0, 1)) * extent.y +
+                            std::abs(m(0, 2)) * extent.z,
+                        std::abs(m(1, 0)) * extent.x +
+                            std::abs(m(1, 1)) * extent.y +
+                            std::abs(m(1, 2)) * extent.z,
+                        std::abs(m(2, 0)) * extent.x +
+                            std::abs(m(2, 1)) * extent.y +
+                            std::abs(m(2, 2)) * extent.z,
+                    };
+                    data.aosWorldBoxes[i] = rr::Aabb{
+                        .min = c - e,
+                        .max = c + e,
+                    };
+                }
+            },
+            .batch = [](Data& data) {
+                rr::transformAabbs(
+                    data.world.soa(), data.boxes.soa(),
+                    data.worldBoxes.soa(), data.count);
+            },
+            .output = [](const Data& data) {
+                return boxes(data.worldBoxes);
+            },
+        },
+        Kernel{
+            .name = "bounds",
+            .aos = [](Data& data) {
+                rr::Aabb result = data.aosWorldBoxes[0];
+                for (const rr::Aabb& box : data.aosWorldBoxes) {
+                    result.min.x = std::min(result.min.x, box.min.x);
+                    result.min.y = std::min(result.min.y, box.min.y);
+                    result.min.z = std::min(result.min.z, box.min.z);
+                    result.max.x = std::max(result.max.x, box.max.x);
+                    result.max.y = std::max(result.max.y, box.max.y);
+                    result.max.z = std::max(result.max.z, box.max.z);
+                }
+                data.bounds = result;
+            },
+            .batch = [](Data& data) {
+                data.bounds =
+                    rr::bounds(data.worldBoxes.soa(), data.count);
+            },
+            .output = [](const Data& data) {
+                return std::vector<float>{
+                    data.bounds.min.x, data.bounds.min.y, data.bounds.min.z,
+                    data.bounds.max.x, data.bounds.max.y, data.bounds.max.z,
+                };
+            },
+        },
+    };
+}
+
+// The best of the runs, in nanoseconds per element.
+double bestTime(
+    const std::function<void(Data&)>& function, Data& data, uint32_t runs)
+{
+    function(data);
+    auto best = Clock::duration::max();
+    for (uint32_t run = 0; run < runs; run++) {
+        auto start = Clock::now();
+        function(data);
+        best = std::min(best, Clock::now() - start);
+    }
+    return std::chrono::duration<double, std::nano>(best).count() /
+        (double)data.count;
+}
+
+// Relative to the magnitude of the values, since FMA and the order of
+// operations change the last bits.
+bool matches(std::span<const float> a, std::span<const float> b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        float tolerance = 1e-4f * std::max(1.f, std::abs(b[i]));
+        if (!(std::abs(a[i] - b[i]) <= tolerance)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Prints " time (speedup)" in a column of the results table.
+void printTime(double time, double aos)
+{
+    std::cout << " " << std::setw(7) << time << " (" << std::setw(4) <<
+        aos / time << "x)";
+}
+
+int run(const Arguments& arguments)
+{
+    Data data = createData(arguments.count);
+
+    auto levels = std::vector<rr::SimdLevel>{};
+    for (auto level : {
+        rr::SimdLevel::Scalar, rr::SimdLevel::Sse, rr::SimdLevel::Avx2})
+    {
+        if (level <= rr::detectSimdLevel()) {
+            levels.push_back(level);
+        }
+    }
+
+    std::cout << arguments.count << " elements, best of " <<
+        arguments.runs << " runs, ns per element (speedup over aos)\n\n";
+    std::cout << std::left << std::setw(10) << "kernel" << std::right <<
+        " " << std::setw(14) << "aos";
+    for (rr::SimdLevel level : levels) {
+        std::cout << " " << std::setw(14) << rr::toString(level);
+    }
+    std::cout << "\n" << std::fixed << std::setprecision(2);
+
+    bool mismatch = false;
+    for (const Kernel& kernel : kernels()) {
+        double aos = bestTime(kernel.aos, data, arguments.runs);
+
+        auto times = std::vector<double>{};
+        auto reference = std::vector<float>{};
+        for (rr::SimdLevel level : levels) {
+            rr::setSimdLevel(level);
+            times.push_back(bestTime(kernel.batch, data, arguments.runs));
+            std::vector<float> output = kernel.output(data);
+            if (level == rr::SimdLevel::Scalar) {
+                reference = std::move(output);
+            } else if (!matches(output, reference)) {
+                std::cerr << kernel.name << ": " << rr::toString(level) <<
+                    " output differs from scalar\n";
+                mismatch = true;
+            }
+        }
+
+        std::cout << std::left << std::setw(10) << kernel.name <<
+            std::right;
+        printTime(aos, aos);
+        for (double t : times) {
+            printTime(t, aos);
+        }
+        std::cout << "\n";
+    }
+    rr::setSimdLevel(rr::detectSimdLevel());
+    return mismatch ? 1 : 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    try {
+        auto arguments = parseArguments(argc, argv);
+        if (arguments.help) {
+            std::cout << usage;
+            return 0;
+        }
+        return run(arguments);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,1162 @@
+#include "bench.hpp"
+
+#include "gpu_shaders.hpp"
+
+#include <descriptor_allocator.hpp>
+#include <error.hpp>
+#include <gpu_culling.hpp>
+#include <parallel_recorder.hpp>
+#include <texture_streamer.hpp>
+#include <uniform_ring.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <system_error>
+
+namespace bench {
+
+namespace {
+
+constexpr std::array<float, 16> identity {
+    1.f, 0.f, 0.f, 0.f,
+    0.f, 1.f, 0.f, 0.f,
+    0.f, 0.f, 1.f, 0.f,
+    0.f, 0.f, 0.f, 1.f,
+};
+
+struct Mesh {
+    BenchBuffer vertices;
+    BenchBuffer indices;
+    uint32_t indexCount = 0;
+};
+
+template <class T>
+std::span<const std::byte> bytesOf(const std::vector<T>& values)
+{
+    return std::as_bytes(std::span{values});
+}
+
+// A square of cells x cells quads, two triangles each, spanning [-1, 1] in
+// x and y at z = 0.
+Mesh createGrid(BenchContext& context, uint32_t cells)
+{
+    auto vertices = std::vector<rr::MeshVertex>{};
+    for (uint32_t y = 0; y <= cells; y++) {
+        for (uint32_t x = 0; x <= cells; x++) {
+            float u = (float)x / (float)cells;
+            float v = (float)y / (float)cells;
+            vertices.push_back(rr::MeshVertex{
+                .position = {u * 2.f - 1.f, v * 2.f - 1.f, 0.f},
+                .normal = {0.f, 0.f, 1.f},
+                .uv = {u, v},
+            });
+        }
+    }
+    auto indices = std::vector<uint32_t>{};
+    for (uint32_t y = 0; y < cells; y++) {
+        for (uint32_t x = 0; x < cells; x++) {
+            uint32_t i = y * (cells + 1) + x;
+            indices.insert(indices.end(), {
+                i, i + 1, i + cells + 2,
+                i, i + cells + 2, i + cells + 1,
+            });
+        }
+    }
+
+    auto mesh = Mesh{
+        .vertices = context.createBuffer(
+            vertices.size() * sizeof(rr::MeshVertex),
+            vk::BufferUsageFlagBits::eVertexBuffer,
+            false),
+        .indices = context.createBuffer(
+            indices.size() * sizeof(uint32_t),
+            vk::BufferUsageFlagBits::eIndexBuffer,
+            false),
+        .indexCount = (uint32_t)indices.size(),
+    };
+    context.upload(
+        mesh.vertices.buffer,
+        bytesOf(vertices),
+        vk::AccessFlagBits::eVertexAttributeRead,
+        vk::PipelineStageFlagBits::eVertexInput);
+    context.upload(
+        mesh.indices.buffer,
+        bytesOf(indices),
+        vk::AccessFlagBits::eIndexRead,
+        vk::PipelineStageFlagBits::eVertexInput);
+    return mesh;
+}
+
+rr::MeshInstance placedInstance(float x, float y, float scale, uint32_t color)
+{
+    return rr::MeshInstance{
+        .transform = {
+            {scale, 0.f, 0.f, x},
+            {0.f, scale, 0.f, y},
+            {0.f, 0.f, scale, 0.5f},
+        },
+        .color = color,
+        .padding = {},
+    };
+}
+
+uint32_t hashColor(uint32_t i)
+{
+    i ^= i >> 16;
+    i *= 0x7feb352d;
+    i ^= i >> 15;
+    i *= 0x846ca68b;
+    i ^= i >> 16;
+    return i | 0xff000000;
+}
+
+// Instances on a square grid covering [-extent, extent] in x and y, one
+// per object, for the mesh scenes.
+BenchBuffer createGridInstances(
+    BenchContext& context, uint32_t count, float extent)
+{
+    auto buffer = context.createBuffer(
+        (vk::DeviceSize)count * sizeof(rr::MeshInstance),
+        vk::BufferUsageFlagBits::eVertexBuffer,
+        true);
+    auto side = (uint32_t)std::ceil(std::sqrt((double)count));
+    float spacing = 2.f * extent / (float)side;
+    auto instances = (rr::MeshInstance*)buffer.mapped;
+    for (uint32_t i = 0; i < count; i++) {
+        instances[i] = placedInstance(
+            -extent + spacing * ((float)(i % side) + 0.5f),
+            -extent + spacing * ((float)(i / side) + 0.5f),
+            spacing * 0.4f,
+            hashColor(i));
+    }
+    return buffer;
+}
+
+void pushViewProjection(
+    const BenchContext& context,
+    vk::CommandBuffer commandBuffer,
+    const std::array<float, 16>& viewProjection)
+{
+    commandBuffer.pushConstants(
+        context.heap.pipelineLayout(),
+        vk::ShaderStageFlagBits::eAll,
+        0,
+        sizeof(viewProjection),
+        viewProjection.data());
+}
+
+// Maps pixel coordinates to clip space for the quad shader.
+void pushPixelProjection(
+    const BenchContext& context, vk::CommandBuffer commandBuffer)
+{
+    float scaleOffset[] {
+        2.f / (float)context.options.width,
+        2.f / (float)context.options.height,
+        -1.f,
+        -1.f,
+    };
+    commandBuffer.pushConstants(
+        context.heap.pipelineLayout(),
+        vk::ShaderStageFlagBits::eAll,
+        0,
+        sizeof(scaleOffset),
+        scaleOffset);
+}
+
+void bindMesh(
+    vk::CommandBuffer commandBuffer, const Mesh& mesh, vk::Buffer instances)
+{
+    vk::Buffer buffers[] {mesh.vertices.buffer, instances};
+    vk::DeviceSize offsets[] {0, 0};
+    commandBuffer.bindVertexBuffers(0, buffers, offsets);
+    commandBuffer.bindIndexBuffer(
+        mesh.indices.buffer, 0, vk::IndexType::eUint32);
+}
+
+vk::raii::Pipeline createMeshPipeline(const BenchContext& context)
+{
+    return context.createPipeline(
+        rr::shaders::batch_mesh_vert,
+        rr::shaders::batch_color_frag,
+        rr::BatchRenderer::meshVertexInput());
+}
+
+// Raw triangle throughput: one draw of a dense grid mesh.
+class TrianglesScene : public Scene {
+public:
+    TrianglesScene(BenchContext& context, uint32_t triangles)
+        : _context(&context)
+        , _pipeline(createMeshPipeline(context))
+    {
+        auto cells = (uint32_t)std::ceil(std::sqrt(triangles / 2.0));
+        _mesh = createGrid(context, std::max(cells, 1u));
+        _instances = createGridInstances(context, 1, 1.f);
+    }
+
+    void render(SceneFrame& frame) override
+    {
+        vk::CommandBuffer commandBuffer = frame.commandBuffer;
+        commandBuffer.bindPipeline(
+            vk::PipelineBindPoint::eGraphics, *_pipeline);
+        pushViewProjection(*_context, commandBuffer, identity);
+        bindMesh(commandBuffer, _mesh, _instances.buffer);
+        commandBuffer.drawIndexed(_mesh.indexCount, 1, 0, 0, 0);
+    }
+
+    void writeStats(std::ostream& out) const override
+    {
+        out << "{\"triangles\":" << _mesh.indexCount / 3 << "}";
+    }
+
+private:
+    BenchContext* _context = nullptr;
+    vk::raii::Pipeline _pipeline {nullptr};
+    Mesh _mesh;
+    BenchBuffer _instances;
+};
+
+// Draw call overhead: one small draw per object, recorded in parallel into
+// secondary command buffers by the job system's threads.
+class DrawsScene : public Scene {
+public:
+    DrawsScene(BenchContext& context, rr::JobSystem& jobs, uint32_t draws)
+        : _context(&context)
+        , _recorder(
+            jobs, context.device, context.graphicsQueueFamily, framesInFlight)
+        , _pipeline(createMeshPipeline(context))
+        , _mesh(createGrid(context, 1))
+        , _instances(createGridInstances(context, draws, 1.f))
+        , _draws(draws)
+    { }
+
+    void beginFrame(SceneFrame& frame) override
+    {
+        _recorder.beginFrame(frame.frameContext);
+    }
+
+    bool secondaryCommandBuffers() const override
+    {
+        return true;
+    }
+
+    void render(SceneFrame& frame) override
+    {
+        _recorder.record(
+            frame.commandBuffer,
+            frame.inheritance,
+            _draws,
+            [this] (
+                    vk::CommandBuffer commandBuffer,
+                    uint32_t begin,
+                    uint32_t end) {
+                commandBuffer.bindPipeline(
+                    vk::PipelineBindPoint::eGraphics, *_pipeline);
+                pushViewProjection(*_context, commandBuffer, identity);
+                bindMesh(commandBuffer, _mesh, _instances.buffer);
+                for (uint32_t i = begin; i < end; i++) {
+                    commandBuffer.drawIndexed(_mesh.indexCount, 1, 0, 0, i);
+                }
+            });
+    }
+
+    void writeStats(std::ostream& out) const override
+    {
+        out << "{\"draws\":" << _draws <<
+            ",\"workers\":" << _recorder.workerCount() << "}";
+    }
+
+private:
+    BenchContext* _context = nullptr;
+    rr::ParallelRecorder _recorder;
+    vk::raii::Pipeline _pipeline {nullptr};
+    Mesh _mesh;
+    BenchBuffer _instances;
+    uint32_t _draws = 0;
+};
+
+// Pipeline creation and switching: a few quads per pipeline, batched by
+// the BatchRenderer so that each pipeline is bound once per frame.
+class PipelinesScene : public Scene {
+public:
+    PipelinesScene(BenchContext& context, uint32_t pipelines)
+        : _context(&context)
+        , _renderer(context.device, context.allocator, framesInFlight)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < pipelines; i++) {
+            _pipelines.push_back(context.createPipeline(
+                rr::shaders::batch_quad_vert,
+                rr::shaders::batch_color_frag,
+                rr::BatchRenderer::quadVertexInput(),
+                i));
+            _materials.push_back(_renderer.addMaterial(rr::BatchMaterial{
+                .pipeline = *_pipelines.back(),
+                .layout = context.heap.pipelineLayout(),
+                .descriptorSet = vk::DescriptorSet{},
+                .texture = rr::invalidBindlessHandle,
+                .sampler = 0,
+            }));
+        }
+        _creationMilliseconds = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - begin).count();
+    }
+
+    void beginFrame(SceneFrame& frame) override
+    {
+        _renderer.beginFrame(frame.frameContext);
+        float width = (float)_context->options.width;
+        float height = (float)_context->options.height;
+        for (size_t i = 0; i < _materials.size(); i++) {
+            for (uint32_t j = 0; j < quadsPerPipeline; j++) {
+                uint32_t n = (uint32_t)i * quadsPerPipeline + j;
+                _renderer.drawQuad(_materials[i], rr::QuadInstance{
+                    .position = {
+                        std::fmod((float)n * 37.f, width),
+                        std::fmod((float)n * 23.f, height),
+                    },
+                    .size = {32.f, 32.f},
+                    .rotation = 0.f,
+                    .color = hashColor(n),
+                    .uvMin = {0.f, 0.f},
+                    .uvMax = {1.f, 1.f},
+                });
+            }
+        }
+    }
+
+    void render(SceneFrame& frame) override
+    {
+        pushPixelProjection(*_context, frame.commandBuffer);
+        _renderer.record(frame.commandBuffer);
+    }
+
+    void writeStats(std::ostream& out) const override
+    {
+        auto stats = _renderer.stats();
+        out << "{\"pipelines\":" << _pipelines.size() <<
+            ",\"creation_ms\":" << _creationMilliseconds <<
+            ",\"pipeline_binds\":" << stats.pipelineBinds <<
+            ",\"draws\":" << stats.draws << "}";
+    }
+
+private:
+    static constexpr uint32_t quadsPerPipeline = 4;
+
+    BenchContext* _context = nullptr;
+    rr::BatchRenderer _renderer;
+    std::vector<vk::raii::Pipeline> _pipelines;
+    std::vector<rr::MaterialId> _materials;
+    double _creationMilliseconds = 0.0;
+};
+
+// Streaming: rewrites a device-local buffer through the upload service
+// every frame; the frame waits for the copy before its vertex input stage.
+class UploadsScene : public Scene {
+public:
+    UploadsScene(BenchContext& context, uint32_t mebibytes)
+        : _context(&context)
+        , _data((size_t)mebibytes * 1024 * 1024)
+    {
+        for (size_t i = 0; i < _data.size(); i++) {
+            _data[i] = (std::byte)(i * 31);
+        }
+        _buffer = context.createBuffer(
+            _data.size(), vk::BufferUsageFlagBits::eVertexBuffer, false);
+    }
+
+    void beginFrame(SceneFrame& frame) override
+    {
+        _context->uploads.uploadBuffer(
+            _buffer.buffer,
+            0,
+            _data,
+            vk::AccessFlagBits::eVertexAttributeRead,
+            vk::PipelineStageFlagBits::eVertexInput);
+        if (auto submission = _context->uploads.flush()) {
+            submission->recordAcquire(frame.commandBuffer);
+            frame.waits.push_back(submission->wait());
+        }
+    }
+
+    void render(SceneFrame&) override
+    { }
+
+    void writeStats(std::ostream& out) const override
+    {
+        auto stats = _context->uploads.stats();
+        out << "{\"bytes_per_frame\":" << _data.size() <<
+            ",\"dedicated_transfer_queue\":" <<
+            (_context->uploads.dedicatedTransferQueue() ? "true" : "false") <<
+            ",\"bytes\":" << stats.bytes <<
+            ",\"copies\":" << stats.copies <<
+            ",\"submissions\":" << stats.submissions <<
+            ",\"stalls\":" << stats.stalls << "}";
+    }
+
+private:
+    BenchContext* _context = nullptr;
+    std::vector<std::byte> _data;
+    BenchBuffer _buffer;
+};
+
+// Many sprites of one material, drawn either with one instanced draw
+// (BatchRenderer::record) or with one draw per sprite (recordNaive).
+class SpritesScene : public Scene {
+public:
+    SpritesScene(BenchContext& context, uint32_t sprites, bool naive)
+        : _context(&context)
+        , _renderer(context.device, context.allocator, framesInFlight)
+        , _pipeline(context.createPipeline(
+            rr::shaders::batch_quad_vert,
+            rr::shaders::batch_color_frag,
+            rr::BatchRenderer::quadVertexInput()))
+        , _naive(naive)
+    {
+        _material = _renderer.addMaterial(rr::BatchMaterial{
+            .pipeline = *_pipeline,
+            .layout = context.heap.pipelineLayout(),
+            .descriptorSet = vk::DescriptorSet{},
+            .texture = rr::invalidBindlessHandle,
+            .sampler = 0,
+        });
+
+        auto random = std::mt19937{1};
+        auto x = std::uniform_real_distribution<float>{
+            0.f, (float)context.options.width};
+        auto y = std::uniform_real_distribution<float>{
+            0.f, (float)context.options.height};
+        auto size = std::uniform_real_distribution<float>{2.f, 8.f};
+        auto angle = std::uniform_real_distribution<float>{0.f, 6.2831853f};
+        _sprites.reserve(sprites);
+        for (uint32_t i = 0; i < sprites; i++) {
+            float s = size(random);
+            _sprites.push_back(rr::QuadInstance{
+                .position = {x(random), y(random)},
+                .size = {s, s},
+                .rotation = angle(random),
+                .color = hashColor(i),
+                .uvMin = {0.f, 0.f},
+                .uvMax = {1.f, 1.f},
+            });
+        }
+    }
+
+    void beginFrame(SceneFrame& frame) override
+    {
+        _renderer.beginFrame(frame.frameContext);
+        for (const rr::QuadInstance& sprite : _sprites) {
+            _renderer.drawQuad(_material, sprite);
+        }
+    }
+
+    void render(SceneFrame& frame) override
+    {
+        pushPixelProjection(*_context, frame.commandBuffer);
+        if (_naive) {
+            _renderer.recordNaive(frame.commandBuffer);
+        } else {
+            _renderer.record(frame.commandBuffer);
+        }
+    }
+
+    void writeStats(std::ostream& out) const override
+    {
+        auto stats = _renderer.stats();
+        out << "{\"sprites\":" << _sprites.size() <<
+            ",\"draws\":" << stats.draws <<
+            ",\"pipeline_binds\":" << stats.pipelineBinds <<
+            ",\"instance_bytes\":" << stats.instanceBytes << "}";
+    }
+
+private:
+    BenchContext* _context = nullptr;
+    rr::BatchRenderer _renderer;
+    vk::raii::Pipeline _pipeline {nullptr};
+    rr::MaterialId _material = 0;
+    std::vector<rr::QuadInstance> _sprites;
+    bool _naive = false;
+};
+
+// GPU frustum culling of objects spread over four times the visible area,
+// with a camera that pans across them.
+class CullingScene : public Scene {
+public:
+    CullingScene(BenchContext& context, uint32_t objects)
+        : _context(&context)
+        , _culler(
+            context.physicalDevice,
+            context.device,
+            context.allocator,
+            context.heap,
+            rr::shaders::gpu_cull_comp,
+            framesInFlight,
+            rr::GpuCullerOptions{
+                .maxObjects = std::max(objects, 1u),
+                .drawIndirectCount = context.drawIndirectCount,
+                .multiDrawIndirect = context.multiDrawIndirect,
+                .drawIndirectFirstInstance = true,
+            })
+        , _pipeline(createMeshPipeline(context))
+        , _mesh(createGrid(context, 2))
+        , _instances(createGridInstances(context, objects, 2.f))
+    {
+        auto instances = (const rr::MeshInstance*)_instances.mapped;
+        for (uint32_t i = 0; i < objects; i++) {
+            const auto& transform = instances[i].transform;
+            _culler.add(rr::CullObject{
+                .center = {transform[0][3], transform[1][3], transform[2][3]},
+                // The grid mesh spans [-1, 1], scaled by the transform.
+                .radius = transform[0][0] * 1.4142136f,
+                .indexCount = _mesh.indexCount,
+                .firstIndex = 0,
+                .vertexOffset = 0,
+                .firstInstance = i,
+            });
+        }
+    }
+
+    void beginFrame(SceneFrame& frame) override
+    {
+        _viewProjection = identity;
+        _viewProjection[12] = 1.5f * std::sin((float)frame.frame * 0.02f);
+        _culler.beginFrame(frame.frameContext);
+        _culler.cull(frame.commandBuffer, _viewProjection);
+    }
+
+    void render(SceneFrame& frame) override
+    {
+        vk::CommandBuffer commandBuffer = frame.commandBuffer;
+        commandBuffer.bindPipeline(
+            vk::PipelineBindPoint::eGraphics, *_pipeline);
+        pushViewProjection(*_context, commandBuffer, _viewProjection);
+        bindMesh(commandBuffer, _mesh, _instances.buffer);
+        _culler.draw(commandBuffer);
+    }
+
+    void writeStats(std::ostream& out) const override
+    {
+        auto stats = _culler.stats();
+        out << "{\"objects\":" << stats.objects <<
+            ",\"draw_indirect_count\":" <<
+            (_context->drawIndirectCount ? "true" : "false") <<
+            ",\"dispatches\":" << stats.dispatches <<
+            ",\"draw_calls\":" << stats.drawCalls << "}";
+    }
+
+private:
+    BenchContext* _context = nullptr;
+    rr::GpuCuller _culler;
+    vk::raii::Pipeline _pipeline {nullptr};
+    Mesh _mesh;
+    BenchBuffer _instances;
+    std::array<float, 16> _viewProjection = identity;
+};
+
+// Allocator fragmentation: keeps a set of live allocations of random sizes
+// and replaces a tenth of them, picked at random, every frame. No GPU work.
+class AllocatorScene : public Scene {
+public:
+    AllocatorScene(BenchContext& context, uint32_t allocations)
+        : _context(&context)
+    {
+        auto memoryType = context.allocator.findMemoryType(
+            ~0u, vk::MemoryPropertyFlagBits::eDeviceLocal);
+        if (!memoryType) {
+            throw rr::Error{} << "no device-local memory type";
+        }
+        _memoryTypeBits = 1u << *memoryType;
+        for (uint32_t i = 0; i < allocations; i++) {
+            _allocations.push_back(allocate());
+        }
+    }
+
+    ~AllocatorScene() override
+    {
+        for (const rr::MemoryAllocation& allocation : _allocations) {
+            if (allocation) {
+                _context->allocator.free(allocation);
+            }
+        }
+    }
+
+    void beginFrame(SceneFrame&) override
+    {
+        if (_allocations.empty()) {
+            return;
+        }
+        auto pick = std::uniform_int_distribution<size_t>{
+            0, _allocations.size() - 1};
+        size_t replacements = std::max<size_t>(_allocations.size() / 10, 1);
+        for (size_t i = 0; i < replacements; i++) {
+            rr::MemoryAllocation& allocation = _allocations[pick(_random)];
+            if (allocation) {
+                _context->allocator.free(allocation);
+            }
+            allocation = allocate();
+            _replacements++;
+        }
+    }
+
+    void render(SceneFrame&) override
+    { }
+
+    void writeStats(std::ostream& out) const override
+    {
+        // Includes the other resources of the context, which are small.
+        auto stats = _context->allocator.stats();
+        auto total = rr::MemoryHeapStats{};
+        for (const rr::MemoryHeapStats& heap : stats.heaps) {
+            total.blockCount += heap.blockCount;
+            total.blockBytes += heap.blockBytes;
+            total.allocationCount += heap.allocationCount;
+            total.allocationBytes += heap.allocationBytes;
+        }
+        double fragmentation = total.blockBytes == 0 ? 0.0 :
+            1.0 - (double)total.allocationBytes / (double)total.blockBytes;
+        out << "{\"live_allocations\":" << total.allocationCount <<
+            ",\"replacements\":" << _replacements <<
+            ",\"failures\":" << _failures <<
+            ",\"blocks\":" << total.blockCount <<
+            ",\"block_bytes\":" << total.blockBytes <<
+            ",\"allocated_bytes\":" << total.allocationBytes <<
+            ",\"fragmentation\":" << fragmentation << "}";
+    }
+
+private:
+    // Sizes are log-uniform between 256 bytes and 1 MiB, like a mix of
+    // small uniform buffers and larger meshes.
+    rr::MemoryAllocation allocate()
+    {
+        auto log2Size = std::uniform_real_distribution<double>{8.0, 20.0};
+        auto size = (vk::DeviceSize)std::exp2(log2Size(_random));
+        try {
+            return _context->allocator.allocate(rr::AllocationRequest{
+                .requirements = vk::MemoryRequirements{
+                    .size = (size + 255) & ~vk::DeviceSize{255},
+                    .alignment = 256,
+                    .memoryTypeBits = _memoryTypeBits,
+                },
+                .requiredFlags = vk::MemoryPropertyFlagBits::eDeviceLocal,
+                .preferredFlags = vk::MemoryPropertyFlags{},
+                .kind = rr::ResourceKind::Linear,
+                .pool = nullptr,
+                .dedicated = false,
+                .dedicatedBuffer = vk::Buffer{},
+                .dedicatedImage = vk::Image{},
+            });
+        } catch (const rr::Error&) {
+            _failures++;
+            return rr::MemoryAllocation{};
+        }
+    }
+
+    BenchContext* _context = nullptr;
+    uint32_t _memoryTypeBits = 0;
+    std::mt19937 _random {1};
+    std::vector<rr::MemoryAllocation> _allocations;
+    uint64_t _replacements = 0;
+    uint64_t _failures = 0;
+};
+
+// Per-frame descriptor sets: allocates and writes one set per object from
+// the frame context's pools every frame and binds each one, the way
+// materials without bindless handles would. Two passes ask the layout
+// cache for the same layout with their bindings in a different order.
+class DescriptorsScene : public Scene {
+public:
+    DescriptorsScene(BenchContext& context, uint32_t sets)
+        : _context(&context)
+        , _allocator(context.device, framesInFlight)
+        , _layouts(context.device)
+        , _sets(sets)
+        , _uniforms(context.createBuffer(
+            uniformSize, vk::BufferUsageFlagBits::eUniformBuffer, true))
+        , _storage(context.createBuffer(
+            uniformSize, vk::BufferUsageFlagBits::eStorageBuffer, false))
+    {
+        vk::DescriptorSetLayout layout = getLayout(false);
+        _pipelineLayout = context.device.createPipelineLayout(
+            vk::PipelineLayoutCreateInfo{
+                .pNext = nullptr,
+                .flags = vk::PipelineLayoutCreateFlags{},
+                .setLayoutCount = 1,
+                .pSetLayouts = &layout,
+                .pushConstantRangeCount = 0,
+                .pPushConstantRanges = nullptr,
+            });
+    }
+
+    void beginFrame(SceneFrame& frame) override
+    {
+        _allocator.beginFrame(frame.frameContext);
+        uint32_t pools = _allocator.stats().pools;
+
+        auto uniformInfo = vk::DescriptorBufferInfo{
+            .buffer = _uniforms.buffer,
+            .offset = 0,
+            .range = uniformSize,
+        };
+        auto storageInfo = vk::DescriptorBufferInfo{
+            .buffer = _storage.buffer,
+            .offset = 0,
+            .range = uniformSize,
+        };
+        _frameSets.clear();
+        _writes.clear();
+        for (uint32_t i = 0; i < _sets; i++) {
+            // Half of the objects belong to each pass.
+            vk::DescriptorSetLayout layout = getLayout(i % 2 == 1);
+            vk::DescriptorSet set = _allocator.allocate(layout);
+            _frameSets.push_back(set);
+            _writes.push_back(vk::WriteDescriptorSet{
+                .pNext = nullptr,
+                .dstSet = set,
+                .dstBinding = 0,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = vk::DescriptorType::eUniformBuffer,
+                .pImageInfo = nullptr,
+                .pBufferInfo = &uniformInfo,
+                .pTexelBufferView = nullptr,
+            });
+            _writes.push_back(vk::WriteDescriptorSet{
+                .pNext = nullptr,
+                .dstSet = set,
+                .dstBinding = 1,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = vk::DescriptorType::eStorageBuffer,
+                .pImageInfo = nullptr,
+                .pBufferInfo = &storageInfo,
+                .pTexelBufferView = nullptr,
+            });
+        }
+        _context->device.updateDescriptorSets(_writes, {});
+
+        uint32_t created = _allocator.stats().pools - pools;
+        if (created > 0) {
+            _poolsCreated += created;
+            _lastGrowthFrame = frame.frame;
+        }
+    }
+
+    void render(SceneFrame& frame) override
+    {
+        for (vk::DescriptorSet set : _frameSets) {
+            frame.commandBuffer.bindDescriptorSets(
+                vk::PipelineBindPoint::eGraphics, *_pipelineLayout, 0, set,
+                {});
+        }
+    }
+
+    void writeStats(std::ostream& out) const override
+    {
+        auto stats = _allocator.stats();
+        out << "{\"sets_per_frame\":" << stats.sets <<
+            ",\"layouts\":" << _layouts.size() <<
+            ",\"pools\":" << stats.pools <<
+            ",\"pools_used\":" << stats.poolsUsed <<
+            ",\"pools_created\":" << _poolsCreated <<
+            ",\"last_growth_frame\":" << _lastGrowthFrame <<
+            ",\"pool_resets\":" << stats.resets << "}";
+    }
+
+private:
+    static constexpr vk::DeviceSize uniformSize = 256;
+
+    vk::DescriptorSetLayout getLayout(bool reversed)
+    {
+        auto bindings = std::array{
+            vk::DescriptorSetLayoutBinding{
+                .binding = 0,
+                .descriptorType = vk::DescriptorType::eUniformBuffer,
+                .descriptorCount = 1,
+                .stageFlags = vk::ShaderStageFlagBits::eVertex |
+                    vk::ShaderStageFlagBits::eFragment,
+                .pImmutableSamplers = nullptr,
+            },
+            vk::DescriptorSetLayoutBinding{
+                .binding = 1,
+                .descriptorType = vk::DescriptorType::eStorageBuffer,
+                .descriptorCount = 1,
+                .stageFlags = vk::ShaderStageFlagBits::eVertex,
+                .pImmutableSamplers = nullptr,
+            },
+        };
+        if (reversed) {
+            std::ranges::reverse(bindings);
+        }
+        return _layouts.get(vk::DescriptorSetLayoutCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::DescriptorSetLayoutCreateFlags{},
+            .bindingCount = (uint32_t)bindings.size(),
+            .pBindings = bindings.data(),
+        });
+    }
+
+    BenchContext* _context = nullptr;
+    rr::DescriptorAllocator _allocator;
+    rr::DescriptorLayoutCache _layouts;
+    uint32_t _sets = 0;
+    BenchBuffer _uniforms;
+    BenchBuffer _storage;
+    vk::raii::PipelineLayout _pipelineLayout {nullptr};
+    std::vector<vk::DescriptorSet> _frameSets;
+    std::vector<vk::WriteDescriptorSet> _writes;
+    uint32_t _poolsCreated = 0;
+    uint64_t _lastGrowthFrame = 0;
+};
+
+// Per-draw uniform data: pushes a transform per object into the frame
+// context's uniform ring every frame and binds it with its dynamic offset.
+// The ring starts small, so the first frames show it growing.
+class UniformsScene : public Scene {
+public:
+    UniformsScene(BenchContext& context, uint32_t objects)
+        : _ring(
+            context.physicalDevice,
+            context.device,
+            context.allocator,
+            framesInFlight,
+            rr::UniformRingOptions{
+                .capacity = 64 * 1024,
+                .maxAllocationSize = 16 * 1024,
+            })
+        , _objects(objects)
+    {
+        vk::DescriptorSetLayout layout = _ring.setLayout();
+        _pipelineLayout = context.device.createPipelineLayout(
+            vk::PipelineLayoutCreateInfo{
+                .pNext = nullptr,
+                .flags = vk::PipelineLayoutCreateFlags{},
+                .setLayoutCount = 1,
+                .pSetLayouts = &layout,
+                .pushConstantRangeCount = 0,
+                .pPushConstantRanges = nullptr,
+            });
+    }
+
+    void beginFrame(SceneFrame& frame) override
+    {
+        _ring.beginFrame(frame.frameContext);
+        _allocations.clear();
+        for (uint32_t i = 0; i < _objects; i++) {
+            std::array<float, 16> transform = identity;
+            transform[12] = std::sin((float)(frame.frame + i) * 0.01f);
+            _allocations.push_back(_ring.push(transform));
+        }
+    }
+
+    void render(SceneFrame& frame) override
+    {
+        for (const rr::UniformAllocation& allocation : _allocations) {
+            frame.commandBuffer.bindDescriptorSets(
+                vk::PipelineBindPoint::eGraphics,
+                *_pipelineLayout,
+                0,
+                allocation.descriptorSet,
+                allocation.dynamicOffset);
+        }
+    }
+
+    void writeStats(std::ostream& out) const override
+    {
+        auto stats = _ring.stats();
+        out << "{\"allocations_per_frame\":" << stats.allocations <<
+            ",\"bytes_per_frame\":" << stats.allocatedBytes <<
+            ",\"alignment\":" << _ring.alignment() <<
+            ",\"capacity\":" << stats.capacity <<
+            ",\"growths\":" << stats.growths << "}";
+    }
+
+private:
+    rr::UniformRing _ring;
+    uint32_t _objects = 0;
+    vk::raii::PipelineLayout _pipelineLayout {nullptr};
+    std::vector<rr::UniformAllocation> _allocations;
+};
+
+// Texture streaming: textures whose on-screen size swings between a
+// quarter and all of their resolution, at different phases, with a budget
+// of a quarter of what all of them need at full resolution, so levels are
+// both upgraded and evicted. The sizes are reported from the CPU; the
+// .rrtex files are written to a temporary directory.
+class StreamingScene : public Scene {
+public:
+    StreamingScene(
+        BenchContext& context, rr::JobSystem& jobs, uint32_t textures)
+        : _context(&context)
+        , _directory{std::filesystem::temp_directory_path() /
+            ("rr_renderbench_streaming_" +
+                std::to_string(std::random_device{}()))}
+    {
+        std::filesystem::create_directories(_directory.path);
+        auto paths = std::vector<std::filesystem::path>{};
+        vk::DeviceSize fullBytes = 0;
+        for (uint32_t i = 0; i < textures; i++) {
+            paths.push_back(_directory.path / (std::to_string(i) + ".rrtex"));
+            fullBytes += writeTexture(paths.back(), i);
+        }
+
+        _streamer = std::make_unique<rr::TextureStreamer>(
+            context.device,
+            context.allocator,
+            context.uploads,
+            context.heap,
+            jobs,
+            framesInFlight,
+            rr::TextureStreamerOptions{
+                .budget = fullBytes / 4,
+                .tailSize = 64,
+                .maxUploadBytes = 16 * 1024 * 1024,
+                .frameUploadBytes = 32 * 1024 * 1024,
+                .maxTextures = std::max(textures, 1u),
+            });
+        for (const std::filesystem::path& path : paths) {
+            _textures.push_back(_streamer->load(path));
+        }
+    }
+
+    void beginFrame(SceneFrame& frame) override
+    {
+        for (size_t i = 0; i < _textures.size(); i++) {
+            float phase = (float)frame.frame * 0.05f + (float)i;
+            float pixels = (float)textureSize *
+                std::exp2(-1.f - std::sin(phase));
+            _streamer->requestScreenSize(_textures[i], pixels);
+        }
+
+        // The frame context's previous frame has completed, and the frame
+        // in flight before this one may not have.
+        uint64_t completedFrames = frame.frame + 1 > framesInFlight ?
+            frame.frame + 1 - framesInFlight : 0;
+        _context->heap.collect(completedFrames);
+        _streamer->beginFrame(frame.frameContext, frame.frame, completedFrames);
+        if (auto submission = _context->uploads.flush()) {
+            submission->recordAcquire(frame.commandBuffer);
+            frame.waits.push_back(submission->wait());
+        }
+    }
+
+    void render(SceneFrame&) override
+    { }
+
+    void endFrame(SceneFrame& frame) override
+    {
+        _streamer->recordFeedbackBarrier(frame.commandBuffer);
+    }
+
+    void writeStats(std::ostream& out) const override
+    {
+        auto stats = _streamer->stats();
+        out << "{\"textures\":" << stats.textures <<
+            ",\"budget\":" << stats.budget <<
+            ",\"resident_bytes\":" << stats.residentBytes <<
+            ",\"pending_reads\":" << stats.pendingReads <<
+            ",\"uploaded_bytes\":" << stats.uploadedBytes <<
+            ",\"upgrades\":" << stats.upgrades <<
+            ",\"evictions\":" << stats.evictions << "}";
+    }
+
+private:
+    static constexpr uint32_t textureSize = 512;
+
+    // Removed with its files when the scene is destroyed, after the
+    // streamer has unmapped them.
+    struct TemporaryDirectory {
+        std::filesystem::path path;
+
+        ~TemporaryDirectory()
+        {
+            auto error = std::error_code{};
+            std::filesystem::remove_all(path, error);
+        }
+    };
+
+    // Writes an RGBA8 texture with a full mip chain and returns the size of
+    // its levels.
+    static vk::DeviceSize writeTexture(
+        const std::filesystem::path& path, uint32_t seed)
+    {
+        uint32_t levelCount = (uint32_t)std::bit_width(textureSize);
+        auto header = rr::TextureFileHeader{
+            .magic = rr::TextureFileHeader::magicValue,
+            .version = rr::TextureFileHeader::currentVersion,
+            .format = (uint32_t)vk::Format::eR8G8B8A8Unorm,
+            .width = textureSize,
+            .height = textureSize,
+            .levelCount = levelCount,
+        };
+        auto levels = std::vector<rr::TextureFileLevel>{};
+        uint64_t offset =
+            sizeof(header) + levelCount * sizeof(rr::TextureFileLevel);
+        for (uint32_t i = 0; i < levelCount; i++) {
+            uint64_t size = (uint64_t)(textureSize >> i) *
+                (textureSize >> i) * 4;
+            levels.push_back(rr::TextureFileLevel{
+                .offset = offset,
+                .size = size,
+            });
+            offset += size;
+        }
+
+        auto file = std::ofstream{path, std::ios::binary};
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)levels.data(),
+            (std::streamsize)(levels.size() * sizeof(rr::TextureFileLevel)));
+        vk::DeviceSize bytes = 0;
+        for (uint32_t i = 0; i < levelCount; i++) {
+            auto texels = std::vector<uint32_t>(levels[i].size / 4);
+            for (size_t j = 0; j < texels.size(); j++) {
+                texels[j] = hashColor(seed * 31 + (uint32_t)j + i);
+            }
+            file.write((const char*)texels.data(),
+                (std::streamsize)levels[i].size);
+            bytes += levels[i].size;
+        }
+        if (!file) {
+            throw rr::Error{} << path.string() << ": cannot write texture";
+        }
+        return bytes;
+    }
+
+    BenchContext* _context = nullptr;
+    TemporaryDirectory _directory;
+    std::unique_ptr<rr::TextureStreamer> _streamer;
+    std::vector<rr::TextureId> _textures;
+};
+
+} // namespace
+
+void Scene::beginFrame(SceneFrame&)
+{ }
+
+bool Scene::secondaryCommandBuffers() const
+{
+    return false;
+}
+
+void Scene::endFrame(SceneFrame&)
+{ }
+
+void Scene::writeStats(std::ostream& out) const
+{
+    out << "{}";
+}
+
+std::span<const SceneInfo> sceneInfos()
+{
+    static constexpr SceneInfo infos[] {
+        SceneInfo{
+            .name = "triangles",
+            .description = "one draw of a mesh with many small triangles",
+            .defaultCount = 1'000'000,
+            .create = [] (BenchContext& context, rr::JobSystem&, uint32_t n)
+                -> std::unique_ptr<Scene> {
+                return std::make_unique<TrianglesScene>(context, n);
+            },
+        },
+        SceneInfo{
+            .name = "draws",
+            .description = "one draw per object, recorded on all threads",
+            .defaultCount = 100'000,
+            .create = [] (
+                    BenchContext& context, rr::JobSystem& jobs, uint32_t n)
+                -> std::unique_ptr<Scene> {
+                return std::make_unique<DrawsScene>(context, jobs, n);
+            },
+        },
+        SceneInfo{
+            .name = "pipelines",
+            .description = "pipeline creation and one bind per pipeline",
+            .defaultCount = 256,
+            .create = [] (BenchContext& context, rr::JobSystem&, uint32_t n)
+                -> std::unique_ptr<Scene> {
+                return std::make_unique<PipelinesScene>(context, n);
+            },
+        },
+        SceneInfo{
+            .name = "uploads",
+            .description = "MiB uploaded through the transfer queue per frame",
+            .defaultCount = 32,
+            .create = [] (BenchContext& context, rr::JobSystem&, uint32_t n)
+                -> std::unique_ptr<Scene> {
+                return std::make_unique<UploadsScene>(context, n);
+            },
+        },
+        SceneInfo{
+            .name = "sprites",
+            .description = "sprites in one instanced draw",
+            .defaultCount = 1'000'000,
+            .create = [] (BenchContext& context, rr::JobSystem&, uint32_t n)
+                -> std::unique_ptr<Scene> {
+                return std::make_unique<SpritesScene>(context, n, false);
+            },
+        },
+        SceneInfo{
+            .name = "sprites-naive",
+            .description = "sprites with one draw each",
+            .defaultCount = 1'000'000,
+            .create = [] (BenchContext& context, rr::JobSystem&, uint32_t n)
+                -> std::unique_ptr<Scene> {
+                return std::make_unique<SpritesScene>(context, n, true);
+            },
+        },
+        SceneInfo{
+            .name = "culling",
+            .description = "GPU frustum culling with indirect draws",
+            .defaultCount = 256 * 1024,
+            .create = [] (BenchContext& context, rr::JobSystem&, uint32_t n)
+                -> std::unique_ptr<Scene> {
+                return std::make_unique<CullingScene>(context, n);
+            },
+        },
+        SceneInfo{
+            .name = "allocator",
+            .description = "live allocations, a tenth replaced per frame",
+            .defaultCount = 2048,
+            .create = [] (BenchContext& context, rr::JobSystem&, uint32_t n)
+                -> std::unique_ptr<Scene> {
+                return std::make_unique<AllocatorScene>(context, n);
+            },
+        },
+        SceneInfo{
+            .name = "descriptors",
+            .description = "descriptor sets allocated and bound per frame",
+            .defaultCount = 10'000,
+            .create = [] (BenchContext& context, rr::JobSystem&, uint32_t n)
+                -> std::unique_ptr<Scene> {
+                return std::make_unique<DescriptorsScene>(context, n);
+            },
+        },
+        SceneInfo{
+            .name = "uniforms",
+            .description = "per-object uniforms written to the ring and bound",
+            .defaultCount = 10'000,
+            .create = [] (BenchContext& context, rr::JobSystem&, uint32_t n)
+                -> std::unique_ptr<Scene> {
+                return std::make_unique<UniformsScene>(context, n);
+            },
+        },
+        SceneInfo{
+            .name = "streaming",
+            .description = "textures streamed by on-screen size",
+            .defaultCount = 32,
+            .create = [] (
+                    BenchContext& context, rr::JobSystem& jobs, uint32_t n)
+                -> std::unique_ptr<Scene> {
+                return std::make_unique<StreamingScene>(context, jobs, n);
+            },
+        },
+    };
+    return infos;
+}
+
+} // namespace bench
@@ -0,0 +1,94 @@
+# rr_embed_shaders(<target>
+#     HEADER <file name>
+#     NAMESPACE <C++ namespace>
+#     SOURCES <shader>...
+#     [INCLUDE_DIRECTORIES <dir>...]
+#     [TARGET_ENV <env>]
+#     [OPTIMIZE])
+#
+# Compiles GLSL shaders with glslc, strips their debug information with
+# spirv-opt when it is available, and generates a header with the SPIR-V as
+# constexpr uint32_t arrays, so shader modules are created from the binary's
+# read-only data without any file I/O. <target> is an interface library that
+# provides the header; link it to use the shaders.
+#
+# The array of a shader is named after its file name with dots replaced by
+# underscores, e.g. batch_quad_vert for batch_quad.vert, and the header's
+# find(name) looks shaders up by file name. The shader stage is taken from the
+# file extension, as glslc does. OPTIMIZE compiles with -O.
+
+set(RR_EMBED_SPIRV_SCRIPT ${CMAKE_CURRENT_LIST_DIR}/EmbedSpirv.cmake)
+
+find_program(RR_SPIRV_OPT spirv-opt
+    HINTS $ENV{VULKAN_SDK}/bin $ENV{VULKAN_SDK}/Bin)
+
+function(rr_embed_shaders target)
+    cmake_parse_arguments(PARSE_ARGV 1 ARG
+        "OPTIMIZE"
+        "HEADER;NAMESPACE;TARGET_ENV"
+        "SOURCES;INCLUDE_DIRECTORIES")
+    if(NOT ARG_HEADER OR NOT ARG_NAMESPACE OR NOT ARG_SOURCES)
+        message(FATAL_ERROR
+            "rr_embed_shaders needs HEADER, NAMESPACE and SOURCES")
+    endif()
+    if(NOT ARG_TARGET_ENV)
+        set(ARG_TARGET_ENV vulkan1.2)
+    endif()
+
+    set(outputDir ${CMAKE_CURRENT_BINARY_DIR}/${target})
+    file(MAKE_DIRECTORY ${outputDir}/include)
+    set(flags --target-env=${ARG_TARGET_ENV})
+    if(ARG_OPTIMIZE)
+        list(APPEND flags -O)
+    endif()
+    foreach(dir ${ARG_INCLUDE_DIRECTORIES})
+        list(APPEND flags -I ${dir})
+    endforeach()
+
+    set(spirvFiles)
+    set(entries)
+    foreach(source ${ARG_SOURCES})
+        get_filename_component(sourcePath ${source} ABSOLUTE)
+        get_filename_component(name ${source} NAME)
+        set(spirv ${outputDir}/${name}.spv)
+
+        if(RR_SPIRV_OPT)
+            set(strip COMMAND ${RR_SPIRV_OPT} --strip-debug ${spirv}
+                -o ${spirv})
+        else()
+            set(strip)
+        endif()
+
+        add_custom_command(
+            COMMENT "compile shader ${name}"
+            COMMAND Vulkan::glslc ${flags} -MD -MF ${spirv}.d
+                ${sourcePath} -o ${spirv}
+            ${strip}
+            DEPENDS ${sourcePath}
+            DEPFILE ${spirv}.d
+            OUTPUT ${spirv}
+        )
+        list(APPEND spirvFiles ${spirv})
+        list(APPEND entries "${name}=${spirv}")
+    endforeach()
+
+    # A list argument would be split into several arguments of the command.
+    string(REPLACE ";" "|" entries "${entries}")
+    set(header ${outputDir}/include/${ARG_HEADER})
+    add_custom_command(
+        COMMENT "embed shaders in ${ARG_HEADER}"
+        COMMAND ${CMAKE_COMMAND}
+            "-DOUTPUT=${header}"
+            "-DNAMESPACE=${ARG_NAMESPACE}"
+            "-DENTRIES=${entries}"
+            -P ${RR_EMBED_SPIRV_SCRIPT}
+        DEPENDS ${spirvFiles} ${RR_EMBED_SPIRV_SCRIPT}
+        OUTPUT ${header}
+        VERBATIM
+    )
+
+    add_custom_target(${target}_generate DEPENDS ${header})
+    add_library(${target} INTERFACE)
+    add_dependencies(${target} ${target}_generate)
+    target_include_directories(${target} INTERFACE ${outputDir}/include)
+endfunction()
@@ -0,0 +1,73 @@
+# Writes SPIR-V files into a C++ header as constexpr uint32_t arrays. Run by
+# rr_embed_shaders (EmbedShaders.cmake) in script mode:
+#
+#   cmake -DOUTPUT=<header> -DNAMESPACE=<namespace>
+#       -DENTRIES=<name>=<spirv file>|... -P EmbedSpirv.cmake
+
+string(REPLACE "|" ";" entries "${ENTRIES}")
+
+set(arrays "")
+set(table "")
+foreach(entry ${entries})
+    string(FIND "${entry}" "=" split)
+    string(SUBSTRING "${entry}" 0 ${split} name)
+    math(EXPR split "${split} + 1")
+    string(SUBSTRING "${entry}" ${split} -1 file)
+    string(MAKE_C_IDENTIFIER "${name}" identifier)
+
+    file(READ "${file}" hex HEX)
+    string(LENGTH "${hex}" length)
+    math(EXPR remainder "${length} % 8")
+    if(length EQUAL 0 OR NOT remainder EQUAL 0)
+        message(FATAL_ERROR "${file} is not a SPIR-V module")
+    endif()
+
+    # SPIR-V is a stream of little-endian words; six per line.
+    string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1, " words "${hex}")
+    string(REPEAT "0x[0-9a-f]+, " 6 line)
+    string(REGEX REPLACE "(${line})" "\\1\n    " words "${words}")
+    string(REPLACE ", \n" ",\n" words "${words}")
+    string(REGEX REPLACE "[ \n]+$" "" words "${words}")
+
+    string(APPEND arrays
+        "alignas(16) inline constexpr uint32_t ${identifier}[] {\n"
+        "    ${words}\n"
+        "};\n\n")
+    string(APPEND table
+        "    EmbeddedShader{\"${name}\", ${identifier}},\n")
+endforeach()
+
+set(content "// Generated by EmbedSpirv.cmake; do not edit.
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace ${NAMESPACE} {
+
+${arrays}struct EmbeddedShader {
+    std::string_view name;
+    std::span<const uint32_t> code;
+};
+
+inline constexpr EmbeddedShader embeddedShaders[] {
+${table}};
+
+// Returns an empty span if there is no shader of that file name.
+constexpr std::span<const uint32_t> find(std::string_view name)
+{
+    for (const EmbeddedShader& shader : embeddedShaders) {
+        if (shader.name == name) {
+            return shader.code;
+        }
+    }
+    return {};
+}
+
+} // namespace ${NAMESPACE}
+")
+
+# Only touch the header when it changes, so dependents are not rebuilt for
+# shader edits that compile to the same code.
+file(CONFIGURE OUTPUT "${OUTPUT}" CONTENT "${content}" @ONLY)
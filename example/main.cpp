@@ -1,8 +1,25 @@
-#include "build-info.hpp"
-
+#include "example_shaders.hpp"
+
+#include <async_compute.hpp>
+#include <batch_renderer.hpp>
+#include <bindless_heap.hpp>
+#include <deletion_queue.hpp>
+#include <device_selector.hpp>
+#include <dynamic_resolution.hpp>
 #include <error.hpp>
+#include <gpu_culling.hpp>
+#include <gpu_profiler.hpp>
+#include <gpu_shaders.hpp>
 #include <li.hpp>
-#include <mm.hpp>
+#include <math.hpp>
+#include <memory_allocator.hpp>
+#include <memory_budget.hpp>
+#include <pipeline_cache.hpp>
+#include <render_graph.hpp>
+#include <shader_reloader.hpp>
+#include <swapchain.hpp>
+#include <timeline.hpp>
+#include <upload.hpp>
 #include <xcb_window.hpp>
 //#include <windows_window.hpp>
 
@@ -11,9 +28,15 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <optional>
+#include <span>
+#include <string_view>
 
 using namespace std::chrono_literals;
 
@@ -95,10 +118,33 @@ private:
     const T& _value;
 };
 
+std::filesystem::path pipelineCachePath()
+{
+    if (const char* cacheHome = std::getenv("XDG_CACHE_HOME")) {
+        return std::filesystem::path{cacheHome} / "rr" / "pipeline-cache.bin";
+    }
+    if (const char* home = std::getenv("HOME")) {
+        return std::filesystem::path{home} /
+            ".cache" / "rr" / "pipeline-cache.bin";
+    }
+    return "pipeline-cache.bin";
+}
+
 VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 
-int main()
+int main(int argc, char** argv)
 {
+    // --overlay draws the profiler's frame graph over the scene.
+    bool overlay = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::string_view{argv[i]} == "--overlay") {
+            overlay = true;
+        } else {
+            std::cerr << "unknown option: " << argv[i] << "\n";
+            return 1;
+        }
+    }
+
     auto vulkanContext = vk::raii::Context{};
 
     auto vulkanLibrary = rr::DynamicLibrary{"libvulkan.so"};
@@ -151,7 +197,7 @@ int main()
         .applicationVersion = VK_MAKE_VERSION(0, 1, 0),
         .pEngineName = "weewee",
         .engineVersion = VK_MAKE_VERSION(0, 1, 0),
-        .apiVersion = VK_API_VERSION_1_0,
+        .apiVersion = VK_API_VERSION_1_2,
     };
     auto instanceCreateInfo = vk::InstanceCreateInfo{
         .pNext = nullptr,
@@ -197,129 +243,195 @@ int main()
         VK_KHR_SWAPCHAIN_EXTENSION_NAME,
     };
 
-    auto physicalDevices = instance.enumeratePhysicalDevices();
-    auto selectedPhysicalDevice = vk::raii::PhysicalDevice{nullptr};
-    auto selectedQueueFamilies = std::vector<uint32_t>{};
-    auto availableSurfaceFormats = std::vector<vk::SurfaceFormatKHR>{};
-    auto availablePresentModes = std::vector<vk::PresentModeKHR>{};
-    auto availableSurfaceCapabilities = vk::SurfaceCapabilitiesKHR{};
-    uint32_t selectedGraphicsQueueFamily = 0;
-    uint32_t selectedPresentQueueFamily = 0;
+    // The best device that can present to the window: discrete GPUs first,
+    // then integrated, virtual and CPU implementations such as lavapipe.
+    // RR_DEVICE selects one by UUID or name instead.
+    auto deviceRequirements = rr::DeviceRequirements{
+        .extensions = deviceExtensionNames,
+        .surface = *surface,
+        .optionalExtensions = {
+            VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+            VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME,
+            VK_KHR_PRESENT_ID_EXTENSION_NAME,
+            VK_KHR_PRESENT_WAIT_EXTENSION_NAME,
+        },
+    };
     std::cout << "physical devices:\n";
-    for (const auto& physicalDevice : physicalDevices) {
-        auto dp = physicalDevice.getProperties();
-        auto df = physicalDevice.getFeatures();
-
-        std::cout << "  * " << dp.deviceName << "\n";
-
-        auto deviceExtensionProperties =
-            physicalDevice.enumerateDeviceExtensionProperties();
-        //std::cout << "    extensions:\n";
-        //for (const auto& ep : extensionProperties) {
-        //    std::cout << "      * " << ep.extensionName <<
-        //        " (" << ep.specVersion << ")\n";
-        //}
-
-        if (dp.deviceType != vk::PhysicalDeviceType::eDiscreteGpu) {
-            std::cout << "device is not a discrete GPU\n";
+    for (const auto& candidate :
+            rr::rankPhysicalDevices(instance, deviceRequirements)) {
+        std::cout << "  * " << candidate.properties.deviceName << " (" <<
+            vk::to_string(candidate.properties.deviceType) << ", " <<
+            rr::uuidString(candidate.uuid) << ")";
+        if (candidate.usable()) {
+            std::cout << ": score " << std::hex << candidate.score <<
+                std::dec << "\n";
             continue;
         }
-
-        if (!df.geometryShader) {
-            std::cout << "device is lacking geometry shader\n";
-            continue;
-        }
-
-        if (std::ranges::any_of(
-                deviceExtensionNames,
-                [&deviceExtensionProperties] (const char* desiredExtension) {
-                    return std::ranges::none_of(
-                        deviceExtensionProperties,
-                        [desiredExtension] (const vk::ExtensionProperties& p) {
-                            return std::strcmp(
-                                p.extensionName, desiredExtension) == 0;
-                        });
-                })) {
-            std::cout << "device does not support all desired extensions\n";
-            continue;
-        }
-
-        vk::SurfaceCapabilitiesKHR surfaceCapabilities =
-            physicalDevice.getSurfaceCapabilitiesKHR(surface);
-        auto surfaceFormats = physicalDevice.getSurfaceFormatsKHR(surface);
-        auto presentModes = physicalDevice.getSurfacePresentModesKHR(surface);
-
-        if (surfaceFormats.empty()) {
-            std::cout << "device does not have any surface formats\n";
-            continue;
+        std::cout << ": missing";
+        for (const std::string& missing : candidate.missing) {
+            std::cout << " " << missing;
         }
+        std::cout << "\n";
+    }
 
-        if (presentModes.empty()) {
-            std::cout << "device does not have any present modes\n";
-            continue;
-        }
+    const char* deviceOverride = std::getenv("RR_DEVICE");
+    auto selectedDevice = rr::selectPhysicalDevice(
+        instance,
+        deviceRequirements,
+        deviceOverride ? deviceOverride : "");
+    auto selectedPhysicalDevice = selectedDevice.physicalDevice;
+    uint32_t selectedGraphicsQueueFamily = selectedDevice.graphicsQueueFamily;
+    uint32_t selectedPresentQueueFamily = selectedDevice.presentQueueFamily;
+    auto availableSurfaceFormats =
+        selectedPhysicalDevice.getSurfaceFormatsKHR(surface);
+    auto selectedQueueFamilies = std::vector<uint32_t>{
+        selectedGraphicsQueueFamily,
+    };
+    if (selectedPresentQueueFamily != selectedGraphicsQueueFamily) {
+        selectedQueueFamilies.push_back(selectedPresentQueueFamily);
+    }
 
-        auto queueFamilyProperties = physicalDevice.getQueueFamilyProperties();
+    std::cout << "selected " << selectedDevice.properties.deviceName <<
+        ", queue families:\n";
+    auto queueFamilyProperties =
+        selectedPhysicalDevice.getQueueFamilyProperties();
+    for (const vk::QueueFamilyProperties& qfp : queueFamilyProperties) {
+        std::cout << "  * " <<
+            qfp.queueCount << " queues: " << Print{qfp.queueFlags} << "\n";
+    }
 
-        std::optional<uint32_t> graphicsFamily;
-        std::optional<uint32_t> presentFamily;
+    // Uploads go through a transfer-only family when there is one, so that
+    // they do not serialize with rendering on the graphics queue.
+    uint32_t selectedTransferQueueFamily = selectedGraphicsQueueFamily;
+    auto deviceQueueFamilies = selectedQueueFamilies;
+    auto transferFamily = rr::findTransferQueueFamily(selectedPhysicalDevice);
+    if (transferFamily) {
+        selectedTransferQueueFamily = *transferFamily;
+        deviceQueueFamilies.push_back(*transferFamily);
+    }
 
-        std::cout << "    queue families:\n";
-        for (uint32_t i = 0; i < queueFamilyProperties.size(); i++) {
-            const vk::QueueFamilyProperties& qfp = queueFamilyProperties.at(i);
-            std::cout << "      * " <<
-                qfp.queueCount << " queues: " << Print{qfp.queueFlags} << "\n";
+    // Compute work gets a queue of its own so that it overlaps rendering:
+    // one of a compute-only family if there is one, else a second queue of
+    // the graphics family, else the graphics queue itself.
+    uint32_t selectedComputeQueueFamily = selectedGraphicsQueueFamily;
+    uint32_t computeQueueIndex = 0;
+    auto computeFamily = rr::findComputeQueueFamily(selectedPhysicalDevice);
+    if (computeFamily) {
+        selectedComputeQueueFamily = *computeFamily;
+        deviceQueueFamilies.push_back(*computeFamily);
+    } else if (queueFamilyProperties.at(selectedGraphicsQueueFamily)
+            .queueCount > 1) {
+        computeQueueIndex = 1;
+    }
 
-            if (!graphicsFamily) {
-                if (qfp.queueFlags & vk::QueueFlagBits::eGraphics) {
-                    graphicsFamily = i;
-                }
-            }
+    std::cout << "selected queue families:";
+    for (uint32_t i : selectedQueueFamilies) {
+        std::cout << " " << i;
+    }
+    std::cout << ", transfer: " << selectedTransferQueueFamily <<
+        ", compute: " << selectedComputeQueueFamily << "." <<
+        computeQueueIndex << "\n";
+
+    auto availableDeviceExtensions =
+        selectedPhysicalDevice.enumerateDeviceExtensionProperties();
+    auto deviceExtensionSupported = [&] (const char* name) {
+        return std::ranges::any_of(
+            availableDeviceExtensions,
+            [name] (const vk::ExtensionProperties& p) {
+                return std::strcmp(p.extensionName, name) == 0;
+            });
+    };
 
-            if (!presentFamily) {
-                if (physicalDevice.getSurfaceSupportKHR(i, surface)) {
-                    presentFamily = i;
-                }
-            }
-        }
+    bool pipelineCreationFeedbackSupported = deviceExtensionSupported(
+        VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+    if (pipelineCreationFeedbackSupported) {
+        deviceExtensionNames.push_back(
+            VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+    }
 
-        if (graphicsFamily && presentFamily) {
-            selectedPhysicalDevice = physicalDevice;
-            selectedGraphicsQueueFamily = *graphicsFamily;
-            selectedPresentQueueFamily = *presentFamily;
-            availableSurfaceFormats = std::move(surfaceFormats);
-            availablePresentModes = std::move(presentModes);
-            availableSurfaceCapabilities = surfaceCapabilities;
-
-            selectedQueueFamilies.push_back(*graphicsFamily);
-            if (presentFamily != graphicsFamily) {
-                selectedQueueFamilies.push_back(*presentFamily);
-            }
-        }
+    bool memoryBudgetSupported =
+        deviceExtensionSupported(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (memoryBudgetSupported) {
+        deviceExtensionNames.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
     }
 
-    bool graphicsPresentSameFamily =
-        (selectedGraphicsQueueFamily == selectedPresentQueueFamily);
+    // Lines up the timestamps of the graphics and compute queues, which are
+    // not comparable otherwise, to measure how much they overlap.
+    bool calibratedTimestamps =
+        rr::calibratedTimestampsSupported(selectedPhysicalDevice);
+    if (calibratedTimestamps) {
+        deviceExtensionNames.push_back(
+            VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+    }
 
-    std::cout << "selected queue families:";
-    for (uint32_t i : selectedQueueFamilies) {
-        std::cout << " " << i;
+    auto enabledFeatures = vk::StructureChain<
+        vk::PhysicalDeviceFeatures2,
+        vk::PhysicalDeviceTimelineSemaphoreFeatures,
+        vk::PhysicalDeviceDescriptorIndexingFeatures,
+        vk::PhysicalDevicePresentIdFeaturesKHR,
+        vk::PhysicalDevicePresentWaitFeaturesKHR>{};
+    enabledFeatures.get<vk::PhysicalDeviceTimelineSemaphoreFeatures>()
+        .timelineSemaphore = vk::True;
+    // Required by the device selection, for GpuCuller.
+    enabledFeatures.get<vk::PhysicalDeviceFeatures2>()
+        .features.drawIndirectFirstInstance = vk::True;
+    // Lets GpuCuller draw all objects with one indirect call.
+    bool multiDrawIndirect =
+        selectedPhysicalDevice.getFeatures().multiDrawIndirect;
+    enabledFeatures.get<vk::PhysicalDeviceFeatures2>()
+        .features.multiDrawIndirect = multiDrawIndirect;
+    rr::enableBindlessFeatures(
+        enabledFeatures.get<vk::PhysicalDeviceFeatures2>().features,
+        enabledFeatures.get<vk::PhysicalDeviceDescriptorIndexingFeatures>());
+
+    bool presentWaitSupported =
+        deviceExtensionSupported(VK_KHR_PRESENT_ID_EXTENSION_NAME) &&
+        deviceExtensionSupported(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+    if (presentWaitSupported) {
+        auto features = selectedPhysicalDevice.getFeatures2<
+            vk::PhysicalDeviceFeatures2,
+            vk::PhysicalDevicePresentIdFeaturesKHR,
+            vk::PhysicalDevicePresentWaitFeaturesKHR>();
+        const auto& presentIdFeatures =
+            features.get<vk::PhysicalDevicePresentIdFeaturesKHR>();
+        const auto& presentWaitFeatures =
+            features.get<vk::PhysicalDevicePresentWaitFeaturesKHR>();
+        presentWaitSupported =
+            presentIdFeatures.presentId && presentWaitFeatures.presentWait;
+    }
+    if (presentWaitSupported) {
+        deviceExtensionNames.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+        deviceExtensionNames.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+        enabledFeatures.get<vk::PhysicalDevicePresentIdFeaturesKHR>()
+            .presentId = vk::True;
+        enabledFeatures.get<vk::PhysicalDevicePresentWaitFeaturesKHR>()
+            .presentWait = vk::True;
+    } else {
+        enabledFeatures.unlink<vk::PhysicalDevicePresentIdFeaturesKHR>();
+        enabledFeatures.unlink<vk::PhysicalDevicePresentWaitFeaturesKHR>();
     }
-    std::cout << "\n";
+
+    // The present family may also be the transfer or compute one, and each
+    // family must get a single create info with all of its queues.
+    std::ranges::sort(deviceQueueFamilies);
+    auto duplicateFamilies = std::ranges::unique(deviceQueueFamilies);
+    deviceQueueFamilies.erase(
+        duplicateFamilies.begin(), duplicateFamilies.end());
 
     auto queueCreateInfos = std::vector<vk::DeviceQueueCreateInfo>{};
-    float queuePriorities[] {1.f};
-    for (uint32_t queueFamilyIndex : selectedQueueFamilies) {
+    float queuePriorities[] {1.f, 1.f};
+    for (uint32_t queueFamilyIndex : deviceQueueFamilies) {
         queueCreateInfos.push_back(vk::DeviceQueueCreateInfo{
             .pNext = nullptr,
             .flags = vk::DeviceQueueCreateFlags{},
             .queueFamilyIndex = queueFamilyIndex,
-            .queueCount = 1,
+            .queueCount = queueFamilyIndex == selectedComputeQueueFamily ?
+                computeQueueIndex + 1 : 1,
             .pQueuePriorities = queuePriorities,
         });
     }
     auto deviceCreateInfo = vk::DeviceCreateInfo{
-        .pNext = nullptr,
+        .pNext = &enabledFeatures.get<vk::PhysicalDeviceFeatures2>(),
         .flags = vk::DeviceCreateFlags{},
         .queueCreateInfoCount = (uint32_t)queueCreateInfos.size(),
         .pQueueCreateInfos = queueCreateInfos.data(),
@@ -341,95 +453,103 @@ int main()
         }
     }
 
-    vk::PresentModeKHR selectedPresentMode = vk::PresentModeKHR::eFifo;
-    for (const auto& mode : availablePresentModes) {
-        if (mode == vk::PresentModeKHR::eMailbox) {
-            selectedPresentMode = mode;
-            break;
+    // Mailbox by default; RR_PRESENT_MODE selects fifo for power saving, or
+    // immediate for the lowest latency. Unsupported modes fall back.
+    vk::PresentModeKHR requestedPresentMode = vk::PresentModeKHR::eMailbox;
+    if (const char* mode = std::getenv("RR_PRESENT_MODE")) {
+        if (auto parsed = rr::parsePresentMode(mode)) {
+            requestedPresentMode = *parsed;
+        } else {
+            std::cout << "unknown present mode: " << mode << "\n";
         }
     }
 
-    auto [windowWidth, windowHeight] = window->size();
-
-    uint32_t swapChainImageCount = availableSurfaceCapabilities.maxImageCount;
-    if (swapChainImageCount == 0) {
-        swapChainImageCount = availableSurfaceCapabilities.minImageCount + 1;
-    }
-
     vk::Queue graphicsQueue = device.getQueue(selectedGraphicsQueueFamily, 0);
     vk::Queue presentQueue = device.getQueue(selectedPresentQueueFamily, 0);
+    vk::Queue transferQueue = device.getQueue(selectedTransferQueueFamily, 0);
+    vk::Queue computeQueue =
+        device.getQueue(selectedComputeQueueFamily, computeQueueIndex);
+
+    auto memoryAllocator = rr::MemoryAllocator{
+        selectedPhysicalDevice, device, rr::MemoryAllocator::Options{}};
+
+    // Updated every frame; keeps the allocator within the heap budgets.
+    auto memoryBudget = rr::MemoryBudget{
+        selectedPhysicalDevice,
+        memoryAllocator,
+        rr::MemoryBudgetOptions{
+            .memoryBudgetExtension = memoryBudgetSupported,
+            .fallbackBudget = 0.8f,
+            .hysteresis = 0.05f,
+        },
+    };
+    memoryBudget.onPressure(0.9f, [] (const rr::MemoryPressureEvent& e) {
+        std::cout << "memory heap " << e.heap << (e.rising ?
+            " above " : " back below ") << e.threshold * 100.f <<
+            "% of its budget\n";
+    });
+
+    // One timeline per queue; binary semaphores are only used for acquire
+    // and present.
+    auto sync = rr::TimelineSync{device};
+    rr::QueueId graphicsQueueId = sync.addQueue(graphicsQueue);
+    rr::QueueId transferQueueId = sync.addQueue(transferQueue);
+    rr::QueueId computeQueueId = sync.addQueue(computeQueue);
+
+    auto uploadService = rr::UploadService{
+        selectedPhysicalDevice,
+        device,
+        memoryAllocator,
+        sync,
+        rr::UploadServiceOptions{
+            .stagingSize = 16 * 1024 * 1024,
+            .transferQueueFamily = selectedTransferQueueFamily,
+            .graphicsQueueFamily = selectedGraphicsQueueFamily,
+            .transferQueue = transferQueueId,
+        },
+    };
 
-    auto swapchainExtent = vk::Extent2D{
-        .width = (uint32_t)windowWidth,
-        .height = (uint32_t)windowHeight,
+    // Resources dropped while frames are in flight are retired here with
+    // the last frame that may use them, and destroyed off the render thread.
+    auto deletionQueue = rr::DeletionQueue{
+        &memoryAllocator,
+        rr::DeletionQueueOptions{.backgroundThread = true},
     };
 
-    auto swapchainCreateInfo = vk::SwapchainCreateInfoKHR{
-        .pNext = nullptr,
-        .flags = vk::SwapchainCreateFlagsKHR{},
-        .surface = surface,
-        .minImageCount = swapChainImageCount,
-        .imageFormat = selectedSurfaceFormat.format,
-        .imageColorSpace = selectedSurfaceFormat.colorSpace,
-        .imageExtent = swapchainExtent,
-        .imageArrayLayers = 1,
-        .imageUsage = vk::ImageUsageFlagBits::eColorAttachment,
-        .imageSharingMode = graphicsPresentSameFamily ?
-            vk::SharingMode::eExclusive : vk::SharingMode::eConcurrent,
-        .queueFamilyIndexCount = graphicsPresentSameFamily ? 0u : 2u,
-        .pQueueFamilyIndices = graphicsPresentSameFamily ?
-            nullptr : selectedQueueFamilies.data(),
-        .preTransform = availableSurfaceCapabilities.currentTransform,
-        .compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque,
-        .presentMode = selectedPresentMode,
-        .clipped = vk::True,
-        .oldSwapchain = VK_NULL_HANDLE,
-    };
-    vk::raii::SwapchainKHR swapchain = device.createSwapchainKHR(swapchainCreateInfo);
-
-    auto swapchainImages = swapchain.getImages();
-
-    auto swapchainImageViews = std::vector<vk::raii::ImageView>{};
-    swapchainImageViews.reserve(swapchainImages.size());
-    for (const vk::Image& image : swapchainImages) {
-        auto imageViewCreateInfo = vk::ImageViewCreateInfo{
-            .pNext = nullptr,
-            .flags = vk::ImageViewCreateFlags{},
-            .image = image,
-            .viewType = vk::ImageViewType::e2D,
-            .format = selectedSurfaceFormat.format,
-            .components = vk::ComponentMapping {
-                .r = vk::ComponentSwizzle::eIdentity,
-                .g = vk::ComponentSwizzle::eIdentity,
-                .b = vk::ComponentSwizzle::eIdentity,
-                .a = vk::ComponentSwizzle::eIdentity,
-            },
-            .subresourceRange = vk::ImageSubresourceRange{
-                .aspectMask = vk::ImageAspectFlagBits::eColor,
-                .baseMipLevel = 0,
-                .levelCount = 1,
-                .baseArrayLayer = 0,
-                .layerCount = 1,
-            },
-        };
-        swapchainImageViews.push_back(
-            device.createImageView(imageViewCreateInfo));
-    }
+    auto [windowWidth, windowHeight] = window->size();
 
-    auto vertShaderFile = rr::MemoryMap{SHADER_DIR / "vert.spv"};
-    auto fragShaderFile = rr::MemoryMap{SHADER_DIR / "frag.spv"};
+    auto swapchain = rr::Swapchain{
+        selectedPhysicalDevice,
+        device,
+        surface,
+        rr::SwapchainOptions{
+            .surfaceFormat = selectedSurfaceFormat,
+            .presentMode = requestedPresentMode,
+            .queueFamilies = selectedQueueFamilies,
+            .presentWait = presentWaitSupported,
+        },
+        vk::Extent2D{
+            .width = (uint32_t)windowWidth,
+            .height = (uint32_t)windowHeight,
+        },
+    };
+    vk::Extent2D swapchainExtent = swapchain.extent();
+    std::cout << "present mode: " <<
+        vk::to_string(swapchain.presentMode()) <<
+        (presentWaitSupported ? ", present wait" : "") << "\n";
 
+    // The SPIR-V is embedded in the executable at build time.
     auto vertShaderInfo = vk::ShaderModuleCreateInfo{
         .pNext = nullptr,
         .flags = vk::ShaderModuleCreateFlags{},
-        .codeSize = vertShaderFile.size(),
-        .pCode = reinterpret_cast<uint32_t*>(vertShaderFile.addr()),
+        .codeSize = sizeof(shaders::dummy_vert),
+        .pCode = shaders::dummy_vert,
     };
     auto fragShaderInfo = vk::ShaderModuleCreateInfo{
         .pNext = nullptr,
         .flags = vk::ShaderModuleCreateFlags{},
-        .codeSize = fragShaderFile.size(),
-        .pCode = reinterpret_cast<uint32_t*>(fragShaderFile.addr()),
+        .codeSize = sizeof(shaders::dummy_frag),
+        .pCode = shaders::dummy_frag,
     };
 
     vk::raii::ShaderModule vertShaderModule =
@@ -559,16 +679,9 @@ int main()
         .blendConstants = std::array{0.f, 0.f, 0.f, 0.f},
     };
 
-    auto pipelineLayoutInfo = vk::PipelineLayoutCreateInfo {
-        .pNext = nullptr,
-        .flags = vk::PipelineLayoutCreateFlags{},
-        .setLayoutCount = 0,
-        .pSetLayouts = nullptr,
-        .pushConstantRangeCount = 0,
-        .pPushConstantRanges = nullptr,
-    };
-    vk::raii::PipelineLayout pipelineLayout =
-        device.createPipelineLayout(pipelineLayoutInfo);
+    // Every pipeline shares the bindless heap's layout, so the heap is bound
+    // once per frame whatever the pipelines draw with.
+    auto bindlessHeap = rr::BindlessHeap{selectedPhysicalDevice, device};
 
     auto colorAttachmentDescription = vk::AttachmentDescription{
         .flags = vk::AttachmentDescriptionFlags{},
@@ -578,8 +691,9 @@ int main()
         .storeOp = vk::AttachmentStoreOp::eStore,
         .stencilLoadOp = vk::AttachmentLoadOp::eDontCare,
         .stencilStoreOp = vk::AttachmentStoreOp::eDontCare,
-        .initialLayout = vk::ImageLayout::eUndefined,
-        .finalLayout = vk::ImageLayout::ePresentSrcKHR,
+        // The render graph transitions the image around the pass.
+        .initialLayout = vk::ImageLayout::eColorAttachmentOptimal,
+        .finalLayout = vk::ImageLayout::eColorAttachmentOptimal,
     };
 
     auto colorAttachmentReference = vk::AttachmentReference{
@@ -600,15 +714,6 @@ int main()
         .pPreserveAttachments = nullptr,
     };
 
-    auto subpassDependency = vk::SubpassDependency{
-        .srcSubpass = vk::SubpassExternal,
-        .dstSubpass = 0,
-        .srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput,
-        .dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput,
-        .srcAccessMask = vk::AccessFlags{},
-        .dstAccessMask = vk::AccessFlagBits::eColorAttachmentWrite,
-        .dependencyFlags = vk::DependencyFlags{},
-    };
     auto renderPassInfo = vk::RenderPassCreateInfo{
         .pNext = nullptr,
         .flags = vk::RenderPassCreateFlags{},
@@ -616,8 +721,8 @@ int main()
         .pAttachments = &colorAttachmentDescription,
         .subpassCount = 1,
         .pSubpasses = &subpassDescription,
-        .dependencyCount = 1,
-        .pDependencies = &subpassDependency,
+        .dependencyCount = 0,
+        .pDependencies = nullptr,
     };
     vk::raii::RenderPass renderPass = device.createRenderPass(renderPassInfo);
 
@@ -635,33 +740,88 @@ int main()
         .pDepthStencilState = nullptr,
         .pColorBlendState = &colorBlendState,
         .pDynamicState = &dynamicState,
-        .layout = pipelineLayout,
+        .layout = bindlessHeap.pipelineLayout(),
         .renderPass = renderPass,
         .subpass = 0,
         .basePipelineHandle = VK_NULL_HANDLE,
         .basePipelineIndex = -1,
     };
 
-    auto graphicsPipeline =
-        device.createGraphicsPipeline(VK_NULL_HANDLE, pipelineInfo);
+    auto pipelineCache = rr::PipelineCache{
+        selectedPhysicalDevice,
+        device,
+        pipelineCachePath(),
+        pipelineCreationFeedbackSupported,
+    };
+    if (!pipelineCache.rejectReason().empty()) {
+        std::cout << "pipeline cache not loaded: " <<
+            pipelineCache.rejectReason() << "\n";
+    }
 
-    auto swapchainFramebuffers = std::vector<vk::raii::Framebuffer>{};
-    swapchainFramebuffers.reserve(swapchainImageViews.size());
-    for (const auto& swapchainImageView : swapchainImageViews) {
-        auto framebufferInfo = vk::FramebufferCreateInfo{
-            .pNext = nullptr,
-            .flags = vk::FramebufferCreateFlags{},
-            .renderPass = renderPass,
-            .attachmentCount = 1,
-            .pAttachments = &*swapchainImageView,
-            .width = swapchainExtent.width,
-            .height = swapchainExtent.height,
-            .layers = 1,
-        };
-        swapchainFramebuffers.push_back(
-            device.createFramebuffer(framebufferInfo));
+    auto graphicsPipeline = pipelineCache.createGraphicsPipeline(pipelineInfo);
+
+    // RR_SHADER_RELOAD names the directory of the compiled shaders, e.g.
+    // <build>/example/example_shaders; the pipeline is then rebuilt whenever
+    // they are recompiled. Reloaded pipelines bypass the pipeline cache,
+    // which the render thread uses.
+    auto shaderReloader = std::optional<rr::ShaderReloader>{};
+    rr::ReloadablePipelineId reloadablePipeline = 0;
+    uint64_t reportedReloadFailures = 0;
+    if (const char* shaderDir = std::getenv("RR_SHADER_RELOAD")) {
+        shaderReloader.emplace(device);
+        reloadablePipeline = shaderReloader->add(
+            {
+                rr::ShaderSource{
+                    .path = std::filesystem::path{shaderDir} / "dummy.vert.spv",
+                    .code = shaders::dummy_vert,
+                },
+                rr::ShaderSource{
+                    .path = std::filesystem::path{shaderDir} / "dummy.frag.spv",
+                    .code = shaders::dummy_frag,
+                },
+            },
+            [&device, pipelineInfo, shaderStages] (
+                    std::span<const vk::ShaderModule> modules) {
+                vk::PipelineShaderStageCreateInfo stages[] {
+                    shaderStages[0],
+                    shaderStages[1],
+                };
+                stages[0].module = modules[0];
+                stages[1].module = modules[1];
+                auto info = pipelineInfo;
+                info.pStages = stages;
+                return device.createGraphicsPipeline(nullptr, info);
+            });
+        std::cout << "watching shaders in " << shaderDir << "\n";
     }
 
+    swapchain.setRenderPass(renderPass);
+
+    // The scene renders at a resolution that keeps GPU time within a frame
+    // at 60 Hz and is upscaled to the swapchain. The target has the
+    // swapchain's format, so the scene's pipelines, created for renderPass,
+    // are compatible with its render pass too.
+    auto dynamicResolution = rr::DynamicResolution{
+        device,
+        memoryAllocator,
+        bindlessHeap,
+        deletionQueue,
+        renderPass,
+        rr::shaders::fullscreen_vert,
+        rr::shaders::upscale_frag,
+        rr::DynamicResolutionOptions{
+            .targetMilliseconds = 1000.0 / 60.0 * 0.9,
+            .minScale = 0.5f,
+            .maxScale = 1.f,
+            .raiseThreshold = 0.85f,
+            .scaleStep = 0.05f,
+            .settleFrames = 8,
+            .format = selectedSurfaceFormat.format,
+            .filter = rr::UpscaleFilter::Sharpen,
+            .sharpness = 0.5f,
+        },
+    };
+
     auto commandPoolInfo = vk::CommandPoolCreateInfo{
         .pNext = nullptr,
         .flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
@@ -669,29 +829,257 @@ int main()
     };
     vk::raii::CommandPool commandPool = device.createCommandPool(commandPoolInfo);
 
+    // The CPU records one frame while the GPU works on the previous one.
+    // A frame context is reused once the timeline point of its last
+    // submission has passed.
+    constexpr uint32_t framesInFlight = 2;
+
     auto commandBufferInfo = vk::CommandBufferAllocateInfo{
         .pNext = nullptr,
         .commandPool = commandPool,
         .level = vk::CommandBufferLevel::ePrimary,
-        .commandBufferCount = 1,
+        .commandBufferCount = framesInFlight,
     };
     auto commandBuffers = device.allocateCommandBuffers(commandBufferInfo);
-    vk::CommandBuffer commandBuffer = commandBuffers.front();
 
     auto semaphoreInfo = vk::SemaphoreCreateInfo{
         .pNext = nullptr,
         .flags = vk::SemaphoreCreateFlags{},
     };
-    vk::raii::Semaphore imageAvailableSemaphore =
-        device.createSemaphore(semaphoreInfo);
-    vk::raii::Semaphore renderFinishedSemaphore =
-        device.createSemaphore(semaphoreInfo);
 
-    auto fenceInfo = vk::FenceCreateInfo{
-        .pNext = nullptr,
-        .flags = vk::FenceCreateFlagBits::eSignaled,
+    struct FrameContext {
+        vk::CommandBuffer commandBuffer;
+        vk::raii::Semaphore imageAvailable {nullptr};
+        rr::TimelinePoint done;
+        // Frames presented once this context's submission is done.
+        uint64_t presentedFrames = 0;
+    };
+    auto frameContexts = std::vector<FrameContext>(framesInFlight);
+    for (uint32_t i = 0; i < framesInFlight; i++) {
+        frameContexts[i].commandBuffer = commandBuffers[i];
+        frameContexts[i].imageAvailable = device.createSemaphore(semaphoreInfo);
+        frameContexts[i].done = rr::TimelinePoint{
+            .queue = graphicsQueueId,
+            .value = 0,
+        };
+    }
+    uint64_t frameNumber = 0;
+
+    // Present waits on a binary semaphore, one per swapchain image: an image
+    // is only acquired again after its previous present has consumed it.
+    auto renderFinishedSemaphores = std::vector<vk::raii::Semaphore>{};
+
+    auto profiler = rr::GpuProfiler{
+        selectedPhysicalDevice,
+        device,
+        selectedGraphicsQueueFamily,
+        framesInFlight};
+
+    auto asyncCompute = rr::AsyncCompute{
+        selectedPhysicalDevice,
+        device,
+        sync,
+        framesInFlight,
+        rr::AsyncComputeOptions{
+            .computeQueueFamily = selectedComputeQueueFamily,
+            .graphicsQueueFamily = selectedGraphicsQueueFamily,
+            .computeQueue = computeQueueId,
+            .graphicsQueue = graphicsQueueId,
+        },
     };
-    vk::raii::Fence inFlightFence = device.createFence(fenceInfo);
+    if (calibratedTimestamps) {
+        profiler.enableCalibration();
+        asyncCompute.profiler().enableCalibration();
+    }
+
+    // The overlay is drawn as quads in swapchain pixels after the upscale,
+    // blended over the scene.
+    auto overlayRenderer = std::optional<rr::BatchRenderer>{};
+    vk::raii::Pipeline overlayPipeline {nullptr};
+    rr::MaterialId overlayMaterial = 0;
+    if (overlay) {
+        auto createModule = [&device] (std::span<const uint32_t> code) {
+            return device.createShaderModule(vk::ShaderModuleCreateInfo{
+                .pNext = nullptr,
+                .flags = vk::ShaderModuleCreateFlags{},
+                .codeSize = code.size_bytes(),
+                .pCode = code.data(),
+            });
+        };
+        vk::raii::ShaderModule overlayVertexModule =
+            createModule(rr::shaders::batch_quad_vert);
+        vk::raii::ShaderModule overlayFragmentModule =
+            createModule(rr::shaders::batch_color_frag);
+        vk::PipelineShaderStageCreateInfo overlayStages[] {
+            vertShaderStageCreateInfo,
+            fragShaderStageCreateInfo,
+        };
+        overlayStages[0].module = *overlayVertexModule;
+        overlayStages[1].module = *overlayFragmentModule;
+
+        auto overlayVertexInput = rr::BatchRenderer::quadVertexInput();
+        auto overlayVertexInputState = overlayVertexInput.createInfo();
+        auto overlayRasterizationState = rasterizationState;
+        overlayRasterizationState.cullMode = vk::CullModeFlagBits::eNone;
+        auto overlayBlendAttachmentState = colorBlendAttachmentState;
+        overlayBlendAttachmentState.blendEnable = vk::True;
+        overlayBlendAttachmentState.srcColorBlendFactor =
+            vk::BlendFactor::eSrcAlpha;
+        overlayBlendAttachmentState.dstColorBlendFactor =
+            vk::BlendFactor::eOneMinusSrcAlpha;
+        auto overlayBlendState = colorBlendState;
+        overlayBlendState.pAttachments = &overlayBlendAttachmentState;
+
+        auto overlayPipelineInfo = pipelineInfo;
+        overlayPipelineInfo.pStages = overlayStages;
+        overlayPipelineInfo.pVertexInputState = &overlayVertexInputState;
+        overlayPipelineInfo.pRasterizationState = &overlayRasterizationState;
+        overlayPipelineInfo.pColorBlendState = &overlayBlendState;
+        overlayPipeline =
+            device.createGraphicsPipeline(nullptr, overlayPipelineInfo);
+
+        overlayRenderer.emplace(device, memoryAllocator, framesInFlight);
+        overlayMaterial = overlayRenderer->addMaterial(rr::BatchMaterial{
+            .pipeline = *overlayPipeline,
+            .layout = bindlessHeap.pipelineLayout(),
+            .descriptorSet = vk::DescriptorSet{},
+            .texture = rr::invalidBindlessHandle,
+            .sampler = 0,
+        });
+    }
+
+    // The triangle is drawn through the GPU culler, whose dispatch runs on
+    // the compute queue, so the scene pass waits for its draw commands.
+    auto culler = rr::GpuCuller{
+        selectedPhysicalDevice,
+        device,
+        memoryAllocator,
+        bindlessHeap,
+        rr::shaders::gpu_cull_comp,
+        framesInFlight,
+        rr::GpuCullerOptions{
+            .maxObjects = 1,
+            .drawIndirectCount = false,
+            .multiDrawIndirect = multiDrawIndirect,
+            .drawIndirectFirstInstance = true,
+        },
+    };
+    culler.add(rr::CullObject{
+        // The corners are at most sqrt(0.5) from the origin.
+        .center = {0.f, 0.f, 0.f},
+        .radius = 0.7072f,
+        .indexCount = 3,
+        .firstIndex = 0,
+        .vertexOffset = 0,
+        .firstInstance = 0,
+    });
+
+    // dummy.vert picks the corners by gl_VertexIndex.
+    constexpr auto triangleIndices = std::array<uint16_t, 3>{0, 1, 2};
+    auto indexBuffer = device.createBuffer(vk::BufferCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::BufferCreateFlags{},
+        .size = sizeof(triangleIndices),
+        .usage = vk::BufferUsageFlagBits::eIndexBuffer,
+        .sharingMode = vk::SharingMode::eExclusive,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = nullptr,
+    });
+    auto indexMemory = memoryAllocator.allocateForBuffer(
+        *indexBuffer, vk::MemoryPropertyFlagBits::eHostVisible);
+    std::memcpy(
+        indexMemory.mapped, triangleIndices.data(), sizeof(triangleIndices));
+    memoryAllocator.flush(indexMemory, 0, sizeof(triangleIndices));
+
+    // The swapchain image is swapped in every frame; it starts undefined
+    // after the acquire semaphore wait at color attachment output.
+    vk::Framebuffer framebuffer;
+    auto renderGraph = rr::RenderGraph{device, memoryAllocator};
+    auto backbuffer = renderGraph.importImage(
+        "backbuffer",
+        vk::Image{},
+        vk::ImageView{},
+        selectedSurfaceFormat.format,
+        rr::ResourceState{
+            .layout = vk::ImageLayout::eUndefined,
+            .stages = vk::PipelineStageFlagBits::eColorAttachmentOutput,
+            .access = vk::AccessFlags{},
+        });
+    // The scene pass synchronizes with the upscale through its render
+    // pass's dependencies, outside the graph. The triangle turns once every
+    // few seconds and keeps its shape at any aspect ratio.
+    auto startTime = std::chrono::steady_clock::now();
+    auto sceneTransform = rr::Mat4{};
+    renderGraph.addPass("scene", [&] (vk::CommandBuffer commandBuffer) {
+        dynamicResolution.beginScene(
+            commandBuffer,
+            vk::ClearColorValue{std::array{0.f, 0.f, 0.f, 1.f}});
+        bindlessHeap.bind(commandBuffer, vk::PipelineBindPoint::eGraphics);
+        commandBuffer.bindPipeline(
+            vk::PipelineBindPoint::eGraphics,
+            shaderReloader ?
+                shaderReloader->pipeline(reloadablePipeline) :
+                *graphicsPipeline);
+        commandBuffer.pushConstants(
+            bindlessHeap.pipelineLayout(),
+            vk::ShaderStageFlagBits::eAll,
+            0,
+            sizeof(sceneTransform),
+            &sceneTransform);
+        commandBuffer.bindIndexBuffer(*indexBuffer, 0, vk::IndexType::eUint16);
+        culler.draw(commandBuffer);
+        dynamicResolution.endScene(commandBuffer);
+    }).sideEffect();
+    renderGraph.addPass("main pass", [&] (vk::CommandBuffer commandBuffer) {
+        auto clearColor = vk::ClearValue{
+            .color = vk::ClearColorValue{std::array{0.f, 0.f, 0.f, 1.f}}
+        };
+        auto renderPassBeginInfo = vk::RenderPassBeginInfo{
+            .pNext = nullptr,
+            .renderPass = renderPass,
+            .framebuffer = framebuffer,
+            .renderArea = vk::Rect2D{
+                .offset = vk::Offset2D{.x = 0, .y = 0},
+                .extent = swapchainExtent,
+            },
+            .clearValueCount = 1,
+            .pClearValues = &clearColor,
+        };
+        commandBuffer.beginRenderPass(
+            renderPassBeginInfo, vk::SubpassContents::eInline);
+        dynamicResolution.upscale(commandBuffer);
+        if (overlayRenderer) {
+            commandBuffer.setViewport(0, vk::Viewport{
+                .x = 0.f,
+                .y = 0.f,
+                .width = (float)swapchainExtent.width,
+                .height = (float)swapchainExtent.height,
+                .minDepth = 0.f,
+                .maxDepth = 1.f,
+            });
+            commandBuffer.setScissor(0, vk::Rect2D{
+                .offset = vk::Offset2D{.x = 0, .y = 0},
+                .extent = swapchainExtent,
+            });
+            // Maps pixel coordinates to clip space for batch_quad.vert.
+            float scaleOffset[] {
+                2.f / (float)swapchainExtent.width,
+                2.f / (float)swapchainExtent.height,
+                -1.f,
+                -1.f,
+            };
+            commandBuffer.pushConstants(
+                bindlessHeap.pipelineLayout(),
+                vk::ShaderStageFlagBits::eAll,
+                0,
+                sizeof(scaleOffset),
+                scaleOffset);
+            overlayRenderer->record(commandBuffer);
+        }
+        commandBuffer.endRenderPass();
+    }).write(backbuffer, rr::ResourceUsage::ColorAttachment);
+    renderGraph.markOutput(backbuffer, rr::ResourceUsage::Present);
+    renderGraph.compile();
 
     for (;;) {
         bool done = false;
@@ -705,12 +1093,63 @@ int main()
             break;
         }
 
-        (void)device.waitForFences(*inFlightFence, vk::True, UINT64_MAX);
-        (void)device.resetFences(*inFlightFence);
+        // Keep at most one presented frame queued ahead of the display.
+        swapchain.waitForPresentQueue(1);
+
+        uint32_t frameIndex = (uint32_t)(frameNumber % framesInFlight);
+        FrameContext& frame = frameContexts[frameIndex];
+        sync.wait(frame.done);
+
+        uint64_t completedFrames = 0;
+        for (const auto& context : frameContexts) {
+            if (sync.completed(context.done)) {
+                completedFrames =
+                    std::max(completedFrames, context.presentedFrames);
+            }
+        }
+        swapchain.collect(completedFrames);
+        uploadService.collect();
+        bindlessHeap.collect(completedFrames);
+        deletionQueue.collect(completedFrames);
+        memoryBudget.update();
+
+        // Frames are numbered by presents, like completedFrames.
+        if (shaderReloader) {
+            uint32_t swapped = shaderReloader->beginFrame(
+                swapchain.presentedFrames(), completedFrames);
+            if (swapped > 0) {
+                std::cout << "reloaded " << swapped << " pipelines\n";
+            }
+            auto reloadStats = shaderReloader->stats();
+            if (reloadStats.failures != reportedReloadFailures) {
+                reportedReloadFailures = reloadStats.failures;
+                std::cout << "shader reload failed: " <<
+                    shaderReloader->lastError() << "\n";
+            }
+        }
 
-        auto [acquireImageResult, imageIndex] = swapchain.acquireNextImage(
-            UINT64_MAX, imageAvailableSemaphore, VK_NULL_HANDLE);
+        auto [width, height] = window->size();
+        swapchain.resize(vk::Extent2D{
+            .width = (uint32_t)width,
+            .height = (uint32_t)height,
+        });
 
+        auto swapchainImage = swapchain.acquire(frame.imageAvailable);
+        if (!swapchainImage) {
+            continue;
+        }
+        uint32_t imageIndex = swapchainImage->index;
+        swapchainExtent = swapchainImage->extent;
+        dynamicResolution.beginFrame(
+            swapchain.presentedFrames(), swapchainExtent, profiler);
+
+        while (renderFinishedSemaphores.size() <= imageIndex) {
+            renderFinishedSemaphores.push_back(
+                device.createSemaphore(semaphoreInfo));
+        }
+        vk::Semaphore renderFinished = renderFinishedSemaphores[imageIndex];
+
+        vk::CommandBuffer commandBuffer = frame.commandBuffer;
         commandBuffer.reset();
 
         auto beginInfo = vk::CommandBufferBeginInfo{
@@ -720,77 +1159,127 @@ int main()
         };
         commandBuffer.begin(beginInfo);
 
-        vk::Framebuffer framebuffer = swapchainFramebuffers.at(imageIndex);
-
-        auto clearColor = vk::ClearValue{
-            .color = vk::ClearColorValue{std::array{0.f, 0.f, 0.f, 1.f}}
-        };
-        auto renderPassBeginInfo = vk::RenderPassBeginInfo{
-            .pNext = nullptr,
-            .renderPass = renderPass,
-            .framebuffer = framebuffer,
-            .renderArea = vk::Rect2D{
-                .offset = vk::Offset2D{.x = 0, .y = 0},
-                .extent = swapchainExtent,
-            },
-            .clearValueCount = 1,
-            .pClearValues = &clearColor,
-        };
-        commandBuffer.beginRenderPass(
-            renderPassBeginInfo, vk::SubpassContents::eInline);
-
-        commandBuffer.bindPipeline(
-            vk::PipelineBindPoint::eGraphics, graphicsPipeline);
-
-        auto vp = vk::Viewport{
-            .x = 0.f,
-            .y = 0.f,
-            .width = (float)swapchainExtent.width,
-            .height = (float)swapchainExtent.height,
-            .minDepth = 0.f,
-            .maxDepth = 1.f,
-        };
-        commandBuffer.setViewport(0, vp);
-
-        auto sc = vk::Rect2D{
-            .offset = {0, 0},
-            .extent = swapchainExtent,
-        };
-        commandBuffer.setScissor(0, sc);
+        profiler.beginFrame(frameIndex, commandBuffer);
+        uint32_t frameScope = profiler.beginScope(commandBuffer, "frame");
+        if (overlayRenderer) {
+            overlayRenderer->beginFrame(frameIndex);
+            profiler.drawOverlay(
+                *overlayRenderer, overlayMaterial, 10.f, 10.f, 400.f, 120.f);
+        }
 
-        commandBuffer.draw(3, 1, 0, 0);
+        auto uploads = uploadService.flush();
+        if (uploads) {
+            uploads->recordAcquire(commandBuffer);
+        }
 
-        commandBuffer.endRenderPass();
+        auto seconds = std::chrono::duration<float>(
+            std::chrono::steady_clock::now() - startTime).count();
+        vk::Extent2D extent = dynamicResolution.renderExtent();
+        float aspect = (float)extent.width / (float)std::max(extent.height, 1u);
+        sceneTransform =
+            rr::scaling(rr::Vec3{
+                std::min(1.f / aspect, 1.f), std::min(aspect, 1.f), 1.f}) *
+            rr::rotation(rr::axisAngle(rr::Vec3{0.f, 0.f, 1.f}, seconds));
+
+        // The triangle is culled on the compute queue ahead of the graphics
+        // submission, which waits for the draw commands at the indirect
+        // draw stage and acquires them before the scene pass reads them.
+        vk::CommandBuffer computeCommandBuffer =
+            asyncCompute.beginFrame(frameIndex);
+        culler.beginFrame(frameIndex);
+        culler.cull(computeCommandBuffer, sceneTransform.m);
+        asyncCompute.releaseBuffer(
+            culler.drawBuffer(),
+            vk::AccessFlagBits::eShaderWrite,
+            vk::AccessFlagBits::eIndirectCommandRead,
+            vk::PipelineStageFlagBits::eDrawIndirect);
+        asyncCompute.submit();
+        asyncCompute.recordAcquire(commandBuffer);
+
+        framebuffer = swapchainImage->framebuffer;
+        renderGraph.setImportedImage(
+            backbuffer, swapchainImage->image, swapchainImage->view);
+        renderGraph.execute(commandBuffer, &profiler);
+
+        profiler.endScope(commandBuffer, frameScope);
         commandBuffer.end();
 
-        vk::PipelineStageFlags waitStages[] {
-            vk::PipelineStageFlagBits::eColorAttachmentOutput,
-        };
-        auto submitInfo = vk::SubmitInfo{
-            .pNext = nullptr,
-            .waitSemaphoreCount = 1,
-            .pWaitSemaphores = &*imageAvailableSemaphore,
-            .pWaitDstStageMask = waitStages,
-            .commandBufferCount = 1,
-            .pCommandBuffers = &commandBuffer,
-            .signalSemaphoreCount = 1,
-            .pSignalSemaphores = &*renderFinishedSemaphore,
+        auto waits = std::vector<rr::TimelineWait>{};
+        if (uploads) {
+            waits.push_back(uploads->wait());
+        }
+        waits.push_back(asyncCompute.wait());
+        auto imageWait = rr::BinarySemaphoreWait{
+            .semaphore = frame.imageAvailable,
+            .stages = vk::PipelineStageFlagBits::eColorAttachmentOutput,
         };
-        graphicsQueue.submit(submitInfo, inFlightFence);
+        frame.done = sync.submit(graphicsQueueId, rr::TimelineSubmitInfo{
+            .commandBuffers = std::span{&commandBuffer, 1},
+            .waits = waits,
+            .binaryWaits = std::span{&imageWait, 1},
+            .binarySignals = std::span{&renderFinished, 1},
+        });
 
-        auto presentInfo = vk::PresentInfoKHR{
-            .pNext = nullptr,
-            .waitSemaphoreCount = 1,
-            .pWaitSemaphores = &*renderFinishedSemaphore,
-            .swapchainCount = 1,
-            .pSwapchains = &*swapchain,
-            .pImageIndices = &imageIndex,
-            .pResults = nullptr,
-        };
-        (void)presentQueue.presentKHR(presentInfo);
+        swapchain.present(presentQueue, renderFinished, imageIndex);
+        frame.presentedFrames = swapchain.presentedFrames();
+        frameNumber++;
 
         //std::this_thread::sleep_for(1.0s / 30);
     }
 
     device.waitIdle();
+    indexBuffer.clear();
+    memoryAllocator.free(indexMemory);
+
+    pipelineCache.save();
+    auto pipelineCacheStats = pipelineCache.stats();
+    std::cout << "pipeline cache: " <<
+        pipelineCacheStats.pipelines << " pipelines, " <<
+        pipelineCacheStats.hits << " hits, " <<
+        pipelineCacheStats.misses << " misses, " <<
+        pipelineCacheStats.untracked << " untracked, " <<
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            pipelineCacheStats.creationTime).count() << " us creating, " <<
+        pipelineCacheStats.loadedBytes << " bytes loaded, " <<
+        pipelineCacheStats.savedBytes << " bytes saved\n";
+
+    auto presentStats = swapchain.presentStats();
+    std::cout << "present intervals" <<
+        (presentStats.measuredAtDisplay ? " (display)" : " (cpu)") << ": " <<
+        presentStats.averageIntervalMilliseconds << " ms average, " <<
+        presentStats.minIntervalMilliseconds << " ms min, " <<
+        presentStats.maxIntervalMilliseconds << " ms max\n";
+
+    if (auto frame = profiler.latestFrame()) {
+        std::cout << "last profiled frame: " <<
+            frame->gpuMilliseconds << " ms GPU, " <<
+            frame->cpuMilliseconds << " ms CPU\n";
+    }
+    std::cout << "async compute: " <<
+        (asyncCompute.dedicated() ? "own queue" : "graphics queue");
+    if (calibratedTimestamps) {
+        std::cout << ", " << asyncCompute.overlapMilliseconds(profiler) <<
+            " ms overlap with graphics";
+    }
+    std::cout << "\n";
+    auto resolutionStats = dynamicResolution.stats();
+    std::cout << "dynamic resolution: " << resolutionStats.scale * 100.f <<
+        "% (" << resolutionStats.renderExtent.width << "x" <<
+        resolutionStats.renderExtent.height << "), " <<
+        resolutionStats.scaleChanges << " changes, " <<
+        resolutionStats.averageGpuMilliseconds << " ms GPU average\n";
+    auto budgetStats = memoryBudget.stats();
+    std::cout << "memory budget" << (budgetStats.memoryBudgetExtension ?
+        " (VK_EXT_memory_budget)" : " (estimated)") << ":\n";
+    for (size_t i = 0; i < budgetStats.heaps.size(); i++) {
+        const rr::MemoryHeapUsage& heap = budgetStats.heaps[i];
+        std::cout << "  * heap " << i <<
+            (heap.deviceLocal ? " (device local): " : ": ") <<
+            heap.usage / (1024 * 1024) << " of " <<
+            heap.budget / (1024 * 1024) << " MiB\n";
+    }
+    if (const char* path = std::getenv("RR_PROFILE_JSON")) {
+        auto out = std::ofstream{path};
+        profiler.writeJson(out);
+    }
 }
@@ -0,0 +1,249 @@
+#include <async_compute.hpp>
+
+#include <error.hpp>
+
+namespace rr {
+
+std::optional<uint32_t> findComputeQueueFamily(
+    const vk::raii::PhysicalDevice& physicalDevice)
+{
+    auto queueFamilyProperties = physicalDevice.getQueueFamilyProperties();
+    for (uint32_t i = 0; i < queueFamilyProperties.size(); i++) {
+        vk::QueueFlags flags = queueFamilyProperties[i].queueFlags;
+        if ((flags & vk::QueueFlagBits::eCompute) &&
+                !(flags & vk::QueueFlagBits::eGraphics)) {
+            return i;
+        }
+    }
+    return std::nullopt;
+}
+
+AsyncCompute::AsyncCompute(
+    const vk::raii::PhysicalDevice& physicalDevice,
+    const vk::raii::Device& device,
+    TimelineSync& sync,
+    uint32_t frameContextCount,
+    AsyncComputeOptions options)
+    : _sync(&sync)
+    , _options(options)
+    , _separateFamily(options.computeQueueFamily != options.graphicsQueueFamily)
+    , _frames(frameContextCount)
+    , _profiler(
+        physicalDevice,
+        device,
+        options.computeQueueFamily,
+        frameContextCount)
+{
+    if (!_sync->queue(_options.computeQueue)) {
+        throw Error{} << "async compute needs a compute queue";
+    }
+
+    for (auto& frame : _frames) {
+        frame.commandPool = device.createCommandPool(vk::CommandPoolCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::CommandPoolCreateFlagBits::eTransient,
+            .queueFamilyIndex = _options.computeQueueFamily,
+        });
+        auto commandBuffers = device.allocateCommandBuffers(
+            vk::CommandBufferAllocateInfo{
+                .pNext = nullptr,
+                .commandPool = *frame.commandPool,
+                .level = vk::CommandBufferLevel::ePrimary,
+                .commandBufferCount = 1,
+            });
+        // Freed with the pool.
+        frame.commandBuffer = commandBuffers.front().release();
+        frame.point = TimelinePoint{.queue = _options.computeQueue, .value = 0};
+    }
+}
+
+vk::CommandBuffer AsyncCompute::beginFrame(uint32_t frameContext)
+{
+    _current = &_frames.at(frameContext % _frames.size());
+    _sync->wait(_current->point);
+    _current->commandPool.reset();
+
+    _current->commandBuffer.begin(vk::CommandBufferBeginInfo{
+        .pNext = nullptr,
+        .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+        .pInheritanceInfo = nullptr,
+    });
+    _profiler.beginFrame(frameContext, _current->commandBuffer);
+    _frameScope = _profiler.beginScope(
+        _current->commandBuffer, "async compute");
+
+    _waitStages = vk::PipelineStageFlags{};
+    _acquireBuffers.clear();
+    _acquireImages.clear();
+    return _current->commandBuffer;
+}
+
+void AsyncCompute::releaseBuffer(
+    vk::Buffer buffer,
+    vk::AccessFlags srcAccess,
+    vk::AccessFlags dstAccess,
+    vk::PipelineStageFlags dstStage)
+{
+    _waitStages |= dstStage;
+
+    // On a shared family the timeline wait alone makes the writes visible.
+    if (!_separateFamily) {
+        return;
+    }
+
+    auto barrier = vk::BufferMemoryBarrier{
+        .pNext = nullptr,
+        .srcAccessMask = srcAccess,
+        .dstAccessMask = vk::AccessFlags{},
+        .srcQueueFamilyIndex = _options.computeQueueFamily,
+        .dstQueueFamilyIndex = _options.graphicsQueueFamily,
+        .buffer = buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE,
+    };
+    _current->commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eBottomOfPipe,
+        vk::DependencyFlags{},
+        {},
+        barrier,
+        {});
+
+    barrier.srcAccessMask = vk::AccessFlags{};
+    barrier.dstAccessMask = dstAccess;
+    _acquireBuffers.push_back(barrier);
+}
+
+void AsyncCompute::releaseImage(
+    vk::Image image,
+    const vk::ImageSubresourceRange& range,
+    vk::ImageLayout oldLayout,
+    vk::ImageLayout newLayout,
+    vk::AccessFlags srcAccess,
+    vk::AccessFlags dstAccess,
+    vk::PipelineStageFlags dstStage)
+{
+    _waitStages |= dstStage;
+
+    auto barrier = vk::ImageMemoryBarrier{
+        .pNext = nullptr,
+        .srcAccessMask = vk::AccessFlags{},
+        .dstAccessMask = dstAccess,
+        .oldLayout = oldLayout,
+        .newLayout = newLayout,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .image = image,
+        .subresourceRange = range,
+    };
+
+    // On a shared family only the layout transition is left, and it runs on
+    // the graphics queue after the timeline wait.
+    if (!_separateFamily) {
+        if (oldLayout != newLayout) {
+            _acquireImages.push_back(barrier);
+        }
+        return;
+    }
+
+    barrier.srcQueueFamilyIndex = _options.computeQueueFamily;
+    barrier.dstQueueFamilyIndex = _options.graphicsQueueFamily;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = vk::AccessFlags{};
+    _current->commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eBottomOfPipe,
+        vk::DependencyFlags{},
+        {},
+        {},
+        barrier);
+
+    barrier.srcAccessMask = vk::AccessFlags{};
+    barrier.dstAccessMask = dstAccess;
+    _acquireImages.push_back(barrier);
+}
+
+TimelinePoint AsyncCompute::submit(std::span<const TimelineWait> waits)
+{
+    if (!_current) {
+        throw Error{} << "async compute submit without beginFrame";
+    }
+
+    _profiler.endScope(_current->commandBuffer, _frameScope);
+    _current->commandBuffer.end();
+
+    _current->point = _sync->submit(_options.computeQueue, TimelineSubmitInfo{
+        .commandBuffers = std::span{&_current->commandBuffer, 1},
+        .waits = waits,
+        .binaryWaits = {},
+        .binarySignals = {},
+    });
+    _point = _current->point;
+    _current = nullptr;
+    return _point;
+}
+
+TimelineWait AsyncCompute::wait() const
+{
+    // Without released resources graphics does not depend on this frame's
+    // compute work, and value zero is a wait that is dropped.
+    if (!_waitStages) {
+        return TimelineWait{
+            .point = TimelinePoint{.queue = _point.queue, .value = 0},
+            .stages = vk::PipelineStageFlagBits::eTopOfPipe,
+        };
+    }
+    return TimelineWait{.point = _point, .stages = _waitStages};
+}
+
+void AsyncCompute::recordAcquire(vk::CommandBuffer commandBuffer) const
+{
+    if (_acquireBuffers.empty() && _acquireImages.empty()) {
+        return;
+    }
+
+    // The source stages match the timeline wait, which chains the acquire
+    // after the release on the compute queue.
+    commandBuffer.pipelineBarrier(
+        _waitStages,
+        _waitStages,
+        vk::DependencyFlags{},
+        {},
+        _acquireBuffers,
+        _acquireImages);
+}
+
+bool AsyncCompute::dedicated() const
+{
+    return _options.computeQueue != _options.graphicsQueue;
+}
+
+uint32_t AsyncCompute::queueFamily() const
+{
+    return _options.computeQueueFamily;
+}
+
+GpuProfiler& AsyncCompute::profiler()
+{
+    return _profiler;
+}
+
+double AsyncCompute::overlapMilliseconds(
+    const GpuProfiler& graphicsProfiler) const
+{
+    const auto& compute = _profiler.history();
+    const auto& graphics = graphicsProfiler.history();
+    for (auto c = compute.rbegin(); c != compute.rend(); c++) {
+        for (auto g = graphics.rbegin(); g != graphics.rend(); g++) {
+            if (g->frame == c->frame) {
+                return gpuOverlapMilliseconds(*c, *g);
+            }
+            if (g->frame < c->frame) {
+                break;
+            }
+        }
+    }
+    return 0.0;
+}
+
+} // namespace rr
@@ -0,0 +1,527 @@
+#include <batch_renderer.hpp>
+
+#include <error.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <tuple>
+
+namespace rr {
+
+namespace {
+
+constexpr vk::DeviceSize minInstanceBufferSize = 1024 * 1024;
+constexpr vk::DeviceSize batchAlignment = 16;
+// Smallest chunk worth taking from what is left of a buffer.
+constexpr uint32_t minChunkInstances = 64;
+
+vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+uint64_t batchKey(MaterialId material, MeshId mesh)
+{
+    return (uint64_t)material << 32 | mesh;
+}
+
+} // namespace
+
+vk::PipelineVertexInputStateCreateInfo BatchVertexInput::createInfo() const
+{
+    return vk::PipelineVertexInputStateCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineVertexInputStateCreateFlags{},
+        .vertexBindingDescriptionCount = (uint32_t)bindings.size(),
+        .pVertexBindingDescriptions = bindings.data(),
+        .vertexAttributeDescriptionCount = (uint32_t)attributes.size(),
+        .pVertexAttributeDescriptions = attributes.data(),
+    };
+}
+
+BatchRenderer::BatchRenderer(
+    const vk::raii::Device& device,
+    MemoryAllocator& allocator,
+    uint32_t frameContextCount)
+    : _device(&device)
+    , _allocator(&allocator)
+    , _frames(frameContextCount)
+{
+    if (frameContextCount == 0) {
+        throw Error{} << "batch renderer needs at least one frame context";
+    }
+
+    // Six vertices, two triangles, generated by the vertex shader.
+    _meshes.push_back(BatchMesh{
+        .vertexBuffer = {},
+        .vertexOffset = 0,
+        .indexBuffer = {},
+        .indexOffset = 0,
+        .indexType = vk::IndexType::eUint16,
+        .count = 6,
+    });
+}
+
+BatchRenderer::~BatchRenderer()
+{
+    for (auto& frame : _frames) {
+        for (Buffer& buffer : frame.buffers) {
+            freeBuffer(buffer);
+        }
+    }
+}
+
+BatchVertexInput BatchRenderer::quadVertexInput()
+{
+    return BatchVertexInput{
+        .bindings = {
+            vk::VertexInputBindingDescription{
+                .binding = 0,
+                .stride = sizeof(QuadInstance),
+                .inputRate = vk::VertexInputRate::eInstance,
+            },
+        },
+        .attributes = {
+            vk::VertexInputAttributeDescription{
+                .location = 0,
+                .binding = 0,
+                .format = vk::Format::eR32G32B32A32Sfloat,
+                .offset = offsetof(QuadInstance, position),
+            },
+            vk::VertexInputAttributeDescription{
+                .location = 1,
+                .binding = 0,
+                .format = vk::Format::eR32Sfloat,
+                .offset = offsetof(QuadInstance, rotation),
+            },
+            vk::VertexInputAttributeDescription{
+                .location = 2,
+                .binding = 0,
+                .format = vk::Format::eR8G8B8A8Unorm,
+                .offset = offsetof(QuadInstance, color),
+            },
+            vk::VertexInputAttributeDescription{
+                .location = 3,
+                .binding = 0,
+                .format = vk::Format::eR32G32B32A32Sfloat,
+                .offset = offsetof(QuadInstance, uvMin),
+            },
+        },
+    };
+}
+
+BatchVertexInput BatchRenderer::meshVertexInput()
+{
+    auto input = BatchVertexInput{
+        .bindings = {
+            vk::VertexInputBindingDescription{
+                .binding = 0,
+                .stride = sizeof(MeshVertex),
+                .inputRate = vk::VertexInputRate::eVertex,
+            },
+            vk::VertexInputBindingDescription{
+                .binding = 1,
+                .stride = sizeof(MeshInstance),
+                .inputRate = vk::VertexInputRate::eInstance,
+            },
+        },
+        .attributes = {
+            vk::VertexInputAttributeDescription{
+                .location = 0,
+                .binding = 0,
+                .format = vk::Format::eR32G32B32Sfloat,
+                .offset = offsetof(MeshVertex, position),
+            },
+            vk::VertexInputAttributeDescription{
+                .location = 1,
+                .binding = 0,
+                .format = vk::Format::eR32G32B32Sfloat,
+                .offset = offsetof(MeshVertex, normal),
+            },
+            vk::VertexInputAttributeDescription{
+                .location = 2,
+                .binding = 0,
+                .format = vk::Format::eR32G32Sfloat,
+                .offset = offsetof(MeshVertex, uv),
+            },
+        },
+    };
+
+    for (uint32_t row = 0; row < 3; row++) {
+        input.attributes.push_back(vk::VertexInputAttributeDescription{
+            .location = 3 + row,
+            .binding = 1,
+            .format = vk::Format::eR32G32B32A32Sfloat,
+            .offset = (uint32_t)(
+                offsetof(MeshInstance, transform) + row * 4 * sizeof(float)),
+        });
+    }
+    input.attributes.push_back(vk::VertexInputAttributeDescription{
+        .location = 6,
+        .binding = 1,
+        .format = vk::Format::eR8G8B8A8Unorm,
+        .offset = offsetof(MeshInstance, color),
+    });
+    return input;
+}
+
+MaterialId BatchRenderer::addMaterial(const BatchMaterial& material)
+{
+    _materials.push_back(material);
+    return (MaterialId)(_materials.size() - 1);
+}
+
+MeshId BatchRenderer::addMesh(const BatchMesh& mesh)
+{
+    if (!mesh.vertexBuffer) {
+        throw Error{} << "batch mesh has no vertex buffer";
+    }
+    _meshes.push_back(mesh);
+    return (MeshId)(_meshes.size() - 1);
+}
+
+void BatchRenderer::beginFrame(uint32_t frameContext)
+{
+    _frameContext = frameContext % (uint32_t)_frames.size();
+    FrameContext& frame = _frames[_frameContext];
+
+    // The GPU is done with the context's buffers, so a frame that needed
+    // several can have them replaced by one.
+    if (frame.buffers.size() > 1) {
+        vk::DeviceSize capacity = 0;
+        for (Buffer& buffer : frame.buffers) {
+            capacity += buffer.capacity;
+            freeBuffer(buffer);
+        }
+        frame.buffers.clear();
+        frame.buffers.push_back(createBuffer(std::bit_ceil(capacity)));
+    }
+    for (Buffer& buffer : frame.buffers) {
+        buffer.used = 0;
+    }
+    frame.current = 0;
+
+    for (uint32_t index : _activeBatches) {
+        Batch& batch = _batches[index];
+        batch.previousCount = batch.instanceCount;
+        batch.instanceCount = 0;
+        batch.chunks.clear();
+    }
+    _activeBatches.clear();
+    _lastKey = UINT64_MAX;
+}
+
+void BatchRenderer::drawQuad(MaterialId material, const QuadInstance& instance)
+{
+    Batch& batch = batchFor(material, quadMesh, sizeof(QuadInstance));
+    std::memcpy(allocateInstance(batch), &instance, sizeof(QuadInstance));
+}
+
+void BatchRenderer::drawMesh(
+    MaterialId material, MeshId mesh, const MeshInstance& instance)
+{
+    if (mesh == quadMesh || mesh >= _meshes.size()) {
+        throw Error{} << "invalid batch mesh: " << mesh;
+    }
+
+    Batch& batch = batchFor(material, mesh, sizeof(MeshInstance));
+    std::memcpy(allocateInstance(batch), &instance, sizeof(MeshInstance));
+}
+
+void BatchRenderer::record(vk::CommandBuffer commandBuffer)
+{
+    prepareRecord();
+
+    const FrameContext& frame = _frames[_frameContext];
+    const BatchMaterial* bound = nullptr;
+    for (uint32_t index : _activeBatches) {
+        const Batch& batch = _batches[index];
+        const BatchMaterial& material = _materials[batch.material];
+
+        bindMaterial(commandBuffer, material, bound);
+        bound = &material;
+
+        // Chunks taken one after the other from the same buffer are drawn
+        // together; all but the last chunk of a batch are full.
+        for (size_t i = 0; i < batch.chunks.size(); ) {
+            const Chunk& first = batch.chunks[i];
+            uint32_t instanceCount = first.instanceCount;
+            for (i++; i < batch.chunks.size(); i++) {
+                const Chunk& next = batch.chunks[i];
+                if (next.buffer != first.buffer || next.offset != first.offset +
+                        (vk::DeviceSize)instanceCount * batch.instanceSize) {
+                    break;
+                }
+                instanceCount += next.instanceCount;
+            }
+            bindMesh(
+                commandBuffer,
+                batch,
+                *frame.buffers[first.buffer].buffer,
+                first.offset);
+            drawBatch(commandBuffer, batch, instanceCount);
+        }
+    }
+}
+
+void BatchRenderer::recordNaive(vk::CommandBuffer commandBuffer)
+{
+    prepareRecord();
+
+    const FrameContext& frame = _frames[_frameContext];
+    for (uint32_t index : _activeBatches) {
+        const Batch& batch = _batches[index];
+        const BatchMaterial& material = _materials[batch.material];
+
+        for (const Chunk& chunk : batch.chunks) {
+            for (uint32_t i = 0; i < chunk.instanceCount; i++) {
+                bindMaterial(commandBuffer, material, nullptr);
+                bindMesh(
+                    commandBuffer,
+                    batch,
+                    *frame.buffers[chunk.buffer].buffer,
+                    chunk.offset + (vk::DeviceSize)i * batch.instanceSize);
+                drawBatch(commandBuffer, batch, 1);
+            }
+        }
+    }
+}
+
+BatchStats BatchRenderer::stats() const
+{
+    return _stats;
+}
+
+BatchRenderer::Batch& BatchRenderer::batchFor(
+    MaterialId material, MeshId mesh, uint32_t instanceSize)
+{
+    // Consecutive draws mostly hit the same batch; skip the hash lookup.
+    uint64_t key = batchKey(material, mesh);
+    if (key == _lastKey) {
+        return _batches[_lastBatch];
+    }
+
+    if (material >= _materials.size()) {
+        throw Error{} << "invalid batch material: " << material;
+    }
+
+    auto [it, inserted] =
+        _batchIndex.try_emplace(key, (uint32_t)_batches.size());
+    if (inserted) {
+        _batches.push_back(Batch{
+            .material = material,
+            .mesh = mesh,
+            .instanceSize = instanceSize,
+            .instanceCount = 0,
+            .previousCount = 0,
+            .chunks = {},
+        });
+    }
+
+    uint32_t index = it->second;
+    if (_batches[index].instanceCount == 0) {
+        _activeBatches.push_back(index);
+    }
+    _lastKey = key;
+    _lastBatch = index;
+    return _batches[index];
+}
+
+std::byte* BatchRenderer::allocateInstance(Batch& batch)
+{
+    if (batch.chunks.empty() ||
+            batch.chunks.back().instanceCount == batch.chunks.back().capacity) {
+        addChunk(batch);
+    }
+    Chunk& chunk = batch.chunks.back();
+    std::byte* data =
+        chunk.data + (size_t)chunk.instanceCount * batch.instanceSize;
+    chunk.instanceCount++;
+    batch.instanceCount++;
+    return data;
+}
+
+void BatchRenderer::addChunk(Batch& batch)
+{
+    // As many instances as the batch had last time, then doubling.
+    uint32_t wanted = std::max(
+        {batch.previousCount, batch.instanceCount, minChunkInstances});
+
+    FrameContext& frame = _frames[_frameContext];
+    uint32_t capacity = 0;
+    vk::DeviceSize offset = 0;
+    while (frame.current < frame.buffers.size()) {
+        const Buffer& buffer = frame.buffers[frame.current];
+        offset = alignUp(buffer.used, batchAlignment);
+        vk::DeviceSize available = offset < buffer.capacity ?
+            (buffer.capacity - offset) / batch.instanceSize : 0;
+        capacity = (uint32_t)std::min<vk::DeviceSize>(wanted, available);
+        if (capacity >= std::min(wanted, minChunkInstances)) {
+            break;
+        }
+        frame.current++;
+    }
+    if (frame.current == frame.buffers.size()) {
+        vk::DeviceSize bytes = (vk::DeviceSize)wanted * batch.instanceSize;
+        frame.buffers.push_back(createBuffer(
+            std::max(std::bit_ceil(bytes), minInstanceBufferSize)));
+        offset = 0;
+        capacity = wanted;
+    }
+
+    Buffer& buffer = frame.buffers[frame.current];
+    buffer.used = offset + (vk::DeviceSize)capacity * batch.instanceSize;
+    batch.chunks.push_back(Chunk{
+        .buffer = frame.current,
+        .offset = offset,
+        .data = (std::byte*)buffer.memory.mapped + offset,
+        .instanceCount = 0,
+        .capacity = capacity,
+    });
+}
+
+BatchRenderer::Buffer BatchRenderer::createBuffer(
+    vk::DeviceSize capacity) const
+{
+    auto buffer = Buffer{};
+    buffer.buffer = _device->createBuffer(vk::BufferCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::BufferCreateFlags{},
+        .size = capacity,
+        .usage = vk::BufferUsageFlagBits::eVertexBuffer,
+        .sharingMode = vk::SharingMode::eExclusive,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = nullptr,
+    });
+    buffer.memory = _allocator->allocateForBuffer(
+        *buffer.buffer,
+        vk::MemoryPropertyFlagBits::eHostVisible,
+        vk::MemoryPropertyFlagBits::eDeviceLocal |
+            vk::MemoryPropertyFlagBits::eHostCoherent);
+    buffer.capacity = capacity;
+    return buffer;
+}
+
+void BatchRenderer::freeBuffer(Buffer& buffer) const
+{
+    buffer.buffer.clear();
+    if (buffer.memory) {
+        _allocator->free(buffer.memory);
+    }
+}
+
+void BatchRenderer::prepareRecord()
+{
+    // Sorting by pipeline first, then descriptor set, keeps state changes to
+    // one per distinct pipeline and texture.
+    std::ranges::sort(_activeBatches, [this] (uint32_t a, uint32_t b) {
+        const Batch& batchA = _batches[a];
+        const Batch& batchB = _batches[b];
+        const BatchMaterial& materialA = _materials[batchA.material];
+        const BatchMaterial& materialB = _materials[batchB.material];
+        return std::tuple{
+                (uint64_t)(VkPipeline)materialA.pipeline,
+                (uint64_t)(VkDescriptorSet)materialA.descriptorSet,
+                materialA.texture,
+                batchA.mesh} <
+            std::tuple{
+                (uint64_t)(VkPipeline)materialB.pipeline,
+                (uint64_t)(VkDescriptorSet)materialB.descriptorSet,
+                materialB.texture,
+                batchB.mesh};
+    });
+
+    // The instances are already in place; non-coherent memory only needs
+    // the written ranges flushed.
+    const FrameContext& frame = _frames[_frameContext];
+    for (const Buffer& buffer : frame.buffers) {
+        if (buffer.used > 0) {
+            _allocator->flush(buffer.memory, 0, buffer.used);
+        }
+    }
+
+    _stats = BatchStats{};
+    for (uint32_t index : _activeBatches) {
+        const Batch& batch = _batches[index];
+        _stats.instanceBytes +=
+            (vk::DeviceSize)batch.instanceCount * batch.instanceSize;
+    }
+}
+
+void BatchRenderer::bindMaterial(
+    vk::CommandBuffer commandBuffer,
+    const BatchMaterial& material,
+    const BatchMaterial* bound)
+{
+    if (!bound || bound->pipeline != material.pipeline) {
+        commandBuffer.bindPipeline(
+            vk::PipelineBindPoint::eGraphics, material.pipeline);
+        _stats.pipelineBinds++;
+    }
+
+    if (material.descriptorSet && (!bound ||
+            bound->pipeline != material.pipeline ||
+            bound->descriptorSet != material.descriptorSet)) {
+        commandBuffer.bindDescriptorSets(
+            vk::PipelineBindPoint::eGraphics,
+            material.layout,
+            0,
+            material.descriptorSet,
+            {});
+        _stats.descriptorSetBinds++;
+    }
+
+    // Push constants survive pipeline changes between compatible layouts.
+    if (material.texture != invalidBindlessHandle && (!bound ||
+            bound->layout != material.layout ||
+            bound->texture != material.texture ||
+            bound->sampler != material.sampler)) {
+        uint32_t handles[] {material.texture, material.sampler};
+        commandBuffer.pushConstants(
+            material.layout,
+            vk::ShaderStageFlagBits::eAll,
+            BindlessHeap::handlePushOffset,
+            sizeof(handles),
+            handles);
+        _stats.handlePushes++;
+    }
+}
+
+void BatchRenderer::bindMesh(
+    vk::CommandBuffer commandBuffer,
+    const Batch& batch,
+    vk::Buffer instanceBuffer,
+    vk::DeviceSize instanceOffset)
+{
+    if (batch.mesh == quadMesh) {
+        commandBuffer.bindVertexBuffers(0, instanceBuffer, instanceOffset);
+        return;
+    }
+
+    const BatchMesh& mesh = _meshes[batch.mesh];
+    vk::Buffer buffers[] {mesh.vertexBuffer, instanceBuffer};
+    vk::DeviceSize offsets[] {mesh.vertexOffset, instanceOffset};
+    commandBuffer.bindVertexBuffers(0, buffers, offsets);
+    if (mesh.indexBuffer) {
+        commandBuffer.bindIndexBuffer(
+            mesh.indexBuffer, mesh.indexOffset, mesh.indexType);
+    }
+}
+
+void BatchRenderer::drawBatch(
+    vk::CommandBuffer commandBuffer,
+    const Batch& batch,
+    uint32_t instanceCount)
+{
+    const BatchMesh& mesh = _meshes[batch.mesh];
+    if (mesh.indexBuffer) {
+        commandBuffer.drawIndexed(mesh.count, instanceCount, 0, 0, 0);
+    } else {
+        commandBuffer.draw(mesh.count, instanceCount, 0, 0);
+    }
+    _stats.draws++;
+    _stats.instances += instanceCount;
+}
+
+} // namespace rr
@@ -0,0 +1,326 @@
+#include <bindless_heap.hpp>
+
+#include <error.hpp>
+
+#include <algorithm>
+#include <array>
+
+namespace rr {
+
+bool bindlessSupported(const vk::raii::PhysicalDevice& physicalDevice)
+{
+    auto features = physicalDevice.getFeatures2<
+        vk::PhysicalDeviceFeatures2,
+        vk::PhysicalDeviceDescriptorIndexingFeatures>();
+    const auto& core = features.get<vk::PhysicalDeviceFeatures2>().features;
+    const auto& f =
+        features.get<vk::PhysicalDeviceDescriptorIndexingFeatures>();
+    return core.shaderSampledImageArrayDynamicIndexing &&
+        core.shaderStorageBufferArrayDynamicIndexing &&
+        f.shaderSampledImageArrayNonUniformIndexing &&
+        f.shaderStorageBufferArrayNonUniformIndexing &&
+        f.runtimeDescriptorArray &&
+        f.descriptorBindingPartiallyBound &&
+        f.descriptorBindingSampledImageUpdateAfterBind &&
+        f.descriptorBindingStorageBufferUpdateAfterBind &&
+        f.descriptorBindingUpdateUnusedWhilePending;
+}
+
+void enableBindlessFeatures(
+    vk::PhysicalDeviceFeatures& core,
+    vk::PhysicalDeviceDescriptorIndexingFeatures& f)
+{
+    core.shaderSampledImageArrayDynamicIndexing = vk::True;
+    core.shaderStorageBufferArrayDynamicIndexing = vk::True;
+    f.shaderSampledImageArrayNonUniformIndexing = vk::True;
+    f.shaderStorageBufferArrayNonUniformIndexing = vk::True;
+    f.runtimeDescriptorArray = vk::True;
+    f.descriptorBindingPartiallyBound = vk::True;
+    f.descriptorBindingSampledImageUpdateAfterBind = vk::True;
+    f.descriptorBindingStorageBufferUpdateAfterBind = vk::True;
+    f.descriptorBindingUpdateUnusedWhilePending = vk::True;
+}
+
+BindlessHeap::BindlessHeap(
+    const vk::raii::PhysicalDevice& physicalDevice,
+    const vk::raii::Device& device,
+    BindlessHeapOptions options)
+    : _device(&device)
+{
+    auto properties = physicalDevice.getProperties2<
+        vk::PhysicalDeviceProperties2,
+        vk::PhysicalDeviceDescriptorIndexingProperties>();
+    const auto& limits =
+        properties.get<vk::PhysicalDeviceDescriptorIndexingProperties>();
+
+    // Every stage may see the whole set, so the per-stage limits apply too.
+    _slots[SampledImages].capacity = std::min({
+        options.sampledImages,
+        limits.maxDescriptorSetUpdateAfterBindSampledImages,
+        limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+    });
+    _slots[StorageBuffers].capacity = std::min({
+        options.storageBuffers,
+        limits.maxDescriptorSetUpdateAfterBindStorageBuffers,
+        limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+    });
+    _slots[Samplers].capacity = std::min({
+        options.samplers,
+        limits.maxDescriptorSetUpdateAfterBindSamplers,
+        limits.maxPerStageDescriptorUpdateAfterBindSamplers,
+    });
+
+    auto descriptorTypes = std::array{
+        vk::DescriptorType::eSampledImage,
+        vk::DescriptorType::eStorageBuffer,
+        vk::DescriptorType::eSampler,
+    };
+
+    auto bindings = std::array<vk::DescriptorSetLayoutBinding, BindingCount>{};
+    auto bindingFlags = std::array<vk::DescriptorBindingFlags, BindingCount>{};
+    auto poolSizes = std::array<vk::DescriptorPoolSize, BindingCount>{};
+    for (uint32_t i = 0; i < BindingCount; i++) {
+        bindings[i] = vk::DescriptorSetLayoutBinding{
+            .binding = i,
+            .descriptorType = descriptorTypes[i],
+            .descriptorCount = _slots[i].capacity,
+            .stageFlags = vk::ShaderStageFlagBits::eAll,
+            .pImmutableSamplers = nullptr,
+        };
+        bindingFlags[i] =
+            vk::DescriptorBindingFlagBits::eUpdateAfterBind |
+            vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending |
+            vk::DescriptorBindingFlagBits::ePartiallyBound;
+        poolSizes[i] = vk::DescriptorPoolSize{
+            .type = descriptorTypes[i],
+            .descriptorCount = _slots[i].capacity,
+        };
+    }
+
+    auto bindingFlagsInfo = vk::DescriptorSetLayoutBindingFlagsCreateInfo{
+        .pNext = nullptr,
+        .bindingCount = (uint32_t)bindingFlags.size(),
+        .pBindingFlags = bindingFlags.data(),
+    };
+    _setLayout = device.createDescriptorSetLayout(
+        vk::DescriptorSetLayoutCreateInfo{
+            .pNext = &bindingFlagsInfo,
+            .flags =
+                vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool,
+            .bindingCount = (uint32_t)bindings.size(),
+            .pBindings = bindings.data(),
+        });
+
+    auto pushConstantRange = vk::PushConstantRange{
+        .stageFlags = vk::ShaderStageFlagBits::eAll,
+        .offset = 0,
+        .size = pushConstantSize,
+    };
+    vk::DescriptorSetLayout setLayout = *_setLayout;
+    _pipelineLayout = device.createPipelineLayout(vk::PipelineLayoutCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineLayoutCreateFlags{},
+        .setLayoutCount = 1,
+        .pSetLayouts = &setLayout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange,
+    });
+
+    _pool = device.createDescriptorPool(vk::DescriptorPoolCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind,
+        .maxSets = 1,
+        .poolSizeCount = (uint32_t)poolSizes.size(),
+        .pPoolSizes = poolSizes.data(),
+    });
+
+    auto sets = device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{
+        .pNext = nullptr,
+        .descriptorPool = *_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &setLayout,
+    });
+    _set = sets.front().release();
+}
+
+BindlessHandle BindlessHeap::addSampledImage(
+    vk::ImageView view, vk::ImageLayout layout)
+{
+    BindlessHandle handle = allocate(SampledImages);
+    updateSampledImage(handle, view, layout);
+    return handle;
+}
+
+BindlessHandle BindlessHeap::addStorageBuffer(
+    vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range)
+{
+    BindlessHandle handle = allocate(StorageBuffers);
+    _pendingWrites.push_back(PendingWrite{
+        .binding = StorageBuffers,
+        .handle = handle,
+        .image = {},
+        .buffer = vk::DescriptorBufferInfo{
+            .buffer = buffer,
+            .offset = offset,
+            .range = range,
+        },
+    });
+    return handle;
+}
+
+BindlessHandle BindlessHeap::addSampler(vk::Sampler sampler)
+{
+    BindlessHandle handle = allocate(Samplers);
+    _pendingWrites.push_back(PendingWrite{
+        .binding = Samplers,
+        .handle = handle,
+        .image = vk::DescriptorImageInfo{
+            .sampler = sampler,
+            .imageView = vk::ImageView{},
+            .imageLayout = vk::ImageLayout::eUndefined,
+        },
+        .buffer = {},
+    });
+    return handle;
+}
+
+void BindlessHeap::updateSampledImage(
+    BindlessHandle handle, vk::ImageView view, vk::ImageLayout layout)
+{
+    if (handle >= _slots[SampledImages].next) {
+        throw Error{} << "invalid bindless image handle: " << handle;
+    }
+    _pendingWrites.push_back(PendingWrite{
+        .binding = SampledImages,
+        .handle = handle,
+        .image = vk::DescriptorImageInfo{
+            .sampler = vk::Sampler{},
+            .imageView = view,
+            .imageLayout = layout,
+        },
+        .buffer = {},
+    });
+}
+
+void BindlessHeap::releaseSampledImage(
+    BindlessHandle handle, uint64_t lastFrame)
+{
+    release(SampledImages, handle, lastFrame);
+}
+
+void BindlessHeap::releaseStorageBuffer(
+    BindlessHandle handle, uint64_t lastFrame)
+{
+    release(StorageBuffers, handle, lastFrame);
+}
+
+void BindlessHeap::releaseSampler(BindlessHandle handle, uint64_t lastFrame)
+{
+    release(Samplers, handle, lastFrame);
+}
+
+void BindlessHeap::collect(uint64_t completedFrames)
+{
+    for (Slots& slots : _slots) {
+        while (!slots.released.empty() &&
+                slots.released.front().first <= completedFrames) {
+            slots.free.push_back(slots.released.front().second);
+            slots.released.pop_front();
+        }
+    }
+}
+
+void BindlessHeap::bind(
+    vk::CommandBuffer commandBuffer, vk::PipelineBindPoint bindPoint)
+{
+    flush();
+    commandBuffer.bindDescriptorSets(
+        bindPoint, *_pipelineLayout, 0, _set, {});
+}
+
+void BindlessHeap::flush()
+{
+    if (_pendingWrites.empty()) {
+        return;
+    }
+
+    auto writes = std::vector<vk::WriteDescriptorSet>{};
+    writes.reserve(_pendingWrites.size());
+    for (const PendingWrite& pending : _pendingWrites) {
+        bool isBuffer = pending.binding == StorageBuffers;
+        writes.push_back(vk::WriteDescriptorSet{
+            .pNext = nullptr,
+            .dstSet = _set,
+            .dstBinding = pending.binding,
+            .dstArrayElement = pending.handle,
+            .descriptorCount = 1,
+            .descriptorType = pending.binding == SampledImages ?
+                vk::DescriptorType::eSampledImage :
+                isBuffer ?
+                    vk::DescriptorType::eStorageBuffer :
+                    vk::DescriptorType::eSampler,
+            .pImageInfo = isBuffer ? nullptr : &pending.image,
+            .pBufferInfo = isBuffer ? &pending.buffer : nullptr,
+            .pTexelBufferView = nullptr,
+        });
+    }
+    _device->updateDescriptorSets(writes, {});
+    _descriptorWrites += writes.size();
+    _pendingWrites.clear();
+}
+
+vk::DescriptorSetLayout BindlessHeap::setLayout() const
+{
+    return *_setLayout;
+}
+
+vk::PipelineLayout BindlessHeap::pipelineLayout() const
+{
+    return *_pipelineLayout;
+}
+
+BindlessHeapStats BindlessHeap::stats() const
+{
+    auto used = [] (const Slots& slots) {
+        return slots.next - (uint32_t)slots.free.size() -
+            (uint32_t)slots.released.size();
+    };
+    return BindlessHeapStats{
+        .sampledImages = used(_slots[SampledImages]),
+        .storageBuffers = used(_slots[StorageBuffers]),
+        .samplers = used(_slots[Samplers]),
+        .pendingReleases = (uint32_t)(
+            _slots[SampledImages].released.size() +
+            _slots[StorageBuffers].released.size() +
+            _slots[Samplers].released.size()),
+        .descriptorWrites = _descriptorWrites,
+    };
+}
+
+BindlessHandle BindlessHeap::allocate(Binding binding)
+{
+    Slots& slots = _slots[binding];
+    if (!slots.free.empty()) {
+        BindlessHandle handle = slots.free.back();
+        slots.free.pop_back();
+        return handle;
+    }
+    if (slots.next == slots.capacity) {
+        throw Error{} << "bindless heap binding " << (uint32_t)binding <<
+            " is full (" << slots.capacity << " descriptors)";
+    }
+    return slots.next++;
+}
+
+void BindlessHeap::release(
+    Binding binding, BindlessHandle handle, uint64_t lastFrame)
+{
+    Slots& slots = _slots[binding];
+    if (handle >= slots.next) {
+        throw Error{} << "invalid bindless handle: " << handle;
+    }
+    // lastFrame is zero-based; it is done once lastFrame + 1 frames are.
+    slots.released.emplace_back(lastFrame + 1, handle);
+}
+
+} // namespace rr
@@ -0,0 +1,162 @@
+#include <deletion_queue.hpp>
+
+#include <utility>
+
+namespace rr {
+
+DeletionQueue::DeletionQueue(
+        MemoryAllocator* allocator, DeletionQueueOptions options)
+    : _allocator(allocator)
+{
+    if (options.backgroundThread) {
+        _thread = std::thread{[this] { run(); }};
+    }
+}
+
+DeletionQueue::~DeletionQueue()
+{
+    collect(UINT64_MAX);
+    if (_thread.joinable()) {
+        {
+            auto lock = std::lock_guard{_mutex};
+            _stop = true;
+        }
+        _wake.notify_one();
+        _thread.join();
+    }
+}
+
+void DeletionQueue::retire(vk::raii::Pipeline pipeline, uint64_t lastFrame)
+{
+    batch(lastFrame).pipelines.push_back(std::move(pipeline));
+}
+
+void DeletionQueue::retire(
+    vk::raii::Framebuffer framebuffer, uint64_t lastFrame)
+{
+    batch(lastFrame).framebuffers.push_back(std::move(framebuffer));
+}
+
+void DeletionQueue::retire(vk::raii::ImageView view, uint64_t lastFrame)
+{
+    batch(lastFrame).views.push_back(std::move(view));
+}
+
+void DeletionQueue::retire(vk::raii::Image image, uint64_t lastFrame)
+{
+    batch(lastFrame).images.push_back(std::move(image));
+}
+
+void DeletionQueue::retire(vk::raii::Buffer buffer, uint64_t lastFrame)
+{
+    batch(lastFrame).buffers.push_back(std::move(buffer));
+}
+
+void DeletionQueue::retire(vk::raii::Sampler sampler, uint64_t lastFrame)
+{
+    batch(lastFrame).samplers.push_back(std::move(sampler));
+}
+
+void DeletionQueue::retire(
+    const MemoryAllocation& allocation, uint64_t lastFrame)
+{
+    batch(lastFrame).allocations.push_back(allocation);
+}
+
+void DeletionQueue::retire(std::function<void()> destroy, uint64_t lastFrame)
+{
+    batch(lastFrame).functions.push_back(std::move(destroy));
+}
+
+void DeletionQueue::collect(uint64_t completedFrames)
+{
+    while (!_batches.empty() && completedFrames > _batches.front().lastFrame) {
+        if (_thread.joinable()) {
+            {
+                auto lock = std::lock_guard{_mutex};
+                _completed.push_back(std::move(_batches.front()));
+            }
+            _wake.notify_one();
+        } else {
+            destroy(_batches.front());
+        }
+        _batches.pop_front();
+    }
+}
+
+void DeletionQueue::wait()
+{
+    auto lock = std::unique_lock{_mutex};
+    _idle.wait(lock, [this] { return _completed.empty() && !_busy; });
+}
+
+DeletionQueueStats DeletionQueue::stats() const
+{
+    auto lock = std::lock_guard{_mutex};
+    return _stats;
+}
+
+// Frames are retired in order, so objects almost always go to the newest
+// batch. An object retired for an earlier frame joins it too, which only
+// delays its destruction.
+DeletionQueue::Batch& DeletionQueue::batch(uint64_t lastFrame)
+{
+    if (_batches.empty() || _batches.back().lastFrame < lastFrame) {
+        _batches.emplace_back().lastFrame = lastFrame;
+    }
+    Batch& batch = _batches.back();
+    batch.count++;
+
+    auto lock = std::lock_guard{_mutex};
+    _stats.retired++;
+    _stats.pending++;
+    return batch;
+}
+
+void DeletionQueue::destroy(Batch& batch)
+{
+    for (auto& function : batch.functions) {
+        function();
+    }
+    batch.functions.clear();
+    batch.pipelines.clear();
+    batch.framebuffers.clear();
+    batch.views.clear();
+    batch.images.clear();
+    batch.buffers.clear();
+    batch.samplers.clear();
+    for (const MemoryAllocation& allocation : batch.allocations) {
+        _allocator->free(allocation);
+    }
+    batch.allocations.clear();
+
+    auto lock = std::lock_guard{_mutex};
+    _stats.destroyed += batch.count;
+    _stats.batches++;
+    _stats.pending -= batch.count;
+}
+
+void DeletionQueue::run()
+{
+    auto lock = std::unique_lock{_mutex};
+    for (;;) {
+        _wake.wait(lock, [this] { return _stop || !_completed.empty(); });
+        if (_completed.empty()) {
+            break;
+        }
+        Batch batch = std::move(_completed.front());
+        _completed.pop_front();
+        _busy = true;
+
+        lock.unlock();
+        destroy(batch);
+        lock.lock();
+
+        _busy = false;
+        if (_completed.empty()) {
+            _idle.notify_all();
+        }
+    }
+}
+
+} // namespace rr
@@ -0,0 +1,197 @@
+#include <descriptor_allocator.hpp>
+
+#include <error.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <utility>
+
+namespace rr {
+
+namespace {
+
+uint64_t fnv1a(const std::vector<uint64_t>& words)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (uint64_t word : words) {
+        for (int i = 0; i < 8; i++) {
+            hash ^= (word >> (i * 8)) & 0xff;
+            hash *= 0x100000001b3;
+        }
+    }
+    return hash;
+}
+
+} // namespace
+
+DescriptorAllocator::DescriptorAllocator(
+    const vk::raii::Device& device,
+    uint32_t frameContextCount,
+    DescriptorAllocatorOptions options)
+    : _device(&device)
+    , _options(std::move(options))
+    , _frames(frameContextCount)
+{
+    if (frameContextCount == 0) {
+        throw Error{} << "descriptor allocator needs a frame context";
+    }
+    if (_options.setsPerPool == 0 || _options.ratios.empty()) {
+        throw Error{} << "descriptor pools must hold at least one set";
+    }
+}
+
+void DescriptorAllocator::beginFrame(uint32_t frameContext)
+{
+    _frameContext = frameContext % (uint32_t)_frames.size();
+    FrameContext& frame = _frames[_frameContext];
+
+    // Only pools that were allocated from need a reset.
+    size_t used = std::min(frame.current + 1, frame.pools.size());
+    for (size_t i = 0; i < used; i++) {
+        frame.pools[i].reset();
+    }
+    _resets += used;
+    frame.current = 0;
+    _sets = 0;
+}
+
+vk::DescriptorSet DescriptorAllocator::allocate(vk::DescriptorSetLayout layout)
+{
+    FrameContext& frame = _frames[_frameContext];
+
+    // A fresh pool that cannot fit the set means the layout needs more of a
+    // type than the ratios provide.
+    for (bool freshPool = false; ; ) {
+        if (frame.current == frame.pools.size()) {
+            frame.pools.push_back(createPool());
+            freshPool = true;
+        }
+
+        auto allocateInfo = vk::DescriptorSetAllocateInfo{
+            .pNext = nullptr,
+            .descriptorPool = *frame.pools[frame.current],
+            .descriptorSetCount = 1,
+            .pSetLayouts = &layout,
+        };
+        vk::DescriptorSet set;
+        vk::Result result = (**_device).allocateDescriptorSets(
+            &allocateInfo, &set);
+        if (result == vk::Result::eSuccess) {
+            _sets++;
+            return set;
+        }
+        if (result != vk::Result::eErrorOutOfPoolMemory &&
+                result != vk::Result::eErrorFragmentedPool) {
+            throw Error{} << "descriptor set allocation failed: " <<
+                vk::to_string(result);
+        }
+        if (freshPool) {
+            throw Error{} << "descriptor set layout does not fit in a pool";
+        }
+        frame.current++;
+    }
+}
+
+DescriptorAllocatorStats DescriptorAllocator::stats() const
+{
+    const FrameContext& current = _frames[_frameContext];
+    return DescriptorAllocatorStats{
+        .pools = std::accumulate(
+            _frames.begin(), _frames.end(), 0u,
+            [] (uint32_t sum, const FrameContext& frame) {
+                return sum + (uint32_t)frame.pools.size();
+            }),
+        .resets = _resets,
+        .sets = _sets,
+        .poolsUsed = (uint32_t)std::min(
+            current.current + 1, current.pools.size()),
+    };
+}
+
+vk::raii::DescriptorPool DescriptorAllocator::createPool() const
+{
+    auto sizes = std::vector<vk::DescriptorPoolSize>{};
+    sizes.reserve(_options.ratios.size());
+    for (const DescriptorPoolRatio& ratio : _options.ratios) {
+        sizes.push_back(vk::DescriptorPoolSize{
+            .type = ratio.type,
+            .descriptorCount = std::max(1u, (uint32_t)std::ceil(
+                ratio.perSet * (float)_options.setsPerPool)),
+        });
+    }
+
+    return _device->createDescriptorPool(vk::DescriptorPoolCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::DescriptorPoolCreateFlags{},
+        .maxSets = _options.setsPerPool,
+        .poolSizeCount = (uint32_t)sizes.size(),
+        .pPoolSizes = sizes.data(),
+    });
+}
+
+DescriptorLayoutCache::DescriptorLayoutCache(const vk::raii::Device& device)
+    : _device(&device)
+{ }
+
+vk::DescriptorSetLayout DescriptorLayoutCache::get(
+    const vk::DescriptorSetLayoutCreateInfo& info)
+{
+    const vk::DescriptorBindingFlags* bindingFlags = nullptr;
+    for (auto next = (const vk::BaseInStructure*)info.pNext; next;
+            next = next->pNext) {
+        if (next->sType ==
+                vk::StructureType::eDescriptorSetLayoutBindingFlagsCreateInfo) {
+            auto flagsInfo =
+                (const vk::DescriptorSetLayoutBindingFlagsCreateInfo*)next;
+            if (flagsInfo->bindingCount > 0) {
+                bindingFlags = flagsInfo->pBindingFlags;
+            }
+        }
+    }
+
+    // Binding order in the create info does not matter, so sort first.
+    auto order = std::vector<uint32_t>(info.bindingCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::ranges::sort(order, [&info] (uint32_t a, uint32_t b) {
+        return info.pBindings[a].binding < info.pBindings[b].binding;
+    });
+
+    auto key = std::vector<uint64_t>{};
+    key.push_back((uint64_t)(uint32_t)info.flags);
+    for (uint32_t i : order) {
+        const vk::DescriptorSetLayoutBinding& binding = info.pBindings[i];
+        key.push_back((uint64_t)binding.binding << 32 |
+            (uint64_t)binding.descriptorType);
+        key.push_back((uint64_t)binding.descriptorCount << 32 |
+            (uint32_t)binding.stageFlags);
+        key.push_back(bindingFlags ? (uint32_t)bindingFlags[i] : 0);
+        if (binding.pImmutableSamplers) {
+            for (uint32_t j = 0; j < binding.descriptorCount; j++) {
+                key.push_back(
+                    (uint64_t)(VkSampler)binding.pImmutableSamplers[j]);
+            }
+        }
+    }
+
+    auto& entries = _layouts[fnv1a(key)];
+    for (const Entry& entry : entries) {
+        if (entry.key == key) {
+            return *entry.layout;
+        }
+    }
+
+    entries.push_back(Entry{
+        .key = std::move(key),
+        .layout = _device->createDescriptorSetLayout(info),
+    });
+    _size++;
+    return *entries.back().layout;
+}
+
+size_t DescriptorLayoutCache::size() const
+{
+    return _size;
+}
+
+} // namespace rr
@@ -0,0 +1,283 @@
+#include <device_selector.hpp>
+
+#include <async_compute.hpp>
+#include <bindless_heap.hpp>
+#include <error.hpp>
+#include <upload.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <optional>
+#include <sstream>
+
+namespace rr {
+
+namespace {
+
+// The score packs, from most to least significant: the type rank, the size
+// of the largest device-local heap in units of 256 MiB, and weights for
+// optional capabilities. A device of a better type always wins, and so does
+// more memory on the same type.
+constexpr int typeShift = 48;
+constexpr int memoryShift = 16;
+
+uint64_t typeRank(vk::PhysicalDeviceType type)
+{
+    switch (type) {
+    case vk::PhysicalDeviceType::eDiscreteGpu: return 4;
+    case vk::PhysicalDeviceType::eIntegratedGpu: return 3;
+    case vk::PhysicalDeviceType::eVirtualGpu: return 2;
+    case vk::PhysicalDeviceType::eCpu: return 1;
+    default: return 0;
+    }
+}
+
+uint64_t deviceLocalUnits(const vk::raii::PhysicalDevice& physicalDevice)
+{
+    vk::PhysicalDeviceMemoryProperties mp =
+        physicalDevice.getMemoryProperties();
+    vk::DeviceSize largest = 0;
+    for (uint32_t i = 0; i < mp.memoryHeapCount; i++) {
+        if (mp.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+            largest = std::max(largest, mp.memoryHeaps[i].size);
+        }
+    }
+    return std::min<uint64_t>(
+        largest >> 28, (uint64_t{1} << (typeShift - memoryShift)) - 1);
+}
+
+bool hasExtension(
+    const std::vector<vk::ExtensionProperties>& available, const char* name)
+{
+    return std::ranges::any_of(
+        available, [name] (const vk::ExtensionProperties& p) {
+            return std::strcmp(p.extensionName, name) == 0;
+        });
+}
+
+std::string lowercase(std::string_view s)
+{
+    auto result = std::string{s};
+    for (char& c : result) {
+        c = (char)std::tolower((unsigned char)c);
+    }
+    return result;
+}
+
+DeviceCandidate check(
+    const vk::raii::PhysicalDevice& physicalDevice,
+    const DeviceRequirements& requirements)
+{
+    auto candidate = DeviceCandidate{
+        .physicalDevice = physicalDevice,
+        .properties = physicalDevice.getProperties(),
+    };
+    const vk::PhysicalDeviceProperties& dp = candidate.properties;
+    auto& missing = candidate.missing;
+
+    if (dp.apiVersion >= VK_API_VERSION_1_1) {
+        auto properties = physicalDevice.getProperties2<
+            vk::PhysicalDeviceProperties2,
+            vk::PhysicalDeviceIDProperties>();
+        std::ranges::copy(
+            properties.get<vk::PhysicalDeviceIDProperties>().deviceUUID,
+            candidate.uuid.begin());
+    }
+
+    if (dp.apiVersion < requirements.apiVersion) {
+        missing.push_back("Vulkan " +
+            std::to_string(VK_API_VERSION_MAJOR(requirements.apiVersion)) +
+            "." +
+            std::to_string(VK_API_VERSION_MINOR(requirements.apiVersion)));
+        // Querying newer features of an older device is not valid.
+        return candidate;
+    }
+
+    if (requirements.timelineSemaphore) {
+        auto features = physicalDevice.getFeatures2<
+            vk::PhysicalDeviceFeatures2,
+            vk::PhysicalDeviceTimelineSemaphoreFeatures>();
+        if (!features.get<vk::PhysicalDeviceTimelineSemaphoreFeatures>()
+                .timelineSemaphore) {
+            missing.push_back("timeline semaphores");
+        }
+    }
+    if (requirements.bindless && !bindlessSupported(physicalDevice)) {
+        missing.push_back("descriptor indexing");
+    }
+    if (requirements.drawIndirectFirstInstance &&
+            !physicalDevice.getFeatures().drawIndirectFirstInstance) {
+        missing.push_back("drawIndirectFirstInstance");
+    }
+
+    auto extensions = physicalDevice.enumerateDeviceExtensionProperties();
+    for (const char* name : requirements.extensions) {
+        if (!hasExtension(extensions, name)) {
+            missing.push_back(name);
+        }
+    }
+
+    // Presenting from the graphics family avoids ownership transfers, so
+    // prefer a graphics family that can present.
+    auto queueFamilyProperties = physicalDevice.getQueueFamilyProperties();
+    std::optional<uint32_t> graphicsFamily;
+    std::optional<uint32_t> presentFamily;
+    for (uint32_t i = 0; i < queueFamilyProperties.size(); i++) {
+        bool graphics =
+            (bool)(queueFamilyProperties[i].queueFlags &
+                vk::QueueFlagBits::eGraphics);
+        bool present = !requirements.surface ||
+            physicalDevice.getSurfaceSupportKHR(i, requirements.surface);
+        if (graphics && present) {
+            graphicsFamily = i;
+            presentFamily = i;
+            break;
+        }
+        if (graphics && !graphicsFamily) {
+            graphicsFamily = i;
+        }
+        if (present && !presentFamily) {
+            presentFamily = i;
+        }
+    }
+    if (!graphicsFamily) {
+        missing.push_back("a graphics queue");
+    }
+    if (!presentFamily) {
+        missing.push_back("a queue that can present");
+    }
+
+    if (requirements.surface) {
+        if (physicalDevice.getSurfaceFormatsKHR(requirements.surface)
+                .empty()) {
+            missing.push_back("surface formats");
+        }
+        if (physicalDevice.getSurfacePresentModesKHR(requirements.surface)
+                .empty()) {
+            missing.push_back("present modes");
+        }
+    }
+
+    if (!candidate.usable()) {
+        return candidate;
+    }
+    candidate.graphicsQueueFamily = *graphicsFamily;
+    candidate.presentQueueFamily = *presentFamily;
+
+    uint64_t bonus = 0;
+    if (findTransferQueueFamily(physicalDevice)) {
+        bonus += 8;
+    }
+    if (findComputeQueueFamily(physicalDevice)) {
+        bonus += 8;
+    }
+    if (graphicsFamily == presentFamily) {
+        bonus += 4;
+    }
+    if (physicalDevice.getFeatures().multiDrawIndirect) {
+        bonus += 2;
+    }
+    for (const char* name : requirements.optionalExtensions) {
+        if (hasExtension(extensions, name)) {
+            bonus += 1;
+        }
+    }
+    candidate.score =
+        typeRank(dp.deviceType) << typeShift |
+        deviceLocalUnits(physicalDevice) << memoryShift |
+        std::min<uint64_t>(bonus, (uint64_t{1} << memoryShift) - 1);
+    return candidate;
+}
+
+std::string describe(std::span<const DeviceCandidate> candidates)
+{
+    auto stream = std::ostringstream{};
+    for (const DeviceCandidate& candidate : candidates) {
+        stream << "\n  " << candidate.properties.deviceName.data() << " (" <<
+            vk::to_string(candidate.properties.deviceType) << ", " <<
+            uuidString(candidate.uuid) << ")";
+        for (size_t i = 0; i < candidate.missing.size(); i++) {
+            stream << (i == 0 ? ": missing " : ", ") << candidate.missing[i];
+        }
+    }
+    return stream.str();
+}
+
+} // namespace
+
+bool DeviceCandidate::usable() const
+{
+    return missing.empty();
+}
+
+std::string uuidString(std::span<const uint8_t, VK_UUID_SIZE> uuid)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+    auto result = std::string{};
+    for (size_t i = 0; i < uuid.size(); i++) {
+        if (i == 4 || i == 6 || i == 8 || i == 10) {
+            result += '-';
+        }
+        result += digits[uuid[i] >> 4];
+        result += digits[uuid[i] & 0xf];
+    }
+    return result;
+}
+
+std::vector<DeviceCandidate> rankPhysicalDevices(
+    const vk::raii::Instance& instance,
+    const DeviceRequirements& requirements)
+{
+    auto candidates = std::vector<DeviceCandidate>{};
+    for (const auto& physicalDevice : instance.enumeratePhysicalDevices()) {
+        candidates.push_back(check(physicalDevice, requirements));
+    }
+    std::ranges::stable_sort(
+        candidates, [] (const DeviceCandidate& a, const DeviceCandidate& b) {
+            if (a.usable() != b.usable()) {
+                return a.usable();
+            }
+            return a.score > b.score;
+        });
+    return candidates;
+}
+
+DeviceCandidate selectPhysicalDevice(
+    const vk::raii::Instance& instance,
+    const DeviceRequirements& requirements,
+    std::string_view override)
+{
+    auto candidates = rankPhysicalDevices(instance, requirements);
+    if (candidates.empty()) {
+        throw Error{} << "no Vulkan devices";
+    }
+
+    if (override.empty()) {
+        if (!candidates.front().usable()) {
+            throw Error{} << "no usable Vulkan device:" <<
+                describe(candidates);
+        }
+        return std::move(candidates.front());
+    }
+
+    // Usable devices come first, so the first match is the best one.
+    auto name = lowercase(override);
+    auto uuid = name;
+    std::erase(uuid, '-');
+    auto it = std::ranges::find_if(
+        candidates, [&name, &uuid] (const DeviceCandidate& candidate) {
+            auto candidateUuid = uuidString(candidate.uuid);
+            std::erase(candidateUuid, '-');
+            return candidateUuid == uuid ||
+                lowercase(candidate.properties.deviceName.data())
+                    .find(name) != std::string::npos;
+        });
+    if (it == candidates.end() || !it->usable()) {
+        throw Error{} << "no usable Vulkan device matches \"" <<
+            override << "\":" << describe(candidates);
+    }
+    return std::move(*it);
+}
+
+} // namespace rr
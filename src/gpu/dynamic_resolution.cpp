@@ -0,0 +1,550 @@
+#include <dynamic_resolution.hpp>
+
+#include <error.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iterator>
+#include <numeric>
+
+namespace rr {
+
+namespace {
+
+uint32_t scaled(uint32_t size, float scale)
+{
+    return std::max(1u, (uint32_t)std::lround((double)size * scale));
+}
+
+// Rounds down to a multiple of step, tolerating float error so that values
+// that already are multiples stay put.
+float quantize(float scale, float step)
+{
+    return std::floor(scale / step + 1e-3f) * step;
+}
+
+vk::raii::RenderPass createRenderPass(
+    const vk::raii::Device& device, vk::Format format)
+{
+    auto attachment = vk::AttachmentDescription{
+        .flags = vk::AttachmentDescriptionFlags{},
+        .format = format,
+        .samples = vk::SampleCountFlagBits::e1,
+        .loadOp = vk::AttachmentLoadOp::eClear,
+        .storeOp = vk::AttachmentStoreOp::eStore,
+        .stencilLoadOp = vk::AttachmentLoadOp::eDontCare,
+        .stencilStoreOp = vk::AttachmentStoreOp::eDontCare,
+        // Cleared every frame, and sampled by upscale afterwards.
+        .initialLayout = vk::ImageLayout::eUndefined,
+        .finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
+    };
+    auto colorReference = vk::AttachmentReference{
+        .attachment = 0,
+        .layout = vk::ImageLayout::eColorAttachmentOptimal,
+    };
+    auto subpass = vk::SubpassDescription{
+        .flags = vk::SubpassDescriptionFlags{},
+        .pipelineBindPoint = vk::PipelineBindPoint::eGraphics,
+        .inputAttachmentCount = 0,
+        .pInputAttachments = nullptr,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &colorReference,
+        .pResolveAttachments = nullptr,
+        .pDepthStencilAttachment = nullptr,
+        .preserveAttachmentCount = 0,
+        .pPreserveAttachments = nullptr,
+    };
+    vk::SubpassDependency dependencies[] {
+        // The previous frame's upscale reads before the clear writes.
+        vk::SubpassDependency{
+            .srcSubpass = VK_SUBPASS_EXTERNAL,
+            .dstSubpass = 0,
+            .srcStageMask = vk::PipelineStageFlagBits::eFragmentShader,
+            .dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput,
+            .srcAccessMask = vk::AccessFlags{},
+            .dstAccessMask = vk::AccessFlagBits::eColorAttachmentWrite,
+            .dependencyFlags = vk::DependencyFlags{},
+        },
+        // The scene's writes before this frame's upscale reads.
+        vk::SubpassDependency{
+            .srcSubpass = 0,
+            .dstSubpass = VK_SUBPASS_EXTERNAL,
+            .srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput,
+            .dstStageMask = vk::PipelineStageFlagBits::eFragmentShader,
+            .srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite,
+            .dstAccessMask = vk::AccessFlagBits::eShaderRead,
+            .dependencyFlags = vk::DependencyFlags{},
+        },
+    };
+    return device.createRenderPass(vk::RenderPassCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::RenderPassCreateFlags{},
+        .attachmentCount = 1,
+        .pAttachments = &attachment,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+        .dependencyCount = (uint32_t)std::size(dependencies),
+        .pDependencies = dependencies,
+    });
+}
+
+vk::raii::Pipeline createUpscalePipeline(
+    const vk::raii::Device& device,
+    vk::PipelineLayout layout,
+    vk::RenderPass renderPass,
+    std::span<const uint32_t> vertexCode,
+    std::span<const uint32_t> fragmentCode)
+{
+    auto createModule = [&device] (std::span<const uint32_t> code) {
+        return device.createShaderModule(vk::ShaderModuleCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::ShaderModuleCreateFlags{},
+            .codeSize = code.size_bytes(),
+            .pCode = code.data(),
+        });
+    };
+    vk::raii::ShaderModule vertexModule = createModule(vertexCode);
+    vk::raii::ShaderModule fragmentModule = createModule(fragmentCode);
+    vk::PipelineShaderStageCreateInfo stages[] {
+        vk::PipelineShaderStageCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::PipelineShaderStageCreateFlags{},
+            .stage = vk::ShaderStageFlagBits::eVertex,
+            .module = *vertexModule,
+            .pName = "main",
+            .pSpecializationInfo = nullptr,
+        },
+        vk::PipelineShaderStageCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::PipelineShaderStageCreateFlags{},
+            .stage = vk::ShaderStageFlagBits::eFragment,
+            .module = *fragmentModule,
+            .pName = "main",
+            .pSpecializationInfo = nullptr,
+        },
+    };
+
+    auto vertexInputState = vk::PipelineVertexInputStateCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineVertexInputStateCreateFlags{},
+        .vertexBindingDescriptionCount = 0,
+        .pVertexBindingDescriptions = nullptr,
+        .vertexAttributeDescriptionCount = 0,
+        .pVertexAttributeDescriptions = nullptr,
+    };
+    auto inputAssemblyState = vk::PipelineInputAssemblyStateCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineInputAssemblyStateCreateFlags{},
+        .topology = vk::PrimitiveTopology::eTriangleList,
+        .primitiveRestartEnable = vk::False,
+    };
+    auto viewportState = vk::PipelineViewportStateCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineViewportStateCreateFlags{},
+        .viewportCount = 1,
+        .pViewports = nullptr,
+        .scissorCount = 1,
+        .pScissors = nullptr,
+    };
+    auto rasterizationState = vk::PipelineRasterizationStateCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineRasterizationStateCreateFlags{},
+        .depthClampEnable = vk::False,
+        .rasterizerDiscardEnable = vk::False,
+        .polygonMode = vk::PolygonMode::eFill,
+        .cullMode = vk::CullModeFlagBits::eNone,
+        .frontFace = vk::FrontFace::eCounterClockwise,
+        .depthBiasEnable = vk::False,
+        .depthBiasConstantFactor = 0.f,
+        .depthBiasClamp = 0.f,
+        .depthBiasSlopeFactor = 0.f,
+        .lineWidth = 1.f,
+    };
+    auto multisampleState = vk::PipelineMultisampleStateCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineMultisampleStateCreateFlags{},
+        .rasterizationSamples = vk::SampleCountFlagBits::e1,
+        .sampleShadingEnable = vk::False,
+        .minSampleShading = 1.f,
+        .pSampleMask = nullptr,
+        .alphaToCoverageEnable = vk::False,
+        .alphaToOneEnable = vk::False,
+    };
+    auto colorBlendAttachmentState = vk::PipelineColorBlendAttachmentState{
+        .blendEnable = vk::False,
+        .srcColorBlendFactor = vk::BlendFactor::eOne,
+        .dstColorBlendFactor = vk::BlendFactor::eZero,
+        .colorBlendOp = vk::BlendOp::eAdd,
+        .srcAlphaBlendFactor = vk::BlendFactor::eOne,
+        .dstAlphaBlendFactor = vk::BlendFactor::eZero,
+        .alphaBlendOp = vk::BlendOp::eAdd,
+        .colorWriteMask =
+            vk::ColorComponentFlagBits::eR |
+            vk::ColorComponentFlagBits::eG |
+            vk::ColorComponentFlagBits::eB |
+            vk::ColorComponentFlagBits::eA,
+    };
+    auto colorBlendState = vk::PipelineColorBlendStateCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineColorBlendStateCreateFlags{},
+        .logicOpEnable = vk::False,
+        .logicOp = vk::LogicOp::eCopy,
+        .attachmentCount = 1,
+        .pAttachments = &colorBlendAttachmentState,
+        .blendConstants = std::array{0.f, 0.f, 0.f, 0.f},
+    };
+    vk::DynamicState dynamicStates[] {
+        vk::DynamicState::eViewport,
+        vk::DynamicState::eScissor,
+    };
+    auto dynamicState = vk::PipelineDynamicStateCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineDynamicStateCreateFlags{},
+        .dynamicStateCount = (uint32_t)std::size(dynamicStates),
+        .pDynamicStates = dynamicStates,
+    };
+
+    auto pipelineInfo = vk::GraphicsPipelineCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineCreateFlags{},
+        .stageCount = 2,
+        .pStages = stages,
+        .pVertexInputState = &vertexInputState,
+        .pInputAssemblyState = &inputAssemblyState,
+        .pTessellationState = nullptr,
+        .pViewportState = &viewportState,
+        .pRasterizationState = &rasterizationState,
+        .pMultisampleState = &multisampleState,
+        .pDepthStencilState = nullptr,
+        .pColorBlendState = &colorBlendState,
+        .pDynamicState = &dynamicState,
+        .layout = layout,
+        .renderPass = renderPass,
+        .subpass = 0,
+        .basePipelineHandle = nullptr,
+        .basePipelineIndex = -1,
+    };
+    return device.createGraphicsPipeline(nullptr, pipelineInfo);
+}
+
+void setViewport(vk::CommandBuffer commandBuffer, vk::Extent2D extent)
+{
+    commandBuffer.setViewport(0, vk::Viewport{
+        .x = 0.f,
+        .y = 0.f,
+        .width = (float)extent.width,
+        .height = (float)extent.height,
+        .minDepth = 0.f,
+        .maxDepth = 1.f,
+    });
+    commandBuffer.setScissor(0, vk::Rect2D{
+        .offset = vk::Offset2D{.x = 0, .y = 0},
+        .extent = extent,
+    });
+}
+
+} // namespace
+
+DynamicResolution::DynamicResolution(
+    const vk::raii::Device& device,
+    MemoryAllocator& allocator,
+    BindlessHeap& heap,
+    DeletionQueue& deletionQueue,
+    vk::RenderPass outputRenderPass,
+    std::span<const uint32_t> vertexShaderCode,
+    std::span<const uint32_t> fragmentShaderCode,
+    DynamicResolutionOptions options)
+    : _device(&device)
+    , _allocator(&allocator)
+    , _heap(&heap)
+    , _deletionQueue(&deletionQueue)
+    , _options(options)
+{
+    if (_options.minScale <= 0.f || _options.minScale > _options.maxScale ||
+            _options.scaleStep <= 0.f) {
+        throw Error{} << "invalid dynamic resolution scales: " <<
+            _options.minScale << " to " << _options.maxScale <<
+            " in steps of " << _options.scaleStep;
+    }
+    _options.settleFrames = std::max(_options.settleFrames, 1u);
+    _scale = _options.maxScale;
+
+    _renderPass = createRenderPass(device, _options.format);
+    _pipeline = createUpscalePipeline(
+        device,
+        heap.pipelineLayout(),
+        outputRenderPass,
+        vertexShaderCode,
+        fragmentShaderCode);
+
+    _sampler = device.createSampler(vk::SamplerCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::SamplerCreateFlags{},
+        .magFilter = vk::Filter::eLinear,
+        .minFilter = vk::Filter::eLinear,
+        .mipmapMode = vk::SamplerMipmapMode::eNearest,
+        .addressModeU = vk::SamplerAddressMode::eClampToEdge,
+        .addressModeV = vk::SamplerAddressMode::eClampToEdge,
+        .addressModeW = vk::SamplerAddressMode::eClampToEdge,
+        .mipLodBias = 0.f,
+        .anisotropyEnable = vk::False,
+        .maxAnisotropy = 1.f,
+        .compareEnable = vk::False,
+        .compareOp = vk::CompareOp::eAlways,
+        .minLod = 0.f,
+        .maxLod = 0.f,
+        .borderColor = vk::BorderColor::eFloatTransparentBlack,
+        .unnormalizedCoordinates = vk::False,
+    });
+    _samplerHandle = heap.addSampler(*_sampler);
+}
+
+DynamicResolution::~DynamicResolution()
+{
+    _heap->releaseSampler(_samplerHandle, 0);
+    if (_target.handle != invalidBindlessHandle) {
+        _heap->releaseSampledImage(_target.handle, 0);
+    }
+    _target.framebuffer.clear();
+    _target.view.clear();
+    _target.image.clear();
+    _allocator->free(_target.memory);
+}
+
+void DynamicResolution::beginFrame(
+    uint64_t frame, vk::Extent2D outputExtent, const GpuProfiler& profiler)
+{
+    if (outputExtent != _outputExtent) {
+        createTarget(outputExtent, frame);
+    }
+    updateScale(profiler);
+
+    _renderExtent = vk::Extent2D{
+        .width = std::min(
+            scaled(_outputExtent.width, _scale), _target.extent.width),
+        .height = std::min(
+            scaled(_outputExtent.height, _scale), _target.extent.height),
+    };
+    _stats.scale = _scale;
+    _stats.renderExtent = _renderExtent;
+    _stats.targetExtent = _target.extent;
+}
+
+void DynamicResolution::beginScene(
+    vk::CommandBuffer commandBuffer, const vk::ClearColorValue& clear)
+{
+    auto clearValue = vk::ClearValue{.color = clear};
+    commandBuffer.beginRenderPass(
+        vk::RenderPassBeginInfo{
+            .pNext = nullptr,
+            .renderPass = *_renderPass,
+            .framebuffer = *_target.framebuffer,
+            .renderArea = vk::Rect2D{
+                .offset = vk::Offset2D{.x = 0, .y = 0},
+                .extent = _renderExtent,
+            },
+            .clearValueCount = 1,
+            .pClearValues = &clearValue,
+        },
+        vk::SubpassContents::eInline);
+    setViewport(commandBuffer, _renderExtent);
+}
+
+void DynamicResolution::endScene(vk::CommandBuffer commandBuffer)
+{
+    commandBuffer.endRenderPass();
+}
+
+void DynamicResolution::upscale(vk::CommandBuffer commandBuffer)
+{
+    _heap->bind(commandBuffer, vk::PipelineBindPoint::eGraphics);
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, *_pipeline);
+    setViewport(commandBuffer, _outputExtent);
+
+    float width = (float)_target.extent.width;
+    float height = (float)_target.extent.height;
+    auto constants = PushConstants{
+        .uvScale = {
+            (float)_renderExtent.width / width,
+            (float)_renderExtent.height / height,
+        },
+        .uvMax = {
+            ((float)_renderExtent.width - 0.5f) / width,
+            ((float)_renderExtent.height - 0.5f) / height,
+        },
+        .texelSize = {1.f / width, 1.f / height},
+        .sharpness = _options.sharpness,
+        .filterMode = (uint32_t)_options.filter,
+    };
+    commandBuffer.pushConstants(
+        _heap->pipelineLayout(),
+        vk::ShaderStageFlagBits::eAll,
+        0,
+        sizeof(constants),
+        &constants);
+    uint32_t handles[] {_target.handle, _samplerHandle};
+    commandBuffer.pushConstants(
+        _heap->pipelineLayout(),
+        vk::ShaderStageFlagBits::eAll,
+        BindlessHeap::handlePushOffset,
+        sizeof(handles),
+        handles);
+    commandBuffer.draw(3, 1, 0, 0);
+}
+
+void DynamicResolution::setFilter(UpscaleFilter filter, float sharpness)
+{
+    _options.filter = filter;
+    _options.sharpness = sharpness;
+}
+
+vk::RenderPass DynamicResolution::renderPass() const
+{
+    return *_renderPass;
+}
+
+vk::Extent2D DynamicResolution::renderExtent() const
+{
+    return _renderExtent;
+}
+
+float DynamicResolution::scale() const
+{
+    return _scale;
+}
+
+DynamicResolutionStats DynamicResolution::stats() const
+{
+    return _stats;
+}
+
+void DynamicResolution::updateScale(const GpuProfiler& profiler)
+{
+    // Frames recorded before the last change are skipped; the history is
+    // in frame order, so only its tail is new.
+    const auto& history = profiler.history();
+    auto first = history.end();
+    while (first != history.begin() &&
+            std::prev(first)->frame >= _nextProfiledFrame) {
+        --first;
+    }
+    for (auto it = first; it != history.end(); ++it) {
+        _gpuMilliseconds.push_back(it->gpuMilliseconds);
+        _nextProfiledFrame = it->frame + 1;
+    }
+    while (_gpuMilliseconds.size() > _options.settleFrames) {
+        _gpuMilliseconds.pop_front();
+    }
+    if (_gpuMilliseconds.empty()) {
+        return;
+    }
+
+    double average = std::reduce(
+        _gpuMilliseconds.begin(), _gpuMilliseconds.end()) /
+        (double)_gpuMilliseconds.size();
+    _stats.averageGpuMilliseconds = average;
+    if (_gpuMilliseconds.size() < _options.settleFrames) {
+        return;
+    }
+
+    float scale = _scale;
+    double target = _options.targetMilliseconds;
+    if (average > target) {
+        scale = std::min(
+            quantize(_scale * (float)std::sqrt(target / average),
+                _options.scaleStep),
+            _scale - _options.scaleStep);
+    } else if (average < target * _options.raiseThreshold) {
+        scale = _scale + _options.scaleStep;
+    }
+    scale = std::clamp(scale, _options.minScale, _options.maxScale);
+    if (std::abs(scale - _scale) < 1e-4f) {
+        return;
+    }
+
+    _scale = scale;
+    _stats.scaleChanges++;
+    _gpuMilliseconds.clear();
+    // Profiled frames from here on are recorded at the new scale.
+    _nextProfiledFrame = profiler.frameCount();
+}
+
+void DynamicResolution::createTarget(vk::Extent2D outputExtent, uint64_t frame)
+{
+    if (*_target.image) {
+        retireTarget(frame > 0 ? frame - 1 : 0);
+    }
+    _outputExtent = outputExtent;
+
+    Target& target = _target;
+    target.extent = vk::Extent2D{
+        .width = scaled(outputExtent.width, _options.maxScale),
+        .height = scaled(outputExtent.height, _options.maxScale),
+    };
+    target.image = _device->createImage(vk::ImageCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::ImageCreateFlags{},
+        .imageType = vk::ImageType::e2D,
+        .format = _options.format,
+        .extent = vk::Extent3D{
+            .width = target.extent.width,
+            .height = target.extent.height,
+            .depth = 1,
+        },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = vk::SampleCountFlagBits::e1,
+        .tiling = vk::ImageTiling::eOptimal,
+        .usage = vk::ImageUsageFlagBits::eColorAttachment |
+            vk::ImageUsageFlagBits::eSampled,
+        .sharingMode = vk::SharingMode::eExclusive,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = nullptr,
+        .initialLayout = vk::ImageLayout::eUndefined,
+    });
+    target.memory = _allocator->allocateForImage(
+        *target.image,
+        ResourceKind::Optimal,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    target.view = _device->createImageView(vk::ImageViewCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::ImageViewCreateFlags{},
+        .image = *target.image,
+        .viewType = vk::ImageViewType::e2D,
+        .format = _options.format,
+        .components = vk::ComponentMapping{},
+        .subresourceRange = vk::ImageSubresourceRange{
+            .aspectMask = vk::ImageAspectFlagBits::eColor,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    });
+    vk::ImageView attachment = *target.view;
+    target.framebuffer = _device->createFramebuffer(vk::FramebufferCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::FramebufferCreateFlags{},
+        .renderPass = *_renderPass,
+        .attachmentCount = 1,
+        .pAttachments = &attachment,
+        .width = target.extent.width,
+        .height = target.extent.height,
+        .layers = 1,
+    });
+    target.handle = _heap->addSampledImage(*target.view);
+    _stats.targetsCreated++;
+}
+
+void DynamicResolution::retireTarget(uint64_t lastFrame)
+{
+    _heap->releaseSampledImage(_target.handle, lastFrame);
+    _deletionQueue->retire(std::move(_target.framebuffer), lastFrame);
+    _deletionQueue->retire(std::move(_target.view), lastFrame);
+    _deletionQueue->retire(std::move(_target.image), lastFrame);
+    _deletionQueue->retire(_target.memory, lastFrame);
+    _target = Target{};
+}
+
+} // namespace rr
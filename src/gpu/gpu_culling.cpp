@@ -0,0 +1,351 @@
+#include <gpu_culling.hpp>
+
+#include <error.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace rr {
+
+namespace {
+
+constexpr uint32_t workgroupSize = 64;
+
+// Gribb and Hartmann: each plane is a sum or difference of the last row of
+// the matrix and one of the others, normalized so that plane distances are
+// in world units.
+void frustumPlanes(std::span<const float, 16> m, float planes[6][4])
+{
+    auto row = [m] (int r, int c) { return m[c * 4 + r]; };
+    for (int c = 0; c < 4; c++) {
+        planes[0][c] = row(3, c) + row(0, c);
+        planes[1][c] = row(3, c) - row(0, c);
+        planes[2][c] = row(3, c) + row(1, c);
+        planes[3][c] = row(3, c) - row(1, c);
+        planes[4][c] = row(2, c);
+        planes[5][c] = row(3, c) - row(2, c);
+    }
+    for (int i = 0; i < 6; i++) {
+        float length = std::sqrt(
+            planes[i][0] * planes[i][0] +
+            planes[i][1] * planes[i][1] +
+            planes[i][2] * planes[i][2]);
+        if (length > 0.f) {
+            for (int c = 0; c < 4; c++) {
+                planes[i][c] /= length;
+            }
+        }
+    }
+}
+
+} // namespace
+
+bool drawIndirectCountSupported(const vk::raii::PhysicalDevice& physicalDevice)
+{
+    for (const auto& extension :
+            physicalDevice.enumerateDeviceExtensionProperties()) {
+        if (std::strcmp(extension.extensionName,
+                VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+GpuCuller::GpuCuller(
+    const vk::raii::PhysicalDevice& physicalDevice,
+    const vk::raii::Device& device,
+    MemoryAllocator& allocator,
+    BindlessHeap& heap,
+    std::span<const uint32_t> cullShaderCode,
+    uint32_t frameContextCount,
+    GpuCullerOptions options)
+    : _device(&device)
+    , _allocator(&allocator)
+    , _heap(&heap)
+    , _options(options)
+    , _frames(frameContextCount)
+{
+    if (frameContextCount == 0) {
+        throw Error{} << "GPU culler needs a frame context";
+    }
+    if (_options.maxObjects == 0) {
+        throw Error{} << "GPU culler needs room for at least one object";
+    }
+    if (!_options.drawIndirectFirstInstance) {
+        throw Error{} << "GPU culler needs drawIndirectFirstInstance";
+    }
+
+    // Without multiDrawIndirect the limit is 1. The count variant needs room
+    // for every object in a single call; the others split calls.
+    _maxDrawCount = _options.multiDrawIndirect ?
+        physicalDevice.getProperties().limits.maxDrawIndirectCount : 1;
+    if (_maxDrawCount < _options.maxObjects) {
+        _options.drawIndirectCount = false;
+    }
+
+    auto shaderModule = device.createShaderModule(vk::ShaderModuleCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::ShaderModuleCreateFlags{},
+        .codeSize = cullShaderCode.size_bytes(),
+        .pCode = cullShaderCode.data(),
+    });
+    _pipeline = device.createComputePipeline(nullptr,
+        vk::ComputePipelineCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::PipelineCreateFlags{},
+            .stage = vk::PipelineShaderStageCreateInfo{
+                .pNext = nullptr,
+                .flags = vk::PipelineShaderStageCreateFlags{},
+                .stage = vk::ShaderStageFlagBits::eCompute,
+                .module = *shaderModule,
+                .pName = "main",
+                .pSpecializationInfo = nullptr,
+            },
+            .layout = heap.pipelineLayout(),
+            .basePipelineHandle = nullptr,
+            .basePipelineIndex = -1,
+        });
+
+    auto objectBufferInfo = vk::BufferCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::BufferCreateFlags{},
+        .size = _options.maxObjects * sizeof(CullObject),
+        .usage = vk::BufferUsageFlagBits::eStorageBuffer,
+        .sharingMode = vk::SharingMode::eExclusive,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = nullptr,
+    };
+    auto drawBufferInfo = vk::BufferCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::BufferCreateFlags{},
+        .size = drawCommandOffset +
+            _options.maxObjects * sizeof(vk::DrawIndexedIndirectCommand),
+        .usage = vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eIndirectBuffer |
+            vk::BufferUsageFlagBits::eTransferDst,
+        .sharingMode = vk::SharingMode::eExclusive,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = nullptr,
+    };
+    for (auto& frame : _frames) {
+        frame.objectBuffer = device.createBuffer(objectBufferInfo);
+        frame.objectMemory = allocator.allocateForBuffer(
+            *frame.objectBuffer,
+            vk::MemoryPropertyFlagBits::eHostVisible,
+            vk::MemoryPropertyFlagBits::eDeviceLocal |
+                vk::MemoryPropertyFlagBits::eHostCoherent);
+        frame.objectHandle = heap.addStorageBuffer(*frame.objectBuffer);
+
+        frame.drawBuffer = device.createBuffer(drawBufferInfo);
+        frame.drawMemory = allocator.allocateForBuffer(
+            *frame.drawBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+        frame.drawHandle = heap.addStorageBuffer(*frame.drawBuffer);
+    }
+}
+
+GpuCuller::~GpuCuller()
+{
+    for (auto& frame : _frames) {
+        _heap->releaseStorageBuffer(frame.objectHandle, 0);
+        _heap->releaseStorageBuffer(frame.drawHandle, 0);
+        frame.objectBuffer.clear();
+        frame.drawBuffer.clear();
+        _allocator->free(frame.objectMemory);
+        _allocator->free(frame.drawMemory);
+    }
+}
+
+CullObjectId GpuCuller::add(const CullObject& object)
+{
+    CullObjectId id = 0;
+    if (!_freeIds.empty()) {
+        id = _freeIds.back();
+        _freeIds.pop_back();
+        _objects[id] = object;
+    } else {
+        if (_objects.size() == _options.maxObjects) {
+            throw Error{} << "GPU culler is full (" << _options.maxObjects <<
+                " objects)";
+        }
+        id = (CullObjectId)_objects.size();
+        _objects.push_back(object);
+    }
+    markDirty(id);
+    return id;
+}
+
+void GpuCuller::update(CullObjectId id, const CullObject& object)
+{
+    _objects.at(id) = object;
+    markDirty(id);
+}
+
+void GpuCuller::remove(CullObjectId id)
+{
+    // The slot stays in the buffers, culled, until it is reused.
+    _objects.at(id) = CullObject{};
+    _objects[id].radius = -1.f;
+    _freeIds.push_back(id);
+    markDirty(id);
+}
+
+void GpuCuller::beginFrame(uint32_t frameContext)
+{
+    _frameContext = frameContext % (uint32_t)_frames.size();
+    FrameContext& frame = _frames[_frameContext];
+    auto mapped = (CullObject*)frame.objectMemory.mapped;
+
+    if (frame.allDirty) {
+        std::memcpy(
+            mapped, _objects.data(), _objects.size() * sizeof(CullObject));
+        _allocator->flush(
+            frame.objectMemory, 0, _objects.size() * sizeof(CullObject));
+        _stats.uploadedObjects = (uint32_t)_objects.size();
+    } else {
+        // Sorted, so that writes to write-combined memory are sequential and
+        // the flushed range is tight.
+        std::ranges::sort(frame.dirty);
+        for (CullObjectId id : frame.dirty) {
+            mapped[id] = _objects[id];
+        }
+        if (!frame.dirty.empty()) {
+            vk::DeviceSize begin = frame.dirty.front() * sizeof(CullObject);
+            vk::DeviceSize end =
+                (frame.dirty.back() + 1) * sizeof(CullObject);
+            _allocator->flush(frame.objectMemory, begin, end - begin);
+        }
+        _stats.uploadedObjects = (uint32_t)frame.dirty.size();
+    }
+    frame.dirty.clear();
+    frame.allDirty = false;
+    _stats.objects = (uint32_t)_objects.size();
+}
+
+void GpuCuller::cull(
+    vk::CommandBuffer commandBuffer,
+    std::span<const float, 16> viewProjection)
+{
+    FrameContext& frame = _frames[_frameContext];
+    auto objectCount = (uint32_t)_objects.size();
+    bool compact = _options.drawIndirectCount;
+
+    // The previous use of the buffer is from a completed frame, so only the
+    // counter reset needs ordering before the dispatch.
+    vk::PipelineStageFlags srcStage = vk::PipelineStageFlagBits::eTopOfPipe;
+    vk::AccessFlags srcAccess;
+    if (compact) {
+        commandBuffer.fillBuffer(*frame.drawBuffer, 0, sizeof(uint32_t), 0);
+        srcStage = vk::PipelineStageFlagBits::eTransfer;
+        srcAccess = vk::AccessFlagBits::eTransferWrite;
+    }
+    commandBuffer.pipelineBarrier(
+        srcStage,
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::DependencyFlags{},
+        vk::MemoryBarrier{
+            .pNext = nullptr,
+            .srcAccessMask = srcAccess,
+            .dstAccessMask = vk::AccessFlagBits::eShaderRead |
+                vk::AccessFlagBits::eShaderWrite,
+        },
+        {},
+        {});
+
+    auto push = PushConstants{
+        .planes = {},
+        .objectBuffer = frame.objectHandle,
+        .drawBuffer = frame.drawHandle,
+        .objectCount = objectCount,
+        .compact = compact ? 1u : 0u,
+    };
+    frustumPlanes(viewProjection, push.planes);
+
+    _heap->bind(commandBuffer, vk::PipelineBindPoint::eCompute);
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *_pipeline);
+    commandBuffer.pushConstants(
+        _heap->pipelineLayout(),
+        vk::ShaderStageFlagBits::eAll,
+        0,
+        sizeof(push),
+        &push);
+    _stats.dispatches = 0;
+    if (objectCount > 0) {
+        commandBuffer.dispatch(
+            (objectCount + workgroupSize - 1) / workgroupSize, 1, 1);
+        _stats.dispatches = 1;
+    }
+
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eDrawIndirect,
+        vk::DependencyFlags{},
+        vk::MemoryBarrier{
+            .pNext = nullptr,
+            .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+            .dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead,
+        },
+        {},
+        {});
+}
+
+void GpuCuller::draw(vk::CommandBuffer commandBuffer)
+{
+    const FrameContext& frame = _frames[_frameContext];
+    auto objectCount = (uint32_t)_objects.size();
+    constexpr auto stride = (uint32_t)sizeof(vk::DrawIndexedIndirectCommand);
+
+    _stats.drawCalls = 0;
+    if (objectCount == 0) {
+        return;
+    }
+    if (_options.drawIndirectCount) {
+        commandBuffer.drawIndexedIndirectCountKHR(
+            *frame.drawBuffer,
+            drawCommandOffset,
+            *frame.drawBuffer,
+            0,
+            objectCount,
+            stride);
+        _stats.drawCalls = 1;
+        return;
+    }
+    for (uint32_t first = 0; first < objectCount; first += _maxDrawCount) {
+        commandBuffer.drawIndexedIndirect(
+            *frame.drawBuffer,
+            drawCommandOffset + (vk::DeviceSize)first * stride,
+            std::min(_maxDrawCount, objectCount - first),
+            stride);
+        _stats.drawCalls++;
+    }
+}
+
+vk::Buffer GpuCuller::drawBuffer() const
+{
+    return *_frames[_frameContext].drawBuffer;
+}
+
+GpuCullerStats GpuCuller::stats() const
+{
+    return _stats;
+}
+
+void GpuCuller::markDirty(CullObjectId id)
+{
+    for (auto& frame : _frames) {
+        if (frame.allDirty) {
+            continue;
+        }
+        // Past this point a full copy is cheaper than tracking, and the
+        // list would otherwise grow with repeated updates of one object.
+        if (frame.dirty.size() >= _objects.size() / 2) {
+            frame.dirty.clear();
+            frame.allDirty = true;
+            continue;
+        }
+        frame.dirty.push_back(id);
+    }
+}
+
+} // namespace rr
@@ -0,0 +1,440 @@
+#include <gpu_profiler.hpp>
+
+#include <error.hpp>
+
+#include <algorithm>
+#include <array>
+#include <iomanip>
+#include <string_view>
+
+namespace rr {
+
+namespace {
+
+void writeJsonString(std::ostream& out, const std::string& s)
+{
+    out << '"';
+    for (char c : s) {
+        switch (c) {
+            case '"': out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    out << "\\u" << std::hex << std::setw(4) <<
+                        std::setfill('0') << (int)c << std::dec;
+                } else {
+                    out << c;
+                }
+        }
+    }
+    out << '"';
+}
+
+// Scope names may contain commas; quote them the way spreadsheets expect.
+void writeCsvString(std::ostream& out, const std::string& s)
+{
+    out << '"';
+    for (char c : s) {
+        if (c == '"') {
+            out << '"';
+        }
+        out << c;
+    }
+    out << '"';
+}
+
+} // namespace
+
+double gpuOverlapMilliseconds(const GpuFrameResult& a, const GpuFrameResult& b)
+{
+    if (!a.hostBeginNanoseconds || !b.hostBeginNanoseconds) {
+        return 0.0;
+    }
+
+    // Relative to the earlier frame, so the doubles keep their precision.
+    uint64_t origin =
+        std::min(*a.hostBeginNanoseconds, *b.hostBeginNanoseconds);
+    double aBegin = (double)(*a.hostBeginNanoseconds - origin) / 1e6;
+    double bBegin = (double)(*b.hostBeginNanoseconds - origin) / 1e6;
+    double begin = std::max(aBegin, bBegin);
+    double end = std::min(
+        aBegin + a.gpuMilliseconds, bBegin + b.gpuMilliseconds);
+    return std::max(end - begin, 0.0);
+}
+
+bool calibratedTimestampsSupported(
+    const vk::raii::PhysicalDevice& physicalDevice)
+{
+    auto extensions = physicalDevice.enumerateDeviceExtensionProperties();
+    bool extension = std::ranges::any_of(extensions, [] (const auto& e) {
+        return std::string_view{e.extensionName} ==
+            VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME;
+    });
+    if (!extension) {
+        return false;
+    }
+
+    auto domains = physicalDevice.getCalibrateableTimeDomainsEXT();
+    auto has = [&] (vk::TimeDomainEXT domain) {
+        return std::ranges::find(domains, domain) != domains.end();
+    };
+    return has(vk::TimeDomainEXT::eDevice) &&
+        has(vk::TimeDomainEXT::eClockMonotonic);
+}
+
+GpuProfiler::GpuProfiler(
+    const vk::raii::PhysicalDevice& physicalDevice,
+    const vk::raii::Device& device,
+    uint32_t queueFamilyIndex,
+    uint32_t frameContextCount,
+    uint32_t maxScopesPerFrame,
+    size_t historySize)
+    : _device(&device)
+    , _maxScopes(maxScopesPerFrame)
+    , _historySize(historySize)
+    , _frames(frameContextCount)
+{
+    if (frameContextCount == 0) {
+        throw Error{} << "profiler needs at least one frame context";
+    }
+
+    _timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+
+    auto queueFamilies = physicalDevice.getQueueFamilyProperties();
+    uint32_t validBits = queueFamilies.at(queueFamilyIndex).timestampValidBits;
+    if (validBits == 0) {
+        return;
+    }
+    _timestampMask = validBits >= 64 ?
+        ~uint64_t{0} : (uint64_t{1} << validBits) - 1;
+
+    auto queryPoolInfo = vk::QueryPoolCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::QueryPoolCreateFlags{},
+        .queryType = vk::QueryType::eTimestamp,
+        .queryCount = maxScopesPerFrame * 2,
+        .pipelineStatistics = vk::QueryPipelineStatisticFlags{},
+    };
+    for (auto& frame : _frames) {
+        frame.queryPool = device.createQueryPool(queryPoolInfo);
+        frame.scopes.reserve(maxScopesPerFrame);
+    }
+}
+
+bool GpuProfiler::supported() const
+{
+    return _timestampMask != 0;
+}
+
+void GpuProfiler::beginFrame(
+    uint32_t frameContext, vk::CommandBuffer commandBuffer)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (_current) {
+        _current->cpuMilliseconds =
+            std::chrono::duration<double, std::milli>(
+                now - _current->cpuBegin).count();
+    }
+
+    _current = &_frames.at(frameContext % _frames.size());
+    if (_current->pending) {
+        collect(*_current);
+    }
+
+    _current->scopes.clear();
+    _current->frame = _frameNumber++;
+    _current->cpuBegin = now;
+    _current->pending = false;
+    _depth = 0;
+
+    if (supported()) {
+        commandBuffer.resetQueryPool(*_current->queryPool, 0, _maxScopes * 2);
+    }
+}
+
+uint32_t GpuProfiler::beginScope(
+    vk::CommandBuffer commandBuffer, std::string name)
+{
+    if (!supported() || !_current || _current->scopes.size() >= _maxScopes) {
+        return UINT32_MAX;
+    }
+
+    auto scope = (uint32_t)_current->scopes.size();
+    _current->scopes.push_back(Scope{
+        .name = std::move(name),
+        .depth = _depth++,
+    });
+    _current->pending = true;
+
+    commandBuffer.writeTimestamp(
+        vk::PipelineStageFlagBits::eTopOfPipe,
+        *_current->queryPool,
+        scope * 2);
+    return scope;
+}
+
+void GpuProfiler::endScope(vk::CommandBuffer commandBuffer, uint32_t scope)
+{
+    if (scope == UINT32_MAX || !_current) {
+        return;
+    }
+
+    _depth--;
+    commandBuffer.writeTimestamp(
+        vk::PipelineStageFlagBits::eBottomOfPipe,
+        *_current->queryPool,
+        scope * 2 + 1);
+}
+
+void GpuProfiler::enableCalibration()
+{
+    _calibrated = true;
+}
+
+uint64_t GpuProfiler::frameCount() const
+{
+    return _frameNumber;
+}
+
+std::optional<GpuFrameResult> GpuProfiler::latestFrame() const
+{
+    if (_history.empty()) {
+        return std::nullopt;
+    }
+    return _history.back();
+}
+
+const std::deque<GpuFrameResult>& GpuProfiler::history() const
+{
+    return _history;
+}
+
+void GpuProfiler::writeCsv(std::ostream& out) const
+{
+    out << "frame,cpu_ms,gpu_ms,host_begin_ns,scope,depth,scope_begin_ms," <<
+        "scope_ms\n";
+    for (const auto& frame : _history) {
+        for (const auto& scope : frame.scopes) {
+            out << frame.frame << "," <<
+                frame.cpuMilliseconds << "," <<
+                frame.gpuMilliseconds << ",";
+            if (frame.hostBeginNanoseconds) {
+                out << *frame.hostBeginNanoseconds;
+            }
+            out << ",";
+            writeCsvString(out, scope.name);
+            out << "," << scope.depth << "," << scope.beginMilliseconds <<
+                "," << scope.milliseconds << "\n";
+        }
+    }
+}
+
+void GpuProfiler::writeJson(std::ostream& out) const
+{
+    out << "{\"frames\":[";
+    for (size_t i = 0; i < _history.size(); i++) {
+        const auto& frame = _history[i];
+        out << (i > 0 ? "," : "") <<
+            "{\"frame\":" << frame.frame <<
+            ",\"cpu_ms\":" << frame.cpuMilliseconds <<
+            ",\"gpu_ms\":" << frame.gpuMilliseconds <<
+            ",\"host_begin_ns\":";
+        if (frame.hostBeginNanoseconds) {
+            out << *frame.hostBeginNanoseconds;
+        } else {
+            out << "null";
+        }
+        out << ",\"scopes\":[";
+        for (size_t j = 0; j < frame.scopes.size(); j++) {
+            const auto& scope = frame.scopes[j];
+            out << (j > 0 ? "," : "") << "{\"name\":";
+            writeJsonString(out, scope.name);
+            out << ",\"depth\":" << scope.depth <<
+                ",\"begin_ms\":" << scope.beginMilliseconds <<
+                ",\"ms\":" << scope.milliseconds << "}";
+        }
+        out << "]}";
+    }
+    out << "]}\n";
+}
+
+void GpuProfiler::drawOverlay(
+    BatchRenderer& renderer,
+    MaterialId material,
+    float x,
+    float y,
+    float width,
+    float height,
+    double budgetMilliseconds) const
+{
+    constexpr uint32_t background = 0xc0000000;
+    constexpr uint32_t underBudget = 0xff40c040;
+    constexpr uint32_t overBudget = 0xff4040e0;
+    constexpr uint32_t budgetLine = 0xffffffff;
+    constexpr uint32_t cpuColor = 0xff40e0e0;
+    constexpr auto scopeColors = std::array<uint32_t, 6>{
+        0xffe0a040, 0xff40a0e0, 0xffa040e0,
+        0xff40e0a0, 0xffe04080, 0xff80e040,
+    };
+
+    auto quad = [&] (float left, float top, float w, float h, uint32_t c) {
+        renderer.drawQuad(material, QuadInstance{
+            .position = {left + w / 2, top + h / 2},
+            .size = {w, h},
+            .rotation = 0.f,
+            .color = c,
+            .uvMin = {0.f, 0.f},
+            .uvMax = {1.f, 1.f},
+        });
+    };
+
+    quad(x, y, width, height, background);
+
+    // Frame graph over the top three quarters, the budget at two thirds of
+    // its height; frames over budget are red. A tick on each bar marks the
+    // frame's CPU time.
+    float graphHeight = height * 0.75f;
+    float budgetHeight = graphHeight * (2.f / 3.f);
+    float barWidth = 2.f;
+    auto barCount = std::min(_history.size(), (size_t)(width / barWidth));
+    for (size_t i = 0; i < barCount; i++) {
+        const auto& frame = _history[_history.size() - barCount + i];
+        float h = std::min(
+            (float)(frame.gpuMilliseconds / budgetMilliseconds) * budgetHeight,
+            graphHeight);
+        quad(
+            x + (float)i * barWidth,
+            y + graphHeight - h,
+            barWidth,
+            h,
+            frame.gpuMilliseconds > budgetMilliseconds ?
+                overBudget : underBudget);
+        float cpuHeight = std::min(
+            (float)(frame.cpuMilliseconds / budgetMilliseconds) *
+                budgetHeight,
+            graphHeight - 2.f);
+        quad(
+            x + (float)i * barWidth,
+            y + graphHeight - cpuHeight - 2.f,
+            barWidth,
+            2.f,
+            cpuColor);
+    }
+    quad(x, y + graphHeight - budgetHeight, width, 1.f, budgetLine);
+
+    // Top-level GPU scopes of the latest frame, stacked left to right, and
+    // its CPU time on the same scale below them.
+    if (_history.empty()) {
+        return;
+    }
+    const GpuFrameResult& latest = _history.back();
+    float rowHeight = (height - graphHeight - 6.f) / 2.f;
+    float left = x;
+    size_t colorIndex = 0;
+    for (const auto& scope : latest.scopes) {
+        if (scope.depth != 0) {
+            continue;
+        }
+        float w = (float)(scope.milliseconds / budgetMilliseconds) * width;
+        w = std::min(w, x + width - left);
+        if (w <= 0.f) {
+            break;
+        }
+        quad(
+            left,
+            y + graphHeight + 2.f,
+            w,
+            rowHeight,
+            scopeColors[colorIndex++ % scopeColors.size()]);
+        left += w;
+    }
+    float cpuWidth = std::min(
+        (float)(latest.cpuMilliseconds / budgetMilliseconds) * width, width);
+    if (cpuWidth > 0.f) {
+        quad(x, y + graphHeight + rowHeight + 4.f, cpuWidth, rowHeight,
+            cpuColor);
+    }
+}
+
+void GpuProfiler::collect(FrameContext& context)
+{
+    context.pending = false;
+    if (context.scopes.empty()) {
+        return;
+    }
+
+    // The caller has waited for the frame, so the results are available and
+    // this does not block.
+    auto queryCount = (uint32_t)context.scopes.size() * 2;
+    auto [result, timestamps] = context.queryPool.getResults<uint64_t>(
+        0,
+        queryCount,
+        queryCount * sizeof(uint64_t),
+        sizeof(uint64_t),
+        vk::QueryResultFlagBits::e64);
+    if (result != vk::Result::eSuccess) {
+        return;
+    }
+
+    auto milliseconds = [this] (uint64_t begin, uint64_t end) {
+        return (double)((end - begin) & _timestampMask) *
+            _timestampPeriod / 1e6;
+    };
+
+    uint64_t first = timestamps[0];
+    auto frame = GpuFrameResult{
+        .frame = context.frame,
+        .cpuMilliseconds = context.cpuMilliseconds,
+        .gpuMilliseconds = 0.0,
+        .hostBeginNanoseconds = std::nullopt,
+        .scopes = {},
+    };
+    if (_calibrated) {
+        frame.hostBeginNanoseconds = hostNanoseconds(first);
+    }
+    frame.scopes.reserve(context.scopes.size());
+
+    for (size_t i = 0; i < context.scopes.size(); i++) {
+        uint64_t begin = timestamps[i * 2];
+        uint64_t end = timestamps[i * 2 + 1];
+        frame.scopes.push_back(GpuScopeResult{
+            .name = std::move(context.scopes[i].name),
+            .depth = context.scopes[i].depth,
+            .beginMilliseconds = milliseconds(first, begin),
+            .milliseconds = milliseconds(begin, end),
+        });
+        frame.gpuMilliseconds =
+            std::max(frame.gpuMilliseconds, milliseconds(first, end));
+    }
+
+    _history.push_back(std::move(frame));
+    while (_history.size() > _historySize) {
+        _history.pop_front();
+    }
+}
+
+uint64_t GpuProfiler::hostNanoseconds(uint64_t timestamp) const
+{
+    auto infos = std::array{
+        vk::CalibratedTimestampInfoEXT{
+            .pNext = nullptr,
+            .timeDomain = vk::TimeDomainEXT::eDevice,
+        },
+        vk::CalibratedTimestampInfoEXT{
+            .pNext = nullptr,
+            .timeDomain = vk::TimeDomainEXT::eClockMonotonic,
+        },
+    };
+    std::vector<uint64_t> values =
+        _device->getCalibratedTimestampsEXT(infos).first;
+
+    // The frame has finished, so its timestamp is before the device one of
+    // the pair.
+    auto before = (double)((values[0] - timestamp) & _timestampMask) *
+        _timestampPeriod;
+    return values[1] - (uint64_t)before;
+}
+
+} // namespace rr
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <gpu_profiler.hpp>
+#include <timeline.hpp>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace rr {
+
+// Returns a queue family that supports compute but not graphics, if the
+// device has one. Work on such a family runs alongside the graphics queue
+// on hardware with separate compute engines.
+std::optional<uint32_t> findComputeQueueFamily(
+    const vk::raii::PhysicalDevice& physicalDevice);
+
+struct AsyncComputeOptions {
+    uint32_t computeQueueFamily = 0;
+    uint32_t graphicsQueueFamily = 0;
+    // Registered with the TimelineSync passed to AsyncCompute. Without a
+    // separate compute queue, both are the graphics queue.
+    QueueId computeQueue = 0;
+    QueueId graphicsQueue = 0;
+};
+
+// Records and submits compute work on its own queue, so that it overlaps
+// graphics work instead of serializing behind it.
+//
+// Each frame gets one compute command buffer. Its submission returns a
+// timeline point; the graphics submission that consumes the results waits
+// for it at the stage where they are first used, so graphics work before
+// that stage overlaps the compute work. Compute work that consumes
+// graphics results, e.g. of the previous frame, waits for a graphics point
+// the same way.
+//
+// Buffers and images shared with graphics are either created with
+// CONCURRENT sharing, or handed over with release and acquire barriers:
+// releaseBuffer and releaseImage record the release into the compute
+// command buffer, and recordAcquire records the matching acquires into the
+// graphics command buffer. On a shared family they are plain barriers.
+//
+// The compute command buffers are profiled with their own GpuProfiler;
+// overlapMilliseconds lines its frames up with those of the graphics queue's
+// profiler by their host begin times, so both profilers must be calibrated.
+class AsyncCompute {
+public:
+    AsyncCompute(
+        const vk::raii::PhysicalDevice& physicalDevice,
+        const vk::raii::Device& device,
+        TimelineSync& sync,
+        uint32_t frameContextCount,
+        AsyncComputeOptions options);
+
+    AsyncCompute(const AsyncCompute&) = delete;
+    AsyncCompute& operator=(const AsyncCompute&) = delete;
+
+    // Waits for the frame context's previous compute submission, which has
+    // usually long finished, and begins its command buffer with a profiler
+    // frame.
+    vk::CommandBuffer beginFrame(uint32_t frameContext);
+
+    // Hands resources written by this frame's compute work to the graphics
+    // queue. srcAccess describes the compute shader writes, dstAccess and
+    // dstStage the first graphics use.
+    void releaseBuffer(
+        vk::Buffer buffer,
+        vk::AccessFlags srcAccess,
+        vk::AccessFlags dstAccess,
+        vk::PipelineStageFlags dstStage);
+    void releaseImage(
+        vk::Image image,
+        const vk::ImageSubresourceRange& range,
+        vk::ImageLayout oldLayout,
+        vk::ImageLayout newLayout,
+        vk::AccessFlags srcAccess,
+        vk::AccessFlags dstAccess,
+        vk::PipelineStageFlags dstStage);
+
+    // Ends and submits the frame's command buffer. The returned point is
+    // what the graphics queue waits on.
+    TimelinePoint submit(std::span<const TimelineWait> waits = {});
+
+    // What the graphics submission waits for: the submitted point at the
+    // stages of the released resources' first use, or nothing if nothing was
+    // released.
+    TimelineWait wait() const;
+    // Records the acquires matching this frame's releases into a graphics
+    // command buffer, before the resources are used.
+    void recordAcquire(vk::CommandBuffer commandBuffer) const;
+
+    // False if compute shares the graphics queue, in which case submissions
+    // serialize with graphics work.
+    bool dedicated() const;
+    uint32_t queueFamily() const;
+    GpuProfiler& profiler();
+
+    // GPU time of the latest compute frame that overlapped the graphics
+    // frame with the same number, or zero if either is not available yet or
+    // not calibrated. Both profilers must begin a frame for every frame.
+    double overlapMilliseconds(const GpuProfiler& graphicsProfiler) const;
+
+private:
+    struct FrameContext {
+        vk::raii::CommandPool commandPool {nullptr};
+        vk::CommandBuffer commandBuffer;
+        TimelinePoint point;
+    };
+
+    TimelineSync* _sync = nullptr;
+    AsyncComputeOptions _options;
+    bool _separateFamily = false;
+
+    std::vector<FrameContext> _frames;
+    FrameContext* _current = nullptr;
+    uint32_t _frameScope = UINT32_MAX;
+    GpuProfiler _profiler;
+
+    TimelinePoint _point;
+    vk::PipelineStageFlags _waitStages;
+    std::vector<vk::BufferMemoryBarrier> _acquireBuffers;
+    std::vector<vk::ImageMemoryBarrier> _acquireImages;
+};
+
+} // namespace rr
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <bindless_heap.hpp>
+#include <memory_allocator.hpp>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace rr {
+
+using MaterialId = uint32_t;
+using MeshId = uint32_t;
+
+// A pipeline and the descriptor set (usually just a texture) bound at set 0.
+// Materials sharing a pipeline are drawn next to each other.
+//
+// Materials of pipelines that use a BindlessHeap leave descriptorSet empty
+// and set texture and sampler instead. The handles are pushed at
+// BindlessHeap::handlePushOffset, so the heap is bound once and switching
+// between such materials costs a push constant update.
+struct BatchMaterial {
+    vk::Pipeline pipeline;
+    vk::PipelineLayout layout;
+    vk::DescriptorSet descriptorSet;
+    BindlessHandle texture = invalidBindlessHandle;
+    BindlessHandle sampler = 0;
+};
+
+struct BatchMesh {
+    vk::Buffer vertexBuffer;
+    vk::DeviceSize vertexOffset = 0;
+    // Leave indexBuffer empty for non-indexed meshes; count is the index or
+    // vertex count.
+    vk::Buffer indexBuffer;
+    vk::DeviceSize indexOffset = 0;
+    vk::IndexType indexType = vk::IndexType::eUint16;
+    uint32_t count = 0;
+};
+
+struct MeshVertex {
+    float position[3];
+    float normal[3];
+    float uv[2];
+};
+
+// Quads are expanded from gl_VertexIndex in the vertex shader, so they need
+// no vertex buffer. A sprite is a quad with a textured material and the
+// sprite's rectangle in the texture as uv range.
+struct QuadInstance {
+    float position[2] {0.f, 0.f};
+    float size[2] {1.f, 1.f};
+    float rotation = 0.f;
+    // RGBA8, red in the lowest byte.
+    uint32_t color = 0xffffffff;
+    float uvMin[2] {0.f, 0.f};
+    float uvMax[2] {1.f, 1.f};
+};
+
+struct MeshInstance {
+    // Row-major 3x4 object-to-world transform.
+    float transform[3][4] {
+        {1.f, 0.f, 0.f, 0.f},
+        {0.f, 1.f, 0.f, 0.f},
+        {0.f, 0.f, 1.f, 0.f},
+    };
+    uint32_t color = 0xffffffff;
+    uint32_t padding[3] {};
+};
+
+// Vertex input state matching the instance layouts above, for creating
+// material pipelines. The reference shaders are in src/gpu/shaders.
+struct BatchVertexInput {
+    std::vector<vk::VertexInputBindingDescription> bindings;
+    std::vector<vk::VertexInputAttributeDescription> attributes;
+
+    vk::PipelineVertexInputStateCreateInfo createInfo() const;
+};
+
+struct BatchStats {
+    uint64_t instances = 0;
+    uint64_t draws = 0;
+    uint64_t pipelineBinds = 0;
+    uint64_t descriptorSetBinds = 0;
+    uint64_t handlePushes = 0;
+    vk::DeviceSize instanceBytes = 0;
+};
+
+// Collects quads, sprites and meshes over a frame and draws them with one
+// instanced call per (material, mesh) pair.
+//
+// Instances are written straight into the frame context's persistently
+// mapped instance buffer, into chunks that each batch takes from it as it
+// fills them. A batch's first chunk holds as many instances as it had the
+// last time it was drawn and further chunks double its size, so a steady
+// workload needs one chunk per batch. record() sorts the batches by
+// pipeline and descriptor set, so each pipeline and texture is bound once,
+// and draws each run of contiguous chunks with one instanced call.
+//
+// A frame that fills the buffer continues in an additional one. Buffers
+// are only replaced in beginFrame, which merges them into one buffer large
+// enough for the whole frame, so record() can be called any number of
+// times.
+class BatchRenderer {
+public:
+    // Mesh id for quads, which are generated in the vertex shader.
+    static constexpr MeshId quadMesh = 0;
+
+    BatchRenderer(
+        const vk::raii::Device& device,
+        MemoryAllocator& allocator,
+        uint32_t frameContextCount);
+    ~BatchRenderer();
+
+    BatchRenderer(const BatchRenderer&) = delete;
+    BatchRenderer& operator=(const BatchRenderer&) = delete;
+
+    static BatchVertexInput quadVertexInput();
+    static BatchVertexInput meshVertexInput();
+
+    MaterialId addMaterial(const BatchMaterial& material);
+    MeshId addMesh(const BatchMesh& mesh);
+
+    // Drops the instances of the previous frame. The caller must make sure
+    // the GPU has finished with the frame context's instance buffer.
+    void beginFrame(uint32_t frameContext);
+
+    void drawQuad(MaterialId material, const QuadInstance& instance);
+    void drawMesh(
+        MaterialId material, MeshId mesh, const MeshInstance& instance);
+
+    // Records the batched draws of the frame's instances into a command
+    // buffer inside a render pass.
+    void record(vk::CommandBuffer commandBuffer);
+
+    // Records the same instances with one draw, and one pipeline and
+    // descriptor bind, per object. Reference path for benchmarks.
+    void recordNaive(vk::CommandBuffer commandBuffer);
+
+    // Counters of the last record call.
+    BatchStats stats() const;
+
+private:
+    // A batch's instances in one of the frame context's buffers.
+    struct Chunk {
+        uint32_t buffer = 0;
+        vk::DeviceSize offset = 0;
+        std::byte* data = nullptr;
+        uint32_t instanceCount = 0;
+        uint32_t capacity = 0;
+    };
+
+    struct Batch {
+        MaterialId material = 0;
+        MeshId mesh = 0;
+        uint32_t instanceSize = 0;
+        uint32_t instanceCount = 0;
+        // The instance count of the last frame the batch was drawn in.
+        uint32_t previousCount = 0;
+        std::vector<Chunk> chunks;
+    };
+
+    struct Buffer {
+        vk::raii::Buffer buffer {nullptr};
+        MemoryAllocation memory;
+        vk::DeviceSize capacity = 0;
+        vk::DeviceSize used = 0;
+    };
+
+    struct FrameContext {
+        std::vector<Buffer> buffers;
+        // The buffer chunks are taken from.
+        uint32_t current = 0;
+    };
+
+    Batch& batchFor(MaterialId material, MeshId mesh, uint32_t instanceSize);
+    // Returns where the batch's next instance goes.
+    std::byte* allocateInstance(Batch& batch);
+    void addChunk(Batch& batch);
+    Buffer createBuffer(vk::DeviceSize capacity) const;
+    void freeBuffer(Buffer& buffer) const;
+    void prepareRecord();
+    void bindMaterial(
+        vk::CommandBuffer commandBuffer,
+        const BatchMaterial& material,
+        const BatchMaterial* bound);
+    void bindMesh(
+        vk::CommandBuffer commandBuffer,
+        const Batch& batch,
+        vk::Buffer instanceBuffer,
+        vk::DeviceSize instanceOffset);
+    void drawBatch(
+        vk::CommandBuffer commandBuffer,
+        const Batch& batch,
+        uint32_t instanceCount);
+
+    const vk::raii::Device* _device = nullptr;
+    MemoryAllocator* _allocator = nullptr;
+
+    std::vector<BatchMaterial> _materials;
+    std::vector<BatchMesh> _meshes;
+
+    std::vector<FrameContext> _frames;
+    uint32_t _frameContext = 0;
+
+    // Batches are kept across frames so their chunk arrays keep their
+    // capacity and their previous instance count.
+    std::vector<Batch> _batches;
+    std::unordered_map<uint64_t, uint32_t> _batchIndex;
+    std::vector<uint32_t> _activeBatches;
+    uint64_t _lastKey = UINT64_MAX;
+    uint32_t _lastBatch = 0;
+
+    BatchStats _stats;
+};
+
+} // namespace rr
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+namespace rr {
+
+// Index into one of the arrays of a BindlessHeap.
+using BindlessHandle = uint32_t;
+constexpr BindlessHandle invalidBindlessHandle = UINT32_MAX;
+
+struct BindlessHeapOptions {
+    // Clamped to the device's update-after-bind limits.
+    uint32_t sampledImages = 65536;
+    uint32_t storageBuffers = 16384;
+    uint32_t samplers = 256;
+};
+
+struct BindlessHeapStats {
+    uint32_t sampledImages = 0;
+    uint32_t storageBuffers = 0;
+    uint32_t samplers = 0;
+    // Handles released but not yet reusable.
+    uint32_t pendingReleases = 0;
+    uint64_t descriptorWrites = 0;
+};
+
+// Returns true if the device supports the features a BindlessHeap needs:
+// the descriptor indexing ones, and indexing the heap's arrays with
+// dynamically uniform and non-uniform indices. Enable them on a device's
+// core and descriptor indexing features with enableBindlessFeatures.
+bool bindlessSupported(const vk::raii::PhysicalDevice& physicalDevice);
+void enableBindlessFeatures(
+    vk::PhysicalDeviceFeatures& core,
+    vk::PhysicalDeviceDescriptorIndexingFeatures& f);
+
+// One descriptor set holding every sampled image, storage buffer and sampler
+// in large, partially bound arrays:
+//
+//   set 0, binding 0: texture2D textures[]
+//   set 0, binding 1: buffer buffers[]
+//   set 0, binding 2: sampler samplers[]
+//
+// Shaders index the arrays with handles passed in push constants (see
+// src/gpu/shaders/bindless.glsl), so the set is bound once per frame and
+// switching materials only pushes new handles.
+//
+// The set is update-after-bind: adding a resource writes its descriptor
+// without waiting for frames in flight, which never read the new slot.
+// Released handles are only reused once the frames that may still read them
+// have completed, as reported through collect.
+class BindlessHeap {
+public:
+    // Handles are pushed at this offset, after a mat4 the vertex stage may
+    // use, and the layout's push constant range covers 128 bytes, the
+    // minimum every device supports.
+    static constexpr uint32_t handlePushOffset = 64;
+    static constexpr uint32_t pushConstantSize = 128;
+
+    BindlessHeap(
+        const vk::raii::PhysicalDevice& physicalDevice,
+        const vk::raii::Device& device,
+        BindlessHeapOptions options = {});
+
+    BindlessHeap(const BindlessHeap&) = delete;
+    BindlessHeap& operator=(const BindlessHeap&) = delete;
+
+    BindlessHandle addSampledImage(
+        vk::ImageView view,
+        vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal);
+    BindlessHandle addStorageBuffer(
+        vk::Buffer buffer,
+        vk::DeviceSize offset = 0,
+        vk::DeviceSize range = VK_WHOLE_SIZE);
+    BindlessHandle addSampler(vk::Sampler sampler);
+
+    // Points a handle at another resource, e.g. when a streamed texture
+    // gains mip levels. Frames in flight may still read the old descriptor,
+    // so only replace it with a view of the same resource.
+    void updateSampledImage(
+        BindlessHandle handle,
+        vk::ImageView view,
+        vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal);
+
+    // lastFrame is the last frame that may use the handle, in the numbering
+    // used by collect.
+    void releaseSampledImage(BindlessHandle handle, uint64_t lastFrame);
+    void releaseStorageBuffer(BindlessHandle handle, uint64_t lastFrame);
+    void releaseSampler(BindlessHandle handle, uint64_t lastFrame);
+
+    // Makes handles of completed frames available again. completedFrames is
+    // the number of frames known to be finished on the GPU.
+    void collect(uint64_t completedFrames);
+
+    // Writes pending descriptors and binds the set at set 0. Call it once
+    // per command buffer, before any draw that uses the heap.
+    void bind(vk::CommandBuffer commandBuffer, vk::PipelineBindPoint bindPoint);
+    // Writes pending descriptors; bind does this too.
+    void flush();
+
+    vk::DescriptorSetLayout setLayout() const;
+    // The heap's set at set 0 and a push constant range of pushConstantSize
+    // bytes for all stages. Pipelines that use the heap should use it.
+    vk::PipelineLayout pipelineLayout() const;
+    BindlessHeapStats stats() const;
+
+private:
+    enum Binding : uint32_t {
+        SampledImages = 0,
+        StorageBuffers = 1,
+        Samplers = 2,
+        BindingCount,
+    };
+
+    struct Slots {
+        uint32_t capacity = 0;
+        uint32_t next = 0;
+        std::vector<BindlessHandle> free;
+        // Released handles and the completed frame count from which they can
+        // be reused, in release order.
+        std::deque<std::pair<uint64_t, BindlessHandle>> released;
+    };
+
+    struct PendingWrite {
+        Binding binding = SampledImages;
+        BindlessHandle handle = 0;
+        vk::DescriptorImageInfo image;
+        vk::DescriptorBufferInfo buffer;
+    };
+
+    BindlessHandle allocate(Binding binding);
+    void release(Binding binding, BindlessHandle handle, uint64_t lastFrame);
+
+    const vk::raii::Device* _device = nullptr;
+
+    vk::raii::DescriptorSetLayout _setLayout {nullptr};
+    vk::raii::PipelineLayout _pipelineLayout {nullptr};
+    vk::raii::DescriptorPool _pool {nullptr};
+    // Freed with the pool, which is not created with FREE_DESCRIPTOR_SET.
+    vk::DescriptorSet _set;
+
+    Slots _slots[BindingCount];
+    std::vector<PendingWrite> _pendingWrites;
+    uint64_t _descriptorWrites = 0;
+};
+
+} // namespace rr
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <memory_allocator.hpp>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rr {
+
+struct DeletionQueueOptions {
+    // Destroy completed batches on a worker thread instead of in collect,
+    // so that drivers that take long to destroy objects (pipelines, large
+    // dedicated allocations) do not hold up the render thread.
+    bool backgroundThread = false;
+};
+
+struct DeletionQueueStats {
+    uint64_t retired = 0;
+    uint64_t destroyed = 0;
+    // Batches destroyed; every frame that retired something is one batch.
+    uint64_t batches = 0;
+    // Objects retired but not destroyed yet.
+    uint32_t pending = 0;
+};
+
+// Destroys resources once the frames that may use them have completed.
+//
+// Objects dropped while frames are in flight are moved into the queue
+// together with the last frame that may use them, instead of stalling with
+// device.waitIdle() or destroying them under a running command buffer.
+// Objects retired for the same frame form one batch; collect destroys the
+// batches of completed frames, either right away or, with the background
+// thread, by handing them to a worker. Within a batch, pipelines and views
+// are destroyed before the images and buffers they refer to, and memory
+// allocations last.
+//
+// Frame numbers are those of the other collect calls. A queue used with a
+// single timeline can pass timeline values instead, and the completed value
+// plus one as completedFrames.
+//
+// retire and collect must be called from one thread. The destructor
+// destroys everything still queued, so the device must be idle by then.
+class DeletionQueue {
+public:
+    // The allocator frees retired memory allocations; it may be null if
+    // none are retired.
+    explicit DeletionQueue(
+        MemoryAllocator* allocator, DeletionQueueOptions options = {});
+    ~DeletionQueue();
+
+    DeletionQueue(const DeletionQueue&) = delete;
+    DeletionQueue& operator=(const DeletionQueue&) = delete;
+
+    // lastFrame is the last frame that may use the object.
+    void retire(vk::raii::Pipeline pipeline, uint64_t lastFrame);
+    void retire(vk::raii::Framebuffer framebuffer, uint64_t lastFrame);
+    void retire(vk::raii::ImageView view, uint64_t lastFrame);
+    void retire(vk::raii::Image image, uint64_t lastFrame);
+    void retire(vk::raii::Buffer buffer, uint64_t lastFrame);
+    void retire(vk::raii::Sampler sampler, uint64_t lastFrame);
+    void retire(const MemoryAllocation& allocation, uint64_t lastFrame);
+    // For anything else, e.g. an object owning several resources. Runs
+    // before the other objects of its batch are destroyed, on the worker
+    // thread if there is one.
+    void retire(std::function<void()> destroy, uint64_t lastFrame);
+
+    // Destroys the batches of completed frames. completedFrames is the
+    // number of frames known to be finished on the GPU; UINT64_MAX, after
+    // waiting for the device, destroys everything.
+    void collect(uint64_t completedFrames);
+    // Waits until the worker thread has destroyed what collect handed it.
+    void wait();
+
+    DeletionQueueStats stats() const;
+
+private:
+    struct Batch {
+        uint64_t lastFrame = 0;
+        uint32_t count = 0;
+        std::vector<std::function<void()>> functions;
+        std::vector<vk::raii::Pipeline> pipelines;
+        std::vector<vk::raii::Framebuffer> framebuffers;
+        std::vector<vk::raii::ImageView> views;
+        std::vector<vk::raii::Image> images;
+        std::vector<vk::raii::Buffer> buffers;
+        std::vector<vk::raii::Sampler> samplers;
+        std::vector<MemoryAllocation> allocations;
+    };
+
+    Batch& batch(uint64_t lastFrame);
+    void destroy(Batch& batch);
+    void run();
+
+    MemoryAllocator* _allocator = nullptr;
+
+    // Ordered by lastFrame; only the render thread touches it.
+    std::deque<Batch> _batches;
+
+    // Completed batches for the worker, and the counters it updates.
+    mutable std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    std::deque<Batch> _completed;
+    bool _busy = false;
+    bool _stop = false;
+    DeletionQueueStats _stats;
+    std::thread _thread;
+};
+
+} // namespace rr
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace rr {
+
+struct DescriptorPoolRatio {
+    vk::DescriptorType type = vk::DescriptorType::eCombinedImageSampler;
+    // Descriptors of this type per set in the pool.
+    float perSet = 1.f;
+};
+
+struct DescriptorAllocatorOptions {
+    uint32_t setsPerPool = 1024;
+    std::vector<DescriptorPoolRatio> ratios {
+        {vk::DescriptorType::eCombinedImageSampler, 2.f},
+        {vk::DescriptorType::eSampledImage, 2.f},
+        {vk::DescriptorType::eSampler, 1.f},
+        {vk::DescriptorType::eUniformBuffer, 1.f},
+        {vk::DescriptorType::eUniformBufferDynamic, 1.f},
+        {vk::DescriptorType::eStorageBuffer, 1.f},
+        {vk::DescriptorType::eStorageImage, 0.5f},
+    };
+};
+
+struct DescriptorAllocatorStats {
+    // Over all frame contexts.
+    uint32_t pools = 0;
+    // Pool resets since creation, over all frame contexts.
+    uint64_t resets = 0;
+    // In the current frame.
+    uint64_t sets = 0;
+    uint32_t poolsUsed = 0;
+};
+
+// Allocates short-lived descriptor sets, valid for one frame.
+//
+// Each frame context owns a chain of pools created without
+// FREE_DESCRIPTOR_SET, so allocation is a linear bump in the driver. When
+// the current pool runs out, the next one in the chain is used, and a new
+// pool is only created once the chain is exhausted. beginFrame resets every
+// pool of the context with one vkResetDescriptorPool each; pools are kept
+// for the next use of the context, so a steady workload stops creating
+// pools after the first frames.
+class DescriptorAllocator {
+public:
+    DescriptorAllocator(
+        const vk::raii::Device& device,
+        uint32_t frameContextCount,
+        DescriptorAllocatorOptions options = {});
+
+    DescriptorAllocator(const DescriptorAllocator&) = delete;
+    DescriptorAllocator& operator=(const DescriptorAllocator&) = delete;
+
+    // Resets the pools of a frame context. The caller must make sure the GPU
+    // has finished with the sets allocated for it previously.
+    void beginFrame(uint32_t frameContext);
+
+    vk::DescriptorSet allocate(vk::DescriptorSetLayout layout);
+
+    DescriptorAllocatorStats stats() const;
+
+private:
+    struct FrameContext {
+        std::vector<vk::raii::DescriptorPool> pools;
+        size_t current = 0;
+    };
+
+    vk::raii::DescriptorPool createPool() const;
+
+    const vk::raii::Device* _device = nullptr;
+    DescriptorAllocatorOptions _options;
+    std::vector<FrameContext> _frames;
+    uint32_t _frameContext = 0;
+    uint64_t _sets = 0;
+    uint64_t _resets = 0;
+};
+
+// Creates each distinct descriptor set layout once.
+//
+// Layouts are looked up by a hash of their content: flags, and the
+// bindings in binding order with their binding flags and immutable
+// samplers. Identical layouts requested by different materials or passes
+// share one handle, so sets allocated for one are compatible with the
+// other.
+class DescriptorLayoutCache {
+public:
+    explicit DescriptorLayoutCache(const vk::raii::Device& device);
+
+    DescriptorLayoutCache(const DescriptorLayoutCache&) = delete;
+    DescriptorLayoutCache& operator=(const DescriptorLayoutCache&) = delete;
+
+    // Supports a DescriptorSetLayoutBindingFlagsCreateInfo in the pNext
+    // chain; other extension structures are not part of the key.
+    vk::DescriptorSetLayout get(const vk::DescriptorSetLayoutCreateInfo& info);
+
+    size_t size() const;
+
+private:
+    struct Entry {
+        std::vector<uint64_t> key;
+        vk::raii::DescriptorSetLayout layout {nullptr};
+    };
+
+    const vk::raii::Device* _device = nullptr;
+    std::unordered_map<uint64_t, std::vector<Entry>> _layouts;
+    size_t _size = 0;
+};
+
+} // namespace rr
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rr {
+
+// What a physical device must support to be selected at all.
+struct DeviceRequirements {
+    uint32_t apiVersion = VK_API_VERSION_1_2;
+    std::vector<const char*> extensions;
+    bool timelineSemaphore = true;
+    // Checked with rr::bindlessSupported.
+    bool bindless = true;
+    // Needed by GpuCuller.
+    bool drawIndirectFirstInstance = true;
+    // If set, the device must be able to present to the surface: a queue
+    // family with present support, surface formats and present modes.
+    // Without a surface, e.g. for offscreen benchmarks, nothing is checked.
+    vk::SurfaceKHR surface;
+    // Extensions that are used when available; each one raises the score.
+    std::vector<const char*> optionalExtensions;
+};
+
+struct DeviceCandidate {
+    vk::raii::PhysicalDevice physicalDevice {nullptr};
+    vk::PhysicalDeviceProperties properties;
+    // VkPhysicalDeviceIDProperties::deviceUUID, which identifies the device
+    // across instances and processes, unlike its index.
+    std::array<uint8_t, VK_UUID_SIZE> uuid {};
+    // Higher is better; only comparable between devices of one call.
+    uint64_t score = 0;
+    // Requirements the device does not meet; it can be used if empty.
+    std::vector<std::string> missing;
+    // Valid if the device can be used. Without a surface, presentQueueFamily
+    // is the graphics family.
+    uint32_t graphicsQueueFamily = 0;
+    uint32_t presentQueueFamily = 0;
+
+    bool usable() const;
+};
+
+// Formats a device or driver UUID as 8-4-4-4-12 lowercase hex digits.
+std::string uuidString(std::span<const uint8_t, VK_UUID_SIZE> uuid);
+
+// Checks every physical device of the instance against the requirements and
+// scores the usable ones. The score ranks device types first (discrete, then
+// integrated, virtual and CPU implementations such as lavapipe), then the
+// size of the largest device-local heap, then queue topology (dedicated
+// transfer and compute families, presenting from the graphics family) and
+// optional features (multiDrawIndirect and the optional extensions).
+//
+// Returns all devices, usable ones first, in descending score order.
+std::vector<DeviceCandidate> rankPhysicalDevices(
+    const vk::raii::Instance& instance,
+    const DeviceRequirements& requirements);
+
+// Returns the best usable device. A non-empty override selects a device by
+// UUID, in the form of uuidString with or without dashes, or else by a case
+// insensitive substring of its name; the device must still meet the
+// requirements. Throws rr::Error if no device can be selected, listing what
+// each device is missing.
+DeviceCandidate selectPhysicalDevice(
+    const vk::raii::Instance& instance,
+    const DeviceRequirements& requirements,
+    std::string_view override = {});
+
+} // namespace rr
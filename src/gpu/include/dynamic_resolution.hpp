@@ -0,0 +1,161 @@
+#pragma once
+
+#include <bindless_heap.hpp>
+#include <deletion_queue.hpp>
+#include <gpu_profiler.hpp>
+#include <memory_allocator.hpp>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <span>
+
+namespace rr {
+
+enum class UpscaleFilter : uint32_t {
+    Bilinear = 0,
+    // Bilinear, then an unsharp mask clamped to the neighbourhood, which
+    // recovers some of the detail lost at low scales.
+    Sharpen = 1,
+};
+
+struct DynamicResolutionOptions {
+    // GPU time per frame to stay under, e.g. somewhat below the display's
+    // refresh interval.
+    double targetMilliseconds = 1000.0 / 60.0 * 0.9;
+    // Of the output extent, per axis.
+    float minScale = 0.5f;
+    float maxScale = 1.f;
+    // The scale only rises while GPU time is below this share of the
+    // target; between it and the target the scale holds.
+    float raiseThreshold = 0.85f;
+    // Scales are multiples of this, so that small fluctuations in GPU time
+    // do not change the resolution every frame.
+    float scaleStep = 0.05f;
+    // GPU times averaged before deciding, counted from the last change.
+    uint32_t settleFrames = 8;
+    // The target's format; the scene's pipelines must be compatible with
+    // renderPass(), so using the swapchain's format lets them be shared.
+    vk::Format format = vk::Format::eB8G8R8A8Unorm;
+    UpscaleFilter filter = UpscaleFilter::Bilinear;
+    // For UpscaleFilter::Sharpen, from 0 (none) to about 1.
+    float sharpness = 0.5f;
+};
+
+struct DynamicResolutionStats {
+    float scale = 1.f;
+    vk::Extent2D renderExtent;
+    vk::Extent2D targetExtent;
+    // Of the frames since the last scale change.
+    double averageGpuMilliseconds = 0.0;
+    uint64_t scaleChanges = 0;
+    // Targets created, on the first frame and when the output resized.
+    uint32_t targetsCreated = 0;
+};
+
+// Renders the scene at a resolution that keeps GPU time within a budget and
+// upscales it to the output.
+//
+// The offscreen target is created once for the output extent at maxScale,
+// and each frame renders into its top left corner at the current scale, so
+// changing the scale creates nothing. beginFrame averages the GPU frame
+// times the profiler reported since the last change and, after settleFrames
+// frames, lowers the scale when the average exceeds the target, by the
+// square root of the overshoot since cost follows the pixel count, or
+// raises it by one step when it is below raiseThreshold of the target. The
+// band in between and the settle time keep the resolution from oscillating.
+//
+// Scenes are recorded between beginScene and endScene, in a render pass
+// that leaves the target ready for sampling. upscale then draws it over the
+// output in the caller's render pass with a fullscreen triangle that
+// samples the target through the BindlessHeap. Targets replaced on resize
+// are retired to the DeletionQueue.
+class DynamicResolution {
+public:
+    // The shader code is fullscreen.vert and upscale.frag compiled to
+    // SPIR-V; outputRenderPass is the render pass upscale is recorded in.
+    DynamicResolution(
+        const vk::raii::Device& device,
+        MemoryAllocator& allocator,
+        BindlessHeap& heap,
+        DeletionQueue& deletionQueue,
+        vk::RenderPass outputRenderPass,
+        std::span<const uint32_t> vertexShaderCode,
+        std::span<const uint32_t> fragmentShaderCode,
+        DynamicResolutionOptions options = {});
+    ~DynamicResolution();
+
+    DynamicResolution(const DynamicResolution&) = delete;
+    DynamicResolution& operator=(const DynamicResolution&) = delete;
+
+    // Updates the scale from the profiler's results and recreates the
+    // target if the output extent changed. frame is the frame about to be
+    // recorded, in the numbering of the other collect calls.
+    void beginFrame(
+        uint64_t frame, vk::Extent2D outputExtent, const GpuProfiler& profiler);
+
+    // Begins the offscreen render pass over the render extent, with the
+    // viewport and scissor set to it.
+    void beginScene(
+        vk::CommandBuffer commandBuffer, const vk::ClearColorValue& clear);
+    void endScene(vk::CommandBuffer commandBuffer);
+
+    // Draws the scene over the output, inside outputRenderPass. Binds the
+    // heap and sets the viewport and scissor to the output extent.
+    void upscale(vk::CommandBuffer commandBuffer);
+
+    void setFilter(UpscaleFilter filter, float sharpness);
+
+    // A render pass with one color attachment of the target's format.
+    vk::RenderPass renderPass() const;
+    vk::Extent2D renderExtent() const;
+    float scale() const;
+    DynamicResolutionStats stats() const;
+
+private:
+    // Matches PushConstants in upscale.frag.
+    struct PushConstants {
+        float uvScale[2];
+        float uvMax[2];
+        float texelSize[2];
+        float sharpness;
+        uint32_t filterMode;
+    };
+
+    struct Target {
+        vk::raii::Image image {nullptr};
+        MemoryAllocation memory;
+        vk::raii::ImageView view {nullptr};
+        vk::raii::Framebuffer framebuffer {nullptr};
+        BindlessHandle handle = invalidBindlessHandle;
+        vk::Extent2D extent;
+    };
+
+    void updateScale(const GpuProfiler& profiler);
+    void createTarget(vk::Extent2D outputExtent, uint64_t frame);
+    void retireTarget(uint64_t lastFrame);
+
+    const vk::raii::Device* _device = nullptr;
+    MemoryAllocator* _allocator = nullptr;
+    BindlessHeap* _heap = nullptr;
+    DeletionQueue* _deletionQueue = nullptr;
+    DynamicResolutionOptions _options;
+
+    vk::raii::RenderPass _renderPass {nullptr};
+    vk::raii::Pipeline _pipeline {nullptr};
+    vk::raii::Sampler _sampler {nullptr};
+    BindlessHandle _samplerHandle = invalidBindlessHandle;
+
+    Target _target;
+    vk::Extent2D _outputExtent;
+    vk::Extent2D _renderExtent;
+    float _scale = 1.f;
+
+    // GPU times of the frames since the last scale change.
+    std::deque<double> _gpuMilliseconds;
+    uint64_t _nextProfiledFrame = 0;
+    DynamicResolutionStats _stats;
+};
+
+} // namespace rr
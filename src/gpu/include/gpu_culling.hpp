@@ -0,0 +1,167 @@
+#pragma once
+
+#include <bindless_heap.hpp>
+#include <memory_allocator.hpp>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace rr {
+
+using CullObjectId = uint32_t;
+
+// Matches CullObject in src/gpu/shaders/gpu_cull.comp.
+struct CullObject {
+    // World-space bounding sphere. Objects with a negative radius are never
+    // drawn.
+    float center[3] {0.f, 0.f, 0.f};
+    float radius = 0.f;
+    // The draw's part of a VkDrawIndexedIndirectCommand, into the index and
+    // vertex buffers the caller binds.
+    uint32_t indexCount = 0;
+    uint32_t firstIndex = 0;
+    int32_t vertexOffset = 0;
+    // Passed as gl_InstanceIndex, typically the index of the object's
+    // transform and material in a storage buffer. Indirect draws only honor
+    // it with drawIndirectFirstInstance, which GpuCuller requires.
+    uint32_t firstInstance = 0;
+};
+
+struct GpuCullerOptions {
+    uint32_t maxObjects = 1024 * 1024;
+    // Set to whether VK_KHR_draw_indirect_count and multiDrawIndirect are
+    // enabled on the device.
+    bool drawIndirectCount = false;
+    bool multiDrawIndirect = false;
+    // Set to whether drawIndirectFirstInstance is enabled; the constructor
+    // throws without it.
+    bool drawIndirectFirstInstance = false;
+};
+
+struct GpuCullerStats {
+    uint32_t objects = 0;
+    // Objects written to the frame context's buffer in the last beginFrame.
+    uint32_t uploadedObjects = 0;
+    uint32_t dispatches = 0;
+    // vkCmdDraw*Indirect* calls of the last draw.
+    uint32_t drawCalls = 0;
+};
+
+// Returns true if the device supports VK_KHR_draw_indirect_count, which
+// GpuCuller uses when enabled.
+bool drawIndirectCountSupported(const vk::raii::PhysicalDevice& physicalDevice);
+
+// Culls objects against the view frustum on the GPU and draws the visible
+// ones with indirect draws.
+//
+// Objects live in a persistently mapped buffer per frame context. Adding,
+// updating and removing objects only marks them, and beginFrame copies the
+// marked objects into the context's buffer, so the CPU cost of a frame
+// depends on how many objects changed rather than how many exist.
+//
+// cull() records a compute dispatch, one thread per object, that tests each
+// bounding sphere against the frustum planes. With drawIndirectCount, the
+// visible objects' commands are compacted into the context's draw buffer
+// behind an atomic counter and draw() issues a single
+// vkCmdDrawIndexedIndirectCount. Without it, every object keeps its slot and
+// culled objects get an instance count of zero; draw() then issues one
+// vkCmdDrawIndexedIndirect for all objects with multiDrawIndirect. Without
+// multiDrawIndirect it issues one per object, a slow compatibility fallback
+// for the few devices that lack the feature: its CPU cost grows with the
+// object count, as with plain draws.
+//
+// The dispatch reads and writes the buffers through the BindlessHeap, which
+// cull() binds for compute. The buffers are exclusive to one queue family;
+// when cull() is recorded on a compute queue of another family than draw(),
+// the draw buffer is released to the graphics family in between, e.g. with
+// AsyncCompute::releaseBuffer. cull() writes it anew every frame, so it is
+// not handed back.
+class GpuCuller {
+public:
+    // cullShaderCode is gpu_cull.comp compiled to SPIR-V.
+    GpuCuller(
+        const vk::raii::PhysicalDevice& physicalDevice,
+        const vk::raii::Device& device,
+        MemoryAllocator& allocator,
+        BindlessHeap& heap,
+        std::span<const uint32_t> cullShaderCode,
+        uint32_t frameContextCount,
+        GpuCullerOptions options = {});
+    ~GpuCuller();
+
+    GpuCuller(const GpuCuller&) = delete;
+    GpuCuller& operator=(const GpuCuller&) = delete;
+
+    CullObjectId add(const CullObject& object);
+    void update(CullObjectId id, const CullObject& object);
+    void remove(CullObjectId id);
+
+    // Copies the objects changed since the frame context was last used into
+    // its buffer. The caller must make sure the GPU has finished with the
+    // context.
+    void beginFrame(uint32_t frameContext);
+
+    // Records the culling dispatch outside a render pass. viewProjection is
+    // column-major, as a GLSL mat4, with Vulkan's [0, 1] depth range.
+    void cull(
+        vk::CommandBuffer commandBuffer,
+        std::span<const float, 16> viewProjection);
+
+    // Records the indirect draws inside a render pass, with the pipeline and
+    // the index and vertex buffers of the objects bound.
+    void draw(vk::CommandBuffer commandBuffer);
+
+    // The frame context's buffer of draw commands, which cull() writes and
+    // draw() reads as indirect commands.
+    vk::Buffer drawBuffer() const;
+
+    GpuCullerStats stats() const;
+
+private:
+    // Matches CullPushConstants in gpu_cull.comp.
+    struct PushConstants {
+        float planes[6][4];
+        uint32_t objectBuffer;
+        uint32_t drawBuffer;
+        uint32_t objectCount;
+        uint32_t compact;
+    };
+
+    struct FrameContext {
+        vk::raii::Buffer objectBuffer {nullptr};
+        MemoryAllocation objectMemory;
+        BindlessHandle objectHandle = invalidBindlessHandle;
+        // A draw count padded to 16 bytes, then the draw commands.
+        vk::raii::Buffer drawBuffer {nullptr};
+        MemoryAllocation drawMemory;
+        BindlessHandle drawHandle = invalidBindlessHandle;
+
+        std::vector<CullObjectId> dirty;
+        bool allDirty = false;
+    };
+
+    static constexpr vk::DeviceSize drawCommandOffset = 16;
+
+    void markDirty(CullObjectId id);
+
+    const vk::raii::Device* _device = nullptr;
+    MemoryAllocator* _allocator = nullptr;
+    BindlessHeap* _heap = nullptr;
+    GpuCullerOptions _options;
+    uint32_t _maxDrawCount = 1;
+
+    vk::raii::Pipeline _pipeline {nullptr};
+
+    std::vector<CullObject> _objects;
+    std::vector<CullObjectId> _freeIds;
+
+    std::vector<FrameContext> _frames;
+    uint32_t _frameContext = 0;
+
+    GpuCullerStats _stats;
+};
+
+} // namespace rr
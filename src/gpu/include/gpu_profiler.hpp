@@ -0,0 +1,144 @@
+#pragma once
+
+#include <batch_renderer.hpp>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace rr {
+
+struct GpuScopeResult {
+    std::string name;
+    uint32_t depth = 0;
+    // From the frame's first scope begin.
+    double beginMilliseconds = 0.0;
+    double milliseconds = 0.0;
+};
+
+struct GpuFrameResult {
+    uint64_t frame = 0;
+    // Time between this frame's beginFrame and the next one.
+    double cpuMilliseconds = 0.0;
+    // From the first scope begin to the last scope end.
+    double gpuMilliseconds = 0.0;
+    // The first scope begin on the host's monotonic clock, if the profiler
+    // is calibrated. Raw timestamps of different queues are not comparable;
+    // these line up the frames of profilers on different queues.
+    std::optional<uint64_t> hostBeginNanoseconds;
+    std::vector<GpuScopeResult> scopes;
+};
+
+// Time during which both frames were executing on the GPU, e.g. the frames
+// of an async compute queue and the graphics queue with the same number, or
+// zero if either has no host begin time.
+double gpuOverlapMilliseconds(const GpuFrameResult& a, const GpuFrameResult& b);
+
+// Returns true if the device can calibrate its timestamps against the host's
+// monotonic clock with VK_EXT_calibrated_timestamps.
+bool calibratedTimestampsSupported(
+    const vk::raii::PhysicalDevice& physicalDevice);
+
+// Measures GPU time of named scopes with timestamp queries.
+//
+// Each frame context has its own query pool. Results are read in beginFrame
+// for the frame that last used the context, which the caller has already
+// waited on, so reading never stalls: timings arrive frameContextCount
+// frames late. Scopes may nest and may be spread over several command
+// buffers of the frame, as long as they are submitted in order.
+class GpuProfiler {
+public:
+    GpuProfiler(
+        const vk::raii::PhysicalDevice& physicalDevice,
+        const vk::raii::Device& device,
+        uint32_t queueFamilyIndex,
+        uint32_t frameContextCount,
+        uint32_t maxScopesPerFrame = 256,
+        size_t historySize = 600);
+
+    GpuProfiler(const GpuProfiler&) = delete;
+    GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+    // False if the queue family has no timestamp support; all other calls
+    // are then no-ops.
+    bool supported() const;
+
+    // Collects the results of the frame context's previous use and resets
+    // its queries. Must be recorded before any scope of the frame, outside
+    // a render pass.
+    void beginFrame(uint32_t frameContext, vk::CommandBuffer commandBuffer);
+
+    // Returns a scope index for endScope, or UINT32_MAX if the frame ran out
+    // of queries.
+    uint32_t beginScope(vk::CommandBuffer commandBuffer, std::string name);
+    void endScope(vk::CommandBuffer commandBuffer, uint32_t scope);
+
+    // Gives the frames collected from now on a host begin time, from a
+    // calibration sampled as each frame is collected. The device must have
+    // been created with VK_EXT_calibrated_timestamps, see
+    // calibratedTimestampsSupported.
+    void enableCalibration();
+
+    // Frames begun so far, which is the number the next frame gets.
+    uint64_t frameCount() const;
+    std::optional<GpuFrameResult> latestFrame() const;
+    const std::deque<GpuFrameResult>& history() const;
+
+    // One row per scope per frame, for regression tracking.
+    void writeCsv(std::ostream& out) const;
+    void writeJson(std::ostream& out) const;
+
+    // Draws a frame time graph of the history, GPU time as bars with a tick
+    // at the CPU time, and for the latest frame a stacked bar of its
+    // top-level scopes above a bar of its CPU time. material must be an
+    // untextured quad material in pixel coordinates; width pixels span
+    // budgetMilliseconds.
+    void drawOverlay(
+        BatchRenderer& renderer,
+        MaterialId material,
+        float x,
+        float y,
+        float width,
+        float height,
+        double budgetMilliseconds = 1000.0 / 60.0) const;
+
+private:
+    struct Scope {
+        std::string name;
+        uint32_t depth = 0;
+    };
+
+    struct FrameContext {
+        vk::raii::QueryPool queryPool {nullptr};
+        std::vector<Scope> scopes;
+        uint64_t frame = 0;
+        std::chrono::steady_clock::time_point cpuBegin;
+        double cpuMilliseconds = 0.0;
+        bool pending = false;
+    };
+
+    void collect(FrameContext& context);
+    uint64_t hostNanoseconds(uint64_t timestamp) const;
+
+    const vk::raii::Device* _device = nullptr;
+    bool _calibrated = false;
+    double _timestampPeriod = 1.0;
+    uint64_t _timestampMask = 0;
+    uint32_t _maxScopes = 0;
+    size_t _historySize = 0;
+
+    std::vector<FrameContext> _frames;
+    FrameContext* _current = nullptr;
+    uint32_t _depth = 0;
+    uint64_t _frameNumber = 0;
+
+    std::deque<GpuFrameResult> _history;
+};
+
+} // namespace rr
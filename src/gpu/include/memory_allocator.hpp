@@ -0,0 +1,256 @@
+#pragma once
+
+#include <tlsf.hpp>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace rr {
+
+enum class AllocationStrategy {
+    // General purpose: allocations are freed in any order.
+    Tlsf,
+    // Bump allocation; memory is only reclaimed by MemoryAllocator::resetPool.
+    Linear,
+    // Bump allocation that wraps around; allocations must be freed in the
+    // order they were made. Suited for per-frame transient data.
+    Ring,
+};
+
+// Resources placed next to each other in one VkDeviceMemory must be
+// bufferImageGranularity apart if one is linear and the other is not. The
+// allocator keeps the two kinds in separate blocks instead.
+enum class ResourceKind {
+    // Buffers and linear-tiling images.
+    Linear,
+    // Optimal-tiling images.
+    Optimal,
+};
+
+class MemoryPool;
+
+struct MemoryAllocation {
+    vk::DeviceMemory memory;
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size = 0;
+    // Set for allocations in host-visible memory, which is mapped for the
+    // whole lifetime of its block.
+    void* mapped = nullptr;
+    uint32_t memoryTypeIndex = 0;
+
+    MemoryPool* pool = nullptr;
+    uint32_t block = 0;
+    uint32_t handle = 0;
+    bool dedicated = false;
+
+    explicit operator bool() const
+    {
+        return static_cast<bool>(memory);
+    }
+};
+
+struct AllocationRequest {
+    vk::MemoryRequirements requirements;
+    vk::MemoryPropertyFlags requiredFlags;
+    vk::MemoryPropertyFlags preferredFlags;
+    ResourceKind kind = ResourceKind::Linear;
+    // Allocate from this pool instead of the default ones.
+    MemoryPool* pool = nullptr;
+    // Give the resource its own VkDeviceMemory. Set automatically for large
+    // requests and when the driver prefers it.
+    bool dedicated = false;
+    // Passed in VkMemoryDedicatedAllocateInfo for dedicated allocations.
+    vk::Buffer dedicatedBuffer;
+    vk::Image dedicatedImage;
+};
+
+struct MemoryPoolOptions {
+    uint32_t memoryTypeIndex = 0;
+    vk::DeviceSize blockSize = 0;
+    AllocationStrategy strategy = AllocationStrategy::Tlsf;
+    ResourceKind kind = ResourceKind::Linear;
+    // Linear and ring pools always have exactly one block.
+    uint32_t maxBlocks = 0;
+};
+
+struct MemoryHeapStats {
+    uint32_t blockCount = 0;
+    vk::DeviceSize blockBytes = 0;
+    uint32_t allocationCount = 0;
+    vk::DeviceSize allocationBytes = 0;
+    uint32_t dedicatedCount = 0;
+    vk::DeviceSize dedicatedBytes = 0;
+};
+
+struct MemoryStats {
+    std::vector<MemoryHeapStats> heaps;
+    uint64_t deviceMemoryAllocations = 0;
+    uint64_t deviceMemoryFrees = 0;
+    uint64_t allocations = 0;
+    uint64_t frees = 0;
+    uint64_t failedAllocations = 0;
+};
+
+// What the process uses of a memory heap and how much it should use, as
+// reported by VK_EXT_memory_budget or estimated without it. A budget of zero
+// is unknown.
+struct MemoryHeapBudget {
+    vk::DeviceSize usage = 0;
+    vk::DeviceSize budget = 0;
+};
+
+class MemoryPool {
+public:
+    MemoryPool(const MemoryPool&) = delete;
+    MemoryPool& operator=(const MemoryPool&) = delete;
+
+    const MemoryPoolOptions& options() const;
+
+private:
+    friend class MemoryAllocator;
+
+    struct Block {
+        vk::raii::DeviceMemory memory {nullptr};
+        vk::DeviceSize size = 0;
+        void* mapped = nullptr;
+        std::unique_ptr<Tlsf> tlsf;
+        // Linear and ring state. For a ring, head == tail means empty unless
+        // full is set.
+        vk::DeviceSize head = 0;
+        vk::DeviceSize tail = 0;
+        bool full = false;
+        uint32_t allocationCount = 0;
+        vk::DeviceSize usedBytes = 0;
+    };
+
+    explicit MemoryPool(MemoryPoolOptions options);
+
+    std::optional<MemoryAllocation> allocateFromBlock(
+        uint32_t blockIndex, vk::DeviceSize size, vk::DeviceSize alignment);
+    void free(const MemoryAllocation& allocation);
+
+    MemoryPoolOptions _options;
+    std::vector<std::unique_ptr<Block>> _blocks;
+};
+
+// Sub-allocates device memory from large blocks.
+//
+// Each memory type gets default TLSF pools (one per resource kind when the
+// device has a bufferImageGranularity above one). Custom pools can use the
+// linear or ring strategies for transient data. Requests larger than half a
+// block, or resources the driver prefers to be dedicated, get their own
+// VkDeviceMemory. All methods are thread-safe.
+//
+// With heap budgets set, new device memory is only allocated within a
+// heap's budget while another allowed memory type still has room, so that
+// device-local heaps under pressure spill into host memory before the
+// driver starts paging. Only when no type fits the budgets is it exceeded.
+class MemoryAllocator {
+public:
+    struct Options {
+        vk::DeviceSize blockSize = 64 * 1024 * 1024;
+    };
+
+    MemoryAllocator(
+        const vk::raii::PhysicalDevice& physicalDevice,
+        const vk::raii::Device& device,
+        Options options);
+
+    MemoryAllocator(const MemoryAllocator&) = delete;
+    MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+    MemoryAllocation allocate(const AllocationRequest& request);
+    void free(const MemoryAllocation& allocation);
+
+    // Allocate memory for a resource, honouring the driver's dedicated
+    // allocation preference, and bind it.
+    MemoryAllocation allocateForBuffer(
+        vk::Buffer buffer,
+        vk::MemoryPropertyFlags requiredFlags,
+        vk::MemoryPropertyFlags preferredFlags = {},
+        MemoryPool* pool = nullptr);
+    MemoryAllocation allocateForImage(
+        vk::Image image,
+        ResourceKind kind,
+        vk::MemoryPropertyFlags requiredFlags,
+        vk::MemoryPropertyFlags preferredFlags = {},
+        MemoryPool* pool = nullptr);
+
+    // Sets the usage and budget of each heap, usually from rr::MemoryBudget
+    // once per frame. Memory allocated afterwards is added to the usage
+    // until the next call.
+    void setHeapBudgets(std::span<const MemoryHeapBudget> budgets);
+
+    MemoryPool& createPool(MemoryPoolOptions options);
+    void destroyPool(MemoryPool& pool);
+    // Drops every allocation of a linear or ring pool at once.
+    void resetPool(MemoryPool& pool);
+
+    // Flushes a host write to non-coherent memory; a no-op for coherent
+    // memory types.
+    void flush(
+        const MemoryAllocation& allocation,
+        vk::DeviceSize offset = 0,
+        vk::DeviceSize size = VK_WHOLE_SIZE) const;
+
+    // Returns the best memory type for the request, or nothing.
+    std::optional<uint32_t> findMemoryType(
+        uint32_t memoryTypeBits,
+        vk::MemoryPropertyFlags requiredFlags,
+        vk::MemoryPropertyFlags preferredFlags = {}) const;
+
+    const vk::PhysicalDeviceMemoryProperties& memoryProperties() const;
+    vk::DeviceSize bufferImageGranularity() const;
+    MemoryStats stats() const;
+
+private:
+    struct DedicatedMemory {
+        vk::raii::DeviceMemory memory {nullptr};
+        vk::DeviceSize size = 0;
+        uint32_t memoryTypeIndex = 0;
+    };
+
+    MemoryPool& defaultPool(uint32_t memoryTypeIndex, ResourceKind kind);
+    // Fail instead of allocating device memory beyond the heap's budget if
+    // withinBudget is set.
+    std::optional<MemoryAllocation> allocateFromPool(
+        MemoryPool& pool,
+        const vk::MemoryRequirements& requirements,
+        bool withinBudget);
+    std::optional<MemoryAllocation> allocateDedicated(
+        uint32_t memoryTypeIndex,
+        const AllocationRequest& request,
+        bool withinBudget);
+    vk::raii::DeviceMemory allocateDeviceMemory(
+        uint32_t memoryTypeIndex,
+        vk::DeviceSize size,
+        const void* pNext,
+        bool withinBudget);
+    void* mapIfHostVisible(
+        const vk::raii::DeviceMemory& memory, uint32_t memoryTypeIndex);
+    vk::DeviceSize blockSizeFor(uint32_t memoryTypeIndex) const;
+
+    const vk::raii::Device* _device = nullptr;
+    Options _options;
+    vk::PhysicalDeviceMemoryProperties _memoryProperties;
+    vk::DeviceSize _bufferImageGranularity = 1;
+    vk::DeviceSize _nonCoherentAtomSize = 1;
+
+    mutable std::mutex _mutex;
+    // Indexed by memoryTypeIndex * 2 + kind.
+    std::vector<std::unique_ptr<MemoryPool>> _defaultPools;
+    std::vector<std::unique_ptr<MemoryPool>> _customPools;
+    std::unordered_map<VkDeviceMemory, DedicatedMemory> _dedicated;
+    // Per heap; empty until setHeapBudgets.
+    std::vector<MemoryHeapBudget> _budgets;
+    MemoryStats _stats;
+};
+
+} // namespace rr
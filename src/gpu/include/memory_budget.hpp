@@ -0,0 +1,115 @@
+#pragma once
+
+#include <memory_allocator.hpp>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+namespace rr {
+
+struct MemoryBudgetOptions {
+    // Set if the device was created with VK_EXT_memory_budget.
+    bool memoryBudgetExtension = false;
+    // Without the extension, the share of a heap's size the process is
+    // expected to get; the rest is left to other processes and the driver.
+    float fallbackBudget = 0.8f;
+    // A falling pressure event fires once pressure is this far below the
+    // threshold, so that usage hovering around it does not fire every frame.
+    float hysteresis = 0.05f;
+};
+
+struct MemoryHeapUsage {
+    vk::DeviceSize size = 0;
+    vk::DeviceSize usage = 0;
+    vk::DeviceSize budget = 0;
+    bool deviceLocal = false;
+
+    // usage / budget; above 1 the driver may start paging or fail.
+    float pressure() const;
+    // budget - usage, or zero.
+    vk::DeviceSize headroom() const;
+};
+
+struct MemoryBudgetStats {
+    std::vector<MemoryHeapUsage> heaps;
+    // Whether usage and budgets come from VK_EXT_memory_budget or from the
+    // allocator's own blocks.
+    bool memoryBudgetExtension = false;
+    uint64_t updates = 0;
+    uint64_t pressureEvents = 0;
+};
+
+struct MemoryPressureEvent {
+    uint32_t heap = 0;
+    float threshold = 0.f;
+    float pressure = 0.f;
+    // True when pressure rose to the threshold, false when it fell below it
+    // again.
+    bool rising = false;
+};
+
+using MemoryPressureCallback =
+    std::function<void(const MemoryPressureEvent& event)>;
+
+// Tracks how much of each memory heap the process uses and may use.
+//
+// With VK_EXT_memory_budget, update() reads the driver's per-heap usage and
+// budget, which account for everything the process allocated, including
+// swapchain images and memory allocated outside the MemoryAllocator, and
+// for what other processes use. Without it, usage is the allocator's device
+// memory and the budget a fixed share of the heap size.
+//
+// Every update passes the numbers to the allocator, which then keeps new
+// blocks within the budgets, and fires the pressure callbacks whose
+// threshold a heap crossed since the previous update. Streaming systems
+// can react in a callback or read headroom() each frame, e.g. to size the
+// TextureStreamer budget.
+class MemoryBudget {
+public:
+    MemoryBudget(
+        const vk::raii::PhysicalDevice& physicalDevice,
+        MemoryAllocator& allocator,
+        MemoryBudgetOptions options = {});
+
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    // Calls the callback when a heap's pressure rises to the threshold and
+    // when it falls below it again. Callbacks run in update.
+    void onPressure(float threshold, MemoryPressureCallback callback);
+
+    // Refreshes usage and budgets; call once per frame. The driver's
+    // numbers only change at frame granularity anyway.
+    void update();
+
+    std::span<const MemoryHeapUsage> heaps() const;
+    // Summed over device-local heaps.
+    vk::DeviceSize deviceLocalHeadroom() const;
+    // The highest pressure of any device-local heap.
+    float deviceLocalPressure() const;
+    MemoryBudgetStats stats() const;
+
+private:
+    struct Callback {
+        float threshold = 0.f;
+        MemoryPressureCallback callback;
+        // Per heap, whether pressure is at or above the threshold.
+        std::vector<bool> above;
+    };
+
+    const vk::raii::PhysicalDevice* _physicalDevice = nullptr;
+    MemoryAllocator* _allocator = nullptr;
+    MemoryBudgetOptions _options;
+
+    std::vector<MemoryHeapUsage> _heaps;
+    std::vector<MemoryHeapBudget> _budgets;
+    std::vector<Callback> _callbacks;
+    uint64_t _updates = 0;
+    uint64_t _pressureEvents = 0;
+};
+
+} // namespace rr
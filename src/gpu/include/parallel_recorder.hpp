@@ -0,0 +1,75 @@
+#pragma once
+
+#include <jobs.hpp>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace rr {
+
+// Records a range of items (typically draws) into a render pass using the
+// threads of a job system.
+//
+// The range is split into contiguous chunks. Each chunk is recorded as a job
+// into a secondary command buffer, and the secondaries are executed from the
+// primary buffer in chunk order, so the result matches what a single thread
+// would record.
+//
+// Every job system thread has its own command pool per frame context, so
+// recording needs no locking. The pools are created without
+// RESET_COMMAND_BUFFER and are reset as a whole in beginFrame, which is much
+// cheaper than resetting buffers one by one.
+class ParallelRecorder {
+public:
+    // Records items [begin, end) into a secondary command buffer that has
+    // already been begun with the render pass inheritance info.
+    using RecordFunction = std::function<void(
+        vk::CommandBuffer commandBuffer, uint32_t begin, uint32_t end)>;
+
+    ParallelRecorder(
+        JobSystem& jobs,
+        const vk::raii::Device& device,
+        uint32_t queueFamilyIndex,
+        uint32_t frameContextCount);
+
+    ParallelRecorder(const ParallelRecorder&) = delete;
+    ParallelRecorder& operator=(const ParallelRecorder&) = delete;
+
+    // Resets all command pools of a frame context. The caller must make sure
+    // the GPU has finished with the buffers recorded for it previously.
+    void beginFrame(uint32_t frameContext);
+
+    // Records itemCount items into the current subpass of primary, which must
+    // have been begun with vk::SubpassContents::eSecondaryCommandBuffers.
+    // Work is only split into chunks of at least minItemsPerWorker items.
+    // Must be called from a thread of the job system.
+    void record(
+        vk::CommandBuffer primary,
+        const vk::CommandBufferInheritanceInfo& inheritance,
+        uint32_t itemCount,
+        const RecordFunction& recordFunction,
+        uint32_t minItemsPerWorker = 256);
+
+    uint32_t workerCount() const;
+
+private:
+    struct WorkerPool {
+        vk::raii::CommandPool pool {nullptr};
+        std::vector<vk::raii::CommandBuffer> buffers;
+        size_t used = 0;
+    };
+
+    vk::CommandBuffer nextBuffer(uint32_t worker);
+
+    JobSystem* _jobs = nullptr;
+    const vk::raii::Device* _device = nullptr;
+    uint32_t _workerCount = 1;
+    uint32_t _frameContext = 0;
+    // Indexed by frameContext * workerCount + worker.
+    std::vector<WorkerPool> _pools;
+};
+
+} // namespace rr
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+
+namespace rr {
+
+struct PipelineCacheStats {
+    bool loadedFromDisk = false;
+    size_t loadedBytes = 0;
+    size_t savedBytes = 0;
+    uint64_t pipelines = 0;
+    // Hits and misses are only known when VK_EXT_pipeline_creation_feedback
+    // is enabled; otherwise pipelines are counted as untracked.
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t untracked = 0;
+    std::chrono::nanoseconds creationTime {};
+};
+
+// A VkPipelineCache persisted on disk.
+//
+// The file is read through rr::MemoryMap and is only used if it was written
+// for the same device (vendor, device, pipeline cache UUID) and the same
+// driver version; anything else, including a file that cannot be read,
+// starts from an empty cache and sets rejectReason(). The file is written
+// back by save(), through a temporary file and a rename, so a crash while
+// saving never leaves a truncated cache behind.
+class PipelineCache {
+public:
+    PipelineCache(
+        const vk::raii::PhysicalDevice& physicalDevice,
+        const vk::raii::Device& device,
+        std::filesystem::path path,
+        bool creationFeedbackEnabled = false);
+
+    PipelineCache(const PipelineCache&) = delete;
+    PipelineCache& operator=(const PipelineCache&) = delete;
+
+    const vk::raii::PipelineCache& cache() const;
+
+    // Returns an empty cache for a worker thread, so that threads compiling
+    // pipelines do not contend on the main cache. Merge it back with merge().
+    vk::raii::PipelineCache createWorkerCache() const;
+    void merge(std::span<const vk::PipelineCache> workerCaches);
+
+    // Create a pipeline through the given cache (the main one by default) and
+    // record timing and cache hit statistics.
+    vk::raii::Pipeline createGraphicsPipeline(
+        const vk::GraphicsPipelineCreateInfo& createInfo,
+        const vk::raii::PipelineCache* cache = nullptr);
+    vk::raii::Pipeline createComputePipeline(
+        const vk::ComputePipelineCreateInfo& createInfo,
+        const vk::raii::PipelineCache* cache = nullptr);
+
+    void save();
+
+    PipelineCacheStats stats() const;
+    // Why the file on disk was not used, or an empty string if it was.
+    const std::string& rejectReason() const;
+
+private:
+    template <class CreateInfo>
+    vk::raii::Pipeline createPipeline(
+        CreateInfo createInfo,
+        uint32_t stageCount,
+        const vk::raii::PipelineCache* cache);
+
+    const vk::raii::Device* _device = nullptr;
+    vk::PhysicalDeviceProperties _deviceProperties;
+    std::filesystem::path _path;
+    bool _creationFeedbackEnabled = false;
+    vk::raii::PipelineCache _cache {nullptr};
+    std::string _rejectReason;
+
+    bool _loadedFromDisk = false;
+    size_t _loadedBytes = 0;
+    size_t _savedBytes = 0;
+    std::atomic<uint64_t> _pipelines = 0;
+    std::atomic<uint64_t> _hits = 0;
+    std::atomic<uint64_t> _misses = 0;
+    std::atomic<uint64_t> _untracked = 0;
+    std::atomic<int64_t> _creationNanoseconds = 0;
+};
+
+} // namespace rr
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <gpu_profiler.hpp>
+#include <memory_allocator.hpp>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace rr {
+
+// How a pass accesses a resource. Each usage implies an image layout (for
+// images), pipeline stages and access flags.
+enum class ResourceUsage {
+    ColorAttachment,
+    DepthAttachment,
+    DepthRead,
+    Sampled,
+    StorageRead,
+    StorageWrite,
+    TransferSrc,
+    TransferDst,
+    VertexBuffer,
+    IndexBuffer,
+    UniformBuffer,
+    IndirectBuffer,
+    // Only valid as the final usage of an imported swapchain image.
+    Present,
+};
+
+struct ResourceHandle {
+    uint32_t index = UINT32_MAX;
+
+    explicit operator bool() const
+    {
+        return index != UINT32_MAX;
+    }
+};
+
+struct TransientImageDesc {
+    vk::Format format = vk::Format::eUndefined;
+    vk::Extent2D extent;
+    vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+};
+
+// The state an imported resource is in when the graph starts executing.
+// For a swapchain image, use an undefined layout and the stage its acquire
+// semaphore is waited at, so the first barrier chains with the wait.
+struct ResourceState {
+    vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+    vk::PipelineStageFlags stages;
+    vk::AccessFlags access;
+};
+
+struct RenderGraphStats {
+    uint32_t passes = 0;
+    uint32_t culledPasses = 0;
+    uint32_t barrierBatches = 0;
+    uint32_t imageBarriers = 0;
+    uint32_t memoryBarriers = 0;
+    // Transient memory with and without aliasing.
+    vk::DeviceSize transientBytes = 0;
+    vk::DeviceSize unaliasedTransientBytes = 0;
+};
+
+class RenderGraph;
+
+class RenderPassBuilder {
+public:
+    // stages overrides the usage's default shader stages for sampled,
+    // storage and uniform accesses.
+    RenderPassBuilder& read(
+        ResourceHandle resource,
+        ResourceUsage usage,
+        vk::PipelineStageFlags stages = {});
+    RenderPassBuilder& write(
+        ResourceHandle resource,
+        ResourceUsage usage,
+        vk::PipelineStageFlags stages = {});
+    // Keeps the pass even if nothing reads what it writes.
+    RenderPassBuilder& sideEffect();
+
+private:
+    friend class RenderGraph;
+
+    RenderPassBuilder(RenderGraph& graph, uint32_t pass);
+
+    RenderGraph* _graph = nullptr;
+    uint32_t _pass = 0;
+};
+
+// Orders GPU work as a list of passes with declared resource accesses.
+//
+// compile() culls passes whose results are never used, creates transient
+// images with their memory aliased between images whose lifetimes do not
+// overlap, and works out the barriers between passes: one batched
+// vkCmdPipelineBarrier before each pass that needs one, with layout
+// transitions, and no barrier at all between passes that only read.
+// execute() records the barriers and calls the pass functions.
+//
+// Passes begin their own render passes. Attachments are transitioned by the
+// graph, so render passes should use the usage's layout as both initial and
+// final layout and need no external subpass dependencies.
+class RenderGraph {
+public:
+    using PassFunction =
+        std::function<void(vk::CommandBuffer commandBuffer)>;
+
+    RenderGraph(const vk::raii::Device& device, MemoryAllocator& allocator);
+    ~RenderGraph();
+
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    // Drops all passes and resources, including transient images. The GPU
+    // must be done with previous executions.
+    void reset();
+
+    ResourceHandle createImage(
+        std::string name, const TransientImageDesc& desc);
+    ResourceHandle importImage(
+        std::string name,
+        vk::Image image,
+        vk::ImageView view,
+        vk::Format format,
+        ResourceState initialState);
+    ResourceHandle importBuffer(
+        std::string name, vk::Buffer buffer, ResourceState initialState);
+
+    // Swaps the image behind an imported resource, e.g. the swapchain image
+    // acquired for this frame, without recompiling.
+    void setImportedImage(
+        ResourceHandle resource, vk::Image image, vk::ImageView view);
+
+    RenderPassBuilder addPass(std::string name, PassFunction function);
+
+    // Marks a resource as a result of the graph. Passes it depends on are
+    // kept, and it is left in finalUsage's state after execution.
+    void markOutput(ResourceHandle resource, ResourceUsage finalUsage);
+
+    // The GPU must be done with previous executions if transient images
+    // change.
+    void compile();
+    // Profiler scopes are recorded around each pass if a profiler is given.
+    void execute(
+        vk::CommandBuffer commandBuffer, GpuProfiler* profiler = nullptr);
+
+    vk::Image image(ResourceHandle resource) const;
+    vk::ImageView imageView(ResourceHandle resource) const;
+    vk::Buffer buffer(ResourceHandle resource) const;
+    RenderGraphStats stats() const;
+
+private:
+    friend class RenderPassBuilder;
+
+    struct Access {
+        uint32_t resource = 0;
+        ResourceUsage usage = ResourceUsage::Sampled;
+        vk::PipelineStageFlags stages;
+        bool write = false;
+    };
+
+    struct Pass {
+        std::string name;
+        PassFunction function;
+        std::vector<Access> accesses;
+        bool sideEffect = false;
+        bool culled = false;
+    };
+
+    struct Resource {
+        std::string name;
+        bool isImage = true;
+        bool transient = false;
+        vk::Image image;
+        vk::ImageView view;
+        vk::Buffer buffer;
+        vk::Format format = vk::Format::eUndefined;
+        vk::Extent2D extent;
+        vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+        ResourceState initialState;
+        bool output = false;
+        ResourceUsage finalUsage = ResourceUsage::Sampled;
+
+        // Compiled.
+        uint32_t firstPass = UINT32_MAX;
+        uint32_t lastPass = 0;
+        vk::ImageUsageFlags usage;
+        vk::raii::Image ownedImage {nullptr};
+        vk::raii::ImageView ownedView {nullptr};
+        vk::DeviceSize memoryOffset = 0;
+        // Transient images placed in memory used by these before.
+        std::vector<uint32_t> aliases;
+        // Transient images whose memory overlaps this one's, itself
+        // included. Their last accesses in one execution come before its
+        // first use in the next.
+        std::vector<uint32_t> sharesMemoryWith;
+    };
+
+    struct ImageBarrier {
+        uint32_t resource = 0;
+        vk::ImageLayout oldLayout = vk::ImageLayout::eUndefined;
+        vk::ImageLayout newLayout = vk::ImageLayout::eUndefined;
+        vk::AccessFlags srcAccess;
+        vk::AccessFlags dstAccess;
+    };
+
+    struct BarrierBatch {
+        vk::PipelineStageFlags srcStages;
+        vk::PipelineStageFlags dstStages;
+        vk::AccessFlags srcAccess;
+        vk::AccessFlags dstAccess;
+        std::vector<ImageBarrier> images;
+
+        bool empty() const;
+    };
+
+    // Synchronization state of a resource while simulating execution.
+    struct TrackedState {
+        vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+        vk::PipelineStageFlags writeStages;
+        vk::AccessFlags writeAccess;
+        vk::PipelineStageFlags readStages;
+        vk::PipelineStageFlags visibleStages;
+        vk::AccessFlags visibleAccess;
+    };
+
+    void cull();
+    void createTransientImages();
+    void destroyTransientImages();
+    void computeBarriers();
+    // Fills _barriers and _finalBarriers and returns the states the
+    // resources end in. previous holds the end states of the execution
+    // before, or is empty.
+    std::vector<TrackedState> simulate(
+        const std::vector<TrackedState>& previous);
+    void addBarrier(
+        BarrierBatch& batch,
+        TrackedState& state,
+        const Resource& resource,
+        uint32_t resourceIndex,
+        ResourceUsage usage,
+        vk::PipelineStageFlags stages,
+        bool write);
+    void recordBarriers(
+        vk::CommandBuffer commandBuffer, const BarrierBatch& batch);
+
+    const vk::raii::Device* _device = nullptr;
+    MemoryAllocator* _allocator = nullptr;
+
+    std::vector<Pass> _passes;
+    std::vector<Resource> _resources;
+
+    // Compiled. Indexed like _passes; _finalBarriers runs after all passes
+    // and leaves outputs in their final usage.
+    std::vector<BarrierBatch> _barriers;
+    BarrierBatch _finalBarriers;
+    MemoryAllocation _transientMemory;
+    bool _compiled = false;
+    RenderGraphStats _stats;
+};
+
+} // namespace rr
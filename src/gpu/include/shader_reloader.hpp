@@ -0,0 +1,122 @@
+#pragma once
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rr {
+
+using ReloadablePipelineId = uint32_t;
+
+// A stage of a reloadable pipeline: the SPIR-V file to watch, and the code to
+// use until the file changes, e.g. the embedded copy of the same shader.
+struct ShaderSource {
+    std::filesystem::path path;
+    std::span<const uint32_t> code;
+};
+
+// Creates a pipeline from one shader module per source, in source order.
+using PipelineBuilder = std::function<vk::raii::Pipeline(
+    std::span<const vk::ShaderModule> modules)>;
+
+struct ShaderReloaderStats {
+    uint64_t reloads = 0;
+    uint64_t failures = 0;
+    // Replaced pipelines that frames in flight may still use.
+    uint32_t retiredPipelines = 0;
+};
+
+// Rebuilds pipelines when their SPIR-V files change, for development.
+//
+// A worker thread watches the directories of the registered files with
+// inotify. When a file is written or replaced, the worker maps it with
+// rr::MemoryMap, checks that it is SPIR-V, and rebuilds every pipeline that
+// uses it. Finished pipelines are handed to the render thread, which swaps
+// them in with beginFrame, between frames; the replaced pipelines are
+// destroyed once the frames that used them have completed, so nothing waits
+// for the device. A shader that fails to load or a pipeline that fails to
+// build keeps the previous pipeline and is reported through lastError.
+//
+// Builders run on the worker thread, except for the first build in add, so
+// they must not use objects the render thread uses without synchronization,
+// such as the main pipeline cache. Without inotify (on platforms other than
+// Linux) files are not watched.
+class ShaderReloader {
+public:
+    explicit ShaderReloader(const vk::raii::Device& device);
+    ~ShaderReloader();
+
+    ShaderReloader(const ShaderReloader&) = delete;
+    ShaderReloader& operator=(const ShaderReloader&) = delete;
+
+    // Builds the pipeline from the sources' code, on the calling thread,
+    // and starts watching their files.
+    ReloadablePipelineId add(
+        std::vector<ShaderSource> sources, PipelineBuilder builder);
+
+    // The current pipeline; it only changes in beginFrame.
+    vk::Pipeline pipeline(ReloadablePipelineId id) const;
+
+    // Swaps in rebuilt pipelines for frame and destroys replaced ones that
+    // are no longer in use. Frame numbers are those of the other collect
+    // calls. Returns the number of pipelines swapped.
+    uint32_t beginFrame(uint64_t frame, uint64_t completedFrames);
+
+    // The message of the latest failed reload, or an empty string.
+    std::string lastError() const;
+    ShaderReloaderStats stats() const;
+
+private:
+    struct Entry {
+        // With absolute paths.
+        std::vector<ShaderSource> sources;
+        PipelineBuilder builder;
+        vk::raii::Pipeline pipeline {nullptr};
+    };
+
+    struct Rebuilt {
+        ReloadablePipelineId id = 0;
+        vk::raii::Pipeline pipeline {nullptr};
+    };
+
+    struct Retired {
+        vk::raii::Pipeline pipeline {nullptr};
+        uint64_t lastFrame = 0;
+    };
+
+    vk::raii::Pipeline build(
+        std::span<const std::span<const uint32_t>> code,
+        const PipelineBuilder& builder) const;
+    void watch(const std::filesystem::path& path);
+    void run();
+    void reload(const std::vector<std::filesystem::path>& changed);
+
+    const vk::raii::Device* _device = nullptr;
+
+    // Entries are only appended, by the render thread, which also owns their
+    // pipelines. The worker reads sources and builders under the lock.
+    mutable std::mutex _mutex;
+    std::deque<Entry> _entries;
+    std::vector<Rebuilt> _rebuilt;
+    std::string _lastError;
+    ShaderReloaderStats _stats;
+
+    std::vector<Retired> _retired;
+
+    int _inotify = -1;
+    // Watch descriptors and the directories they watch.
+    std::vector<std::pair<int, std::filesystem::path>> _watches;
+    std::atomic<bool> _stop = false;
+    std::thread _thread;
+};
+
+} // namespace rr
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace rr {
+
+struct SwapchainOptions {
+    vk::SurfaceFormatKHR surfaceFormat {};
+    vk::PresentModeKHR presentMode = vk::PresentModeKHR::eFifo;
+    vk::ImageUsageFlags imageUsage = vk::ImageUsageFlagBits::eColorAttachment;
+    // Queue families that access swapchain images. If more than one distinct
+    // family is listed, images are created with concurrent sharing.
+    std::vector<uint32_t> queueFamilies;
+    // Tag presents with VK_KHR_present_id and allow waiting for them with
+    // VK_KHR_present_wait. Both extensions and their features must be
+    // enabled on the device.
+    bool presentWait = false;
+};
+
+struct PresentStats {
+    uint64_t presents = 0;
+    // Measured between completed presents when present wait is enabled, and
+    // between present calls otherwise.
+    bool measuredAtDisplay = false;
+    double lastIntervalMilliseconds = 0.0;
+    double averageIntervalMilliseconds = 0.0;
+    double minIntervalMilliseconds = 0.0;
+    double maxIntervalMilliseconds = 0.0;
+};
+
+// Picks the present mode to use for a requested one. Unsupported modes fall
+// back to the closest supported one: immediate and mailbox to each other,
+// then FIFO-relaxed, then FIFO, which every device supports.
+vk::PresentModeKHR choosePresentMode(
+    vk::PresentModeKHR requested,
+    std::span<const vk::PresentModeKHR> supported);
+
+// Parses "fifo", "fifo-relaxed", "mailbox" or "immediate".
+std::optional<vk::PresentModeKHR> parsePresentMode(std::string_view name);
+
+struct SwapchainImage {
+    uint32_t index = 0;
+    vk::Image image;
+    vk::ImageView view;
+    vk::Framebuffer framebuffer;
+    vk::Extent2D extent;
+};
+
+// Owns the swapchain together with its image views and framebuffers, and
+// rebuilds all of them when the surface goes out of date or the window is
+// resized.
+//
+// A rebuilt swapchain is created with the previous one as oldSwapchain, so
+// the presentation engine can hand its images over. The previous generation
+// is not destroyed right away: it is retired and kept alive until the caller
+// reports (through collect) that every frame submitted while it was current
+// has completed. This way recreation never needs device.waitIdle(), and the
+// frame that triggers it is still rendered and presented.
+class Swapchain {
+public:
+    Swapchain(
+        const vk::raii::PhysicalDevice& physicalDevice,
+        const vk::raii::Device& device,
+        const vk::raii::SurfaceKHR& surface,
+        SwapchainOptions options,
+        vk::Extent2D extent);
+
+    Swapchain(const Swapchain&) = delete;
+    Swapchain& operator=(const Swapchain&) = delete;
+
+    // Framebuffers are (re)created for this render pass on every rebuild.
+    void setRenderPass(vk::RenderPass renderPass);
+
+    // Requests a new extent, typically the current window size. The swapchain
+    // is rebuilt lazily on the next acquire.
+    void resize(vk::Extent2D extent);
+
+    // Marks the swapchain for rebuilding on the next acquire.
+    void invalidate();
+
+    // Switches the present mode, falling back as choosePresentMode does. The
+    // swapchain is rebuilt on the next acquire if the mode changes. Returns
+    // the mode that will be used.
+    vk::PresentModeKHR setPresentMode(vk::PresentModeKHR mode);
+    std::vector<vk::PresentModeKHR> supportedPresentModes() const;
+
+    // Blocks until at most queueDepth presented frames are still waiting to
+    // be displayed. Call it before recording a frame to bound latency: with
+    // a depth of one, the CPU never runs more than one frame ahead of the
+    // display. Returns false on timeout, or if present wait is not enabled.
+    bool waitForPresentQueue(
+        uint32_t queueDepth,
+        std::chrono::nanoseconds timeout = std::chrono::milliseconds{100});
+
+    // Acquires the next image, rebuilding the swapchain first if needed.
+    // Returns nothing if there is nothing to render to (e.g. the window is
+    // minimized); the semaphore is not signaled in that case.
+    std::optional<SwapchainImage> acquire(vk::Semaphore imageAvailable);
+
+    // Presents an image obtained from the last acquire. An out of date or
+    // suboptimal result schedules a rebuild instead of failing.
+    void present(vk::Queue queue, vk::Semaphore renderFinished, uint32_t imageIndex);
+
+    // Destroys retired swapchains whose frames have all completed.
+    // completedFrames is the number of presented frames known to be finished
+    // on the GPU.
+    void collect(uint64_t completedFrames);
+
+    vk::SwapchainKHR handle() const;
+    vk::Format format() const;
+    vk::ColorSpaceKHR colorSpace() const;
+    vk::PresentModeKHR presentMode() const;
+    vk::Extent2D extent() const;
+    size_t imageCount() const;
+    uint64_t presentedFrames() const;
+    uint64_t generation() const;
+    PresentStats presentStats() const;
+
+private:
+    struct Generation {
+        vk::raii::SwapchainKHR swapchain {nullptr};
+        std::vector<vk::Image> images;
+        std::vector<vk::raii::ImageView> views;
+        std::vector<vk::raii::Framebuffer> framebuffers;
+        vk::Extent2D extent;
+        // Present ids are shared by all generations; ids below this one
+        // were presented to an older swapchain.
+        uint64_t firstPresentId = 0;
+        uint64_t retiredAfterFrame = 0;
+    };
+
+    bool rebuild();
+    void createFramebuffers(Generation& generation) const;
+    void recordPresentInterval(uint64_t presentId);
+
+    const vk::raii::PhysicalDevice* _physicalDevice = nullptr;
+    const vk::raii::Device* _device = nullptr;
+    const vk::raii::SurfaceKHR* _surface = nullptr;
+    SwapchainOptions _options;
+    vk::RenderPass _renderPass;
+    vk::Extent2D _requestedExtent;
+    Generation _current;
+    std::vector<Generation> _retired;
+    bool _dirty = true;
+    uint64_t _presentedFrames = 0;
+    uint64_t _generation = 0;
+
+    uint64_t _completedPresentId = 0;
+    std::chrono::steady_clock::time_point _lastPresentTime;
+    std::deque<double> _presentIntervals;
+};
+
+} // namespace rr
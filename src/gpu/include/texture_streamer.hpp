@@ -0,0 +1,237 @@
+#pragma once
+
+#include <bindless_heap.hpp>
+#include <memory_allocator.hpp>
+#include <upload.hpp>
+
+#include <jobs.hpp>
+#include <mm.hpp>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace rr {
+
+// Streamed textures are stored in .rrtex files: a TextureFileHeader, then
+// one TextureFileLevel per mip level, level 0 first, then the level data.
+// Each level is tightly packed (rows of whole texels or blocks), as
+// vkCmdCopyBufferToImage expects with a zero row length.
+struct TextureFileHeader {
+    static constexpr uint32_t magicValue = 0x58545252; // "RRTX"
+    static constexpr uint32_t currentVersion = 1;
+
+    uint32_t magic = magicValue;
+    uint32_t version = currentVersion;
+    // A VkFormat.
+    uint32_t format = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t levelCount = 0;
+};
+
+struct TextureFileLevel {
+    // From the start of the file.
+    uint64_t offset = 0;
+    uint64_t size = 0;
+};
+
+using TextureId = uint32_t;
+
+struct TextureStreamerOptions {
+    // Device memory for all streamed textures. Mip tails are loaded even if
+    // they exceed it; higher levels are evicted to stay under it. Can be
+    // changed with setBudget, e.g. under memory pressure.
+    vk::DeviceSize budget = 512 * 1024 * 1024;
+    // Levels whose width and height are both at most this are always
+    // resident.
+    uint32_t tailSize = 64;
+    // A resident image is rebuilt in one upload, which must fit the upload
+    // service's staging ring; levels that would exceed this are not loaded.
+    vk::DeviceSize maxUploadBytes = 16 * 1024 * 1024;
+    // Bytes uploaded per frame at most, to bound the frame time spikes of
+    // streaming.
+    vk::DeviceSize frameUploadBytes = 32 * 1024 * 1024;
+    uint32_t maxTextures = 4096;
+};
+
+struct TextureStreamerStats {
+    uint32_t textures = 0;
+    vk::DeviceSize budget = 0;
+    vk::DeviceSize residentBytes = 0;
+    uint32_t pendingReads = 0;
+    uint64_t uploadedBytes = 0;
+    uint64_t upgrades = 0;
+    uint64_t evictions = 0;
+};
+
+// Streams mip levels of textures from disk according to how large they
+// appear on screen.
+//
+// Files are mapped with rr::MemoryMap. A texture starts with its mip tail
+// resident; each texture's image holds only its resident levels, from the
+// finest loaded level down to 1x1, so memory is only spent on what is
+// loaded, and sampling cannot reach a level that is not: the resident
+// level is the texture's minimum LOD.
+//
+// Which level a texture needs comes from feedback. Shaders sample through
+// sampleStreamed (src/gpu/shaders/streaming.glsl), which looks up the
+// texture's current bindless handle in a per-frame table and records the
+// finest level it wanted with an atomicMin. The application can also report
+// on-screen sizes from the CPU with requestScreenSize.
+//
+// Reading the levels of a finer image from the mapped file, which may fault
+// pages in from disk, runs on the job system. The finished read is uploaded
+// through the UploadService in a later beginFrame and the table switches to
+// the new image in the same frame; the graphics submission waits for the
+// upload. Replaced images are destroyed once their last frame completes.
+// When resident memory exceeds the budget, textures that were not wanted at
+// their resident level for the longest time drop to a coarser one.
+class TextureStreamer {
+public:
+    TextureStreamer(
+        const vk::raii::Device& device,
+        MemoryAllocator& allocator,
+        UploadService& uploads,
+        BindlessHeap& heap,
+        JobSystem& jobs,
+        uint32_t frameContextCount,
+        TextureStreamerOptions options = {});
+    ~TextureStreamer();
+
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    // Maps the file and uploads the mip tail.
+    TextureId load(const std::filesystem::path& path);
+
+    // Requests the level that fits a size of pixels texels along the
+    // texture's larger axis. Combined with shader feedback for the next
+    // beginFrame.
+    void requestScreenSize(TextureId texture, float pixels);
+
+    // Reads the feedback the frame context collected when it was last used,
+    // updates residency, and writes the context's table. The caller must
+    // make sure that frame has completed; completedFrames and frame use the
+    // numbering of the other collect calls, frame being the one about to be
+    // recorded. Uploads are flushed with the upload service's next flush.
+    void beginFrame(
+        uint32_t frameContext, uint64_t frame, uint64_t completedFrames);
+
+    // Takes effect in the next beginFrame. Lowering the budget evicts levels
+    // that are not wanted any more first; levels that are still wanted stay
+    // resident, but no further upgrades start until there is room.
+    void setBudget(vk::DeviceSize budget);
+
+    // Records the barrier that makes the frame's feedback writes visible to
+    // the host, after the last command that samples streamed textures.
+    void recordFeedbackBarrier(vk::CommandBuffer commandBuffer) const;
+
+    // The storage buffer with the table of the current frame context, for
+    // sampleStreamed.
+    BindlessHandle tableHandle() const;
+
+    uint32_t levelCount(TextureId texture) const;
+    // The finest resident level, which is the texture's minimum LOD.
+    uint32_t residentLevel(TextureId texture) const;
+    TextureStreamerStats stats() const;
+
+private:
+    // Matches StreamedTexture in streaming.glsl.
+    struct TableEntry {
+        uint32_t handle = 0;
+        uint32_t residentLevel = 0;
+        // Written by shaders; UINT32_MAX if the texture was not sampled.
+        uint32_t requestedLevel = UINT32_MAX;
+        uint32_t padding = 0;
+    };
+
+    struct Resident {
+        vk::raii::Image image {nullptr};
+        vk::raii::ImageView view {nullptr};
+        MemoryAllocation memory;
+        BindlessHandle handle = invalidBindlessHandle;
+        uint32_t level = 0;
+    };
+
+    // The levels of a new image, read from the file by a job.
+    struct Read {
+        uint32_t level = 0;
+        // Change of resident memory the new image is expected to cause.
+        int64_t delta = 0;
+        std::vector<std::byte> data;
+        JobCounter counter;
+    };
+
+    struct Texture {
+        MemoryMap file;
+        vk::Format format = vk::Format::eUndefined;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<TextureFileLevel> levels;
+        // Coarsest level that is always resident, and finest level that
+        // fits in one upload.
+        uint32_t tailLevel = 0;
+        uint32_t finestLevel = 0;
+
+        Resident resident;
+        std::unique_ptr<Read> read;
+        uint32_t wantedLevel = UINT32_MAX;
+        // From requestScreenSize, for the next beginFrame.
+        uint32_t requestedLevel = UINT32_MAX;
+        // Last frame the texture wanted its resident level or finer.
+        uint64_t lastUsedFrame = 0;
+    };
+
+    struct Retired {
+        Resident resident;
+        uint64_t lastFrame = 0;
+    };
+
+    struct FrameContext {
+        vk::raii::Buffer buffer {nullptr};
+        MemoryAllocation memory;
+        BindlessHandle handle = invalidBindlessHandle;
+        // Textures with an entry in the table, as of its last write.
+        size_t entryCount = 0;
+    };
+
+    void readFeedback(const FrameContext& context, uint64_t frame);
+    void startRead(Texture& texture, uint32_t level);
+    void finishRead(Texture& texture, uint64_t frame);
+    Resident createResident(
+        const Texture& texture,
+        uint32_t level,
+        std::span<const std::byte> data);
+    void retire(Resident& resident, uint64_t frame);
+    // Starts moving textures that are wanted at a coarser level than their
+    // resident one to that level, least recently used first, until the
+    // projected resident memory fits the budget. Returns whether it does.
+    bool evict(vk::DeviceSize needed, const Texture* keep);
+    vk::DeviceSize projectedBytes() const;
+
+    const vk::raii::Device* _device = nullptr;
+    MemoryAllocator* _allocator = nullptr;
+    UploadService* _uploads = nullptr;
+    BindlessHeap* _heap = nullptr;
+    JobSystem* _jobs = nullptr;
+    TextureStreamerOptions _options;
+
+    std::vector<std::unique_ptr<Texture>> _textures;
+    std::vector<FrameContext> _frames;
+    uint32_t _frameContext = 0;
+    std::vector<Retired> _retired;
+    vk::DeviceSize _residentBytes = 0;
+    // Expected change of _residentBytes once all reads are uploaded.
+    int64_t _pendingDelta = 0;
+    vk::DeviceSize _frameUploadedBytes = 0;
+
+    TextureStreamerStats _stats;
+};
+
+} // namespace rr
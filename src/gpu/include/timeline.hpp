@@ -0,0 +1,109 @@
+#pragma once
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace rr {
+
+using QueueId = uint32_t;
+
+// A point on a queue's timeline. Value zero is complete from the start, so a
+// default point can stand for "nothing to wait for".
+struct TimelinePoint {
+    QueueId queue = 0;
+    uint64_t value = 0;
+};
+
+struct TimelineWait {
+    TimelinePoint point;
+    vk::PipelineStageFlags stages;
+};
+
+// Binary semaphores are only for the swapchain, which cannot use timelines.
+struct BinarySemaphoreWait {
+    vk::Semaphore semaphore;
+    vk::PipelineStageFlags stages;
+};
+
+struct TimelineSubmitInfo {
+    std::span<const vk::CommandBuffer> commandBuffers;
+    std::span<const TimelineWait> waits;
+    std::span<const BinarySemaphoreWait> binaryWaits;
+    std::span<const vk::Semaphore> binarySignals;
+};
+
+// Synchronizes queues and the host with Vulkan 1.2 timeline semaphores.
+//
+// Every registered queue has one semaphore whose value counts the queue's
+// submissions: each submit signals the next value and returns it as a
+// TimelinePoint. The host waits for points instead of fences, so nothing has
+// to be reset, and another queue depends on work by waiting for the point in
+// its own submission. Completed values are cached, so polling a point that
+// is known to be done does not call into the driver.
+//
+// Requires the timelineSemaphore feature. Not thread-safe; submit from one
+// thread per TimelineSync.
+class TimelineSync {
+public:
+    explicit TimelineSync(const vk::raii::Device& device);
+    ~TimelineSync();
+
+    TimelineSync(const TimelineSync&) = delete;
+    TimelineSync& operator=(const TimelineSync&) = delete;
+
+    // Registers a queue and creates its timeline. Registering the same queue
+    // again returns the existing id, so families that share a queue share a
+    // timeline.
+    QueueId addQueue(vk::Queue queue);
+
+    // Submits to the queue and signals the queue's next timeline value. Waits
+    // on points that are already known to be complete are dropped, and waits
+    // on the same queue are merged into the latest one.
+    TimelinePoint submit(QueueId queue, const TimelineSubmitInfo& info);
+
+    // The point of the latest submission to the queue.
+    TimelinePoint lastSubmitted(QueueId queue) const;
+    uint64_t completedValue(QueueId queue);
+    bool completed(TimelinePoint point);
+
+    // Return false on timeout.
+    bool wait(
+        TimelinePoint point,
+        std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max());
+    bool waitAll(
+        std::span<const TimelinePoint> points,
+        std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max());
+    // Waits for everything submitted through this object; unlike
+    // device.waitIdle(), it leaves other queues and submitters alone.
+    void waitIdle();
+
+    vk::Queue queue(QueueId queue) const;
+    vk::Semaphore semaphore(QueueId queue) const;
+
+private:
+    struct QueueTimeline {
+        vk::Queue queue;
+        vk::raii::Semaphore semaphore {nullptr};
+        uint64_t submitted = 0;
+        uint64_t completed = 0;
+    };
+
+    QueueTimeline& timeline(QueueId queue);
+    const QueueTimeline& timeline(QueueId queue) const;
+
+    const vk::raii::Device* _device = nullptr;
+    std::vector<QueueTimeline> _queues;
+
+    // Scratch space for submit.
+    std::vector<vk::Semaphore> _waitSemaphores;
+    std::vector<uint64_t> _waitValues;
+    std::vector<vk::PipelineStageFlags> _waitStages;
+    std::vector<vk::Semaphore> _signalSemaphores;
+    std::vector<uint64_t> _signalValues;
+};
+
+} // namespace rr
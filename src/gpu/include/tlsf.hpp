@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace rr {
+
+// Two-level segregated fit allocator over an abstract range [0, size).
+//
+// It only hands out offsets; the memory itself lives elsewhere (a
+// VkDeviceMemory block, for example). Allocation and free are O(1): free
+// ranges are kept in lists bucketed by size class, with a bitmap per level
+// to find a non-empty bucket with two bit scans. Adjacent free ranges are
+// merged on free.
+class Tlsf {
+public:
+    struct Allocation {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        uint32_t handle = 0;
+    };
+
+    explicit Tlsf(uint64_t size);
+
+    std::optional<Allocation> allocate(uint64_t size, uint64_t alignment);
+    void free(uint32_t handle);
+
+    uint64_t size() const;
+    uint64_t usedBytes() const;
+    uint32_t allocationCount() const;
+    bool empty() const;
+    uint64_t largestFreeRange() const;
+    size_t freeRangeCount() const;
+
+private:
+    static constexpr uint32_t secondLevelLog2 = 4;
+    static constexpr uint32_t secondLevelCount = 1u << secondLevelLog2;
+    static constexpr uint32_t firstLevelCount = 64;
+    static constexpr uint32_t noBlock = UINT32_MAX;
+
+    struct Block {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        uint32_t prevPhysical = noBlock;
+        uint32_t nextPhysical = noBlock;
+        uint32_t prevFree = noBlock;
+        uint32_t nextFree = noBlock;
+        bool free = false;
+    };
+
+    struct Bucket {
+        uint32_t firstLevel = 0;
+        uint32_t secondLevel = 0;
+    };
+
+    static Bucket bucketFor(uint64_t size);
+    std::optional<Bucket> findBucket(uint64_t size) const;
+
+    uint32_t newBlock();
+    void insertFree(uint32_t index);
+    void removeFree(uint32_t index);
+    uint32_t splitOff(uint32_t index, uint64_t size);
+    void mergeWithNext(uint32_t index);
+
+    uint64_t _size = 0;
+    uint64_t _usedBytes = 0;
+    uint32_t _allocationCount = 0;
+    size_t _freeRangeCount = 0;
+
+    std::vector<Block> _blocks;
+    std::vector<uint32_t> _unusedBlocks;
+
+    uint64_t _firstLevelBitmap = 0;
+    std::array<uint32_t, firstLevelCount> _secondLevelBitmaps {};
+    std::array<std::array<uint32_t, secondLevelCount>, firstLevelCount> _freeLists;
+};
+
+} // namespace rr
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <memory_allocator.hpp>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace rr {
+
+struct UniformRingOptions {
+    // Initial size of each frame context's buffer.
+    vk::DeviceSize capacity = 1024 * 1024;
+    // Largest allocation, and the range of the dynamic uniform buffer
+    // descriptor. Clamped to maxUniformBufferRange.
+    uint32_t maxAllocationSize = 16 * 1024;
+};
+
+// A sub-allocation for one frame. Bind descriptorSet with dynamicOffset
+// for the uniform block to read data.
+struct UniformAllocation {
+    void* data = nullptr;
+    vk::Buffer buffer;
+    vk::DescriptorSet descriptorSet;
+    uint32_t dynamicOffset = 0;
+};
+
+struct UniformRingStats {
+    // In the current frame.
+    uint64_t allocations = 0;
+    vk::DeviceSize allocatedBytes = 0;
+    // Of the current frame context's buffer.
+    vk::DeviceSize capacity = 0;
+    // Buffers replaced by larger ones, over all frame contexts.
+    uint64_t growths = 0;
+};
+
+// Transient uniform data for one frame, such as per-draw constants.
+//
+// Each frame context owns one persistently mapped, host-coherent buffer
+// with a single UNIFORM_BUFFER_DYNAMIC descriptor over it (binding 0 of
+// setLayout()). Allocation bumps an offset aligned to
+// minUniformBufferOffsetAlignment and returns the mapped pointer and the
+// dynamic offset, so writing per-draw data is a bump and a memcpy without
+// Vulkan calls. beginFrame rewinds the context's buffer.
+//
+// A frame that runs out of space switches to a new buffer of twice the
+// size, with its own descriptor set; the old one is kept until the context
+// is reused, and the new one stays, so a steady workload stops growing
+// after its first frames.
+class UniformRing {
+public:
+    UniformRing(
+        const vk::raii::PhysicalDevice& physicalDevice,
+        const vk::raii::Device& device,
+        MemoryAllocator& allocator,
+        uint32_t frameContextCount,
+        UniformRingOptions options = {});
+    ~UniformRing();
+
+    UniformRing(const UniformRing&) = delete;
+    UniformRing& operator=(const UniformRing&) = delete;
+
+    // Rewinds the frame context's buffer. The caller must make sure the GPU
+    // has finished with the allocations made for it previously.
+    void beginFrame(uint32_t frameContext);
+
+    // size must not exceed maxAllocationSize.
+    UniformAllocation allocate(vk::DeviceSize size);
+
+    template<typename T>
+    UniformAllocation push(const T& value)
+    {
+        UniformAllocation allocation = allocate(sizeof(T));
+        std::memcpy(allocation.data, &value, sizeof(T));
+        return allocation;
+    }
+
+    // One dynamic uniform buffer at binding 0, visible to all stages.
+    vk::DescriptorSetLayout setLayout() const;
+    vk::DeviceSize alignment() const;
+    UniformRingStats stats() const;
+
+private:
+    struct Buffer {
+        vk::raii::Buffer buffer {nullptr};
+        MemoryAllocation memory;
+        vk::raii::DescriptorPool pool {nullptr};
+        vk::DescriptorSet set;
+        vk::DeviceSize capacity = 0;
+    };
+
+    struct FrameContext {
+        Buffer current;
+        // Outgrown during the context's last frame.
+        std::vector<Buffer> retired;
+    };
+
+    Buffer createBuffer(vk::DeviceSize capacity) const;
+    void destroyBuffer(Buffer& buffer) const;
+    void grow(vk::DeviceSize size);
+
+    const vk::raii::Device* _device = nullptr;
+    MemoryAllocator* _allocator = nullptr;
+    UniformRingOptions _options;
+    vk::DeviceSize _alignment = 1;
+
+    vk::raii::DescriptorSetLayout _setLayout {nullptr};
+    std::vector<FrameContext> _frames;
+    uint32_t _frameContext = 0;
+    // Into the current context's buffer.
+    vk::DeviceSize _head = 0;
+
+    UniformRingStats _stats;
+};
+
+} // namespace rr
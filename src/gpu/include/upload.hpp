@@ -0,0 +1,156 @@
+#pragma once
+
+#include <memory_allocator.hpp>
+#include <timeline.hpp>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace rr {
+
+// Returns a queue family that supports transfers but neither graphics nor
+// compute, if the device has one. Such families usually map to dedicated
+// DMA engines that run alongside rendering.
+std::optional<uint32_t> findTransferQueueFamily(
+    const vk::raii::PhysicalDevice& physicalDevice);
+
+struct UploadServiceOptions {
+    vk::DeviceSize stagingSize = 64 * 1024 * 1024;
+    uint32_t transferQueueFamily = 0;
+    uint32_t graphicsQueueFamily = 0;
+    // Registered with the TimelineSync passed to the service.
+    QueueId transferQueue = 0;
+};
+
+// What the graphics queue needs to consume a batch of uploads.
+struct UploadSubmission {
+    // Wait for this point, at waitStage, in the next graphics submission.
+    TimelinePoint point;
+    vk::PipelineStageFlags waitStage;
+    // Queue family acquire operations (or, on a shared family, layout
+    // transitions) to record before the uploaded resources are used.
+    std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+    std::vector<vk::ImageMemoryBarrier> imageBarriers;
+
+    void recordAcquire(vk::CommandBuffer commandBuffer) const;
+    TimelineWait wait() const;
+};
+
+struct UploadStats {
+    uint64_t bytes = 0;
+    uint64_t copies = 0;
+    uint64_t submissions = 0;
+    // Times an upload had to wait for staging space.
+    uint64_t stalls = 0;
+};
+
+// Streams data to device-local resources through a staging ring buffer on a
+// transfer queue.
+//
+// Uploads copy their data into the ring right away and record the GPU copy
+// into the current batch. flush() submits the batch and returns the timeline
+// point for the graphics queue to wait on, so the copies run on the transfer
+// queue while the previous frame renders. When the transfer queue belongs to a
+// different family, resources are released to the graphics family after the
+// copy and must be acquired with the returned barriers.
+class UploadService {
+public:
+    UploadService(
+        const vk::raii::PhysicalDevice& physicalDevice,
+        const vk::raii::Device& device,
+        MemoryAllocator& allocator,
+        TimelineSync& sync,
+        UploadServiceOptions options);
+    ~UploadService();
+
+    UploadService(const UploadService&) = delete;
+    UploadService& operator=(const UploadService&) = delete;
+
+    // dstAccess and dstStage describe how the graphics queue will first use
+    // the data. Uploads larger than the ring are split into several copies.
+    void uploadBuffer(
+        vk::Buffer buffer,
+        vk::DeviceSize offset,
+        std::span<const std::byte> data,
+        vk::AccessFlags dstAccess,
+        vk::PipelineStageFlags dstStage);
+
+    // Uploads one mip level of one or more array layers. The image is moved
+    // from oldLayout to finalLayout; the whole upload must fit in the ring.
+    void uploadImage(
+        vk::Image image,
+        const vk::ImageSubresourceLayers& subresource,
+        vk::Extent3D extent,
+        std::span<const std::byte> data,
+        vk::ImageLayout oldLayout,
+        vk::ImageLayout finalLayout,
+        vk::AccessFlags dstAccess,
+        vk::PipelineStageFlags dstStage);
+
+    // Submits the pending copies. Returns nothing if there was nothing to
+    // submit.
+    std::optional<UploadSubmission> flush();
+
+    // Reclaims staging space and command buffers of finished copies.
+    void collect();
+
+    bool dedicatedTransferQueue() const;
+    UploadStats stats() const;
+
+private:
+    struct Batch {
+        vk::raii::CommandPool pool {nullptr};
+        vk::raii::CommandBuffer commandBuffer {nullptr};
+        TimelinePoint point;
+        // Ring state after the batch's staging data is released.
+        vk::DeviceSize stagingEnd = 0;
+        vk::DeviceSize stagingBytes = 0;
+    };
+
+    Batch& currentBatch();
+    vk::DeviceSize allocateStaging(vk::DeviceSize size);
+    void releaseStaging(Batch& batch);
+    bool waitForStaging();
+    void submit();
+
+    const vk::raii::Device* _device = nullptr;
+    MemoryAllocator* _allocator = nullptr;
+    TimelineSync* _sync = nullptr;
+    UploadServiceOptions _options;
+    vk::DeviceSize _copyAlignment = 16;
+
+    vk::raii::Buffer _staging {nullptr};
+    MemoryAllocation _stagingMemory;
+    vk::DeviceSize _head = 0;
+    vk::DeviceSize _tail = 0;
+    // Bytes between tail and head, including padding, and the part of them
+    // owned by the batch being recorded.
+    vk::DeviceSize _used = 0;
+    vk::DeviceSize _pendingBytes = 0;
+
+    std::unique_ptr<Batch> _current;
+    std::deque<std::unique_ptr<Batch>> _inFlight;
+    std::vector<std::unique_ptr<Batch>> _freeBatches;
+
+    // Recorded at the end of the current batch.
+    std::vector<vk::BufferMemoryBarrier> _releaseBuffers;
+    std::vector<vk::ImageMemoryBarrier> _releaseImages;
+    // Handed to the graphics queue by the next flush.
+    std::vector<vk::BufferMemoryBarrier> _acquireBuffers;
+    std::vector<vk::ImageMemoryBarrier> _acquireImages;
+    vk::PipelineStageFlags _waitStages;
+    // Set when a batch was submitted early because the ring ran full; the
+    // next flush must still hand its point to the graphics queue.
+    bool _unflushedSubmissions = false;
+
+    UploadStats _stats;
+};
+
+} // namespace rr
@@ -0,0 +1,697 @@
+#include <memory_allocator.hpp>
+
+#include <error.hpp>
+
+#include <algorithm>
+#include <bit>
+
+namespace rr {
+
+namespace {
+
+vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+vk::DeviceSize alignDown(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return value / alignment * alignment;
+}
+
+size_t defaultPoolIndex(uint32_t memoryTypeIndex, ResourceKind kind)
+{
+    return memoryTypeIndex * 2 + (kind == ResourceKind::Optimal ? 1 : 0);
+}
+
+} // namespace
+
+MemoryPool::MemoryPool(MemoryPoolOptions options)
+    : _options(options)
+{ }
+
+const MemoryPoolOptions& MemoryPool::options() const
+{
+    return _options;
+}
+
+std::optional<MemoryAllocation> MemoryPool::allocateFromBlock(
+    uint32_t blockIndex, vk::DeviceSize size, vk::DeviceSize alignment)
+{
+    Block& block = *_blocks.at(blockIndex);
+
+    auto allocation = MemoryAllocation{
+        .memory = *block.memory,
+        .offset = 0,
+        .size = size,
+        .mapped = nullptr,
+        .memoryTypeIndex = _options.memoryTypeIndex,
+        .pool = this,
+        .block = blockIndex,
+        .handle = 0,
+        .dedicated = false,
+    };
+
+    switch (_options.strategy) {
+        case AllocationStrategy::Tlsf:
+        {
+            auto range = block.tlsf->allocate(size, alignment);
+            if (!range) {
+                return std::nullopt;
+            }
+            allocation.offset = range->offset;
+            allocation.handle = range->handle;
+            break;
+        }
+
+        case AllocationStrategy::Linear:
+        {
+            vk::DeviceSize offset = alignUp(block.head, alignment);
+            if (offset + size > block.size) {
+                return std::nullopt;
+            }
+            allocation.offset = offset;
+            block.head = offset + size;
+            break;
+        }
+
+        case AllocationStrategy::Ring:
+        {
+            if (block.full) {
+                return std::nullopt;
+            }
+
+            vk::DeviceSize offset = alignUp(block.head, alignment);
+            if (block.head >= block.tail) {
+                // Free space is [head, size) followed by [0, tail). Skip the
+                // end of the block if the allocation does not fit there; the
+                // skipped bytes come back when the tail wraps around.
+                if (offset + size > block.size) {
+                    offset = 0;
+                    if (size > block.tail) {
+                        return std::nullopt;
+                    }
+                }
+            } else if (offset + size > block.tail) {
+                return std::nullopt;
+            }
+
+            allocation.offset = offset;
+            block.head = offset + size;
+            if (block.head == block.size) {
+                block.head = 0;
+            }
+            block.full = (block.head == block.tail);
+            break;
+        }
+    }
+
+    if (block.mapped) {
+        allocation.mapped = static_cast<char*>(block.mapped) + allocation.offset;
+    }
+    block.allocationCount++;
+    block.usedBytes += size;
+    return allocation;
+}
+
+void MemoryPool::free(const MemoryAllocation& allocation)
+{
+    Block& block = *_blocks.at(allocation.block);
+    block.allocationCount--;
+    block.usedBytes -= allocation.size;
+
+    switch (_options.strategy) {
+        case AllocationStrategy::Tlsf:
+            block.tlsf->free(allocation.handle);
+            break;
+
+        case AllocationStrategy::Linear:
+            if (block.allocationCount == 0) {
+                block.head = 0;
+            }
+            break;
+
+        case AllocationStrategy::Ring:
+            // Allocations are freed oldest first, so the end of this one is
+            // the start of the oldest allocation still alive.
+            block.tail = allocation.offset + allocation.size;
+            block.full = false;
+            if (block.allocationCount == 0) {
+                block.head = 0;
+                block.tail = 0;
+            }
+            break;
+    }
+}
+
+MemoryAllocator::MemoryAllocator(
+    const vk::raii::PhysicalDevice& physicalDevice,
+    const vk::raii::Device& device,
+    Options options)
+    : _device(&device)
+    , _options(options)
+    , _memoryProperties(physicalDevice.getMemoryProperties())
+{
+    auto limits = physicalDevice.getProperties().limits;
+    _bufferImageGranularity = limits.bufferImageGranularity;
+    _nonCoherentAtomSize = limits.nonCoherentAtomSize;
+
+    _defaultPools.resize(_memoryProperties.memoryTypeCount * 2);
+    _stats.heaps.resize(_memoryProperties.memoryHeapCount);
+}
+
+MemoryAllocation MemoryAllocator::allocate(const AllocationRequest& request)
+{
+    auto lock = std::lock_guard{_mutex};
+    _stats.allocations++;
+
+    const vk::MemoryRequirements& requirements = request.requirements;
+
+    if (request.pool && !request.dedicated) {
+        uint32_t memoryTypeIndex = request.pool->options().memoryTypeIndex;
+        if (!(requirements.memoryTypeBits & (1u << memoryTypeIndex))) {
+            _stats.failedAllocations++;
+            throw Error{} << "memory type " << memoryTypeIndex <<
+                " of the pool is not allowed by the resource";
+        }
+        auto allocation = allocateFromPool(*request.pool, requirements, false);
+        if (allocation) {
+            return *allocation;
+        }
+        _stats.failedAllocations++;
+        throw Error{} << "pool is out of memory for " <<
+            requirements.size << " bytes";
+    }
+
+    // Walk memory types from best to worst, so that a full device-local heap
+    // spills into the next best type instead of failing: first within the
+    // heap budgets, then ignoring them.
+    for (bool withinBudget : {!_budgets.empty(), false}) {
+        uint32_t memoryTypeBits = requirements.memoryTypeBits;
+        while (auto memoryTypeIndex = findMemoryType(
+                memoryTypeBits,
+                request.requiredFlags,
+                request.preferredFlags)) {
+            bool dedicated = request.dedicated ||
+                requirements.size > blockSizeFor(*memoryTypeIndex) / 2;
+
+            auto allocation = dedicated ?
+                allocateDedicated(*memoryTypeIndex, request, withinBudget) :
+                allocateFromPool(
+                    defaultPool(*memoryTypeIndex, request.kind),
+                    requirements,
+                    withinBudget);
+            if (allocation) {
+                return *allocation;
+            }
+            memoryTypeBits &= ~(1u << *memoryTypeIndex);
+        }
+        if (!withinBudget) {
+            break;
+        }
+    }
+
+    _stats.failedAllocations++;
+    throw Error{} << "cannot allocate " << requirements.size <<
+        " bytes of device memory";
+}
+
+void MemoryAllocator::free(const MemoryAllocation& allocation)
+{
+    if (!allocation) {
+        return;
+    }
+
+    auto lock = std::lock_guard{_mutex};
+    _stats.frees++;
+
+    if (allocation.dedicated) {
+        _dedicated.erase(static_cast<VkDeviceMemory>(allocation.memory));
+        _stats.deviceMemoryFrees++;
+        return;
+    }
+
+    MemoryPool& pool = *allocation.pool;
+    pool.free(allocation);
+
+    // Give empty general-purpose blocks back to the driver, but keep one
+    // around so that a pool oscillating around a block boundary does not
+    // allocate and free device memory every frame.
+    if (pool._options.strategy == AllocationStrategy::Tlsf &&
+            pool._blocks.at(allocation.block)->allocationCount == 0) {
+        auto liveBlocks = std::ranges::count_if(
+            pool._blocks, [] (const auto& block) { return block != nullptr; });
+        if (liveBlocks > 1) {
+            pool._blocks.at(allocation.block).reset();
+            _stats.deviceMemoryFrees++;
+        }
+    }
+}
+
+MemoryAllocation MemoryAllocator::allocateForBuffer(
+    vk::Buffer buffer,
+    vk::MemoryPropertyFlags requiredFlags,
+    vk::MemoryPropertyFlags preferredFlags,
+    MemoryPool* pool)
+{
+    auto requirementsInfo = vk::BufferMemoryRequirementsInfo2{
+        .pNext = nullptr,
+        .buffer = buffer,
+    };
+    auto requirements = _device->getBufferMemoryRequirements2<
+        vk::MemoryRequirements2, vk::MemoryDedicatedRequirements>(
+            requirementsInfo);
+    const auto& dedicatedRequirements =
+        requirements.get<vk::MemoryDedicatedRequirements>();
+
+    auto allocation = allocate(AllocationRequest{
+        .requirements =
+            requirements.get<vk::MemoryRequirements2>().memoryRequirements,
+        .requiredFlags = requiredFlags,
+        .preferredFlags = preferredFlags,
+        .kind = ResourceKind::Linear,
+        .pool = pool,
+        .dedicated = dedicatedRequirements.requiresDedicatedAllocation ||
+            (!pool && dedicatedRequirements.prefersDedicatedAllocation),
+        .dedicatedBuffer = buffer,
+        .dedicatedImage = {},
+    });
+
+    _device->bindBufferMemory2(vk::BindBufferMemoryInfo{
+        .pNext = nullptr,
+        .buffer = buffer,
+        .memory = allocation.memory,
+        .memoryOffset = allocation.offset,
+    });
+    return allocation;
+}
+
+MemoryAllocation MemoryAllocator::allocateForImage(
+    vk::Image image,
+    ResourceKind kind,
+    vk::MemoryPropertyFlags requiredFlags,
+    vk::MemoryPropertyFlags preferredFlags,
+    MemoryPool* pool)
+{
+    auto requirementsInfo = vk::ImageMemoryRequirementsInfo2{
+        .pNext = nullptr,
+        .image = image,
+    };
+    auto requirements = _device->getImageMemoryRequirements2<
+        vk::MemoryRequirements2, vk::MemoryDedicatedRequirements>(
+            requirementsInfo);
+    const auto& dedicatedRequirements =
+        requirements.get<vk::MemoryDedicatedRequirements>();
+
+    auto allocation = allocate(AllocationRequest{
+        .requirements =
+            requirements.get<vk::MemoryRequirements2>().memoryRequirements,
+        .requiredFlags = requiredFlags,
+        .preferredFlags = preferredFlags,
+        .kind = kind,
+        .pool = pool,
+        .dedicated = dedicatedRequirements.requiresDedicatedAllocation ||
+            (!pool && dedicatedRequirements.prefersDedicatedAllocation),
+        .dedicatedBuffer = {},
+        .dedicatedImage = image,
+    });
+
+    _device->bindImageMemory2(vk::BindImageMemoryInfo{
+        .pNext = nullptr,
+        .image = image,
+        .memory = allocation.memory,
+        .memoryOffset = allocation.offset,
+    });
+    return allocation;
+}
+
+void MemoryAllocator::setHeapBudgets(
+    std::span<const MemoryHeapBudget> budgets)
+{
+    auto lock = std::lock_guard{_mutex};
+    _budgets.assign(budgets.begin(), budgets.end());
+    _budgets.resize(_memoryProperties.memoryHeapCount);
+}
+
+MemoryPool& MemoryAllocator::createPool(MemoryPoolOptions options)
+{
+    if (options.memoryTypeIndex >= _memoryProperties.memoryTypeCount) {
+        throw Error{} << "invalid memory type index: " << options.memoryTypeIndex;
+    }
+    if (options.blockSize == 0) {
+        options.blockSize = blockSizeFor(options.memoryTypeIndex);
+    }
+    if (options.strategy != AllocationStrategy::Tlsf) {
+        options.maxBlocks = 1;
+    }
+
+    auto lock = std::lock_guard{_mutex};
+    _customPools.push_back(
+        std::unique_ptr<MemoryPool>{new MemoryPool{options}});
+    return *_customPools.back();
+}
+
+void MemoryAllocator::destroyPool(MemoryPool& pool)
+{
+    auto lock = std::lock_guard{_mutex};
+    for (const auto& block : pool._blocks) {
+        if (block) {
+            _stats.deviceMemoryFrees++;
+        }
+    }
+    std::erase_if(_customPools, [&pool] (const auto& p) {
+        return p.get() == &pool;
+    });
+}
+
+void MemoryAllocator::resetPool(MemoryPool& pool)
+{
+    if (pool._options.strategy == AllocationStrategy::Tlsf) {
+        throw Error{} << "only linear and ring pools can be reset";
+    }
+
+    auto lock = std::lock_guard{_mutex};
+    for (auto& block : pool._blocks) {
+        if (block) {
+            _stats.frees += block->allocationCount;
+            block->head = 0;
+            block->tail = 0;
+            block->full = false;
+            block->allocationCount = 0;
+            block->usedBytes = 0;
+        }
+    }
+}
+
+void MemoryAllocator::flush(
+    const MemoryAllocation& allocation,
+    vk::DeviceSize offset,
+    vk::DeviceSize size) const
+{
+    const vk::MemoryType& memoryType =
+        _memoryProperties.memoryTypes.at(allocation.memoryTypeIndex);
+    if (memoryType.propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent) {
+        return;
+    }
+
+    if (size == VK_WHOLE_SIZE) {
+        size = allocation.size - offset;
+    }
+
+    vk::DeviceSize memorySize = 0;
+    {
+        auto lock = std::lock_guard{_mutex};
+        if (allocation.dedicated) {
+            memorySize = _dedicated.at(
+                static_cast<VkDeviceMemory>(allocation.memory)).size;
+        } else {
+            memorySize = allocation.pool->_blocks.at(allocation.block)->size;
+        }
+    }
+
+    // Flushed ranges must be multiples of nonCoherentAtomSize, or reach the
+    // end of the memory object.
+    vk::DeviceSize begin = alignDown(
+        allocation.offset + offset, _nonCoherentAtomSize);
+    vk::DeviceSize end = alignUp(
+        allocation.offset + offset + size, _nonCoherentAtomSize);
+
+    _device->flushMappedMemoryRanges(vk::MappedMemoryRange{
+        .pNext = nullptr,
+        .memory = allocation.memory,
+        .offset = begin,
+        .size = end >= memorySize ? VK_WHOLE_SIZE : end - begin,
+    });
+}
+
+std::optional<uint32_t> MemoryAllocator::findMemoryType(
+    uint32_t memoryTypeBits,
+    vk::MemoryPropertyFlags requiredFlags,
+    vk::MemoryPropertyFlags preferredFlags) const
+{
+    // Never pick these unless asked to: protected memory needs a protected
+    // queue, and lazily allocated memory only works for transient
+    // attachments.
+    const auto avoidedFlags =
+        (vk::MemoryPropertyFlagBits::eProtected |
+            vk::MemoryPropertyFlagBits::eLazilyAllocated) &
+        ~(requiredFlags | preferredFlags);
+
+    std::optional<uint32_t> best;
+    int bestScore = -1;
+    for (uint32_t i = 0; i < _memoryProperties.memoryTypeCount; i++) {
+        if (!(memoryTypeBits & (1u << i))) {
+            continue;
+        }
+
+        vk::MemoryPropertyFlags flags =
+            _memoryProperties.memoryTypes.at(i).propertyFlags;
+        if ((flags & requiredFlags) != requiredFlags || (flags & avoidedFlags)) {
+            continue;
+        }
+
+        int score = std::popcount(
+            static_cast<VkMemoryPropertyFlags>(flags & preferredFlags));
+        if (score > bestScore) {
+            best = i;
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
+const vk::PhysicalDeviceMemoryProperties& MemoryAllocator::memoryProperties() const
+{
+    return _memoryProperties;
+}
+
+vk::DeviceSize MemoryAllocator::bufferImageGranularity() const
+{
+    return _bufferImageGranularity;
+}
+
+MemoryStats MemoryAllocator::stats() const
+{
+    auto lock = std::lock_guard{_mutex};
+
+    MemoryStats stats = _stats;
+    for (auto& heap : stats.heaps) {
+        heap = MemoryHeapStats{};
+    }
+
+    auto addPool = [this, &stats] (const MemoryPool& pool) {
+        uint32_t heapIndex = _memoryProperties.memoryTypes.at(
+            pool._options.memoryTypeIndex).heapIndex;
+        MemoryHeapStats& heap = stats.heaps.at(heapIndex);
+        for (const auto& block : pool._blocks) {
+            if (block) {
+                heap.blockCount++;
+                heap.blockBytes += block->size;
+                heap.allocationCount += block->allocationCount;
+                heap.allocationBytes += block->usedBytes;
+            }
+        }
+    };
+    for (const auto& pool : _defaultPools) {
+        if (pool) {
+            addPool(*pool);
+        }
+    }
+    for (const auto& pool : _customPools) {
+        addPool(*pool);
+    }
+
+    for (const auto& [handle, dedicated] : _dedicated) {
+        uint32_t heapIndex = _memoryProperties.memoryTypes.at(
+            dedicated.memoryTypeIndex).heapIndex;
+        MemoryHeapStats& heap = stats.heaps.at(heapIndex);
+        heap.dedicatedCount++;
+        heap.dedicatedBytes += dedicated.size;
+    }
+
+    return stats;
+}
+
+MemoryPool& MemoryAllocator::defaultPool(
+    uint32_t memoryTypeIndex, ResourceKind kind)
+{
+    // Without a granularity constraint both kinds can share blocks.
+    if (_bufferImageGranularity <= 1) {
+        kind = ResourceKind::Linear;
+    }
+
+    auto& pool = _defaultPools.at(defaultPoolIndex(memoryTypeIndex, kind));
+    if (!pool) {
+        pool.reset(new MemoryPool{MemoryPoolOptions{
+            .memoryTypeIndex = memoryTypeIndex,
+            .blockSize = blockSizeFor(memoryTypeIndex),
+            .strategy = AllocationStrategy::Tlsf,
+            .kind = kind,
+            .maxBlocks = 0,
+        }});
+    }
+    return *pool;
+}
+
+std::optional<MemoryAllocation> MemoryAllocator::allocateFromPool(
+    MemoryPool& pool,
+    const vk::MemoryRequirements& requirements,
+    bool withinBudget)
+{
+    for (uint32_t i = 0; i < pool._blocks.size(); i++) {
+        if (!pool._blocks[i]) {
+            continue;
+        }
+        auto allocation = pool.allocateFromBlock(
+            i, requirements.size, requirements.alignment);
+        if (allocation) {
+            return allocation;
+        }
+    }
+
+    auto liveBlocks = (uint32_t)std::ranges::count_if(
+        pool._blocks, [] (const auto& block) { return block != nullptr; });
+    if (pool._options.maxBlocks != 0 && liveBlocks >= pool._options.maxBlocks) {
+        return std::nullopt;
+    }
+
+    // Try smaller blocks when the heap cannot fit a full one, as long as the
+    // request still fits.
+    uint32_t memoryTypeIndex = pool._options.memoryTypeIndex;
+    vk::DeviceSize blockSize =
+        std::max(pool._options.blockSize, requirements.size);
+    auto memory = vk::raii::DeviceMemory{nullptr};
+    for (;;) {
+        memory = allocateDeviceMemory(
+            memoryTypeIndex, blockSize, nullptr, withinBudget);
+        if (*memory || blockSize / 2 < requirements.size) {
+            break;
+        }
+        blockSize /= 2;
+    }
+    if (!*memory) {
+        return std::nullopt;
+    }
+
+    auto block = std::make_unique<MemoryPool::Block>();
+    block->mapped = mapIfHostVisible(memory, memoryTypeIndex);
+    block->memory = std::move(memory);
+    block->size = blockSize;
+    if (pool._options.strategy == AllocationStrategy::Tlsf) {
+        block->tlsf = std::make_unique<Tlsf>(blockSize);
+    }
+
+    auto slot = std::ranges::find(pool._blocks, nullptr);
+    if (slot == pool._blocks.end()) {
+        pool._blocks.push_back(std::move(block));
+        slot = std::prev(pool._blocks.end());
+    } else {
+        *slot = std::move(block);
+    }
+
+    return pool.allocateFromBlock(
+        (uint32_t)(slot - pool._blocks.begin()),
+        requirements.size,
+        requirements.alignment);
+}
+
+std::optional<MemoryAllocation> MemoryAllocator::allocateDedicated(
+    uint32_t memoryTypeIndex,
+    const AllocationRequest& request,
+    bool withinBudget)
+{
+    auto dedicatedInfo = vk::MemoryDedicatedAllocateInfo{
+        .pNext = nullptr,
+        .image = request.dedicatedImage,
+        .buffer = request.dedicatedBuffer,
+    };
+    bool hasResource = request.dedicatedImage || request.dedicatedBuffer;
+
+    vk::raii::DeviceMemory memory = allocateDeviceMemory(
+        memoryTypeIndex,
+        request.requirements.size,
+        hasResource ? &dedicatedInfo : nullptr,
+        withinBudget);
+    if (!*memory) {
+        return std::nullopt;
+    }
+
+    auto allocation = MemoryAllocation{
+        .memory = *memory,
+        .offset = 0,
+        .size = request.requirements.size,
+        .mapped = mapIfHostVisible(memory, memoryTypeIndex),
+        .memoryTypeIndex = memoryTypeIndex,
+        .pool = nullptr,
+        .block = 0,
+        .handle = 0,
+        .dedicated = true,
+    };
+    _dedicated.emplace(
+        static_cast<VkDeviceMemory>(*memory),
+        DedicatedMemory{
+            .memory = std::move(memory),
+            .size = request.requirements.size,
+            .memoryTypeIndex = memoryTypeIndex,
+        });
+    return allocation;
+}
+
+vk::raii::DeviceMemory MemoryAllocator::allocateDeviceMemory(
+    uint32_t memoryTypeIndex,
+    vk::DeviceSize size,
+    const void* pNext,
+    bool withinBudget)
+{
+    uint32_t heapIndex =
+        _memoryProperties.memoryTypes.at(memoryTypeIndex).heapIndex;
+    MemoryHeapBudget* budget =
+        _budgets.empty() ? nullptr : &_budgets.at(heapIndex);
+    if (withinBudget && budget && budget->budget != 0 &&
+            budget->usage + size > budget->budget) {
+        return vk::raii::DeviceMemory{nullptr};
+    }
+
+    auto allocateInfo = vk::MemoryAllocateInfo{
+        .pNext = pNext,
+        .allocationSize = size,
+        .memoryTypeIndex = memoryTypeIndex,
+    };
+    try {
+        auto memory = _device->allocateMemory(allocateInfo);
+        _stats.deviceMemoryAllocations++;
+        if (budget) {
+            budget->usage += size;
+        }
+        return memory;
+    } catch (const vk::OutOfDeviceMemoryError&) {
+        return vk::raii::DeviceMemory{nullptr};
+    }
+}
+
+void* MemoryAllocator::mapIfHostVisible(
+    const vk::raii::DeviceMemory& memory, uint32_t memoryTypeIndex)
+{
+    const vk::MemoryType& memoryType =
+        _memoryProperties.memoryTypes.at(memoryTypeIndex);
+    if (!(memoryType.propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)) {
+        return nullptr;
+    }
+    return memory.mapMemory(0, VK_WHOLE_SIZE);
+}
+
+vk::DeviceSize MemoryAllocator::blockSizeFor(uint32_t memoryTypeIndex) const
+{
+    uint32_t heapIndex =
+        _memoryProperties.memoryTypes.at(memoryTypeIndex).heapIndex;
+    vk::DeviceSize heapSize = _memoryProperties.memoryHeaps.at(heapIndex).size;
+
+    // Small heaps (such as a 256 MiB host-visible BAR window) would be used
+    // up by a handful of full-size blocks.
+    if (heapSize <= 1024ull * 1024 * 1024) {
+        return std::min(_options.blockSize, std::bit_ceil(heapSize / 8));
+    }
+    return _options.blockSize;
+}
+
+} // namespace rr
@@ -0,0 +1,141 @@
+#include <memory_budget.hpp>
+
+#include <algorithm>
+#include <utility>
+
+namespace rr {
+
+float MemoryHeapUsage::pressure() const
+{
+    return budget != 0 ? (float)((double)usage / (double)budget) : 0.f;
+}
+
+vk::DeviceSize MemoryHeapUsage::headroom() const
+{
+    return budget > usage ? budget - usage : 0;
+}
+
+MemoryBudget::MemoryBudget(
+    const vk::raii::PhysicalDevice& physicalDevice,
+    MemoryAllocator& allocator,
+    MemoryBudgetOptions options)
+    : _physicalDevice(&physicalDevice)
+    , _allocator(&allocator)
+    , _options(options)
+{
+    const vk::PhysicalDeviceMemoryProperties& properties =
+        allocator.memoryProperties();
+    _heaps.resize(properties.memoryHeapCount);
+    _budgets.resize(properties.memoryHeapCount);
+    for (uint32_t i = 0; i < properties.memoryHeapCount; i++) {
+        const vk::MemoryHeap& heap = properties.memoryHeaps.at(i);
+        _heaps[i].size = heap.size;
+        _heaps[i].deviceLocal =
+            bool(heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal);
+    }
+    update();
+}
+
+void MemoryBudget::onPressure(float threshold, MemoryPressureCallback callback)
+{
+    auto& entry = _callbacks.emplace_back();
+    entry.threshold = threshold;
+    entry.callback = std::move(callback);
+    entry.above.resize(_heaps.size());
+    for (size_t i = 0; i < _heaps.size(); i++) {
+        entry.above[i] = _heaps[i].pressure() >= threshold;
+    }
+}
+
+void MemoryBudget::update()
+{
+    if (_options.memoryBudgetExtension) {
+        auto properties = _physicalDevice->getMemoryProperties2<
+            vk::PhysicalDeviceMemoryProperties2,
+            vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+        const auto& budget =
+            properties.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+        for (size_t i = 0; i < _heaps.size(); i++) {
+            _heaps[i].usage = budget.heapUsage.at(i);
+            // Drivers may report budgets above the heap size.
+            _heaps[i].budget =
+                std::min(budget.heapBudget.at(i), _heaps[i].size);
+        }
+    } else {
+        auto stats = _allocator->stats();
+        for (size_t i = 0; i < _heaps.size(); i++) {
+            const MemoryHeapStats& heap = stats.heaps.at(i);
+            _heaps[i].usage = heap.blockBytes + heap.dedicatedBytes;
+            _heaps[i].budget = (vk::DeviceSize)(
+                (double)_heaps[i].size * _options.fallbackBudget);
+        }
+    }
+    _updates++;
+
+    for (size_t i = 0; i < _heaps.size(); i++) {
+        _budgets[i] = MemoryHeapBudget{
+            .usage = _heaps[i].usage,
+            .budget = _heaps[i].budget,
+        };
+    }
+    _allocator->setHeapBudgets(_budgets);
+
+    for (Callback& entry : _callbacks) {
+        for (size_t i = 0; i < _heaps.size(); i++) {
+            float pressure = _heaps[i].pressure();
+            bool rising = !entry.above[i] && pressure >= entry.threshold;
+            bool falling = entry.above[i] &&
+                pressure < entry.threshold - _options.hysteresis;
+            if (!rising && !falling) {
+                continue;
+            }
+            entry.above[i] = rising;
+            _pressureEvents++;
+            entry.callback(MemoryPressureEvent{
+                .heap = (uint32_t)i,
+                .threshold = entry.threshold,
+                .pressure = pressure,
+                .rising = rising,
+            });
+        }
+    }
+}
+
+std::span<const MemoryHeapUsage> MemoryBudget::heaps() const
+{
+    return _heaps;
+}
+
+vk::DeviceSize MemoryBudget::deviceLocalHeadroom() const
+{
+    vk::DeviceSize headroom = 0;
+    for (const MemoryHeapUsage& heap : _heaps) {
+        if (heap.deviceLocal) {
+            headroom += heap.headroom();
+        }
+    }
+    return headroom;
+}
+
+float MemoryBudget::deviceLocalPressure() const
+{
+    float pressure = 0.f;
+    for (const MemoryHeapUsage& heap : _heaps) {
+        if (heap.deviceLocal) {
+            pressure = std::max(pressure, heap.pressure());
+        }
+    }
+    return pressure;
+}
+
+MemoryBudgetStats MemoryBudget::stats() const
+{
+    return MemoryBudgetStats{
+        .heaps = _heaps,
+        .memoryBudgetExtension = _options.memoryBudgetExtension,
+        .updates = _updates,
+        .pressureEvents = _pressureEvents,
+    };
+}
+
+} // namespace rr
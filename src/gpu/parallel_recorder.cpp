@@ -0,0 +1,103 @@
+#include <parallel_recorder.hpp>
+
+#include <algorithm>
+
+namespace rr {
+
+ParallelRecorder::ParallelRecorder(
+    JobSystem& jobs,
+    const vk::raii::Device& device,
+    uint32_t queueFamilyIndex,
+    uint32_t frameContextCount)
+    : _jobs(&jobs)
+    , _device(&device)
+    , _workerCount(jobs.threadCount())
+{
+    _pools.reserve(frameContextCount * _workerCount);
+    for (uint32_t i = 0; i < frameContextCount * _workerCount; i++) {
+        auto commandPoolInfo = vk::CommandPoolCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::CommandPoolCreateFlagBits::eTransient,
+            .queueFamilyIndex = queueFamilyIndex,
+        };
+        _pools.push_back(WorkerPool{
+            .pool = device.createCommandPool(commandPoolInfo),
+            .buffers = {},
+            .used = 0,
+        });
+    }
+}
+
+void ParallelRecorder::beginFrame(uint32_t frameContext)
+{
+    _frameContext = frameContext;
+    for (uint32_t worker = 0; worker < _workerCount; worker++) {
+        WorkerPool& pool = _pools.at(_frameContext * _workerCount + worker);
+        pool.pool.reset();
+        pool.used = 0;
+    }
+}
+
+void ParallelRecorder::record(
+    vk::CommandBuffer primary,
+    const vk::CommandBufferInheritanceInfo& inheritance,
+    uint32_t itemCount,
+    const RecordFunction& recordFunction,
+    uint32_t minItemsPerWorker)
+{
+    if (itemCount == 0) {
+        return;
+    }
+
+    uint32_t chunkCount = std::clamp(
+        itemCount / std::max(minItemsPerWorker, 1u), 1u, _workerCount);
+
+    auto secondaries = std::vector<vk::CommandBuffer>(chunkCount);
+    _jobs->parallelFor(0, chunkCount, 1, [&] (uint32_t chunk, uint32_t) {
+        auto begin = (uint32_t)((uint64_t)itemCount * chunk / chunkCount);
+        auto end = (uint32_t)((uint64_t)itemCount * (chunk + 1) / chunkCount);
+
+        // Chunks may run on any thread, but a thread runs one job at a time,
+        // so its pool is never used concurrently.
+        vk::CommandBuffer commandBuffer =
+            nextBuffer(JobSystem::currentThreadIndex());
+        auto beginInfo = vk::CommandBufferBeginInfo{
+            .pNext = nullptr,
+            .flags =
+                vk::CommandBufferUsageFlagBits::eOneTimeSubmit |
+                vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+            .pInheritanceInfo = &inheritance,
+        };
+        commandBuffer.begin(beginInfo);
+        recordFunction(commandBuffer, begin, end);
+        commandBuffer.end();
+
+        secondaries.at(chunk) = commandBuffer;
+    });
+
+    primary.executeCommands(secondaries);
+}
+
+uint32_t ParallelRecorder::workerCount() const
+{
+    return _workerCount;
+}
+
+vk::CommandBuffer ParallelRecorder::nextBuffer(uint32_t worker)
+{
+    WorkerPool& pool = _pools.at(_frameContext * _workerCount + worker);
+    if (pool.used == pool.buffers.size()) {
+        auto commandBufferInfo = vk::CommandBufferAllocateInfo{
+            .pNext = nullptr,
+            .commandPool = pool.pool,
+            .level = vk::CommandBufferLevel::eSecondary,
+            .commandBufferCount = 4,
+        };
+        for (auto& buffer : _device->allocateCommandBuffers(commandBufferInfo)) {
+            pool.buffers.push_back(std::move(buffer));
+        }
+    }
+    return pool.buffers.at(pool.used++);
+}
+
+} // namespace rr
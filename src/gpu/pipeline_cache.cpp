@@ -0,0 +1,311 @@
+#include <pipeline_cache.hpp>
+
+#include <error.hpp>
+#include <mm.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+namespace rr {
+
+namespace {
+
+constexpr uint32_t fileMagic = 0x43505252; // "RRPC"
+constexpr uint32_t fileVersion = 1;
+
+// Written in front of the data returned by vkGetPipelineCacheData. The
+// Vulkan header already carries vendor, device and cache UUID, but not the
+// driver version, and nothing protects against a truncated or damaged file.
+struct FileHeader {
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint32_t vendorID = 0;
+    uint32_t deviceID = 0;
+    uint32_t driverVersion = 0;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE] {};
+    uint32_t reserved = 0;
+    uint64_t dataSize = 0;
+    uint64_t checksum = 0;
+};
+
+uint64_t fnv1a(const uint8_t* data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+// Returns the reason the file cannot be used, or an empty string.
+std::string validate(
+    const MemoryMap& file, const vk::PhysicalDeviceProperties& properties)
+{
+    if (file.size() < sizeof(FileHeader)) {
+        return "file is too small";
+    }
+
+    auto header = FileHeader{};
+    std::memcpy(&header, file.addr(), sizeof(header));
+    const auto* data = static_cast<const uint8_t*>(file.addr()) + sizeof(header);
+
+    if (header.magic != fileMagic || header.version != fileVersion) {
+        return "unknown file format";
+    }
+    if (header.dataSize != file.size() - sizeof(header)) {
+        return "file is truncated";
+    }
+    if (header.checksum != fnv1a(data, header.dataSize)) {
+        return "checksum mismatch";
+    }
+    if (header.vendorID != properties.vendorID ||
+            header.deviceID != properties.deviceID) {
+        return "cache was written for a different device";
+    }
+    if (header.driverVersion != properties.driverVersion) {
+        return "cache was written by a different driver version";
+    }
+    if (std::memcmp(
+            header.pipelineCacheUUID,
+            properties.pipelineCacheUUID.data(),
+            VK_UUID_SIZE) != 0) {
+        return "pipeline cache UUID mismatch";
+    }
+
+    // The driver validates its own header too, but rejecting a bad one here
+    // lets us report why the cache was not used.
+    auto vulkanHeader = VkPipelineCacheHeaderVersionOne{};
+    if (header.dataSize < sizeof(vulkanHeader)) {
+        return "pipeline cache data is too small";
+    }
+    std::memcpy(&vulkanHeader, data, sizeof(vulkanHeader));
+    if (vulkanHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+            vulkanHeader.vendorID != properties.vendorID ||
+            vulkanHeader.deviceID != properties.deviceID ||
+            std::memcmp(
+                vulkanHeader.pipelineCacheUUID,
+                properties.pipelineCacheUUID.data(),
+                VK_UUID_SIZE) != 0) {
+        return "pipeline cache data header mismatch";
+    }
+
+    return "";
+}
+
+} // namespace
+
+PipelineCache::PipelineCache(
+    const vk::raii::PhysicalDevice& physicalDevice,
+    const vk::raii::Device& device,
+    std::filesystem::path path,
+    bool creationFeedbackEnabled)
+    : _device(&device)
+    , _deviceProperties(physicalDevice.getProperties())
+    , _path(std::move(path))
+    , _creationFeedbackEnabled(creationFeedbackEnabled)
+{
+    // A cache that cannot be read is treated like a missing one: it only
+    // costs compile time, so it must not fail device setup.
+    auto file = MemoryMap{};
+    auto existsError = std::error_code{};
+    if (std::filesystem::exists(_path, existsError)) {
+        try {
+            file.map(_path);
+            _rejectReason = validate(file, _deviceProperties);
+        } catch (const std::exception& e) {
+            file = MemoryMap{};
+            _rejectReason = std::string{"cannot read cache file: "} + e.what();
+        }
+    } else if (existsError) {
+        _rejectReason = "cannot access cache file: " + existsError.message();
+    } else {
+        _rejectReason = "no cache file";
+    }
+
+    auto pipelineCacheInfo = vk::PipelineCacheCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineCacheCreateFlags{},
+        .initialDataSize = 0,
+        .pInitialData = nullptr,
+    };
+    if (_rejectReason.empty()) {
+        pipelineCacheInfo.initialDataSize = file.size() - sizeof(FileHeader);
+        pipelineCacheInfo.pInitialData =
+            static_cast<const uint8_t*>(file.addr()) + sizeof(FileHeader);
+        _loadedFromDisk = true;
+        _loadedBytes = file.size();
+    }
+
+    // The driver copies the initial data, so the file can be unmapped (and
+    // later replaced by save) right after this. Should the driver still fail
+    // on data that passed validation, start empty as well.
+    if (_loadedFromDisk) {
+        try {
+            _cache = device.createPipelineCache(pipelineCacheInfo);
+            return;
+        } catch (const vk::SystemError& e) {
+            _rejectReason =
+                std::string{"driver rejected the cache: "} + e.what();
+            _loadedFromDisk = false;
+            _loadedBytes = 0;
+            pipelineCacheInfo.initialDataSize = 0;
+            pipelineCacheInfo.pInitialData = nullptr;
+        }
+    }
+    _cache = device.createPipelineCache(pipelineCacheInfo);
+}
+
+const vk::raii::PipelineCache& PipelineCache::cache() const
+{
+    return _cache;
+}
+
+vk::raii::PipelineCache PipelineCache::createWorkerCache() const
+{
+    auto pipelineCacheInfo = vk::PipelineCacheCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::PipelineCacheCreateFlags{},
+        .initialDataSize = 0,
+        .pInitialData = nullptr,
+    };
+    return _device->createPipelineCache(pipelineCacheInfo);
+}
+
+void PipelineCache::merge(std::span<const vk::PipelineCache> workerCaches)
+{
+    if (!workerCaches.empty()) {
+        _cache.merge(vk::ArrayProxy<const vk::PipelineCache>{
+            (uint32_t)workerCaches.size(), workerCaches.data()});
+    }
+}
+
+vk::raii::Pipeline PipelineCache::createGraphicsPipeline(
+    const vk::GraphicsPipelineCreateInfo& createInfo,
+    const vk::raii::PipelineCache* cache)
+{
+    return createPipeline(createInfo, createInfo.stageCount, cache);
+}
+
+vk::raii::Pipeline PipelineCache::createComputePipeline(
+    const vk::ComputePipelineCreateInfo& createInfo,
+    const vk::raii::PipelineCache* cache)
+{
+    return createPipeline(createInfo, 1, cache);
+}
+
+void PipelineCache::save()
+{
+    std::vector<uint8_t> data = _cache.getData();
+
+    auto header = FileHeader{
+        .magic = fileMagic,
+        .version = fileVersion,
+        .vendorID = _deviceProperties.vendorID,
+        .deviceID = _deviceProperties.deviceID,
+        .driverVersion = _deviceProperties.driverVersion,
+        .pipelineCacheUUID = {},
+        .reserved = 0,
+        .dataSize = data.size(),
+        .checksum = fnv1a(data.data(), data.size()),
+    };
+    std::memcpy(
+        header.pipelineCacheUUID,
+        _deviceProperties.pipelineCacheUUID.data(),
+        VK_UUID_SIZE);
+
+    if (_path.has_parent_path()) {
+        std::filesystem::create_directories(_path.parent_path());
+    }
+
+    auto temporaryPath = _path;
+    temporaryPath += ".tmp";
+    {
+        auto output = std::ofstream{
+            temporaryPath, std::ios::binary | std::ios::trunc};
+        if (!output) {
+            throw Error{} << "cannot open " << temporaryPath;
+        }
+        output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        output.write(
+            reinterpret_cast<const char*>(data.data()),
+            (std::streamsize)data.size());
+        output.close();
+        if (!output) {
+            throw Error{} << "cannot write " << temporaryPath;
+        }
+    }
+    std::filesystem::rename(temporaryPath, _path);
+
+    _savedBytes = sizeof(header) + data.size();
+}
+
+PipelineCacheStats PipelineCache::stats() const
+{
+    return PipelineCacheStats{
+        .loadedFromDisk = _loadedFromDisk,
+        .loadedBytes = _loadedBytes,
+        .savedBytes = _savedBytes,
+        .pipelines = _pipelines.load(),
+        .hits = _hits.load(),
+        .misses = _misses.load(),
+        .untracked = _untracked.load(),
+        .creationTime = std::chrono::nanoseconds{_creationNanoseconds.load()},
+    };
+}
+
+const std::string& PipelineCache::rejectReason() const
+{
+    return _rejectReason;
+}
+
+template <class CreateInfo>
+vk::raii::Pipeline PipelineCache::createPipeline(
+    CreateInfo createInfo,
+    uint32_t stageCount,
+    const vk::raii::PipelineCache* cache)
+{
+    const vk::raii::PipelineCache& targetCache = cache ? *cache : _cache;
+
+    auto feedback = vk::PipelineCreationFeedback{};
+    auto stageFeedbacks = std::vector<vk::PipelineCreationFeedback>(stageCount);
+    auto feedbackInfo = vk::PipelineCreationFeedbackCreateInfo{
+        .pNext = createInfo.pNext,
+        .pPipelineCreationFeedback = &feedback,
+        .pipelineStageCreationFeedbackCount = stageCount,
+        .pPipelineStageCreationFeedbacks = stageFeedbacks.data(),
+    };
+    if (_creationFeedbackEnabled) {
+        createInfo.pNext = &feedbackInfo;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto pipeline = [&] {
+        if constexpr (std::is_same_v<CreateInfo, vk::GraphicsPipelineCreateInfo>) {
+            return _device->createGraphicsPipeline(targetCache, createInfo);
+        } else {
+            return _device->createComputePipeline(targetCache, createInfo);
+        }
+    }();
+    auto duration = std::chrono::steady_clock::now() - start;
+
+    _pipelines++;
+    _creationNanoseconds +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    if (!(feedback.flags & vk::PipelineCreationFeedbackFlagBits::eValid)) {
+        _untracked++;
+    } else if (feedback.flags &
+            vk::PipelineCreationFeedbackFlagBits::eApplicationPipelineCacheHit) {
+        _hits++;
+    } else {
+        _misses++;
+    }
+
+    return pipeline;
+}
+
+} // namespace rr
@@ -0,0 +1,816 @@
+#include <render_graph.hpp>
+
+#include <error.hpp>
+
+#include <algorithm>
+
+namespace rr {
+
+namespace {
+
+struct UsageInfo {
+    vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+    vk::PipelineStageFlags stages;
+    vk::AccessFlags access;
+    vk::ImageUsageFlags imageUsage;
+};
+
+UsageInfo usageInfo(ResourceUsage usage)
+{
+    using Stage = vk::PipelineStageFlagBits;
+    using Access = vk::AccessFlagBits;
+    using Layout = vk::ImageLayout;
+
+    switch (usage) {
+        case ResourceUsage::ColorAttachment:
+            return UsageInfo{
+                .layout = Layout::eColorAttachmentOptimal,
+                .stages = Stage::eColorAttachmentOutput,
+                .access = Access::eColorAttachmentRead |
+                    Access::eColorAttachmentWrite,
+                .imageUsage = vk::ImageUsageFlagBits::eColorAttachment,
+            };
+        case ResourceUsage::DepthAttachment:
+            return UsageInfo{
+                .layout = Layout::eDepthStencilAttachmentOptimal,
+                .stages = Stage::eEarlyFragmentTests |
+                    Stage::eLateFragmentTests,
+                .access = Access::eDepthStencilAttachmentRead |
+                    Access::eDepthStencilAttachmentWrite,
+                .imageUsage = vk::ImageUsageFlagBits::eDepthStencilAttachment,
+            };
+        case ResourceUsage::DepthRead:
+            return UsageInfo{
+                .layout = Layout::eDepthStencilReadOnlyOptimal,
+                .stages = Stage::eEarlyFragmentTests |
+                    Stage::eLateFragmentTests,
+                .access = Access::eDepthStencilAttachmentRead,
+                .imageUsage = vk::ImageUsageFlagBits::eDepthStencilAttachment,
+            };
+        case ResourceUsage::Sampled:
+            return UsageInfo{
+                .layout = Layout::eShaderReadOnlyOptimal,
+                .stages = Stage::eFragmentShader,
+                .access = Access::eShaderRead,
+                .imageUsage = vk::ImageUsageFlagBits::eSampled,
+            };
+        case ResourceUsage::StorageRead:
+            return UsageInfo{
+                .layout = Layout::eGeneral,
+                .stages = Stage::eComputeShader,
+                .access = Access::eShaderRead,
+                .imageUsage = vk::ImageUsageFlagBits::eStorage,
+            };
+        case ResourceUsage::StorageWrite:
+            return UsageInfo{
+                .layout = Layout::eGeneral,
+                .stages = Stage::eComputeShader,
+                .access = Access::eShaderRead | Access::eShaderWrite,
+                .imageUsage = vk::ImageUsageFlagBits::eStorage,
+            };
+        case ResourceUsage::TransferSrc:
+            return UsageInfo{
+                .layout = Layout::eTransferSrcOptimal,
+                .stages = Stage::eTransfer,
+                .access = Access::eTransferRead,
+                .imageUsage = vk::ImageUsageFlagBits::eTransferSrc,
+            };
+        case ResourceUsage::TransferDst:
+            return UsageInfo{
+                .layout = Layout::eTransferDstOptimal,
+                .stages = Stage::eTransfer,
+                .access = Access::eTransferWrite,
+                .imageUsage = vk::ImageUsageFlagBits::eTransferDst,
+            };
+        case ResourceUsage::VertexBuffer:
+            return UsageInfo{
+                .layout = Layout::eUndefined,
+                .stages = Stage::eVertexInput,
+                .access = Access::eVertexAttributeRead,
+                .imageUsage = {},
+            };
+        case ResourceUsage::IndexBuffer:
+            return UsageInfo{
+                .layout = Layout::eUndefined,
+                .stages = Stage::eVertexInput,
+                .access = Access::eIndexRead,
+                .imageUsage = {},
+            };
+        case ResourceUsage::UniformBuffer:
+            return UsageInfo{
+                .layout = Layout::eUndefined,
+                .stages = Stage::eVertexShader | Stage::eFragmentShader,
+                .access = Access::eUniformRead,
+                .imageUsage = {},
+            };
+        case ResourceUsage::IndirectBuffer:
+            return UsageInfo{
+                .layout = Layout::eUndefined,
+                .stages = Stage::eDrawIndirect,
+                .access = Access::eIndirectCommandRead,
+                .imageUsage = {},
+            };
+        case ResourceUsage::Present:
+            return UsageInfo{
+                .layout = Layout::ePresentSrcKHR,
+                .stages = Stage::eBottomOfPipe,
+                .access = {},
+                .imageUsage = {},
+            };
+    }
+    throw Error{} << "unknown resource usage: " << (int)usage;
+}
+
+vk::ImageAspectFlags aspectFor(vk::Format format)
+{
+    switch (format) {
+        case vk::Format::eD16Unorm:
+        case vk::Format::eX8D24UnormPack32:
+        case vk::Format::eD32Sfloat:
+            return vk::ImageAspectFlagBits::eDepth;
+        case vk::Format::eS8Uint:
+            return vk::ImageAspectFlagBits::eStencil;
+        case vk::Format::eD16UnormS8Uint:
+        case vk::Format::eD24UnormS8Uint:
+        case vk::Format::eD32SfloatS8Uint:
+            return vk::ImageAspectFlagBits::eDepth |
+                vk::ImageAspectFlagBits::eStencil;
+        default:
+            return vk::ImageAspectFlagBits::eColor;
+    }
+}
+
+vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+RenderPassBuilder::RenderPassBuilder(RenderGraph& graph, uint32_t pass)
+    : _graph(&graph)
+    , _pass(pass)
+{ }
+
+RenderPassBuilder& RenderPassBuilder::read(
+    ResourceHandle resource,
+    ResourceUsage usage,
+    vk::PipelineStageFlags stages)
+{
+    if (resource.index >= _graph->_resources.size()) {
+        throw Error{} << "pass " << _graph->_passes[_pass].name <<
+            " reads an invalid resource";
+    }
+    _graph->_passes[_pass].accesses.push_back(RenderGraph::Access{
+        .resource = resource.index,
+        .usage = usage,
+        .stages = stages,
+        .write = false,
+    });
+    _graph->_compiled = false;
+    return *this;
+}
+
+RenderPassBuilder& RenderPassBuilder::write(
+    ResourceHandle resource,
+    ResourceUsage usage,
+    vk::PipelineStageFlags stages)
+{
+    if (resource.index >= _graph->_resources.size()) {
+        throw Error{} << "pass " << _graph->_passes[_pass].name <<
+            " writes an invalid resource";
+    }
+    _graph->_passes[_pass].accesses.push_back(RenderGraph::Access{
+        .resource = resource.index,
+        .usage = usage,
+        .stages = stages,
+        .write = true,
+    });
+    _graph->_compiled = false;
+    return *this;
+}
+
+RenderPassBuilder& RenderPassBuilder::sideEffect()
+{
+    _graph->_passes[_pass].sideEffect = true;
+    _graph->_compiled = false;
+    return *this;
+}
+
+bool RenderGraph::BarrierBatch::empty() const
+{
+    return !dstStages;
+}
+
+RenderGraph::RenderGraph(
+    const vk::raii::Device& device, MemoryAllocator& allocator)
+    : _device(&device)
+    , _allocator(&allocator)
+{ }
+
+RenderGraph::~RenderGraph()
+{
+    destroyTransientImages();
+}
+
+void RenderGraph::reset()
+{
+    destroyTransientImages();
+    _passes.clear();
+    _resources.clear();
+    _barriers.clear();
+    _finalBarriers = BarrierBatch{};
+    _compiled = false;
+    _stats = RenderGraphStats{};
+}
+
+ResourceHandle RenderGraph::createImage(
+    std::string name, const TransientImageDesc& desc)
+{
+    auto& resource = _resources.emplace_back();
+    resource.name = std::move(name);
+    resource.isImage = true;
+    resource.transient = true;
+    resource.format = desc.format;
+    resource.extent = desc.extent;
+    resource.samples = desc.samples;
+    _compiled = false;
+    return ResourceHandle{(uint32_t)(_resources.size() - 1)};
+}
+
+ResourceHandle RenderGraph::importImage(
+    std::string name,
+    vk::Image image,
+    vk::ImageView view,
+    vk::Format format,
+    ResourceState initialState)
+{
+    auto& resource = _resources.emplace_back();
+    resource.name = std::move(name);
+    resource.isImage = true;
+    resource.image = image;
+    resource.view = view;
+    resource.format = format;
+    resource.initialState = initialState;
+    _compiled = false;
+    return ResourceHandle{(uint32_t)(_resources.size() - 1)};
+}
+
+ResourceHandle RenderGraph::importBuffer(
+    std::string name, vk::Buffer buffer, ResourceState initialState)
+{
+    auto& resource = _resources.emplace_back();
+    resource.name = std::move(name);
+    resource.isImage = false;
+    resource.buffer = buffer;
+    resource.initialState = initialState;
+    _compiled = false;
+    return ResourceHandle{(uint32_t)(_resources.size() - 1)};
+}
+
+void RenderGraph::setImportedImage(
+    ResourceHandle resource, vk::Image image, vk::ImageView view)
+{
+    Resource& r = _resources.at(resource.index);
+    if (r.transient || !r.isImage) {
+        throw Error{} << r.name << " is not an imported image";
+    }
+    r.image = image;
+    r.view = view;
+}
+
+RenderPassBuilder RenderGraph::addPass(std::string name, PassFunction function)
+{
+    _passes.push_back(Pass{
+        .name = std::move(name),
+        .function = std::move(function),
+        .accesses = {},
+        .sideEffect = false,
+        .culled = false,
+    });
+    _compiled = false;
+    return RenderPassBuilder{*this, (uint32_t)(_passes.size() - 1)};
+}
+
+void RenderGraph::markOutput(ResourceHandle resource, ResourceUsage finalUsage)
+{
+    Resource& r = _resources.at(resource.index);
+    r.output = true;
+    r.finalUsage = finalUsage;
+    _compiled = false;
+}
+
+void RenderGraph::compile()
+{
+    destroyTransientImages();
+    cull();
+    createTransientImages();
+    computeBarriers();
+    _compiled = true;
+}
+
+void RenderGraph::execute(
+    vk::CommandBuffer commandBuffer, GpuProfiler* profiler)
+{
+    if (!_compiled) {
+        compile();
+    }
+
+    for (size_t i = 0; i < _passes.size(); i++) {
+        const Pass& pass = _passes[i];
+        if (pass.culled) {
+            continue;
+        }
+
+        uint32_t scope = profiler ?
+            profiler->beginScope(commandBuffer, pass.name) : UINT32_MAX;
+        recordBarriers(commandBuffer, _barriers[i]);
+        pass.function(commandBuffer);
+        if (profiler) {
+            profiler->endScope(commandBuffer, scope);
+        }
+    }
+    recordBarriers(commandBuffer, _finalBarriers);
+}
+
+vk::Image RenderGraph::image(ResourceHandle resource) const
+{
+    return _resources.at(resource.index).image;
+}
+
+vk::ImageView RenderGraph::imageView(ResourceHandle resource) const
+{
+    return _resources.at(resource.index).view;
+}
+
+vk::Buffer RenderGraph::buffer(ResourceHandle resource) const
+{
+    return _resources.at(resource.index).buffer;
+}
+
+RenderGraphStats RenderGraph::stats() const
+{
+    return _stats;
+}
+
+void RenderGraph::cull()
+{
+    // Walk backwards from the outputs: a pass is needed if it has side
+    // effects or writes something needed, and then everything it accesses
+    // is needed too (a write may load what earlier passes wrote).
+    auto needed = std::vector<bool>(_resources.size());
+    for (size_t i = 0; i < _resources.size(); i++) {
+        needed[i] = _resources[i].output;
+    }
+
+    _stats = RenderGraphStats{};
+    for (size_t i = _passes.size(); i-- > 0; ) {
+        Pass& pass = _passes[i];
+        pass.culled = !pass.sideEffect && std::ranges::none_of(
+            pass.accesses, [&needed] (const Access& access) {
+                return access.write && needed[access.resource];
+            });
+
+        if (pass.culled) {
+            _stats.culledPasses++;
+            continue;
+        }
+        _stats.passes++;
+        for (const Access& access : pass.accesses) {
+            needed[access.resource] = true;
+        }
+    }
+
+    for (auto& resource : _resources) {
+        resource.firstPass = UINT32_MAX;
+        resource.lastPass = 0;
+        resource.usage = vk::ImageUsageFlags{};
+        resource.aliases.clear();
+        resource.sharesMemoryWith.clear();
+    }
+    for (uint32_t i = 0; i < _passes.size(); i++) {
+        if (_passes[i].culled) {
+            continue;
+        }
+        for (const Access& access : _passes[i].accesses) {
+            Resource& resource = _resources[access.resource];
+            resource.firstPass = std::min(resource.firstPass, i);
+            resource.lastPass = std::max(resource.lastPass, i);
+            resource.usage |= usageInfo(access.usage).imageUsage;
+        }
+    }
+}
+
+void RenderGraph::createTransientImages()
+{
+    struct Placement {
+        uint32_t resource = 0;
+        vk::MemoryRequirements requirements;
+        vk::DeviceSize offset = 0;
+    };
+    auto placements = std::vector<Placement>{};
+    uint32_t memoryTypeBits = ~0u;
+
+    for (uint32_t i = 0; i < _resources.size(); i++) {
+        Resource& resource = _resources[i];
+        if (!resource.transient || resource.firstPass == UINT32_MAX) {
+            continue;
+        }
+
+        auto imageInfo = vk::ImageCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::ImageCreateFlags{},
+            .imageType = vk::ImageType::e2D,
+            .format = resource.format,
+            .extent = vk::Extent3D{
+                resource.extent.width, resource.extent.height, 1},
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = resource.samples,
+            .tiling = vk::ImageTiling::eOptimal,
+            .usage = resource.usage,
+            .sharingMode = vk::SharingMode::eExclusive,
+            .queueFamilyIndexCount = 0,
+            .pQueueFamilyIndices = nullptr,
+            .initialLayout = vk::ImageLayout::eUndefined,
+        };
+        resource.ownedImage = _device->createImage(imageInfo);
+        resource.image = *resource.ownedImage;
+
+        vk::MemoryRequirements requirements =
+            resource.ownedImage.getMemoryRequirements();
+        memoryTypeBits &= requirements.memoryTypeBits;
+        placements.push_back(Placement{
+            .resource = i,
+            .requirements = requirements,
+            .offset = 0,
+        });
+        _stats.unaliasedTransientBytes += requirements.size;
+    }
+
+    if (placements.empty()) {
+        return;
+    }
+    if (memoryTypeBits == 0) {
+        throw Error{} << "transient images have no memory type in common";
+    }
+
+    // Greedy placement, largest first: each image goes to the lowest offset
+    // that does not overlap an image whose lifetime overlaps its own.
+    std::ranges::sort(placements, [] (const auto& a, const auto& b) {
+        return a.requirements.size > b.requirements.size;
+    });
+
+    auto lifetimesOverlap = [this] (uint32_t a, uint32_t b) {
+        return _resources[a].firstPass <= _resources[b].lastPass &&
+            _resources[b].firstPass <= _resources[a].lastPass;
+    };
+    auto rangesOverlap = [] (const Placement& a, const Placement& b) {
+        return a.offset < b.offset + b.requirements.size &&
+            b.offset < a.offset + a.requirements.size;
+    };
+
+    vk::DeviceSize totalSize = 0;
+    vk::DeviceSize maxAlignment = 1;
+    for (size_t i = 0; i < placements.size(); i++) {
+        Placement& placement = placements[i];
+        vk::DeviceSize alignment = placement.requirements.alignment;
+        maxAlignment = std::max(maxAlignment, alignment);
+
+        auto candidates = std::vector<vk::DeviceSize>{0};
+        for (size_t j = 0; j < i; j++) {
+            if (lifetimesOverlap(placement.resource, placements[j].resource)) {
+                candidates.push_back(alignUp(
+                    placements[j].offset + placements[j].requirements.size,
+                    alignment));
+            }
+        }
+        std::ranges::sort(candidates);
+
+        for (vk::DeviceSize candidate : candidates) {
+            placement.offset = candidate;
+            bool fits = true;
+            for (size_t j = 0; j < i && fits; j++) {
+                fits = !lifetimesOverlap(
+                        placement.resource, placements[j].resource) ||
+                    !rangesOverlap(placement, placements[j]);
+            }
+            if (fits) {
+                break;
+            }
+        }
+        totalSize = std::max(
+            totalSize, placement.offset + placement.requirements.size);
+    }
+
+    // An image that reuses memory must wait for the previous users of that
+    // memory, which are recorded as its aliases, and for every user of it
+    // in the previous execution, which may still be in flight.
+    for (const Placement& a : placements) {
+        for (const Placement& b : placements) {
+            if (!rangesOverlap(a, b)) {
+                continue;
+            }
+            _resources[b.resource].sharesMemoryWith.push_back(a.resource);
+            if (_resources[a.resource].lastPass <
+                    _resources[b.resource].firstPass) {
+                _resources[b.resource].aliases.push_back(a.resource);
+            }
+        }
+    }
+
+    _transientMemory = _allocator->allocate(AllocationRequest{
+        .requirements = vk::MemoryRequirements{
+            .size = totalSize,
+            .alignment = maxAlignment,
+            .memoryTypeBits = memoryTypeBits,
+        },
+        .requiredFlags = vk::MemoryPropertyFlagBits::eDeviceLocal,
+        .preferredFlags = {},
+        .kind = ResourceKind::Optimal,
+        .pool = nullptr,
+        .dedicated = false,
+        .dedicatedBuffer = {},
+        .dedicatedImage = {},
+    });
+    _stats.transientBytes = totalSize;
+
+    for (const Placement& placement : placements) {
+        Resource& resource = _resources[placement.resource];
+        resource.memoryOffset = placement.offset;
+        resource.ownedImage.bindMemory(
+            _transientMemory.memory,
+            _transientMemory.offset + placement.offset);
+
+        auto viewInfo = vk::ImageViewCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::ImageViewCreateFlags{},
+            .image = resource.image,
+            .viewType = vk::ImageViewType::e2D,
+            .format = resource.format,
+            .components = vk::ComponentMapping{
+                .r = vk::ComponentSwizzle::eIdentity,
+                .g = vk::ComponentSwizzle::eIdentity,
+                .b = vk::ComponentSwizzle::eIdentity,
+                .a = vk::ComponentSwizzle::eIdentity,
+            },
+            .subresourceRange = vk::ImageSubresourceRange{
+                .aspectMask = aspectFor(resource.format),
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+        };
+        resource.ownedView = _device->createImageView(viewInfo);
+        resource.view = *resource.ownedView;
+    }
+}
+
+void RenderGraph::destroyTransientImages()
+{
+    for (auto& resource : _resources) {
+        if (resource.transient) {
+            resource.ownedView.clear();
+            resource.ownedImage.clear();
+            resource.image = vk::Image{};
+            resource.view = vk::ImageView{};
+        }
+    }
+    if (_transientMemory) {
+        _allocator->free(_transientMemory);
+        _transientMemory = MemoryAllocation{};
+    }
+}
+
+// The graph is compiled once and executed every frame, with frames in
+// flight, so the first use of a transient image must also wait for the
+// previous execution's accesses to its memory: the end states of a first
+// simulation seed the second, whose barriers are kept. End states do not
+// depend on the seeds, since each transient image is transitioned, which
+// resets its state, on first use.
+void RenderGraph::computeBarriers()
+{
+    std::vector<TrackedState> endStates = simulate({});
+    simulate(endStates);
+
+    for (const auto& batch : _barriers) {
+        if (!batch.empty()) {
+            _stats.barrierBatches++;
+            _stats.imageBarriers += (uint32_t)batch.images.size();
+            _stats.memoryBarriers += batch.srcAccess || batch.dstAccess ? 1 : 0;
+        }
+    }
+    if (!_finalBarriers.empty()) {
+        _stats.barrierBatches++;
+        _stats.imageBarriers += (uint32_t)_finalBarriers.images.size();
+        _stats.memoryBarriers +=
+            _finalBarriers.srcAccess || _finalBarriers.dstAccess ? 1 : 0;
+    }
+}
+
+std::vector<RenderGraph::TrackedState> RenderGraph::simulate(
+    const std::vector<TrackedState>& previous)
+{
+    auto states = std::vector<TrackedState>(_resources.size());
+    for (size_t i = 0; i < _resources.size(); i++) {
+        const Resource& resource = _resources[i];
+        if (!resource.transient) {
+            states[i] = TrackedState{
+                .layout = resource.initialState.layout,
+                .writeStages = resource.initialState.stages,
+                .writeAccess = resource.initialState.access,
+                .readStages = {},
+                .visibleStages = {},
+                .visibleAccess = {},
+            };
+        }
+    }
+
+    _barriers.assign(_passes.size(), BarrierBatch{});
+    _finalBarriers = BarrierBatch{};
+
+    for (uint32_t i = 0; i < _passes.size(); i++) {
+        const Pass& pass = _passes[i];
+        if (pass.culled) {
+            continue;
+        }
+
+        BarrierBatch& batch = _barriers[i];
+        for (const Access& access : pass.accesses) {
+            const Resource& resource = _resources[access.resource];
+            TrackedState& state = states[access.resource];
+
+            // A transient image starts out undefined, after whatever last
+            // used its memory, in this execution or the previous one.
+            if (resource.transient && resource.firstPass == i &&
+                    state.layout == vk::ImageLayout::eUndefined) {
+                for (uint32_t alias : resource.aliases) {
+                    const TrackedState& aliasState = states[alias];
+                    state.writeStages |=
+                        aliasState.writeStages | aliasState.readStages;
+                    state.writeAccess |= aliasState.writeAccess;
+                }
+                if (!previous.empty()) {
+                    for (uint32_t other : resource.sharesMemoryWith) {
+                        const TrackedState& otherState = previous[other];
+                        state.writeStages |=
+                            otherState.writeStages | otherState.readStages;
+                        state.writeAccess |= otherState.writeAccess;
+                    }
+                }
+            }
+
+            addBarrier(
+                batch,
+                state,
+                resource,
+                access.resource,
+                access.usage,
+                access.stages,
+                access.write);
+        }
+    }
+
+    for (uint32_t i = 0; i < _resources.size(); i++) {
+        const Resource& resource = _resources[i];
+        if (resource.output) {
+            addBarrier(
+                _finalBarriers,
+                states[i],
+                resource,
+                i,
+                resource.finalUsage,
+                {},
+                false);
+        }
+    }
+    return states;
+}
+
+void RenderGraph::addBarrier(
+    BarrierBatch& batch,
+    TrackedState& state,
+    const Resource& resource,
+    uint32_t resourceIndex,
+    ResourceUsage usage,
+    vk::PipelineStageFlags stages,
+    bool write)
+{
+    UsageInfo info = usageInfo(usage);
+    if (stages) {
+        info.stages = stages;
+    }
+
+    vk::ImageLayout layout =
+        resource.isImage ? info.layout : vk::ImageLayout::eUndefined;
+    bool transition = resource.isImage && state.layout != layout;
+
+    if (write || transition) {
+        // Write after write, write after read, or a layout transition, which
+        // counts as a write. Reads only need an execution dependency.
+        vk::PipelineStageFlags srcStages = state.writeStages | state.readStages;
+        if (transition) {
+            batch.images.push_back(ImageBarrier{
+                .resource = resourceIndex,
+                .oldLayout = state.layout,
+                .newLayout = layout,
+                .srcAccess = state.writeAccess,
+                .dstAccess = info.access,
+            });
+            batch.srcStages |= srcStages;
+            batch.dstStages |= info.stages;
+        } else if (srcStages) {
+            batch.srcStages |= srcStages;
+            batch.dstStages |= info.stages;
+            if (state.writeAccess) {
+                batch.srcAccess |= state.writeAccess;
+                batch.dstAccess |= info.access;
+            }
+        }
+
+        state.layout = layout;
+        if (write) {
+            state.writeStages = info.stages;
+            state.writeAccess = info.access;
+            state.readStages = {};
+            state.visibleStages = {};
+            state.visibleAccess = {};
+        } else {
+            // The transition is complete and visible for this reader.
+            state.writeStages = info.stages;
+            state.writeAccess = {};
+            state.readStages = info.stages;
+            state.visibleStages = info.stages;
+            state.visibleAccess = info.access;
+        }
+        return;
+    }
+
+    // Read after read needs nothing; read after write needs the write to be
+    // made visible once for each new stage or access type.
+    bool invisible = (info.stages & ~state.visibleStages) ||
+        (info.access & ~state.visibleAccess);
+    if (state.writeStages && invisible) {
+        batch.srcStages |= state.writeStages;
+        batch.dstStages |= info.stages;
+        if (state.writeAccess) {
+            batch.srcAccess |= state.writeAccess;
+            batch.dstAccess |= info.access;
+        }
+        state.visibleStages |= info.stages;
+        state.visibleAccess |= info.access;
+    }
+    state.readStages |= info.stages;
+}
+
+void RenderGraph::recordBarriers(
+    vk::CommandBuffer commandBuffer, const BarrierBatch& batch)
+{
+    if (batch.empty()) {
+        return;
+    }
+
+    auto imageBarriers = std::vector<vk::ImageMemoryBarrier>{};
+    imageBarriers.reserve(batch.images.size());
+    for (const ImageBarrier& barrier : batch.images) {
+        const Resource& resource = _resources[barrier.resource];
+        imageBarriers.push_back(vk::ImageMemoryBarrier{
+            .pNext = nullptr,
+            .srcAccessMask = barrier.srcAccess,
+            .dstAccessMask = barrier.dstAccess,
+            .oldLayout = barrier.oldLayout,
+            .newLayout = barrier.newLayout,
+            .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .image = resource.image,
+            .subresourceRange = vk::ImageSubresourceRange{
+                .aspectMask = aspectFor(resource.format),
+                .baseMipLevel = 0,
+                .levelCount = vk::RemainingMipLevels,
+                .baseArrayLayer = 0,
+                .layerCount = vk::RemainingArrayLayers,
+            },
+        });
+    }
+
+    auto memoryBarrier = vk::MemoryBarrier{
+        .pNext = nullptr,
+        .srcAccessMask = batch.srcAccess,
+        .dstAccessMask = batch.dstAccess,
+    };
+    bool hasMemoryBarrier = batch.srcAccess || batch.dstAccess;
+
+    commandBuffer.pipelineBarrier(
+        batch.srcStages ?
+            batch.srcStages : vk::PipelineStageFlagBits::eTopOfPipe,
+        batch.dstStages,
+        vk::DependencyFlags{},
+        hasMemoryBarrier ?
+            vk::ArrayProxy<const vk::MemoryBarrier>{memoryBarrier} :
+            vk::ArrayProxy<const vk::MemoryBarrier>{},
+        {},
+        imageBarriers);
+}
+
+} // namespace rr
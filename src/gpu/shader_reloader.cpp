@@ -0,0 +1,267 @@
+#include <shader_reloader.hpp>
+
+#include <error.hpp>
+#include <mm.hpp>
+
+#if defined(__linux__)
+    #include <poll.h>
+    #include <sys/inotify.h>
+    #include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <source_location>
+
+namespace rr {
+
+namespace {
+
+constexpr uint32_t spirvMagic = 0x07230203;
+
+#if defined(__linux__)
+[[noreturn]] void throwErrno(
+    std::source_location sl = std::source_location::current())
+{
+    int e = errno;
+    throw Error{sl} << strerrorname_np(e) << ": " << strerrordesc_np(e);
+}
+#endif
+
+} // namespace
+
+ShaderReloader::ShaderReloader(const vk::raii::Device& device)
+    : _device(&device)
+{
+#if defined(__linux__)
+    _inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotify < 0) {
+        throwErrno();
+    }
+    _thread = std::thread{[this] { run(); }};
+#endif
+}
+
+ShaderReloader::~ShaderReloader()
+{
+    _stop = true;
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+#if defined(__linux__)
+    if (_inotify >= 0) {
+        close(_inotify);
+    }
+#endif
+}
+
+ReloadablePipelineId ShaderReloader::add(
+    std::vector<ShaderSource> sources, PipelineBuilder builder)
+{
+    auto code = std::vector<std::span<const uint32_t>>{};
+    for (ShaderSource& source : sources) {
+        source.path = std::filesystem::absolute(source.path).lexically_normal();
+        code.push_back(source.code);
+    }
+    auto pipeline = build(code, builder);
+
+    auto lock = std::lock_guard{_mutex};
+    for (const ShaderSource& source : sources) {
+        watch(source.path);
+    }
+    _entries.push_back(Entry{
+        .sources = std::move(sources),
+        .builder = std::move(builder),
+        .pipeline = std::move(pipeline),
+    });
+    return (ReloadablePipelineId)(_entries.size() - 1);
+}
+
+vk::Pipeline ShaderReloader::pipeline(ReloadablePipelineId id) const
+{
+    return *_entries.at(id).pipeline;
+}
+
+uint32_t ShaderReloader::beginFrame(uint64_t frame, uint64_t completedFrames)
+{
+    std::erase_if(_retired, [completedFrames] (const Retired& retired) {
+        return completedFrames > retired.lastFrame;
+    });
+
+    auto rebuilt = std::vector<Rebuilt>{};
+    {
+        auto lock = std::lock_guard{_mutex};
+        rebuilt.swap(_rebuilt);
+        _stats.retiredPipelines = (uint32_t)(_retired.size() + rebuilt.size());
+    }
+
+    // Frames before this one may have recorded the old pipelines.
+    uint64_t lastFrame = frame > 0 ? frame - 1 : 0;
+    for (Rebuilt& r : rebuilt) {
+        Entry& entry = _entries[r.id];
+        _retired.push_back(Retired{
+            .pipeline = std::move(entry.pipeline),
+            .lastFrame = lastFrame,
+        });
+        entry.pipeline = std::move(r.pipeline);
+    }
+    return (uint32_t)rebuilt.size();
+}
+
+std::string ShaderReloader::lastError() const
+{
+    auto lock = std::lock_guard{_mutex};
+    return _lastError;
+}
+
+ShaderReloaderStats ShaderReloader::stats() const
+{
+    auto lock = std::lock_guard{_mutex};
+    return _stats;
+}
+
+vk::raii::Pipeline ShaderReloader::build(
+    std::span<const std::span<const uint32_t>> code,
+    const PipelineBuilder& builder) const
+{
+    auto modules = std::vector<vk::raii::ShaderModule>{};
+    auto handles = std::vector<vk::ShaderModule>{};
+    for (std::span<const uint32_t> words : code) {
+        modules.push_back(_device->createShaderModule(
+            vk::ShaderModuleCreateInfo{
+                .pNext = nullptr,
+                .flags = vk::ShaderModuleCreateFlags{},
+                .codeSize = words.size_bytes(),
+                .pCode = words.data(),
+            }));
+        handles.push_back(*modules.back());
+    }
+    // Modules are only needed while the pipeline is created.
+    return builder(handles);
+}
+
+// Watches the file's directory, since compilers and editors often replace
+// files instead of writing them in place. Called with the lock held.
+void ShaderReloader::watch(const std::filesystem::path& path)
+{
+#if defined(__linux__)
+    std::filesystem::path directory = path.parent_path();
+    if (std::ranges::any_of(_watches, [&directory] (const auto& watch) {
+            return watch.second == directory;
+        })) {
+        return;
+    }
+    int wd = inotify_add_watch(
+        _inotify,
+        directory.c_str(),
+        IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0) {
+        throwErrno();
+    }
+    _watches.emplace_back(wd, directory);
+#else
+    (void)path;
+#endif
+}
+
+void ShaderReloader::run()
+{
+#if defined(__linux__)
+    alignas(inotify_event) char buffer[4096];
+    auto changed = std::vector<std::filesystem::path>{};
+
+    while (!_stop) {
+        auto fd = pollfd{.fd = _inotify, .events = POLLIN, .revents = 0};
+        // Wake up regularly to notice _stop, and collect events until the
+        // files have been quiet for one timeout, so that a compiler that
+        // writes a file in several steps triggers a single reload.
+        int ready = poll(&fd, 1, 100);
+        if (ready > 0) {
+            ssize_t length = read(_inotify, buffer, sizeof(buffer));
+            for (ssize_t offset = 0; offset < length; ) {
+                auto event = (const inotify_event*)(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+                if (event->len == 0) {
+                    continue;
+                }
+
+                auto lock = std::lock_guard{_mutex};
+                for (const auto& [wd, directory] : _watches) {
+                    if (wd == event->wd) {
+                        changed.push_back(directory / event->name);
+                    }
+                }
+            }
+            continue;
+        }
+        if (!changed.empty()) {
+            reload(changed);
+            changed.clear();
+        }
+    }
+#endif
+}
+
+void ShaderReloader::reload(const std::vector<std::filesystem::path>& changed)
+{
+    auto affected = std::vector<std::pair<ReloadablePipelineId, Entry>>{};
+    {
+        auto lock = std::lock_guard{_mutex};
+        for (size_t i = 0; i < _entries.size(); i++) {
+            const Entry& entry = _entries[i];
+            bool uses = std::ranges::any_of(
+                entry.sources, [&changed] (const ShaderSource& source) {
+                    return std::ranges::find(changed, source.path) !=
+                        changed.end();
+                });
+            if (uses) {
+                affected.emplace_back((ReloadablePipelineId)i, Entry{
+                    .sources = entry.sources,
+                    .builder = entry.builder,
+                    .pipeline = vk::raii::Pipeline{nullptr},
+                });
+            }
+        }
+    }
+
+    for (auto& [id, entry] : affected) {
+        try {
+            // Sources without a file on disk keep their initial code.
+            auto files = std::vector<MemoryMap>{};
+            auto code = std::vector<std::span<const uint32_t>>{};
+            for (const ShaderSource& source : entry.sources) {
+                if (!std::filesystem::exists(source.path)) {
+                    code.push_back(source.code);
+                    continue;
+                }
+                MemoryMap& file = files.emplace_back(source.path);
+                auto words = std::span{
+                    (const uint32_t*)file.addr(),
+                    file.size() / sizeof(uint32_t)};
+                if (file.size() % sizeof(uint32_t) != 0 || words.size() < 5 ||
+                        words[0] != spirvMagic) {
+                    throw Error{} << source.path.string() << ": not SPIR-V";
+                }
+                code.push_back(words);
+            }
+
+            auto pipeline = build(code, entry.builder);
+
+            auto lock = std::lock_guard{_mutex};
+            std::erase_if(_rebuilt, [id] (const Rebuilt& r) {
+                return r.id == id;
+            });
+            _rebuilt.push_back(Rebuilt{
+                .id = id,
+                .pipeline = std::move(pipeline),
+            });
+            _stats.reloads++;
+        } catch (const std::exception& e) {
+            auto lock = std::lock_guard{_mutex};
+            _lastError = e.what();
+            _stats.failures++;
+        }
+    }
+}
+
+} // namespace rr
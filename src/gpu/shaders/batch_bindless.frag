@@ -0,0 +1,21 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "bindless.glsl"
+
+// BatchMaterial::texture and sampler, pushed by BatchRenderer at
+// BindlessHeap::handlePushOffset.
+layout(push_constant) uniform PushConstants {
+    layout(offset = 64) uint textureHandle;
+    uint samplerHandle;
+} pc;
+
+layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 fragUv;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = fragColor *
+        sampleBindless(pc.textureHandle, pc.samplerHandle, fragUv);
+}
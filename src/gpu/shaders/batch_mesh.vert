@@ -0,0 +1,37 @@
+#version 450
+
+// Matches rr::MeshVertex, rr::MeshInstance and
+// BatchRenderer::meshVertexInput.
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 uv;
+layout(location = 3) in vec4 transformRow0;
+layout(location = 4) in vec4 transformRow1;
+layout(location = 5) in vec4 transformRow2;
+layout(location = 6) in vec4 instanceColor;
+
+layout(push_constant) uniform PushConstants {
+    mat4 viewProjection;
+} pc;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragUv;
+
+void main() {
+    vec4 p = vec4(position, 1.0);
+    vec3 world = vec3(
+        dot(transformRow0, p),
+        dot(transformRow1, p),
+        dot(transformRow2, p));
+
+    // Cheap directional shading so that meshes read as 3D without lights.
+    vec3 worldNormal = normalize(vec3(
+        dot(transformRow0.xyz, normal),
+        dot(transformRow1.xyz, normal),
+        dot(transformRow2.xyz, normal)));
+    float shade = 0.6 + 0.4 * max(dot(worldNormal, normalize(vec3(1.0))), 0.0);
+
+    gl_Position = pc.viewProjection * vec4(world, 1.0);
+    fragColor = vec4(instanceColor.rgb * shade, instanceColor.a);
+    fragUv = uv;
+}
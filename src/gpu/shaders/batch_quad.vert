@@ -0,0 +1,39 @@
+#version 450
+
+// Matches rr::QuadInstance and BatchRenderer::quadVertexInput.
+layout(location = 0) in vec4 instanceRect;
+layout(location = 1) in float instanceRotation;
+layout(location = 2) in vec4 instanceColor;
+layout(location = 3) in vec4 instanceUv;
+
+// Maps pixel coordinates to clip space.
+layout(push_constant) uniform PushConstants {
+    vec2 scale;
+    vec2 offset;
+} pc;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragUv;
+
+vec2 corners[6] = vec2[](
+    vec2(-0.5, -0.5),
+    vec2(0.5, -0.5),
+    vec2(0.5, 0.5),
+    vec2(-0.5, -0.5),
+    vec2(0.5, 0.5),
+    vec2(-0.5, 0.5)
+);
+
+void main() {
+    vec2 corner = corners[gl_VertexIndex];
+    float c = cos(instanceRotation);
+    float s = sin(instanceRotation);
+    vec2 local = corner * instanceRect.zw;
+    vec2 position = instanceRect.xy + vec2(
+        c * local.x - s * local.y,
+        s * local.x + c * local.y);
+
+    gl_Position = vec4(position * pc.scale + pc.offset, 0.0, 1.0);
+    fragColor = instanceColor;
+    fragUv = mix(instanceUv.xy, instanceUv.zw, corner + 0.5);
+}
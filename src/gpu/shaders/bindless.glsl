@@ -0,0 +1,22 @@
+// Declarations matching rr::BindlessHeap. Include it with
+// GL_GOOGLE_include_directive; handles are pushed by the application.
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(set = 0, binding = 0) uniform texture2D bindlessTextures[];
+
+layout(set = 0, binding = 1) buffer BindlessBuffer {
+    uint words[];
+} bindlessBuffers[];
+
+layout(set = 0, binding = 2) uniform sampler bindlessSamplers[];
+
+// The handles must be dynamically uniform, e.g. push constants; wrap them
+// in nonuniformEXT and index the arrays directly where they vary within a
+// draw.
+vec4 sampleBindless(uint textureHandle, uint samplerHandle, vec2 uv) {
+    return texture(
+        sampler2D(
+            bindlessTextures[textureHandle],
+            bindlessSamplers[samplerHandle]),
+        uv);
+}
@@ -0,0 +1,10 @@
+#version 450
+
+// One triangle that covers the viewport, drawn with three vertices and no
+// vertex buffer. fragUv is 0 at the top left and 1 at the bottom right.
+layout(location = 0) out vec2 fragUv;
+
+void main() {
+    fragUv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    gl_Position = vec4(fragUv * 2.0 - 1.0, 0.0, 1.0);
+}
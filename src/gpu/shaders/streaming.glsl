@@ -0,0 +1,29 @@
+// Sampling of textures streamed by rr::TextureStreamer. Include it after
+// bindless.glsl; the table handle is TextureStreamer::tableHandle() and
+// texture ids are returned by TextureStreamer::load.
+//
+// Each table entry is a StreamedTexture: the bindless handle of the texture's
+// resident image, the mip level of the file its level 0 is, the finest level
+// requested this frame, and padding.
+//
+// The table handle must be dynamically uniform; texture ids and sampler
+// handles may vary between invocations.
+
+vec4 sampleStreamed(
+        uint tableHandle, uint textureId, uint samplerHandle, vec2 uv) {
+    uint entry = textureId * 4;
+    uint textureHandle = bindlessBuffers[tableHandle].words[entry];
+    uint residentLevel = bindlessBuffers[tableHandle].words[entry + 1];
+
+    sampler2D s = sampler2D(
+        bindlessTextures[nonuniformEXT(textureHandle)],
+        bindlessSamplers[nonuniformEXT(samplerHandle)]);
+
+    // The unclamped LOD is relative to the resident image; feedback is in
+    // levels of the full texture.
+    float lod = textureQueryLod(s, uv).y;
+    uint wanted = uint(max(float(residentLevel) + floor(lod), 0.0));
+    atomicMin(bindlessBuffers[tableHandle].words[entry + 2], wanted);
+
+    return texture(s, uv);
+}
@@ -0,0 +1,48 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "bindless.glsl"
+
+// Matches DynamicResolution::PushConstants; the handles are pushed at
+// BindlessHeap::handlePushOffset.
+layout(push_constant) uniform PushConstants {
+    // Maps the output's [0, 1] to the rendered part of the target.
+    vec2 uvScale;
+    // Keeps bilinear taps inside the rendered part.
+    vec2 uvMax;
+    vec2 texelSize;
+    float sharpness;
+    // 0: bilinear, 1: sharpen.
+    uint filterMode;
+    layout(offset = 64) uint textureHandle;
+    uint samplerHandle;
+} pc;
+
+layout(location = 0) in vec2 fragUv;
+
+layout(location = 0) out vec4 outColor;
+
+vec3 tap(vec2 uv) {
+    uv = clamp(uv, 0.5 * pc.texelSize, pc.uvMax);
+    return sampleBindless(pc.textureHandle, pc.samplerHandle, uv).rgb;
+}
+
+void main() {
+    vec2 uv = fragUv * pc.uvScale;
+    vec3 center = tap(uv);
+    if (pc.filterMode == 0) {
+        outColor = vec4(center, 1.0);
+        return;
+    }
+
+    // Unsharp mask over the four neighbours, clamped to their range so
+    // that edges do not ring.
+    vec3 n = tap(uv + vec2(0.0, -pc.texelSize.y));
+    vec3 s = tap(uv + vec2(0.0, pc.texelSize.y));
+    vec3 w = tap(uv + vec2(-pc.texelSize.x, 0.0));
+    vec3 e = tap(uv + vec2(pc.texelSize.x, 0.0));
+    vec3 lo = min(center, min(min(n, s), min(w, e)));
+    vec3 hi = max(center, max(max(n, s), max(w, e)));
+    vec3 sharpened = center + pc.sharpness * (center - 0.25 * (n + s + w + e));
+    outColor = vec4(clamp(sharpened, lo, hi), 1.0);
+}
@@ -0,0 +1,449 @@
+#include <swapchain.hpp>
+
+#include <error.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace rr {
+
+namespace {
+
+constexpr size_t presentIntervalHistory = 120;
+
+} // namespace
+
+vk::PresentModeKHR choosePresentMode(
+    vk::PresentModeKHR requested,
+    std::span<const vk::PresentModeKHR> supported)
+{
+    auto isSupported = [supported] (vk::PresentModeKHR mode) {
+        return std::ranges::find(supported, mode) != supported.end();
+    };
+
+    if (isSupported(requested)) {
+        return requested;
+    }
+
+    // Low-latency modes prefer each other over waiting for vblank.
+    auto fallbacks = std::vector<vk::PresentModeKHR>{};
+    if (requested == vk::PresentModeKHR::eImmediate) {
+        fallbacks = {vk::PresentModeKHR::eMailbox};
+    } else if (requested == vk::PresentModeKHR::eMailbox) {
+        fallbacks = {vk::PresentModeKHR::eImmediate};
+    }
+    fallbacks.push_back(vk::PresentModeKHR::eFifoRelaxed);
+
+    for (vk::PresentModeKHR mode : fallbacks) {
+        if (isSupported(mode)) {
+            return mode;
+        }
+    }
+    return vk::PresentModeKHR::eFifo;
+}
+
+std::optional<vk::PresentModeKHR> parsePresentMode(std::string_view name)
+{
+    if (name == "fifo") {
+        return vk::PresentModeKHR::eFifo;
+    }
+    if (name == "fifo-relaxed") {
+        return vk::PresentModeKHR::eFifoRelaxed;
+    }
+    if (name == "mailbox") {
+        return vk::PresentModeKHR::eMailbox;
+    }
+    if (name == "immediate") {
+        return vk::PresentModeKHR::eImmediate;
+    }
+    return std::nullopt;
+}
+
+Swapchain::Swapchain(
+    const vk::raii::PhysicalDevice& physicalDevice,
+    const vk::raii::Device& device,
+    const vk::raii::SurfaceKHR& surface,
+    SwapchainOptions options,
+    vk::Extent2D extent)
+    : _physicalDevice(&physicalDevice)
+    , _device(&device)
+    , _surface(&surface)
+    , _options(std::move(options))
+    , _requestedExtent(extent)
+{
+    std::ranges::sort(_options.queueFamilies);
+    auto [first, last] = std::ranges::unique(_options.queueFamilies);
+    _options.queueFamilies.erase(first, last);
+    _options.presentMode =
+        choosePresentMode(_options.presentMode, supportedPresentModes());
+
+    if (!rebuild()) {
+        throw Error{} << "cannot create swapchain for extent " <<
+            extent.width << "x" << extent.height;
+    }
+}
+
+void Swapchain::setRenderPass(vk::RenderPass renderPass)
+{
+    _renderPass = renderPass;
+    createFramebuffers(_current);
+}
+
+void Swapchain::resize(vk::Extent2D extent)
+{
+    _requestedExtent = extent;
+    if (extent != _current.extent) {
+        _dirty = true;
+    }
+}
+
+void Swapchain::invalidate()
+{
+    _dirty = true;
+}
+
+vk::PresentModeKHR Swapchain::setPresentMode(vk::PresentModeKHR mode)
+{
+    mode = choosePresentMode(mode, supportedPresentModes());
+    if (mode != _options.presentMode) {
+        _options.presentMode = mode;
+        _dirty = true;
+    }
+    return mode;
+}
+
+std::vector<vk::PresentModeKHR> Swapchain::supportedPresentModes() const
+{
+    return _physicalDevice->getSurfacePresentModesKHR(**_surface);
+}
+
+bool Swapchain::waitForPresentQueue(
+    uint32_t queueDepth, std::chrono::nanoseconds timeout)
+{
+    if (!_options.presentWait || !*_current.swapchain) {
+        return false;
+    }
+    if (_presentedFrames <= queueDepth) {
+        return true;
+    }
+
+    // Presents to a retired swapchain cannot be waited on through the
+    // current one; the swapchain handover has completed them in any case.
+    uint64_t presentId = _presentedFrames - queueDepth;
+    if (presentId <= _completedPresentId ||
+            presentId < _current.firstPresentId) {
+        return true;
+    }
+
+    try {
+        vk::Result result = _current.swapchain.waitForPresent(
+            presentId, (uint64_t)timeout.count());
+        if (result == vk::Result::eTimeout) {
+            return false;
+        }
+        if (result == vk::Result::eSuboptimalKHR) {
+            _dirty = true;
+        }
+    } catch (const vk::OutOfDateKHRError&) {
+        _dirty = true;
+        return false;
+    }
+
+    recordPresentInterval(presentId);
+    return true;
+}
+
+std::optional<SwapchainImage> Swapchain::acquire(vk::Semaphore imageAvailable)
+{
+    // One retry is enough: a swapchain that is out of date right after being
+    // rebuilt means the surface is changing faster than we can follow, and
+    // the next frame will try again.
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (_dirty && !rebuild()) {
+            return std::nullopt;
+        }
+
+        try {
+            auto [result, index] = _current.swapchain.acquireNextImage(
+                std::numeric_limits<uint64_t>::max(),
+                imageAvailable,
+                VK_NULL_HANDLE);
+
+            // A suboptimal image is still presentable. Render into it so that
+            // no frame is dropped, and rebuild before the next acquire.
+            if (result == vk::Result::eSuboptimalKHR) {
+                _dirty = true;
+            }
+
+            return SwapchainImage{
+                .index = index,
+                .image = _current.images.at(index),
+                .view = *_current.views.at(index),
+                .framebuffer = _current.framebuffers.empty() ?
+                    vk::Framebuffer{} : *_current.framebuffers.at(index),
+                .extent = _current.extent,
+            };
+        } catch (const vk::OutOfDateKHRError&) {
+            _dirty = true;
+        }
+    }
+
+    return std::nullopt;
+}
+
+void Swapchain::present(
+    vk::Queue queue, vk::Semaphore renderFinished, uint32_t imageIndex)
+{
+    _presentedFrames++;
+
+    vk::SwapchainKHR swapchain = *_current.swapchain;
+    auto presentId = vk::PresentIdKHR{
+        .pNext = nullptr,
+        .swapchainCount = 1,
+        .pPresentIds = &_presentedFrames,
+    };
+    auto presentInfo = vk::PresentInfoKHR{
+        .pNext = _options.presentWait ? &presentId : nullptr,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &renderFinished,
+        .swapchainCount = 1,
+        .pSwapchains = &swapchain,
+        .pImageIndices = &imageIndex,
+        .pResults = nullptr,
+    };
+
+    try {
+        if (queue.presentKHR(presentInfo) == vk::Result::eSuboptimalKHR) {
+            _dirty = true;
+        }
+    } catch (const vk::OutOfDateKHRError&) {
+        _dirty = true;
+    }
+
+    // Without present wait, the best available measure is the rate at which
+    // frames are handed to the presentation engine.
+    if (!_options.presentWait) {
+        recordPresentInterval(_presentedFrames);
+    }
+}
+
+void Swapchain::collect(uint64_t completedFrames)
+{
+    std::erase_if(_retired, [completedFrames] (const Generation& g) {
+        return g.retiredAfterFrame <= completedFrames;
+    });
+}
+
+vk::SwapchainKHR Swapchain::handle() const
+{
+    return *_current.swapchain;
+}
+
+vk::Format Swapchain::format() const
+{
+    return _options.surfaceFormat.format;
+}
+
+vk::ColorSpaceKHR Swapchain::colorSpace() const
+{
+    return _options.surfaceFormat.colorSpace;
+}
+
+vk::PresentModeKHR Swapchain::presentMode() const
+{
+    return _options.presentMode;
+}
+
+vk::Extent2D Swapchain::extent() const
+{
+    return _current.extent;
+}
+
+size_t Swapchain::imageCount() const
+{
+    return _current.images.size();
+}
+
+uint64_t Swapchain::presentedFrames() const
+{
+    return _presentedFrames;
+}
+
+uint64_t Swapchain::generation() const
+{
+    return _generation;
+}
+
+PresentStats Swapchain::presentStats() const
+{
+    auto stats = PresentStats{
+        .presents = _presentedFrames,
+        .measuredAtDisplay = _options.presentWait,
+        .lastIntervalMilliseconds = 0.0,
+        .averageIntervalMilliseconds = 0.0,
+        .minIntervalMilliseconds = 0.0,
+        .maxIntervalMilliseconds = 0.0,
+    };
+    if (_presentIntervals.empty()) {
+        return stats;
+    }
+
+    stats.lastIntervalMilliseconds = _presentIntervals.back();
+    stats.minIntervalMilliseconds = _presentIntervals.front();
+    stats.maxIntervalMilliseconds = _presentIntervals.front();
+    double sum = 0.0;
+    for (double interval : _presentIntervals) {
+        sum += interval;
+        stats.minIntervalMilliseconds =
+            std::min(stats.minIntervalMilliseconds, interval);
+        stats.maxIntervalMilliseconds =
+            std::max(stats.maxIntervalMilliseconds, interval);
+    }
+    stats.averageIntervalMilliseconds = sum / (double)_presentIntervals.size();
+    return stats;
+}
+
+bool Swapchain::rebuild()
+{
+    vk::SurfaceCapabilitiesKHR capabilities =
+        _physicalDevice->getSurfaceCapabilitiesKHR(**_surface);
+
+    vk::Extent2D extent = capabilities.currentExtent;
+    if (extent.width == std::numeric_limits<uint32_t>::max()) {
+        extent.width = std::clamp(
+            _requestedExtent.width,
+            capabilities.minImageExtent.width,
+            capabilities.maxImageExtent.width);
+        extent.height = std::clamp(
+            _requestedExtent.height,
+            capabilities.minImageExtent.height,
+            capabilities.maxImageExtent.height);
+    }
+
+    // A minimized window reports a zero extent, and a swapchain cannot be
+    // created for it. Stay dirty and try again on a later frame.
+    if (extent.width == 0 || extent.height == 0) {
+        return false;
+    }
+
+    uint32_t imageCount = capabilities.minImageCount + 1;
+    if (capabilities.maxImageCount != 0) {
+        imageCount = std::min(imageCount, capabilities.maxImageCount);
+    }
+
+    bool concurrent = _options.queueFamilies.size() > 1;
+
+    auto swapchainCreateInfo = vk::SwapchainCreateInfoKHR{
+        .pNext = nullptr,
+        .flags = vk::SwapchainCreateFlagsKHR{},
+        .surface = **_surface,
+        .minImageCount = imageCount,
+        .imageFormat = _options.surfaceFormat.format,
+        .imageColorSpace = _options.surfaceFormat.colorSpace,
+        .imageExtent = extent,
+        .imageArrayLayers = 1,
+        .imageUsage = _options.imageUsage,
+        .imageSharingMode = concurrent ?
+            vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive,
+        .queueFamilyIndexCount = concurrent ?
+            (uint32_t)_options.queueFamilies.size() : 0u,
+        .pQueueFamilyIndices = concurrent ?
+            _options.queueFamilies.data() : nullptr,
+        .preTransform = capabilities.currentTransform,
+        .compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque,
+        .presentMode = _options.presentMode,
+        .clipped = vk::True,
+        .oldSwapchain = *_current.swapchain,
+    };
+
+    auto next = Generation{};
+    next.swapchain = _device->createSwapchainKHR(swapchainCreateInfo);
+    next.extent = extent;
+    next.firstPresentId = _presentedFrames + 1;
+
+    for (VkImage image : next.swapchain.getImages()) {
+        next.images.push_back(image);
+    }
+
+    next.views.reserve(next.images.size());
+    for (vk::Image image : next.images) {
+        auto imageViewCreateInfo = vk::ImageViewCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::ImageViewCreateFlags{},
+            .image = image,
+            .viewType = vk::ImageViewType::e2D,
+            .format = _options.surfaceFormat.format,
+            .components = vk::ComponentMapping {
+                .r = vk::ComponentSwizzle::eIdentity,
+                .g = vk::ComponentSwizzle::eIdentity,
+                .b = vk::ComponentSwizzle::eIdentity,
+                .a = vk::ComponentSwizzle::eIdentity,
+            },
+            .subresourceRange = vk::ImageSubresourceRange{
+                .aspectMask = vk::ImageAspectFlagBits::eColor,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+        };
+        next.views.push_back(_device->createImageView(imageViewCreateInfo));
+    }
+
+    createFramebuffers(next);
+
+    // The old swapchain is retired by the create call above. Its images may
+    // still be referenced by frames in flight, so keep it (and the views and
+    // framebuffers built on it) until those frames complete.
+    if (*_current.swapchain) {
+        _current.retiredAfterFrame = _presentedFrames;
+        _retired.push_back(std::move(_current));
+    }
+    _current = std::move(next);
+    _dirty = false;
+    _generation++;
+    return true;
+}
+
+void Swapchain::createFramebuffers(Generation& generation) const
+{
+    generation.framebuffers.clear();
+    if (!_renderPass) {
+        return;
+    }
+
+    generation.framebuffers.reserve(generation.views.size());
+    for (const auto& view : generation.views) {
+        auto framebufferInfo = vk::FramebufferCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::FramebufferCreateFlags{},
+            .renderPass = _renderPass,
+            .attachmentCount = 1,
+            .pAttachments = &*view,
+            .width = generation.extent.width,
+            .height = generation.extent.height,
+            .layers = 1,
+        };
+        generation.framebuffers.push_back(
+            _device->createFramebuffer(framebufferInfo));
+    }
+}
+
+void Swapchain::recordPresentInterval(uint64_t presentId)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (_completedPresentId != 0 && presentId > _completedPresentId) {
+        // Spread the time evenly if several presents completed at once.
+        double interval = std::chrono::duration<double, std::milli>(
+            now - _lastPresentTime).count() /
+            (double)(presentId - _completedPresentId);
+        _presentIntervals.push_back(interval);
+        if (_presentIntervals.size() > presentIntervalHistory) {
+            _presentIntervals.pop_front();
+        }
+    }
+    _completedPresentId = presentId;
+    _lastPresentTime = now;
+}
+
+} // namespace rr
@@ -0,0 +1,504 @@
+#include <texture_streamer.hpp>
+
+#include <error.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+
+namespace rr {
+
+namespace {
+
+// Levels from level down to the coarsest, as they are laid out in a
+// resident image's upload.
+vk::DeviceSize levelBytes(
+    std::span<const TextureFileLevel> levels, uint32_t level)
+{
+    vk::DeviceSize total = 0;
+    for (size_t i = level; i < levels.size(); i++) {
+        total += levels[i].size;
+    }
+    return total;
+}
+
+// Copying out of the mapping is what faults the pages in, so this is the
+// part that runs on the job system.
+std::vector<std::byte> readLevels(
+    const MemoryMap& file,
+    std::span<const TextureFileLevel> levels,
+    uint32_t level)
+{
+    auto data = std::vector<std::byte>(levelBytes(levels, level));
+    auto out = data.data();
+    for (size_t i = level; i < levels.size(); i++) {
+        std::memcpy(
+            out,
+            (const std::byte*)file.addr() + levels[i].offset,
+            levels[i].size);
+        out += levels[i].size;
+    }
+    return data;
+}
+
+} // namespace
+
+TextureStreamer::TextureStreamer(
+    const vk::raii::Device& device,
+    MemoryAllocator& allocator,
+    UploadService& uploads,
+    BindlessHeap& heap,
+    JobSystem& jobs,
+    uint32_t frameContextCount,
+    TextureStreamerOptions options)
+    : _device(&device)
+    , _allocator(&allocator)
+    , _uploads(&uploads)
+    , _heap(&heap)
+    , _jobs(&jobs)
+    , _options(options)
+    , _frames(frameContextCount)
+{
+    if (frameContextCount == 0) {
+        throw Error{} << "texture streamer needs a frame context";
+    }
+
+    auto bufferInfo = vk::BufferCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::BufferCreateFlags{},
+        .size = _options.maxTextures * sizeof(TableEntry),
+        .usage = vk::BufferUsageFlagBits::eStorageBuffer,
+        .sharingMode = vk::SharingMode::eExclusive,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = nullptr,
+    };
+    for (auto& frame : _frames) {
+        frame.buffer = device.createBuffer(bufferInfo);
+        // The CPU reads the feedback back, so prefer cached memory.
+        frame.memory = allocator.allocateForBuffer(
+            *frame.buffer,
+            vk::MemoryPropertyFlagBits::eHostVisible |
+                vk::MemoryPropertyFlagBits::eHostCoherent,
+            vk::MemoryPropertyFlagBits::eHostCached);
+        frame.handle = heap.addStorageBuffer(*frame.buffer);
+    }
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    // Jobs still reference the textures; the caller waits for the GPU. A
+    // failed read no longer matters, and its error cannot leave a destructor.
+    for (const auto& texture : _textures) {
+        if (texture->read) {
+            try {
+                _jobs->wait(texture->read->counter);
+            } catch (const std::exception&) {
+            }
+        }
+        _heap->releaseSampledImage(texture->resident.handle, 0);
+        texture->resident.view.clear();
+        texture->resident.image.clear();
+        _allocator->free(texture->resident.memory);
+    }
+    for (auto& retired : _retired) {
+        retired.resident.view.clear();
+        retired.resident.image.clear();
+        _allocator->free(retired.resident.memory);
+    }
+    for (auto& frame : _frames) {
+        _heap->releaseStorageBuffer(frame.handle, 0);
+        frame.buffer.clear();
+        _allocator->free(frame.memory);
+    }
+}
+
+TextureId TextureStreamer::load(const std::filesystem::path& path)
+{
+    if (_textures.size() == _options.maxTextures) {
+        throw Error{} << "texture streamer is full (" <<
+            _options.maxTextures << " textures)";
+    }
+
+    auto texture = std::make_unique<Texture>();
+    texture->file.map(path);
+
+    auto fileData = (const std::byte*)texture->file.addr();
+    size_t fileSize = texture->file.size();
+    auto header = TextureFileHeader{};
+    if (fileSize < sizeof(header)) {
+        throw Error{} << path.string() << ": truncated texture header";
+    }
+    std::memcpy(&header, fileData, sizeof(header));
+    if (header.magic != TextureFileHeader::magicValue ||
+            header.version != TextureFileHeader::currentVersion) {
+        throw Error{} << path.string() << ": not a version " <<
+            TextureFileHeader::currentVersion << " texture file";
+    }
+
+    uint32_t maxLevels =
+        (uint32_t)std::bit_width(std::max(header.width, header.height));
+    if (header.width == 0 || header.height == 0 ||
+            header.levelCount == 0 || header.levelCount > maxLevels) {
+        throw Error{} << path.string() << ": invalid texture size " <<
+            header.width << "x" << header.height << " with " <<
+            header.levelCount << " levels";
+    }
+    if (fileSize < sizeof(header) +
+            header.levelCount * sizeof(TextureFileLevel)) {
+        throw Error{} << path.string() << ": truncated level table";
+    }
+
+    texture->format = (vk::Format)header.format;
+    texture->width = header.width;
+    texture->height = header.height;
+    texture->levels.resize(header.levelCount);
+    std::memcpy(
+        texture->levels.data(),
+        fileData + sizeof(header),
+        header.levelCount * sizeof(TextureFileLevel));
+    for (const TextureFileLevel& level : texture->levels) {
+        if (level.offset > fileSize || level.size > fileSize - level.offset) {
+            throw Error{} << path.string() << ": level data out of bounds";
+        }
+    }
+
+    uint32_t lastLevel = header.levelCount - 1;
+    texture->tailLevel = lastLevel;
+    for (uint32_t i = 0; i < header.levelCount; i++) {
+        if (std::max(header.width >> i, header.height >> i) <=
+                _options.tailSize) {
+            texture->tailLevel = i;
+            break;
+        }
+    }
+    texture->finestLevel = texture->tailLevel;
+    while (texture->finestLevel > 0 &&
+            levelBytes(texture->levels, texture->finestLevel - 1) <=
+                _options.maxUploadBytes) {
+        texture->finestLevel--;
+    }
+    if (levelBytes(texture->levels, texture->tailLevel) >
+            _options.maxUploadBytes) {
+        throw Error{} << path.string() << ": mip tail does not fit in " <<
+            _options.maxUploadBytes << " bytes";
+    }
+
+    // The tail is small and needed right away, so it is read here.
+    auto tail = readLevels(texture->file, texture->levels, texture->tailLevel);
+    texture->resident = createResident(*texture, texture->tailLevel, tail);
+    texture->wantedLevel = texture->tailLevel;
+
+    _textures.push_back(std::move(texture));
+    return (TextureId)(_textures.size() - 1);
+}
+
+void TextureStreamer::requestScreenSize(TextureId texture, float pixels)
+{
+    Texture& t = *_textures.at(texture);
+    float size = (float)std::max(t.width, t.height);
+    auto level = pixels >= size ?
+        0u : (uint32_t)std::floor(std::log2(size / std::max(pixels, 1.f)));
+    t.requestedLevel = std::min(t.requestedLevel, level);
+}
+
+void TextureStreamer::beginFrame(
+    uint32_t frameContext, uint64_t frame, uint64_t completedFrames)
+{
+    _frameContext = frameContext % (uint32_t)_frames.size();
+    FrameContext& context = _frames[_frameContext];
+    _frameUploadedBytes = 0;
+
+    std::erase_if(_retired, [this, completedFrames] (Retired& retired) {
+        if (retired.lastFrame >= completedFrames) {
+            return false;
+        }
+        retired.resident.view.clear();
+        retired.resident.image.clear();
+        _allocator->free(retired.resident.memory);
+        return true;
+    });
+
+    readFeedback(context, frame);
+
+    for (auto& texture : _textures) {
+        if (texture->read) {
+            finishRead(*texture, frame);
+            continue;
+        }
+        if (texture->wantedLevel >= texture->resident.level) {
+            continue;
+        }
+
+        // Only start an upgrade that fits, making room from textures that
+        // are no longer needed at their current detail if necessary.
+        vk::DeviceSize needed =
+            levelBytes(texture->levels, texture->wantedLevel) -
+            std::min(
+                texture->resident.memory.size,
+                levelBytes(texture->levels, texture->wantedLevel));
+        if (evict(needed, texture.get())) {
+            startRead(*texture, texture->wantedLevel);
+        }
+    }
+
+    // Textures above the budget without upgrades, e.g. after the budget
+    // was lowered, still get evicted.
+    evict(0, nullptr);
+
+    auto table = (TableEntry*)context.memory.mapped;
+    for (size_t i = 0; i < _textures.size(); i++) {
+        const Resident& resident = _textures[i]->resident;
+        table[i] = TableEntry{
+            .handle = resident.handle,
+            .residentLevel = resident.level,
+            .requestedLevel = UINT32_MAX,
+            .padding = 0,
+        };
+    }
+    context.entryCount = _textures.size();
+
+    _stats.textures = (uint32_t)_textures.size();
+    _stats.budget = _options.budget;
+    _stats.residentBytes = _residentBytes;
+    _stats.pendingReads = (uint32_t)std::ranges::count_if(
+        _textures, [] (const auto& texture) { return bool(texture->read); });
+}
+
+void TextureStreamer::setBudget(vk::DeviceSize budget)
+{
+    _options.budget = budget;
+}
+
+void TextureStreamer::recordFeedbackBarrier(
+    vk::CommandBuffer commandBuffer) const
+{
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eAllCommands,
+        vk::PipelineStageFlagBits::eHost,
+        vk::DependencyFlags{},
+        vk::MemoryBarrier{
+            .pNext = nullptr,
+            .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+            .dstAccessMask = vk::AccessFlagBits::eHostRead,
+        },
+        {},
+        {});
+}
+
+BindlessHandle TextureStreamer::tableHandle() const
+{
+    return _frames[_frameContext].handle;
+}
+
+uint32_t TextureStreamer::levelCount(TextureId texture) const
+{
+    return (uint32_t)_textures.at(texture)->levels.size();
+}
+
+uint32_t TextureStreamer::residentLevel(TextureId texture) const
+{
+    return _textures.at(texture)->resident.level;
+}
+
+TextureStreamerStats TextureStreamer::stats() const
+{
+    return _stats;
+}
+
+void TextureStreamer::readFeedback(
+    const FrameContext& context, uint64_t frame)
+{
+    auto table = (const TableEntry*)context.memory.mapped;
+    for (size_t i = 0; i < _textures.size(); i++) {
+        Texture& texture = *_textures[i];
+
+        // Textures loaded after the context was last written have no entry
+        // in it yet, and only their CPU requests count.
+        uint32_t requested = texture.requestedLevel;
+        if (i < context.entryCount) {
+            requested = std::min(requested, table[i].requestedLevel);
+        }
+        texture.requestedLevel = UINT32_MAX;
+
+        texture.wantedLevel = requested == UINT32_MAX ?
+            texture.tailLevel :
+            std::clamp(requested, texture.finestLevel, texture.tailLevel);
+        if (texture.wantedLevel <= texture.resident.level) {
+            texture.lastUsedFrame = frame;
+        }
+    }
+}
+
+void TextureStreamer::startRead(Texture& texture, uint32_t level)
+{
+    auto read = std::make_unique<Read>();
+    read->level = level;
+    read->delta = (int64_t)levelBytes(texture.levels, level) -
+        (int64_t)texture.resident.memory.size;
+    _pendingDelta += read->delta;
+
+    Read* r = read.get();
+    const Texture* t = &texture;
+    _jobs->spawn(r->counter, [r, t] {
+        r->data = readLevels(t->file, t->levels, r->level);
+    });
+    texture.read = std::move(read);
+}
+
+void TextureStreamer::finishRead(Texture& texture, uint64_t frame)
+{
+    Read& read = *texture.read;
+    if (!read.counter.done()) {
+        return;
+    }
+    // The first upload of a frame always goes through, so that levels
+    // larger than the per-frame limit are not starved.
+    if (_frameUploadedBytes > 0 &&
+            _frameUploadedBytes + read.data.size() >
+                _options.frameUploadBytes) {
+        return;
+    }
+    // Rethrows errors of the read job.
+    _jobs->wait(read.counter);
+
+    Resident resident = createResident(texture, read.level, read.data);
+    if (resident.level < texture.resident.level) {
+        _stats.upgrades++;
+    } else {
+        _stats.evictions++;
+    }
+    retire(texture.resident, frame);
+    texture.resident = std::move(resident);
+
+    _pendingDelta -= read.delta;
+    _frameUploadedBytes += read.data.size();
+    texture.read.reset();
+}
+
+TextureStreamer::Resident TextureStreamer::createResident(
+    const Texture& texture,
+    uint32_t level,
+    std::span<const std::byte> data)
+{
+    auto extent = vk::Extent3D{
+        .width = std::max(texture.width >> level, 1u),
+        .height = std::max(texture.height >> level, 1u),
+        .depth = 1,
+    };
+    auto levelCount = (uint32_t)texture.levels.size() - level;
+
+    auto resident = Resident{};
+    resident.level = level;
+    resident.image = _device->createImage(vk::ImageCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::ImageCreateFlags{},
+        .imageType = vk::ImageType::e2D,
+        .format = texture.format,
+        .extent = extent,
+        .mipLevels = levelCount,
+        .arrayLayers = 1,
+        .samples = vk::SampleCountFlagBits::e1,
+        .tiling = vk::ImageTiling::eOptimal,
+        .usage = vk::ImageUsageFlagBits::eSampled |
+            vk::ImageUsageFlagBits::eTransferDst,
+        .sharingMode = vk::SharingMode::eExclusive,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = nullptr,
+        .initialLayout = vk::ImageLayout::eUndefined,
+    });
+    resident.memory = _allocator->allocateForImage(
+        *resident.image,
+        ResourceKind::Optimal,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    resident.view = _device->createImageView(vk::ImageViewCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::ImageViewCreateFlags{},
+        .image = *resident.image,
+        .viewType = vk::ImageViewType::e2D,
+        .format = texture.format,
+        .components = vk::ComponentMapping{
+            .r = vk::ComponentSwizzle::eIdentity,
+            .g = vk::ComponentSwizzle::eIdentity,
+            .b = vk::ComponentSwizzle::eIdentity,
+            .a = vk::ComponentSwizzle::eIdentity,
+        },
+        .subresourceRange = vk::ImageSubresourceRange{
+            .aspectMask = vk::ImageAspectFlagBits::eColor,
+            .baseMipLevel = 0,
+            .levelCount = levelCount,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    });
+
+    size_t offset = 0;
+    for (uint32_t i = 0; i < levelCount; i++) {
+        size_t size = texture.levels[level + i].size;
+        _uploads->uploadImage(
+            *resident.image,
+            vk::ImageSubresourceLayers{
+                .aspectMask = vk::ImageAspectFlagBits::eColor,
+                .mipLevel = i,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+            vk::Extent3D{
+                .width = std::max(extent.width >> i, 1u),
+                .height = std::max(extent.height >> i, 1u),
+                .depth = 1,
+            },
+            data.subspan(offset, size),
+            vk::ImageLayout::eUndefined,
+            vk::ImageLayout::eShaderReadOnlyOptimal,
+            vk::AccessFlagBits::eShaderRead,
+            vk::PipelineStageFlagBits::eFragmentShader);
+        offset += size;
+    }
+    _stats.uploadedBytes += data.size();
+
+    resident.handle = _heap->addSampledImage(*resident.view);
+    _residentBytes += resident.memory.size;
+    return resident;
+}
+
+void TextureStreamer::retire(Resident& resident, uint64_t frame)
+{
+    // The previous frame was the last to see the old handle in its table.
+    uint64_t lastFrame = frame > 0 ? frame - 1 : 0;
+    _heap->releaseSampledImage(resident.handle, lastFrame);
+    _residentBytes -= resident.memory.size;
+    _retired.push_back(Retired{
+        .resident = std::move(resident),
+        .lastFrame = lastFrame,
+    });
+}
+
+bool TextureStreamer::evict(vk::DeviceSize needed, const Texture* keep)
+{
+    while (projectedBytes() + needed > _options.budget) {
+        Texture* victim = nullptr;
+        for (auto& texture : _textures) {
+            if (texture.get() == keep || texture->read ||
+                    texture->wantedLevel <= texture->resident.level) {
+                continue;
+            }
+            if (!victim || texture->lastUsedFrame < victim->lastUsedFrame) {
+                victim = texture.get();
+            }
+        }
+        if (!victim) {
+            return false;
+        }
+        startRead(*victim, victim->wantedLevel);
+    }
+    return true;
+}
+
+vk::DeviceSize TextureStreamer::projectedBytes() const
+{
+    return (vk::DeviceSize)std::max<int64_t>(
+        (int64_t)_residentBytes + _pendingDelta, 0);
+}
+
+} // namespace rr
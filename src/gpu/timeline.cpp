@@ -0,0 +1,217 @@
+#include <timeline.hpp>
+
+#include <error.hpp>
+
+#include <algorithm>
+
+namespace rr {
+
+namespace {
+
+uint64_t timeoutNanoseconds(std::chrono::nanoseconds timeout)
+{
+    return timeout == std::chrono::nanoseconds::max() ?
+        UINT64_MAX : (uint64_t)std::max<int64_t>(timeout.count(), 0);
+}
+
+} // namespace
+
+TimelineSync::TimelineSync(const vk::raii::Device& device)
+    : _device(&device)
+{ }
+
+// The wait fails if the device was lost, which leaves nothing to wait for;
+// the error cannot leave a destructor.
+TimelineSync::~TimelineSync()
+{
+    try {
+        waitIdle();
+    } catch (const std::exception&) {
+    }
+}
+
+QueueId TimelineSync::addQueue(vk::Queue queue)
+{
+    for (QueueId i = 0; i < _queues.size(); i++) {
+        if (_queues[i].queue == queue) {
+            return i;
+        }
+    }
+
+    auto typeInfo = vk::SemaphoreTypeCreateInfo{
+        .pNext = nullptr,
+        .semaphoreType = vk::SemaphoreType::eTimeline,
+        .initialValue = 0,
+    };
+    auto& timeline = _queues.emplace_back();
+    timeline.queue = queue;
+    timeline.semaphore = _device->createSemaphore(vk::SemaphoreCreateInfo{
+        .pNext = &typeInfo,
+        .flags = vk::SemaphoreCreateFlags{},
+    });
+    return (QueueId)(_queues.size() - 1);
+}
+
+TimelinePoint TimelineSync::submit(
+    QueueId queue, const TimelineSubmitInfo& info)
+{
+    QueueTimeline& target = timeline(queue);
+
+    _waitSemaphores.clear();
+    _waitValues.clear();
+    _waitStages.clear();
+
+    for (const TimelineWait& wait : info.waits) {
+        if (completed(wait.point)) {
+            continue;
+        }
+        vk::Semaphore semaphore = *timeline(wait.point.queue).semaphore;
+        auto it = std::ranges::find(_waitSemaphores, semaphore);
+        if (it != _waitSemaphores.end()) {
+            size_t i = it - _waitSemaphores.begin();
+            _waitValues[i] = std::max(_waitValues[i], wait.point.value);
+            _waitStages[i] |= wait.stages;
+            continue;
+        }
+        _waitSemaphores.push_back(semaphore);
+        _waitValues.push_back(wait.point.value);
+        _waitStages.push_back(wait.stages);
+    }
+    // Values of binary semaphores are ignored, but the arrays must match.
+    for (const BinarySemaphoreWait& wait : info.binaryWaits) {
+        _waitSemaphores.push_back(wait.semaphore);
+        _waitValues.push_back(0);
+        _waitStages.push_back(wait.stages);
+    }
+
+    _signalSemaphores.assign(
+        info.binarySignals.begin(), info.binarySignals.end());
+    _signalValues.assign(info.binarySignals.size(), 0);
+    _signalSemaphores.push_back(*target.semaphore);
+    _signalValues.push_back(target.submitted + 1);
+
+    auto timelineInfo = vk::TimelineSemaphoreSubmitInfo{
+        .pNext = nullptr,
+        .waitSemaphoreValueCount = (uint32_t)_waitValues.size(),
+        .pWaitSemaphoreValues = _waitValues.data(),
+        .signalSemaphoreValueCount = (uint32_t)_signalValues.size(),
+        .pSignalSemaphoreValues = _signalValues.data(),
+    };
+    auto submitInfo = vk::SubmitInfo{
+        .pNext = &timelineInfo,
+        .waitSemaphoreCount = (uint32_t)_waitSemaphores.size(),
+        .pWaitSemaphores = _waitSemaphores.data(),
+        .pWaitDstStageMask = _waitStages.data(),
+        .commandBufferCount = (uint32_t)info.commandBuffers.size(),
+        .pCommandBuffers = info.commandBuffers.data(),
+        .signalSemaphoreCount = (uint32_t)_signalSemaphores.size(),
+        .pSignalSemaphores = _signalSemaphores.data(),
+    };
+    target.queue.submit(submitInfo);
+
+    // Only count the value once the submission has been accepted.
+    target.submitted++;
+    return TimelinePoint{.queue = queue, .value = target.submitted};
+}
+
+TimelinePoint TimelineSync::lastSubmitted(QueueId queue) const
+{
+    return TimelinePoint{.queue = queue, .value = timeline(queue).submitted};
+}
+
+uint64_t TimelineSync::completedValue(QueueId queue)
+{
+    QueueTimeline& t = timeline(queue);
+    if (t.completed < t.submitted) {
+        t.completed = t.semaphore.getCounterValue();
+    }
+    return t.completed;
+}
+
+bool TimelineSync::completed(TimelinePoint point)
+{
+    if (point.value == 0 || point.value <= timeline(point.queue).completed) {
+        return true;
+    }
+    return point.value <= completedValue(point.queue);
+}
+
+bool TimelineSync::wait(TimelinePoint point, std::chrono::nanoseconds timeout)
+{
+    return waitAll(std::span{&point, 1}, timeout);
+}
+
+bool TimelineSync::waitAll(
+    std::span<const TimelinePoint> points, std::chrono::nanoseconds timeout)
+{
+    auto semaphores = std::vector<vk::Semaphore>{};
+    auto values = std::vector<uint64_t>{};
+    for (const TimelinePoint& point : points) {
+        if (point.value > timeline(point.queue).submitted) {
+            throw Error{} << "waiting for timeline value " << point.value <<
+                " that was never submitted";
+        }
+        if (!completed(point)) {
+            semaphores.push_back(*timeline(point.queue).semaphore);
+            values.push_back(point.value);
+        }
+    }
+    if (semaphores.empty()) {
+        return true;
+    }
+
+    auto waitInfo = vk::SemaphoreWaitInfo{
+        .pNext = nullptr,
+        .flags = vk::SemaphoreWaitFlags{},
+        .semaphoreCount = (uint32_t)semaphores.size(),
+        .pSemaphores = semaphores.data(),
+        .pValues = values.data(),
+    };
+    if (_device->waitSemaphores(waitInfo, timeoutNanoseconds(timeout)) ==
+            vk::Result::eTimeout) {
+        return false;
+    }
+
+    for (const TimelinePoint& point : points) {
+        QueueTimeline& t = timeline(point.queue);
+        t.completed = std::max(t.completed, point.value);
+    }
+    return true;
+}
+
+void TimelineSync::waitIdle()
+{
+    auto points = std::vector<TimelinePoint>{};
+    for (QueueId i = 0; i < _queues.size(); i++) {
+        points.push_back(lastSubmitted(i));
+    }
+    waitAll(points);
+}
+
+vk::Queue TimelineSync::queue(QueueId queue) const
+{
+    return timeline(queue).queue;
+}
+
+vk::Semaphore TimelineSync::semaphore(QueueId queue) const
+{
+    return *timeline(queue).semaphore;
+}
+
+TimelineSync::QueueTimeline& TimelineSync::timeline(QueueId queue)
+{
+    if (queue >= _queues.size()) {
+        throw Error{} << "unknown queue id " << queue;
+    }
+    return _queues[queue];
+}
+
+const TimelineSync::QueueTimeline& TimelineSync::timeline(QueueId queue) const
+{
+    if (queue >= _queues.size()) {
+        throw Error{} << "unknown queue id " << queue;
+    }
+    return _queues[queue];
+}
+
+} // namespace rr
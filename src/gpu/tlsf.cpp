@@ -0,0 +1,280 @@
+#include <tlsf.hpp>
+
+#include <error.hpp>
+
+#include <algorithm>
+#include <bit>
+
+namespace rr {
+
+Tlsf::Tlsf(uint64_t size)
+    : _size(size)
+{
+    for (auto& lists : _freeLists) {
+        lists.fill(noBlock);
+    }
+
+    if (size > 0) {
+        uint32_t index = newBlock();
+        _blocks[index].offset = 0;
+        _blocks[index].size = size;
+        insertFree(index);
+    }
+}
+
+std::optional<Tlsf::Allocation> Tlsf::allocate(uint64_t size, uint64_t alignment)
+{
+    size = std::max<uint64_t>(size, 1);
+    alignment = std::max<uint64_t>(alignment, 1);
+    if (!std::has_single_bit(alignment)) {
+        throw Error{} << "alignment is not a power of two: " << alignment;
+    }
+
+    // Searching for size + alignment - 1 wastes a little on average, but
+    // guarantees that any block found can hold an aligned allocation, so the
+    // search never has to look at more than one list.
+    uint64_t padded = size + alignment - 1;
+    if (padded < size || padded > _size) {
+        return std::nullopt;
+    }
+
+    auto bucket = findBucket(padded);
+    if (!bucket) {
+        return std::nullopt;
+    }
+
+    uint32_t index = _freeLists[bucket->firstLevel][bucket->secondLevel];
+    removeFree(index);
+
+    uint64_t offset = _blocks[index].offset;
+    uint64_t alignedOffset = (offset + alignment - 1) & ~(alignment - 1);
+    if (alignedOffset > offset) {
+        uint32_t rest = splitOff(index, alignedOffset - offset);
+        insertFree(index);
+        index = rest;
+    }
+
+    if (_blocks[index].size > size) {
+        uint32_t tail = splitOff(index, size);
+        insertFree(tail);
+    }
+
+    _blocks[index].free = false;
+    _usedBytes += size;
+    _allocationCount++;
+
+    return Allocation{
+        .offset = _blocks[index].offset,
+        .size = size,
+        .handle = index,
+    };
+}
+
+void Tlsf::free(uint32_t handle)
+{
+    if (handle >= _blocks.size() || _blocks[handle].free) {
+        throw Error{} << "invalid TLSF handle: " << handle;
+    }
+
+    _usedBytes -= _blocks[handle].size;
+    _allocationCount--;
+    _blocks[handle].free = true;
+
+    uint32_t next = _blocks[handle].nextPhysical;
+    if (next != noBlock && _blocks[next].free) {
+        removeFree(next);
+        mergeWithNext(handle);
+    }
+
+    uint32_t prev = _blocks[handle].prevPhysical;
+    if (prev != noBlock && _blocks[prev].free) {
+        removeFree(prev);
+        mergeWithNext(prev);
+        handle = prev;
+    }
+
+    insertFree(handle);
+}
+
+uint64_t Tlsf::size() const
+{
+    return _size;
+}
+
+uint64_t Tlsf::usedBytes() const
+{
+    return _usedBytes;
+}
+
+uint32_t Tlsf::allocationCount() const
+{
+    return _allocationCount;
+}
+
+bool Tlsf::empty() const
+{
+    return _allocationCount == 0;
+}
+
+uint64_t Tlsf::largestFreeRange() const
+{
+    if (_firstLevelBitmap == 0) {
+        return 0;
+    }
+
+    auto firstLevel = (uint32_t)(std::bit_width(_firstLevelBitmap) - 1);
+    auto secondLevel =
+        (uint32_t)(std::bit_width(_secondLevelBitmaps[firstLevel]) - 1);
+
+    uint64_t largest = 0;
+    for (uint32_t i = _freeLists[firstLevel][secondLevel];
+            i != noBlock;
+            i = _blocks[i].nextFree) {
+        largest = std::max(largest, _blocks[i].size);
+    }
+    return largest;
+}
+
+size_t Tlsf::freeRangeCount() const
+{
+    return _freeRangeCount;
+}
+
+Tlsf::Bucket Tlsf::bucketFor(uint64_t size)
+{
+    auto firstLevel = (uint32_t)(std::bit_width(size) - 1);
+    uint64_t secondLevel = firstLevel >= secondLevelLog2 ?
+        size >> (firstLevel - secondLevelLog2) :
+        size << (secondLevelLog2 - firstLevel);
+    return Bucket{
+        .firstLevel = firstLevel,
+        .secondLevel = (uint32_t)(secondLevel ^ secondLevelCount),
+    };
+}
+
+std::optional<Tlsf::Bucket> Tlsf::findBucket(uint64_t size) const
+{
+    // Round up to the start of the next bucket, so that every block in the
+    // bucket found is large enough.
+    auto firstLevel = (uint32_t)(std::bit_width(size) - 1);
+    if (firstLevel >= secondLevelLog2) {
+        uint64_t round = (uint64_t{1} << (firstLevel - secondLevelLog2)) - 1;
+        if (size + round < size) {
+            return std::nullopt;
+        }
+        size += round;
+    }
+
+    Bucket bucket = bucketFor(size);
+
+    uint32_t secondLevelMap =
+        _secondLevelBitmaps[bucket.firstLevel] & (~0u << bucket.secondLevel);
+    if (secondLevelMap == 0) {
+        if (bucket.firstLevel + 1 >= firstLevelCount) {
+            return std::nullopt;
+        }
+        uint64_t firstLevelMap =
+            _firstLevelBitmap & (~uint64_t{0} << (bucket.firstLevel + 1));
+        if (firstLevelMap == 0) {
+            return std::nullopt;
+        }
+        bucket.firstLevel = (uint32_t)std::countr_zero(firstLevelMap);
+        secondLevelMap = _secondLevelBitmaps[bucket.firstLevel];
+    }
+    bucket.secondLevel = (uint32_t)std::countr_zero(secondLevelMap);
+    return bucket;
+}
+
+uint32_t Tlsf::newBlock()
+{
+    if (!_unusedBlocks.empty()) {
+        uint32_t index = _unusedBlocks.back();
+        _unusedBlocks.pop_back();
+        _blocks[index] = Block{};
+        return index;
+    }
+    _blocks.emplace_back();
+    return (uint32_t)(_blocks.size() - 1);
+}
+
+void Tlsf::insertFree(uint32_t index)
+{
+    Block& block = _blocks[index];
+    block.free = true;
+
+    Bucket bucket = bucketFor(block.size);
+    uint32_t& head = _freeLists[bucket.firstLevel][bucket.secondLevel];
+    block.prevFree = noBlock;
+    block.nextFree = head;
+    if (head != noBlock) {
+        _blocks[head].prevFree = index;
+    }
+    head = index;
+
+    _firstLevelBitmap |= uint64_t{1} << bucket.firstLevel;
+    _secondLevelBitmaps[bucket.firstLevel] |= 1u << bucket.secondLevel;
+    _freeRangeCount++;
+}
+
+void Tlsf::removeFree(uint32_t index)
+{
+    Block& block = _blocks[index];
+
+    Bucket bucket = bucketFor(block.size);
+    uint32_t& head = _freeLists[bucket.firstLevel][bucket.secondLevel];
+    if (block.prevFree != noBlock) {
+        _blocks[block.prevFree].nextFree = block.nextFree;
+    } else {
+        head = block.nextFree;
+    }
+    if (block.nextFree != noBlock) {
+        _blocks[block.nextFree].prevFree = block.prevFree;
+    }
+    block.prevFree = noBlock;
+    block.nextFree = noBlock;
+    block.free = false;
+
+    if (head == noBlock) {
+        _secondLevelBitmaps[bucket.firstLevel] &= ~(1u << bucket.secondLevel);
+        if (_secondLevelBitmaps[bucket.firstLevel] == 0) {
+            _firstLevelBitmap &= ~(uint64_t{1} << bucket.firstLevel);
+        }
+    }
+    _freeRangeCount--;
+}
+
+uint32_t Tlsf::splitOff(uint32_t index, uint64_t size)
+{
+    uint32_t rest = newBlock();
+    Block& block = _blocks[index];
+    Block& restBlock = _blocks[rest];
+
+    restBlock.offset = block.offset + size;
+    restBlock.size = block.size - size;
+    restBlock.prevPhysical = index;
+    restBlock.nextPhysical = block.nextPhysical;
+    if (block.nextPhysical != noBlock) {
+        _blocks[block.nextPhysical].prevPhysical = rest;
+    }
+
+    block.size = size;
+    block.nextPhysical = rest;
+    return rest;
+}
+
+void Tlsf::mergeWithNext(uint32_t index)
+{
+    uint32_t next = _blocks[index].nextPhysical;
+    Block& block = _blocks[index];
+    const Block& nextBlock = _blocks[next];
+
+    block.size += nextBlock.size;
+    block.nextPhysical = nextBlock.nextPhysical;
+    if (nextBlock.nextPhysical != noBlock) {
+        _blocks[nextBlock.nextPhysical].prevPhysical = index;
+    }
+
+    _unusedBlocks.push_back(next);
+}
+
+} // namespace rr
@@ -0,0 +1,227 @@
+#include <uniform_ring.hpp>
+
+#include <error.hpp>
+
+#include <algorithm>
+#include <utility>
+
+namespace rr {
+
+namespace {
+
+vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+UniformRing::UniformRing(
+    const vk::raii::PhysicalDevice& physicalDevice,
+    const vk::raii::Device& device,
+    MemoryAllocator& allocator,
+    uint32_t frameContextCount,
+    UniformRingOptions options)
+    : _device(&device)
+    , _allocator(&allocator)
+    , _options(options)
+    , _frames(frameContextCount)
+{
+    if (frameContextCount == 0) {
+        throw Error{} << "uniform ring needs a frame context";
+    }
+
+    auto limits = physicalDevice.getProperties().limits;
+    _alignment = std::max<vk::DeviceSize>(
+        limits.minUniformBufferOffsetAlignment, 1);
+    _options.maxAllocationSize = std::min(
+        _options.maxAllocationSize, limits.maxUniformBufferRange);
+    _options.capacity = alignUp(
+        std::max<vk::DeviceSize>(
+            _options.capacity, _options.maxAllocationSize),
+        _alignment);
+
+    auto binding = vk::DescriptorSetLayoutBinding{
+        .binding = 0,
+        .descriptorType = vk::DescriptorType::eUniformBufferDynamic,
+        .descriptorCount = 1,
+        .stageFlags = vk::ShaderStageFlagBits::eAll,
+        .pImmutableSamplers = nullptr,
+    };
+    _setLayout = device.createDescriptorSetLayout(
+        vk::DescriptorSetLayoutCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::DescriptorSetLayoutCreateFlags{},
+            .bindingCount = 1,
+            .pBindings = &binding,
+        });
+
+    for (FrameContext& frame : _frames) {
+        frame.current = createBuffer(_options.capacity);
+    }
+    _stats.capacity = _options.capacity;
+}
+
+UniformRing::~UniformRing()
+{
+    for (FrameContext& frame : _frames) {
+        destroyBuffer(frame.current);
+        for (Buffer& buffer : frame.retired) {
+            destroyBuffer(buffer);
+        }
+    }
+}
+
+void UniformRing::beginFrame(uint32_t frameContext)
+{
+    _frameContext = frameContext % (uint32_t)_frames.size();
+    FrameContext& frame = _frames[_frameContext];
+    for (Buffer& buffer : frame.retired) {
+        destroyBuffer(buffer);
+    }
+    frame.retired.clear();
+
+    _head = 0;
+    _stats.allocations = 0;
+    _stats.allocatedBytes = 0;
+    _stats.capacity = frame.current.capacity;
+}
+
+UniformAllocation UniformRing::allocate(vk::DeviceSize size)
+{
+    if (size > _options.maxAllocationSize) {
+        throw Error{} << "uniform allocation of " << size <<
+            " bytes exceeds the maximum of " << _options.maxAllocationSize;
+    }
+
+    FrameContext& frame = _frames[_frameContext];
+    if (_head + size > frame.current.capacity) {
+        grow(size);
+    }
+
+    vk::DeviceSize offset = _head;
+    _head = alignUp(_head + size, _alignment);
+    _stats.allocations++;
+    _stats.allocatedBytes += size;
+
+    const Buffer& buffer = frame.current;
+    return UniformAllocation{
+        .data = (char*)buffer.memory.mapped + offset,
+        .buffer = *buffer.buffer,
+        .descriptorSet = buffer.set,
+        .dynamicOffset = (uint32_t)offset,
+    };
+}
+
+vk::DescriptorSetLayout UniformRing::setLayout() const
+{
+    return *_setLayout;
+}
+
+vk::DeviceSize UniformRing::alignment() const
+{
+    return _alignment;
+}
+
+UniformRingStats UniformRing::stats() const
+{
+    return _stats;
+}
+
+// Every offset below capacity can be bound with the full descriptor range,
+// so the buffer extends one range past it.
+UniformRing::Buffer UniformRing::createBuffer(vk::DeviceSize capacity) const
+{
+    auto buffer = Buffer{};
+    buffer.capacity = capacity;
+    buffer.buffer = _device->createBuffer(vk::BufferCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::BufferCreateFlags{},
+        .size = capacity + _options.maxAllocationSize,
+        .usage = vk::BufferUsageFlagBits::eUniformBuffer,
+        .sharingMode = vk::SharingMode::eExclusive,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = nullptr,
+    });
+    // Coherent memory needs no flush, which keeps allocation free of Vulkan
+    // calls; device-local host-visible memory (resizable BAR) is preferred
+    // where the device has it.
+    buffer.memory = _allocator->allocateForBuffer(
+        *buffer.buffer,
+        vk::MemoryPropertyFlagBits::eHostVisible |
+            vk::MemoryPropertyFlagBits::eHostCoherent,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    auto poolSize = vk::DescriptorPoolSize{
+        .type = vk::DescriptorType::eUniformBufferDynamic,
+        .descriptorCount = 1,
+    };
+    buffer.pool = _device->createDescriptorPool(vk::DescriptorPoolCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::DescriptorPoolCreateFlags{},
+        .maxSets = 1,
+        .poolSizeCount = 1,
+        .pPoolSizes = &poolSize,
+    });
+    vk::DescriptorSetLayout setLayout = *_setLayout;
+    auto allocateInfo = vk::DescriptorSetAllocateInfo{
+        .pNext = nullptr,
+        .descriptorPool = *buffer.pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &setLayout,
+    };
+    vk::Result result = (**_device).allocateDescriptorSets(
+        &allocateInfo, &buffer.set);
+    if (result != vk::Result::eSuccess) {
+        throw Error{} << "uniform ring descriptor set allocation failed: " <<
+            vk::to_string(result);
+    }
+
+    auto bufferInfo = vk::DescriptorBufferInfo{
+        .buffer = *buffer.buffer,
+        .offset = 0,
+        .range = _options.maxAllocationSize,
+    };
+    _device->updateDescriptorSets(
+        vk::WriteDescriptorSet{
+            .pNext = nullptr,
+            .dstSet = buffer.set,
+            .dstBinding = 0,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = vk::DescriptorType::eUniformBufferDynamic,
+            .pImageInfo = nullptr,
+            .pBufferInfo = &bufferInfo,
+            .pTexelBufferView = nullptr,
+        },
+        {});
+    return buffer;
+}
+
+void UniformRing::destroyBuffer(Buffer& buffer) const
+{
+    // The set is freed with its pool.
+    buffer.pool.clear();
+    buffer.buffer.clear();
+    _allocator->free(buffer.memory);
+    buffer.memory = MemoryAllocation{};
+}
+
+// Allocations made so far this frame stay valid in the old buffer, which
+// command buffers of the frame may already reference.
+void UniformRing::grow(vk::DeviceSize size)
+{
+    FrameContext& frame = _frames[_frameContext];
+    vk::DeviceSize capacity = frame.current.capacity * 2;
+    while (capacity < size) {
+        capacity *= 2;
+    }
+
+    frame.retired.push_back(std::move(frame.current));
+    frame.current = createBuffer(capacity);
+    _head = 0;
+    _stats.growths++;
+    _stats.capacity = capacity;
+}
+
+} // namespace rr
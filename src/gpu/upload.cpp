@@ -0,0 +1,432 @@
+#include <upload.hpp>
+
+#include <error.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace rr {
+
+namespace {
+
+vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+std::optional<uint32_t> findTransferQueueFamily(
+    const vk::raii::PhysicalDevice& physicalDevice)
+{
+    auto queueFamilyProperties = physicalDevice.getQueueFamilyProperties();
+    for (uint32_t i = 0; i < queueFamilyProperties.size(); i++) {
+        vk::QueueFlags flags = queueFamilyProperties[i].queueFlags;
+        if ((flags & vk::QueueFlagBits::eTransfer) &&
+                !(flags & vk::QueueFlagBits::eGraphics) &&
+                !(flags & vk::QueueFlagBits::eCompute)) {
+            return i;
+        }
+    }
+    return std::nullopt;
+}
+
+void UploadSubmission::recordAcquire(vk::CommandBuffer commandBuffer) const
+{
+    if (bufferBarriers.empty() && imageBarriers.empty()) {
+        return;
+    }
+
+    // The source stages match the timeline wait, which chains the acquire
+    // after the release on the transfer queue.
+    commandBuffer.pipelineBarrier(
+        waitStage,
+        waitStage,
+        vk::DependencyFlags{},
+        {},
+        bufferBarriers,
+        imageBarriers);
+}
+
+TimelineWait UploadSubmission::wait() const
+{
+    return TimelineWait{.point = point, .stages = waitStage};
+}
+
+UploadService::UploadService(
+    const vk::raii::PhysicalDevice& physicalDevice,
+    const vk::raii::Device& device,
+    MemoryAllocator& allocator,
+    TimelineSync& sync,
+    UploadServiceOptions options)
+    : _device(&device)
+    , _allocator(&allocator)
+    , _sync(&sync)
+    , _options(options)
+{
+    if (!_sync->queue(_options.transferQueue)) {
+        throw Error{} << "upload service needs a transfer queue";
+    }
+
+    // 16 bytes covers the texel (or block) size of every format, and is a
+    // multiple of the 4 bytes required for depth/stencil copies.
+    _copyAlignment = std::max<vk::DeviceSize>(
+        physicalDevice.getProperties().limits.optimalBufferCopyOffsetAlignment,
+        16);
+
+    auto bufferInfo = vk::BufferCreateInfo{
+        .pNext = nullptr,
+        .flags = vk::BufferCreateFlags{},
+        .size = _options.stagingSize,
+        .usage = vk::BufferUsageFlagBits::eTransferSrc,
+        .sharingMode = vk::SharingMode::eExclusive,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = nullptr,
+    };
+    _staging = device.createBuffer(bufferInfo);
+    _stagingMemory = allocator.allocateForBuffer(
+        *_staging,
+        vk::MemoryPropertyFlagBits::eHostVisible,
+        vk::MemoryPropertyFlagBits::eHostCoherent);
+}
+
+UploadService::~UploadService()
+{
+    if (!_inFlight.empty()) {
+        _sync->wait(_inFlight.back()->point);
+    }
+    _staging.clear();
+    _allocator->free(_stagingMemory);
+}
+
+void UploadService::uploadBuffer(
+    vk::Buffer buffer,
+    vk::DeviceSize offset,
+    std::span<const std::byte> data,
+    vk::AccessFlags dstAccess,
+    vk::PipelineStageFlags dstStage)
+{
+    if (data.empty()) {
+        return;
+    }
+
+    // Split large uploads so that the transfer queue can start on the first
+    // chunks while later ones are still being written.
+    vk::DeviceSize chunkSize = std::max<vk::DeviceSize>(
+        _options.stagingSize / 4, _copyAlignment);
+
+    for (vk::DeviceSize done = 0; done < data.size(); ) {
+        vk::DeviceSize size = std::min(chunkSize, data.size() - done);
+        vk::DeviceSize stagingOffset = allocateStaging(size);
+        std::memcpy(
+            (std::byte*)_stagingMemory.mapped + stagingOffset,
+            data.data() + done,
+            size);
+
+        auto region = vk::BufferCopy{
+            .srcOffset = stagingOffset,
+            .dstOffset = offset + done,
+            .size = size,
+        };
+        currentBatch().commandBuffer.copyBuffer(*_staging, buffer, region);
+
+        done += size;
+        _stats.copies++;
+    }
+    _stats.bytes += data.size();
+    _waitStages |= dstStage;
+
+    // On a shared family the timeline wait alone makes the writes visible.
+    if (!dedicatedTransferQueue()) {
+        return;
+    }
+
+    auto barrier = vk::BufferMemoryBarrier{
+        .pNext = nullptr,
+        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask = vk::AccessFlags{},
+        .srcQueueFamilyIndex = _options.transferQueueFamily,
+        .dstQueueFamilyIndex = _options.graphicsQueueFamily,
+        .buffer = buffer,
+        .offset = offset,
+        .size = data.size(),
+    };
+    _releaseBuffers.push_back(barrier);
+
+    barrier.srcAccessMask = vk::AccessFlags{};
+    barrier.dstAccessMask = dstAccess;
+    _acquireBuffers.push_back(barrier);
+}
+
+void UploadService::uploadImage(
+    vk::Image image,
+    const vk::ImageSubresourceLayers& subresource,
+    vk::Extent3D extent,
+    std::span<const std::byte> data,
+    vk::ImageLayout oldLayout,
+    vk::ImageLayout finalLayout,
+    vk::AccessFlags dstAccess,
+    vk::PipelineStageFlags dstStage)
+{
+    if (data.size() > _options.stagingSize) {
+        throw Error{} << "image upload of " << data.size() <<
+            " bytes does not fit in the staging ring";
+    }
+
+    vk::DeviceSize stagingOffset = allocateStaging(data.size());
+    std::memcpy(
+        (std::byte*)_stagingMemory.mapped + stagingOffset,
+        data.data(),
+        data.size());
+
+    auto range = vk::ImageSubresourceRange{
+        .aspectMask = subresource.aspectMask,
+        .baseMipLevel = subresource.mipLevel,
+        .levelCount = 1,
+        .baseArrayLayer = subresource.baseArrayLayer,
+        .layerCount = subresource.layerCount,
+    };
+
+    vk::CommandBuffer commandBuffer = *currentBatch().commandBuffer;
+
+    auto toTransfer = vk::ImageMemoryBarrier{
+        .pNext = nullptr,
+        .srcAccessMask = vk::AccessFlags{},
+        .dstAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .oldLayout = oldLayout,
+        .newLayout = vk::ImageLayout::eTransferDstOptimal,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .image = image,
+        .subresourceRange = range,
+    };
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTopOfPipe,
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags{},
+        {},
+        {},
+        toTransfer);
+
+    // Transfer-only families may have a coarse minImageTransferGranularity,
+    // but whole mip levels are always allowed.
+    auto region = vk::BufferImageCopy{
+        .bufferOffset = stagingOffset,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = subresource,
+        .imageOffset = vk::Offset3D{0, 0, 0},
+        .imageExtent = extent,
+    };
+    commandBuffer.copyBufferToImage(
+        *_staging, image, vk::ImageLayout::eTransferDstOptimal, region);
+
+    _stats.bytes += data.size();
+    _stats.copies++;
+    _waitStages |= dstStage;
+
+    // The final layout transition doubles as the release. On a shared family
+    // it is a plain transition, and the timeline wait covers visibility.
+    bool dedicated = dedicatedTransferQueue();
+    auto barrier = vk::ImageMemoryBarrier{
+        .pNext = nullptr,
+        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask = vk::AccessFlags{},
+        .oldLayout = vk::ImageLayout::eTransferDstOptimal,
+        .newLayout = finalLayout,
+        .srcQueueFamilyIndex = dedicated ?
+            _options.transferQueueFamily : vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = dedicated ?
+            _options.graphicsQueueFamily : vk::QueueFamilyIgnored,
+        .image = image,
+        .subresourceRange = range,
+    };
+    _releaseImages.push_back(barrier);
+
+    if (dedicated) {
+        barrier.srcAccessMask = vk::AccessFlags{};
+        barrier.dstAccessMask = dstAccess;
+        _acquireImages.push_back(barrier);
+    }
+}
+
+std::optional<UploadSubmission> UploadService::flush()
+{
+    if (!_current && !_unflushedSubmissions) {
+        return std::nullopt;
+    }
+
+    // Batches submitted early are covered by the latest point, since timeline
+    // values on a queue complete in order.
+    if (_current) {
+        submit();
+    }
+    _unflushedSubmissions = false;
+
+    auto submission = UploadSubmission{
+        .point = _inFlight.back()->point,
+        .waitStage = _waitStages ?
+            _waitStages : vk::PipelineStageFlagBits::eTopOfPipe,
+        .bufferBarriers = std::move(_acquireBuffers),
+        .imageBarriers = std::move(_acquireImages),
+    };
+    _acquireBuffers.clear();
+    _acquireImages.clear();
+    _waitStages = vk::PipelineStageFlags{};
+    return submission;
+}
+
+void UploadService::collect()
+{
+    while (!_inFlight.empty() && _sync->completed(_inFlight.front()->point)) {
+        releaseStaging(*_inFlight.front());
+        _freeBatches.push_back(std::move(_inFlight.front()));
+        _inFlight.pop_front();
+    }
+}
+
+bool UploadService::dedicatedTransferQueue() const
+{
+    return _options.transferQueueFamily != _options.graphicsQueueFamily;
+}
+
+UploadStats UploadService::stats() const
+{
+    return _stats;
+}
+
+UploadService::Batch& UploadService::currentBatch()
+{
+    if (_current) {
+        return *_current;
+    }
+
+    if (!_freeBatches.empty()) {
+        _current = std::move(_freeBatches.back());
+        _freeBatches.pop_back();
+        _current->pool.reset();
+    } else {
+        _current = std::make_unique<Batch>();
+
+        auto poolInfo = vk::CommandPoolCreateInfo{
+            .pNext = nullptr,
+            .flags = vk::CommandPoolCreateFlagBits::eTransient,
+            .queueFamilyIndex = _options.transferQueueFamily,
+        };
+        _current->pool = _device->createCommandPool(poolInfo);
+
+        auto commandBufferInfo = vk::CommandBufferAllocateInfo{
+            .pNext = nullptr,
+            .commandPool = _current->pool,
+            .level = vk::CommandBufferLevel::ePrimary,
+            .commandBufferCount = 1,
+        };
+        _current->commandBuffer = std::move(
+            _device->allocateCommandBuffers(commandBufferInfo).front());
+    }
+
+    _current->commandBuffer.begin(vk::CommandBufferBeginInfo{
+        .pNext = nullptr,
+        .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+        .pInheritanceInfo = nullptr,
+    });
+    return *_current;
+}
+
+vk::DeviceSize UploadService::allocateStaging(vk::DeviceSize size)
+{
+    vk::DeviceSize capacity = _options.stagingSize;
+
+    for (;;) {
+        vk::DeviceSize offset = alignUp(_head, _copyAlignment);
+        vk::DeviceSize reserved = 0;
+
+        if (_used == 0 || _head > _tail) {
+            // Free space is [head, capacity) followed by [0, tail).
+            if (offset + size <= capacity) {
+                reserved = offset + size - _head;
+            } else if (size <= _tail) {
+                reserved = capacity - _head + size;
+                offset = 0;
+            }
+        } else if (_head < _tail && offset + size <= _tail) {
+            reserved = offset + size - _head;
+        }
+
+        if (reserved > 0) {
+            _head = offset + size;
+            _used += reserved;
+            _pendingBytes += reserved;
+            return offset;
+        }
+
+        // Out of space: wait for the oldest copies to finish, or, if all the
+        // space belongs to the batch being recorded, submit it first.
+        if (!waitForStaging()) {
+            if (!_current) {
+                throw Error{} << "upload of " << size <<
+                    " bytes does not fit in the staging ring";
+            }
+            submit();
+            _unflushedSubmissions = true;
+        }
+    }
+}
+
+void UploadService::releaseStaging(Batch& batch)
+{
+    _tail = batch.stagingEnd;
+    _used -= batch.stagingBytes;
+    if (_used == 0) {
+        _head = 0;
+        _tail = 0;
+    }
+}
+
+bool UploadService::waitForStaging()
+{
+    if (_inFlight.empty()) {
+        return false;
+    }
+    _stats.stalls++;
+    _sync->wait(_inFlight.front()->point);
+    collect();
+    return true;
+}
+
+void UploadService::submit()
+{
+    Batch& batch = *_current;
+
+    if (!_releaseBuffers.empty() || !_releaseImages.empty()) {
+        batch.commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eBottomOfPipe,
+            vk::DependencyFlags{},
+            {},
+            _releaseBuffers,
+            _releaseImages);
+        _releaseBuffers.clear();
+        _releaseImages.clear();
+    }
+    batch.commandBuffer.end();
+
+    _allocator->flush(_stagingMemory);
+
+    vk::CommandBuffer commandBuffer = *batch.commandBuffer;
+    batch.point = _sync->submit(_options.transferQueue, TimelineSubmitInfo{
+        .commandBuffers = std::span{&commandBuffer, 1},
+        .waits = {},
+        .binaryWaits = {},
+        .binarySignals = {},
+    });
+    _stats.submissions++;
+
+    batch.stagingEnd = _head;
+    batch.stagingBytes = _pendingBytes;
+    _pendingBytes = 0;
+
+    _inFlight.push_back(std::move(_current));
+}
+
+} // namespace rr
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <work_stealing_deque.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rr {
+
+// Counts the unfinished jobs spawned against it. A job may spawn children on
+// the counter it runs under (or on a counter of its own and wait for it), so
+// waiting on a parent counter waits for the whole tree of jobs. The first
+// exception thrown by any of the jobs is rethrown from JobSystem::wait.
+class JobCounter {
+public:
+    JobCounter() = default;
+    JobCounter(const JobCounter&) = delete;
+    JobCounter& operator=(const JobCounter&) = delete;
+
+    bool done() const;
+
+private:
+    friend class JobSystem;
+
+    std::atomic<uint32_t> _pending = 0;
+    std::mutex _errorMutex;
+    std::exception_ptr _error;
+};
+
+// Work-stealing job scheduler.
+//
+// Every thread, including the thread that creates the system (thread 0,
+// called the main thread), owns a Chase-Lev deque. Jobs spawned from a
+// thread go to its own deque; idle threads steal from the others. Jobs that
+// must run on the main thread (window and surface work, for example) go to
+// a separate queue that only the main thread drains.
+//
+// Waiting on a counter never blocks a thread: it keeps running other jobs
+// until the counter drops to zero.
+class JobSystem {
+public:
+    static constexpr uint32_t noThread = std::numeric_limits<uint32_t>::max();
+
+    // threadCount includes the main thread; 0 means one thread per core.
+    explicit JobSystem(uint32_t threadCount = 0);
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    void spawn(JobCounter& counter, std::function<void()> job);
+    void spawnOnMainThread(JobCounter& counter, std::function<void()> job);
+
+    // Runs jobs until the counter reaches zero.
+    void wait(JobCounter& counter);
+
+    // Runs pending main-thread jobs. Must be called from the main thread.
+    void runMainThreadJobs();
+
+    // Calls body(chunkBegin, chunkEnd) for consecutive chunks of at most
+    // grain items covering [begin, end), in parallel, and waits for all of
+    // them. A grain of 0 picks one that gives each thread a few chunks.
+    void parallelFor(
+        uint32_t begin,
+        uint32_t end,
+        uint32_t grain,
+        const std::function<void(uint32_t, uint32_t)>& body);
+
+    uint32_t threadCount() const;
+
+    // Index of the calling thread within its job system, in
+    // [0, threadCount()), or noThread for threads not owned by any system.
+    // Use it to index per-thread resources.
+    static uint32_t currentThreadIndex();
+
+private:
+    struct Job {
+        std::function<void()> function;
+        JobCounter* counter = nullptr;
+    };
+
+    struct alignas(64) Worker {
+        WorkStealingDeque<Job> deque;
+        uint32_t stealSeed = 0;
+    };
+
+    void push(Job* job);
+    Job* findJob(uint32_t threadIndex);
+    Job* popMainThreadJob();
+    void execute(Job* job);
+    void workerLoop(uint32_t threadIndex);
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<std::thread> _threads;
+
+    // Jobs spawned from threads outside the system.
+    std::mutex _injectedMutex;
+    std::deque<Job*> _injected;
+
+    std::mutex _mainThreadMutex;
+    std::deque<Job*> _mainThreadJobs;
+
+    // Bumped whenever work is published, so sleeping workers can wait on it
+    // without missing a wake-up.
+    std::atomic<uint64_t> _workEpoch = 0;
+    std::atomic<uint32_t> _sleepers = 0;
+    std::atomic<bool> _stop = false;
+};
+
+} // namespace rr
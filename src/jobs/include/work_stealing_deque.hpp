@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace rr {
+
+// Chase-Lev work-stealing deque, following "Correct and Efficient
+// Work-Stealing for Weak Memory Models" (Le et al., 2013).
+//
+// The owning thread pushes and pops at the bottom; any other thread may
+// steal from the top. The buffer grows when full. Old buffers are kept until
+// the deque is destroyed, since a concurrent thief may still be reading them.
+template <class T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(int64_t capacity = 1024)
+    {
+        _buffers.push_back(std::make_unique<Buffer>(capacity));
+        _buffer.store(_buffers.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Owner only.
+    void push(T* item)
+    {
+        int64_t bottom = _bottom.load(std::memory_order_relaxed);
+        int64_t top = _top.load(std::memory_order_acquire);
+        Buffer* buffer = _buffer.load(std::memory_order_relaxed);
+        if (bottom - top > buffer->capacity - 1) {
+            buffer = grow(buffer, top, bottom);
+        }
+        buffer->put(bottom, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        _bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only.
+    T* pop()
+    {
+        int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+        Buffer* buffer = _buffer.load(std::memory_order_relaxed);
+        _bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = _top.load(std::memory_order_relaxed);
+
+        if (top > bottom) {
+            _bottom.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        T* item = buffer->get(bottom);
+        if (top == bottom) {
+            // Last item: race against thieves for it.
+            if (!_top.compare_exchange_strong(
+                    top,
+                    top + 1,
+                    std::memory_order_seq_cst,
+                    std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            _bottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread.
+    T* steal()
+    {
+        int64_t top = _top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom = _bottom.load(std::memory_order_acquire);
+        if (top >= bottom) {
+            return nullptr;
+        }
+
+        Buffer* buffer = _buffer.load(std::memory_order_acquire);
+        T* item = buffer->get(top);
+        if (!_top.compare_exchange_strong(
+                top,
+                top + 1,
+                std::memory_order_seq_cst,
+                std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    bool empty() const
+    {
+        return _top.load(std::memory_order_relaxed) >=
+            _bottom.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Buffer {
+        explicit Buffer(int64_t capacity)
+            : capacity(capacity)
+            , mask(capacity - 1)
+            , items(std::make_unique<std::atomic<T*>[]>(capacity))
+        { }
+
+        T* get(int64_t i) const
+        {
+            return items[i & mask].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, T* item)
+        {
+            items[i & mask].store(item, std::memory_order_relaxed);
+        }
+
+        int64_t capacity;
+        int64_t mask;
+        std::unique_ptr<std::atomic<T*>[]> items;
+    };
+
+    Buffer* grow(Buffer* buffer, int64_t top, int64_t bottom)
+    {
+        auto bigger = std::make_unique<Buffer>(buffer->capacity * 2);
+        for (int64_t i = top; i < bottom; i++) {
+            bigger->put(i, buffer->get(i));
+        }
+        _buffers.push_back(std::move(bigger));
+        _buffer.store(_buffers.back().get(), std::memory_order_release);
+        return _buffers.back().get();
+    }
+
+    alignas(64) std::atomic<int64_t> _top = 0;
+    alignas(64) std::atomic<int64_t> _bottom = 0;
+    alignas(64) std::atomic<Buffer*> _buffer = nullptr;
+    std::vector<std::unique_ptr<Buffer>> _buffers;
+};
+
+} // namespace rr
@@ -0,0 +1,269 @@
+#include <jobs.hpp>
+
+#include <error.hpp>
+
+#include <algorithm>
+#include <utility>
+
+namespace rr {
+
+namespace {
+
+thread_local const JobSystem* currentSystem = nullptr;
+thread_local uint32_t currentIndex = JobSystem::noThread;
+
+// Spins this many rounds without finding work before going to sleep.
+constexpr int idleSpins = 64;
+
+uint32_t xorshift(uint32_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+} // namespace
+
+bool JobCounter::done() const
+{
+    return _pending.load(std::memory_order_acquire) == 0;
+}
+
+JobSystem::JobSystem(uint32_t threadCount)
+{
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    _workers.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; i++) {
+        _workers.push_back(std::make_unique<Worker>());
+        _workers.back()->stealSeed = 0x9e3779b9u * (i + 1);
+    }
+
+    currentSystem = this;
+    currentIndex = 0;
+
+    _threads.reserve(threadCount - 1);
+    for (uint32_t i = 1; i < threadCount; i++) {
+        _threads.emplace_back([this, i] { workerLoop(i); });
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    _stop.store(true);
+    _workEpoch.fetch_add(1);
+    _workEpoch.notify_all();
+    for (auto& thread : _threads) {
+        thread.join();
+    }
+
+    if (currentSystem == this) {
+        currentSystem = nullptr;
+        currentIndex = noThread;
+    }
+
+    for (auto& worker : _workers) {
+        while (Job* job = worker->deque.pop()) {
+            delete job;
+        }
+    }
+    for (Job* job : _injected) {
+        delete job;
+    }
+    for (Job* job : _mainThreadJobs) {
+        delete job;
+    }
+}
+
+void JobSystem::spawn(JobCounter& counter, std::function<void()> job)
+{
+    counter._pending.fetch_add(1, std::memory_order_relaxed);
+    push(new Job{.function = std::move(job), .counter = &counter});
+}
+
+void JobSystem::spawnOnMainThread(JobCounter& counter, std::function<void()> job)
+{
+    counter._pending.fetch_add(1, std::memory_order_relaxed);
+    auto lock = std::lock_guard{_mainThreadMutex};
+    _mainThreadJobs.push_back(
+        new Job{.function = std::move(job), .counter = &counter});
+}
+
+void JobSystem::wait(JobCounter& counter)
+{
+    uint32_t threadIndex = currentSystem == this ? currentIndex : noThread;
+    while (!counter.done()) {
+        Job* job = nullptr;
+        if (threadIndex == 0) {
+            job = popMainThreadJob();
+        }
+        if (!job && threadIndex != noThread) {
+            job = findJob(threadIndex);
+        }
+
+        if (job) {
+            execute(job);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    auto lock = std::lock_guard{counter._errorMutex};
+    if (auto error = std::exchange(counter._error, nullptr)) {
+        std::rethrow_exception(error);
+    }
+}
+
+void JobSystem::runMainThreadJobs()
+{
+    if (currentSystem != this || currentIndex != 0) {
+        throw Error{} << "main thread jobs run on a non-main thread";
+    }
+    while (Job* job = popMainThreadJob()) {
+        execute(job);
+    }
+}
+
+void JobSystem::parallelFor(
+    uint32_t begin,
+    uint32_t end,
+    uint32_t grain,
+    const std::function<void(uint32_t, uint32_t)>& body)
+{
+    if (begin >= end) {
+        return;
+    }
+
+    uint32_t count = end - begin;
+    if (grain == 0) {
+        grain = std::max(1u, count / (threadCount() * 4));
+    }
+    if (count <= grain) {
+        body(begin, end);
+        return;
+    }
+
+    auto counter = JobCounter{};
+    for (uint32_t chunkBegin = begin; chunkBegin < end; ) {
+        uint32_t chunkEnd = chunkBegin + std::min(grain, end - chunkBegin);
+        spawn(counter, [&body, chunkBegin, chunkEnd] {
+            body(chunkBegin, chunkEnd);
+        });
+        chunkBegin = chunkEnd;
+    }
+    wait(counter);
+}
+
+uint32_t JobSystem::threadCount() const
+{
+    return (uint32_t)_workers.size();
+}
+
+uint32_t JobSystem::currentThreadIndex()
+{
+    return currentIndex;
+}
+
+void JobSystem::push(Job* job)
+{
+    if (currentSystem == this) {
+        _workers.at(currentIndex)->deque.push(job);
+    } else {
+        auto lock = std::lock_guard{_injectedMutex};
+        _injected.push_back(job);
+    }
+
+    _workEpoch.fetch_add(1, std::memory_order_release);
+    if (_sleepers.load(std::memory_order_acquire) > 0) {
+        _workEpoch.notify_one();
+    }
+}
+
+JobSystem::Job* JobSystem::findJob(uint32_t threadIndex)
+{
+    Worker& self = *_workers.at(threadIndex);
+    if (Job* job = self.deque.pop()) {
+        return job;
+    }
+
+    auto workerCount = (uint32_t)_workers.size();
+    uint32_t start = xorshift(self.stealSeed) % workerCount;
+    for (uint32_t i = 0; i < workerCount; i++) {
+        uint32_t victim = (start + i) % workerCount;
+        if (victim == threadIndex) {
+            continue;
+        }
+        if (Job* job = _workers.at(victim)->deque.steal()) {
+            return job;
+        }
+    }
+
+    auto lock = std::lock_guard{_injectedMutex};
+    if (!_injected.empty()) {
+        Job* job = _injected.front();
+        _injected.pop_front();
+        return job;
+    }
+    return nullptr;
+}
+
+JobSystem::Job* JobSystem::popMainThreadJob()
+{
+    auto lock = std::lock_guard{_mainThreadMutex};
+    if (_mainThreadJobs.empty()) {
+        return nullptr;
+    }
+    Job* job = _mainThreadJobs.front();
+    _mainThreadJobs.pop_front();
+    return job;
+}
+
+void JobSystem::execute(Job* job)
+{
+    try {
+        job->function();
+    } catch (...) {
+        auto lock = std::lock_guard{job->counter->_errorMutex};
+        if (!job->counter->_error) {
+            job->counter->_error = std::current_exception();
+        }
+    }
+    // Release the job before signalling, so that the counter's owner may
+    // destroy anything the job captured as soon as it sees zero.
+    JobCounter* counter = job->counter;
+    delete job;
+    counter->_pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void JobSystem::workerLoop(uint32_t threadIndex)
+{
+    currentSystem = this;
+    currentIndex = threadIndex;
+
+    int spins = 0;
+    while (!_stop.load(std::memory_order_relaxed)) {
+        uint64_t epoch = _workEpoch.load(std::memory_order_acquire);
+        if (Job* job = findJob(threadIndex)) {
+            execute(job);
+            spins = 0;
+            continue;
+        }
+
+        if (++spins < idleSpins) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Nothing was found after reading the epoch; any job published since
+        // then changes it, so this cannot miss a wake-up.
+        _sleepers.fetch_add(1, std::memory_order_acq_rel);
+        _workEpoch.wait(epoch, std::memory_order_acquire);
+        _sleepers.fetch_sub(1, std::memory_order_acq_rel);
+        spins = 0;
+    }
+}
+
+} // namespace rr
@@ -0,0 +1,392 @@
+#include <math_batch.hpp>
+
+#include "kernels.hpp"
+
+#include <error.hpp>
+
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <new>
+
+#if defined(RR_MATH_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace rr {
+
+namespace {
+
+constexpr size_t alignment = 32;
+constexpr size_t padding = alignment / sizeof(float);
+
+// -1 until detected or set.
+std::atomic<int> currentLevel = -1;
+
+#ifdef RR_MATH_X86
+
+bool cpuSupportsAvx2()
+{
+#ifdef _MSC_VER
+    int info[4] {};
+    __cpuid(info, 1);
+    bool fma = (info[2] & (1 << 12)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!fma || !osxsave || !avx) {
+        return false;
+    }
+    // The OS must save the YMM registers on context switches.
+    if ((_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    // Checks the OS support for the YMM registers too.
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+#endif
+
+const BatchKernels& kernelsFor(SimdLevel level)
+{
+    switch (level) {
+#ifdef RR_MATH_X86
+    case SimdLevel::Avx2:
+        return avx2Kernels();
+    case SimdLevel::Sse:
+        return sseKernels();
+#endif
+    default:
+        return scalarKernels();
+    }
+}
+
+// Runs the kernel over the whole registers of begin to end at the current
+// level and the scalar kernel over the rest. args are the kernel's
+// arguments before begin and end.
+template<typename Kernel, typename... Args>
+void run(
+    Kernel BatchKernels::*kernel, size_t begin, size_t end, Args&&... args)
+{
+    const BatchKernels& vector = kernelsFor(simdLevel());
+    size_t split = begin + (end - begin) / vector.width * vector.width;
+    if (split > begin) {
+        (vector.*kernel)(args..., begin, split);
+    }
+    if (end > split) {
+        (scalarKernels().*kernel)(args..., split, end);
+    }
+}
+
+Aabb emptyBounds()
+{
+    float inf = std::numeric_limits<float>::infinity();
+    return Aabb{
+        .min = Vec3{inf, inf, inf},
+        .max = Vec3{-inf, -inf, -inf},
+    };
+}
+
+Vec3Soa vec3Soa(const SoaStorage& storage, uint32_t first)
+{
+    return Vec3Soa{
+        .x = storage.array(first),
+        .y = storage.array(first + 1),
+        .z = storage.array(first + 2),
+    };
+}
+
+} // namespace
+
+const char* toString(SimdLevel level)
+{
+    switch (level) {
+    case SimdLevel::Scalar:
+        return "scalar";
+    case SimdLevel::Sse:
+        return "sse";
+    case SimdLevel::Avx2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+SimdLevel detectSimdLevel()
+{
+#ifdef RR_MATH_X86
+    static const SimdLevel level =
+        cpuSupportsAvx2() ? SimdLevel::Avx2 : SimdLevel::Sse;
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel simdLevel()
+{
+    int level = currentLevel.load(std::memory_order_relaxed);
+    if (level < 0) {
+        level = (int)detectSimdLevel();
+        currentLevel.store(level, std::memory_order_relaxed);
+    }
+    return (SimdLevel)level;
+}
+
+void setSimdLevel(SimdLevel level)
+{
+    if (level > detectSimdLevel()) {
+        level = detectSimdLevel();
+    }
+    currentLevel.store((int)level, std::memory_order_relaxed);
+}
+
+void SoaStorage::AlignedDelete::operator()(float* p) const
+{
+    ::operator delete[](p, std::align_val_t{alignment});
+}
+
+SoaStorage::SoaStorage(size_t size, uint32_t arrayCount)
+    : _size(size)
+    , _stride((size + padding - 1) / padding * padding)
+    , _arrayCount(arrayCount)
+{
+    size_t bytes = _stride * arrayCount * sizeof(float);
+    if (bytes > 0) {
+        _data.reset((float*)::operator new[](
+            bytes, std::align_val_t{alignment}));
+        std::memset(_data.get(), 0, bytes);
+    }
+}
+
+size_t SoaStorage::size() const
+{
+    return _size;
+}
+
+float* SoaStorage::array(uint32_t index) const
+{
+    if (index >= _arrayCount) {
+        throw Error{} << "SoA array " << index << " out of " << _arrayCount;
+    }
+    return _data.get() + index * _stride;
+}
+
+Mat4Batch::Mat4Batch(size_t size)
+    : _storage(size, 16)
+{
+    for (uint32_t k = 0; k < 16; k++) {
+        _soa.m[k] = _storage.array(k);
+    }
+}
+
+size_t Mat4Batch::size() const
+{
+    return _storage.size();
+}
+
+const Mat4Soa& Mat4Batch::soa() const
+{
+    return _soa;
+}
+
+Mat4 Mat4Batch::get(size_t index) const
+{
+    auto value = Mat4{};
+    for (int k = 0; k < 16; k++) {
+        value.m[k] = _soa.m[k][index];
+    }
+    return value;
+}
+
+void Mat4Batch::set(size_t index, const Mat4& value)
+{
+    for (int k = 0; k < 16; k++) {
+        _soa.m[k][index] = value.m[k];
+    }
+}
+
+TransformBatch::TransformBatch(size_t size)
+    : _storage(size, 10)
+{
+    _soa = TransformSoa{
+        .translation = vec3Soa(_storage, 0),
+        .rotation = QuatSoa{
+            .x = _storage.array(3),
+            .y = _storage.array(4),
+            .z = _storage.array(5),
+            .w = _storage.array(6),
+        },
+        .scale = vec3Soa(_storage, 7),
+    };
+    for (size_t i = 0; i < size; i++) {
+        set(i, Vec3{}, Quat{}, Vec3{1.f, 1.f, 1.f});
+    }
+}
+
+size_t TransformBatch::size() const
+{
+    return _storage.size();
+}
+
+const TransformSoa& TransformBatch::soa() const
+{
+    return _soa;
+}
+
+void TransformBatch::set(
+    size_t index, Vec3 translation, Quat rotation, Vec3 scale)
+{
+    _soa.translation.x[index] = translation.x;
+    _soa.translation.y[index] = translation.y;
+    _soa.translation.z[index] = translation.z;
+    _soa.rotation.x[index] = rotation.x;
+    _soa.rotation.y[index] = rotation.y;
+    _soa.rotation.z[index] = rotation.z;
+    _soa.rotation.w[index] = rotation.w;
+    _soa.scale.x[index] = scale.x;
+    _soa.scale.y[index] = scale.y;
+    _soa.scale.z[index] = scale.z;
+}
+
+Vec3Batch::Vec3Batch(size_t size)
+    : _storage(size, 3)
+    , _soa(vec3Soa(_storage, 0))
+{
+}
+
+size_t Vec3Batch::size() const
+{
+    return _storage.size();
+}
+
+const Vec3Soa& Vec3Batch::soa() const
+{
+    return _soa;
+}
+
+Vec3 Vec3Batch::get(size_t index) const
+{
+    return Vec3{_soa.x[index], _soa.y[index], _soa.z[index]};
+}
+
+void Vec3Batch::set(size_t index, Vec3 value)
+{
+    _soa.x[index] = value.x;
+    _soa.y[index] = value.y;
+    _soa.z[index] = value.z;
+}
+
+AabbBatch::AabbBatch(size_t size)
+    : _storage(size, 6)
+    , _soa(AabbSoa{
+        .min = vec3Soa(_storage, 0),
+        .max = vec3Soa(_storage, 3),
+    })
+{
+}
+
+size_t AabbBatch::size() const
+{
+    return _storage.size();
+}
+
+const AabbSoa& AabbBatch::soa() const
+{
+    return _soa;
+}
+
+Aabb AabbBatch::get(size_t index) const
+{
+    return Aabb{
+        .min = Vec3{_soa.min.x[index], _soa.min.y[index], _soa.min.z[index]},
+        .max = Vec3{_soa.max.x[index], _soa.max.y[index], _soa.max.z[index]},
+    };
+}
+
+void AabbBatch::set(size_t index, const Aabb& value)
+{
+    _soa.min.x[index] = value.min.x;
+    _soa.min.y[index] = value.min.y;
+    _soa.min.z[index] = value.min.z;
+    _soa.max.x[index] = value.max.x;
+    _soa.max.y[index] = value.max.y;
+    _soa.max.z[index] = value.max.z;
+}
+
+void composeTransforms(
+    const TransformSoa& transforms, const Mat4Soa& out, size_t count)
+{
+    run(&BatchKernels::composeTransforms, 0, count, transforms, out);
+}
+
+void multiplyMatrices(
+    const Mat4Soa& a, const Mat4Soa& b, const Mat4Soa& out, size_t count)
+{
+    run(&BatchKernels::multiplyMatrices, 0, count, a, b, out);
+}
+
+void transformMatrices(
+    const Mat4& m, const Mat4Soa& in, const Mat4Soa& out, size_t count)
+{
+    run(&BatchKernels::transformMatrices, 0, count, m, in, out);
+}
+
+void composeHierarchy(
+    std::span<const uint32_t> parents,
+    std::span<const uint32_t> levelOffsets,
+    const Mat4Soa& local,
+    const Mat4Soa& world)
+{
+    if (levelOffsets.size() < 2) {
+        return;
+    }
+    for (size_t k = 1; k < levelOffsets.size(); k++) {
+        if (levelOffsets[k] < levelOffsets[k - 1]) {
+            throw Error{} << "hierarchy level " << k << " starts at node " <<
+                levelOffsets[k] << ", before the previous level";
+        }
+    }
+    if (levelOffsets.back() > parents.size()) {
+        throw Error{} << "hierarchy of " << levelOffsets.back() <<
+            " nodes has only " << parents.size() << " parents";
+    }
+
+    for (uint32_t i = levelOffsets[0]; i < levelOffsets[1]; i++) {
+        for (int k = 0; k < 16; k++) {
+            world.m[k][i] = local.m[k][i];
+        }
+    }
+    for (size_t k = 1; k + 1 < levelOffsets.size(); k++) {
+        run(&BatchKernels::multiplyGathered,
+            levelOffsets[k], levelOffsets[k + 1],
+            world, parents.data(), local, world);
+    }
+}
+
+void transformAabbs(
+    const Mat4Soa& matrices,
+    const AabbSoa& local,
+    const AabbSoa& world,
+    size_t count)
+{
+    run(&BatchKernels::transformAabbs, 0, count, matrices, local, world);
+}
+
+Aabb bounds(const Vec3Soa& points, size_t count)
+{
+    Aabb result = emptyBounds();
+    run(&BatchKernels::bounds, 0, count, points, points, result);
+    return result;
+}
+
+Aabb bounds(const AabbSoa& boxes, size_t count)
+{
+    Aabb result = emptyBounds();
+    run(&BatchKernels::bounds, 0, count, boxes.min, boxes.max, result);
+    return result;
+}
+
+} // namespace rr
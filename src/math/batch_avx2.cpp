@@ -0,0 +1,50 @@
+#include "kernels.hpp"
+
+#include <immintrin.h>
+
+// Compiled with AVX2 and FMA enabled; only called after detectSimdLevel()
+// found them.
+
+namespace rr {
+
+namespace {
+
+struct Lanes {
+    using V = __m256;
+    using Index = __m256i;
+    static constexpr size_t width = 8;
+
+    static V load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+    static V set1(float f) { return _mm256_set1_ps(f); }
+    static V add(V a, V b) { return _mm256_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+    static V fmadd(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+    static V min(V a, V b) { return _mm256_min_ps(a, b); }
+    static V max(V a, V b) { return _mm256_max_ps(a, b); }
+    static V abs(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+
+    static Index loadIndex(const uint32_t* p)
+    {
+        return _mm256_loadu_si256((const __m256i*)p);
+    }
+
+    // Indices are taken as signed, which is fine below 2^31 elements.
+    static V gather(const float* base, Index index)
+    {
+        return _mm256_i32gather_ps(base, index, 4);
+    }
+};
+
+#include "kernels_impl.hpp"
+
+} // namespace
+
+const BatchKernels& avx2Kernels()
+{
+    static const BatchKernels kernels = makeKernels<Lanes>();
+    return kernels;
+}
+
+} // namespace rr
@@ -0,0 +1,157 @@
+#include "kernels.hpp"
+
+#include <cmath>
+#include <type_traits>
+
+namespace rr {
+
+namespace {
+
+struct Lanes {
+    using V = float;
+    using Index = uint32_t;
+    static constexpr size_t width = 1;
+
+    static V load(const float* p) { return *p; }
+    static void store(float* p, V v) { *p = v; }
+    static V set1(float f) { return f; }
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+    static V fmadd(V a, V b, V c) { return a * b + c; }
+    static V min(V a, V b) { return a < b ? a : b; }
+    static V max(V a, V b) { return a > b ? a : b; }
+    static V abs(V a) { return std::fabs(a); }
+    static Index loadIndex(const uint32_t* p) { return *p; }
+    static V gather(const float* base, Index index) { return base[index]; }
+};
+
+#include "kernels_impl.hpp"
+
+// multiplyLoop at width 1 walks all 48 arrays of an element before moving
+// to the next, which is several times slower than the same products on
+// arrays of rr::Mat4. These work on blocks of elements instead, with the
+// products as plain loops over the block into a local result. For full
+// blocks the trip count is a constant, so the compiler vectorizes them
+// without alias checks, with whatever vector registers the target has by
+// default.
+constexpr size_t blockSize = 16;
+
+// out[i] = A * b[i] for the count elements from first, where a(k, i) is
+// element k of the A of element i. Count is size_t, or a constant for full
+// blocks. The block's results are kept until all of it is read, so out may
+// be b.
+template<typename ElementOfA, typename Count>
+void multiplyBlock(
+    ElementOfA a,
+    const Mat4Soa& b,
+    const Mat4Soa& out,
+    size_t first,
+    Count count)
+{
+    float result[16][blockSize];
+    for (int c = 0; c < 4; c++) {
+        const float* b0 = b.m[c * 4] + first;
+        const float* b1 = b.m[c * 4 + 1] + first;
+        const float* b2 = b.m[c * 4 + 2] + first;
+        const float* b3 = b.m[c * 4 + 3] + first;
+        for (int r = 0; r < 4; r++) {
+            for (size_t j = 0; j < count; j++) {
+                size_t i = first + j;
+                result[c * 4 + r][j] =
+                    a(r, i) * b0[j] +
+                    a(4 + r, i) * b1[j] +
+                    a(8 + r, i) * b2[j] +
+                    a(12 + r, i) * b3[j];
+            }
+        }
+    }
+    for (int k = 0; k < 16; k++) {
+        for (size_t j = 0; j < count; j++) {
+            out.m[k][first + j] = result[k][j];
+        }
+    }
+}
+
+// Calls function(first, count) for the blocks of begin to end, with count
+// a constant for the full ones.
+template<typename Function>
+void forEachBlock(size_t begin, size_t end, Function function)
+{
+    size_t first = begin;
+    for (; end - first >= blockSize; first += blockSize) {
+        function(first, std::integral_constant<size_t, blockSize>{});
+    }
+    if (first < end) {
+        function(first, end - first);
+    }
+}
+
+void multiplyMatricesScalar(
+    const Mat4Soa& a,
+    const Mat4Soa& b,
+    const Mat4Soa& out,
+    size_t begin,
+    size_t end)
+{
+    auto element = [&](int k, size_t i) { return a.m[k][i]; };
+    forEachBlock(begin, end, [&](size_t first, auto count) {
+        multiplyBlock(element, b, out, first, count);
+    });
+}
+
+void multiplyGatheredScalar(
+    const Mat4Soa& a,
+    const uint32_t* indices,
+    const Mat4Soa& b,
+    const Mat4Soa& out,
+    size_t begin,
+    size_t end)
+{
+    // Gathered once per block rather than in every product that uses them.
+    float gathered[16][blockSize];
+    forEachBlock(begin, end, [&](size_t first, auto count) {
+        for (size_t j = 0; j < count; j++) {
+            uint32_t index = indices[first + j];
+            for (int k = 0; k < 16; k++) {
+                gathered[k][j] = a.m[k][index];
+            }
+        }
+        auto element = [&](int k, size_t i) { return gathered[k][i - first]; };
+        multiplyBlock(element, b, out, first, count);
+    });
+}
+
+void transformMatricesScalar(
+    const Mat4& m,
+    const Mat4Soa& in,
+    const Mat4Soa& out,
+    size_t begin,
+    size_t end)
+{
+    // A copy the stores to out cannot alias.
+    float elements[16];
+    for (int k = 0; k < 16; k++) {
+        elements[k] = m.m[k];
+    }
+    auto element = [&](int k, size_t) { return elements[k]; };
+    forEachBlock(begin, end, [&](size_t first, auto count) {
+        multiplyBlock(element, in, out, first, count);
+    });
+}
+
+} // namespace
+
+const BatchKernels& scalarKernels()
+{
+    static const BatchKernels kernels = [] {
+        BatchKernels k = makeKernels<Lanes>();
+        k.multiplyMatrices = multiplyMatricesScalar;
+        k.multiplyGathered = multiplyGatheredScalar;
+        k.transformMatrices = transformMatricesScalar;
+        return k;
+    }();
+    return kernels;
+}
+
+} // namespace rr
@@ -0,0 +1,46 @@
+#include "kernels.hpp"
+
+#include <immintrin.h>
+
+namespace rr {
+
+namespace {
+
+// SSE2, which every x86-64 CPU has.
+struct Lanes {
+    using V = __m128;
+    using Index = const uint32_t*;
+    static constexpr size_t width = 4;
+
+    static V load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, V v) { _mm_storeu_ps(p, v); }
+    static V set1(float f) { return _mm_set1_ps(f); }
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+    static V fmadd(V a, V b, V c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static V min(V a, V b) { return _mm_min_ps(a, b); }
+    static V max(V a, V b) { return _mm_max_ps(a, b); }
+    static V abs(V a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+
+    // SSE has no gather; the indices are read per lane.
+    static Index loadIndex(const uint32_t* p) { return p; }
+
+    static V gather(const float* base, Index index)
+    {
+        return _mm_setr_ps(
+            base[index[0]], base[index[1]], base[index[2]], base[index[3]]);
+    }
+};
+
+#include "kernels_impl.hpp"
+
+} // namespace
+
+const BatchKernels& sseKernels()
+{
+    static const BatchKernels kernels = makeKernels<Lanes>();
+    return kernels;
+}
+
+} // namespace rr
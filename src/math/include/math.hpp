@@ -0,0 +1,380 @@
+#pragma once
+
+#include <cmath>
+
+namespace rr {
+
+struct Vec2 {
+    float x = 0.f;
+    float y = 0.f;
+};
+
+struct Vec3 {
+    float x = 0.f;
+    float y = 0.f;
+    float z = 0.f;
+};
+
+struct Vec4 {
+    float x = 0.f;
+    float y = 0.f;
+    float z = 0.f;
+    float w = 0.f;
+};
+
+// A rotation as a unit quaternion; w is the real part.
+struct Quat {
+    float x = 0.f;
+    float y = 0.f;
+    float z = 0.f;
+    float w = 1.f;
+};
+
+// Column-major, as a GLSL mat4: m[column * 4 + row]. Points are column
+// vectors, transformed as M * p, so A * B applies B first.
+struct Mat4 {
+    float m[16] {
+        1.f, 0.f, 0.f, 0.f,
+        0.f, 1.f, 0.f, 0.f,
+        0.f, 0.f, 1.f, 0.f,
+        0.f, 0.f, 0.f, 1.f,
+    };
+
+    float& operator()(int row, int column)
+    {
+        return m[column * 4 + row];
+    }
+
+    float operator()(int row, int column) const
+    {
+        return m[column * 4 + row];
+    }
+};
+
+// Vectors.
+
+inline Vec2 operator+(Vec2 a, Vec2 b) { return {a.x + b.x, a.y + b.y}; }
+inline Vec2 operator-(Vec2 a, Vec2 b) { return {a.x - b.x, a.y - b.y}; }
+inline Vec2 operator*(Vec2 a, float s) { return {a.x * s, a.y * s}; }
+
+inline Vec3 operator+(Vec3 a, Vec3 b)
+{
+    return {a.x + b.x, a.y + b.y, a.z + b.z};
+}
+
+inline Vec3 operator-(Vec3 a, Vec3 b)
+{
+    return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+inline Vec3 operator-(Vec3 a)
+{
+    return {-a.x, -a.y, -a.z};
+}
+
+inline Vec3 operator*(Vec3 a, float s)
+{
+    return {a.x * s, a.y * s, a.z * s};
+}
+
+inline Vec3 operator*(float s, Vec3 a)
+{
+    return a * s;
+}
+
+// Component-wise.
+inline Vec3 operator*(Vec3 a, Vec3 b)
+{
+    return {a.x * b.x, a.y * b.y, a.z * b.z};
+}
+
+inline Vec4 operator+(Vec4 a, Vec4 b)
+{
+    return {a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w};
+}
+
+inline Vec4 operator*(Vec4 a, float s)
+{
+    return {a.x * s, a.y * s, a.z * s, a.w * s};
+}
+
+inline float dot(Vec3 a, Vec3 b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline float dot(Vec4 a, Vec4 b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+
+inline Vec3 cross(Vec3 a, Vec3 b)
+{
+    return {
+        a.y * b.z - a.z * b.y,
+        a.z * b.x - a.x * b.z,
+        a.x * b.y - a.y * b.x,
+    };
+}
+
+inline float length(Vec3 a)
+{
+    return std::sqrt(dot(a, a));
+}
+
+// Returns the zero vector unchanged.
+inline Vec3 normalize(Vec3 a)
+{
+    float l = length(a);
+    return l > 0.f ? a * (1.f / l) : a;
+}
+
+inline Vec3 lerp(Vec3 a, Vec3 b, float t)
+{
+    return a + (b - a) * t;
+}
+
+// Quaternions.
+
+inline Quat operator*(Quat a, Quat b)
+{
+    return {
+        a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+        a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+        a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+        a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+    };
+}
+
+inline float dot(Quat a, Quat b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+
+inline Quat normalize(Quat q)
+{
+    float l = std::sqrt(dot(q, q));
+    if (l == 0.f) {
+        return Quat{};
+    }
+    float s = 1.f / l;
+    return {q.x * s, q.y * s, q.z * s, q.w * s};
+}
+
+inline Quat conjugate(Quat q)
+{
+    return {-q.x, -q.y, -q.z, q.w};
+}
+
+// axis must be normalized; angle is in radians, counterclockwise when
+// looking against the axis.
+inline Quat axisAngle(Vec3 axis, float angle)
+{
+    float s = std::sin(angle * 0.5f);
+    return {axis.x * s, axis.y * s, axis.z * s, std::cos(angle * 0.5f)};
+}
+
+inline Vec3 rotate(Quat q, Vec3 v)
+{
+    // v + 2w (u x v) + 2 u x (u x v), with u the vector part.
+    auto u = Vec3{q.x, q.y, q.z};
+    Vec3 t = cross(u, v) * 2.f;
+    return v + t * q.w + cross(u, t);
+}
+
+// Normalized linear interpolation along the shorter arc; close to slerp
+// for the small steps of animation and much cheaper.
+inline Quat nlerp(Quat a, Quat b, float t)
+{
+    float sign = dot(a, b) < 0.f ? -1.f : 1.f;
+    return normalize(Quat{
+        a.x + (b.x * sign - a.x) * t,
+        a.y + (b.y * sign - a.y) * t,
+        a.z + (b.z * sign - a.z) * t,
+        a.w + (b.w * sign - a.w) * t,
+    });
+}
+
+// Matrices.
+
+inline Mat4 operator*(const Mat4& a, const Mat4& b)
+{
+    Mat4 r;
+    for (int c = 0; c < 4; c++) {
+        for (int row = 0; row < 4; row++) {
+            r(row, c) =
+                a(row, 0) * b(0, c) +
+                a(row, 1) * b(1, c) +
+                a(row, 2) * b(2, c) +
+                a(row, 3) * b(3, c);
+        }
+    }
+    return r;
+}
+
+inline Vec4 operator*(const Mat4& a, Vec4 v)
+{
+    return {
+        a(0, 0) * v.x + a(0, 1) * v.y + a(0, 2) * v.z + a(0, 3) * v.w,
+        a(1, 0) * v.x + a(1, 1) * v.y + a(1, 2) * v.z + a(1, 3) * v.w,
+        a(2, 0) * v.x + a(2, 1) * v.y + a(2, 2) * v.z + a(2, 3) * v.w,
+        a(3, 0) * v.x + a(3, 1) * v.y + a(3, 2) * v.z + a(3, 3) * v.w,
+    };
+}
+
+inline Vec3 transformPoint(const Mat4& a, Vec3 p)
+{
+    Vec4 r = a * Vec4{p.x, p.y, p.z, 1.f};
+    return {r.x, r.y, r.z};
+}
+
+inline Vec3 transformVector(const Mat4& a, Vec3 v)
+{
+    Vec4 r = a * Vec4{v.x, v.y, v.z, 0.f};
+    return {r.x, r.y, r.z};
+}
+
+inline Mat4 transpose(const Mat4& a)
+{
+    Mat4 r;
+    for (int c = 0; c < 4; c++) {
+        for (int row = 0; row < 4; row++) {
+            r(row, c) = a(c, row);
+        }
+    }
+    return r;
+}
+
+inline Mat4 translation(Vec3 t)
+{
+    Mat4 r;
+    r(0, 3) = t.x;
+    r(1, 3) = t.y;
+    r(2, 3) = t.z;
+    return r;
+}
+
+inline Mat4 scaling(Vec3 s)
+{
+    Mat4 r;
+    r(0, 0) = s.x;
+    r(1, 1) = s.y;
+    r(2, 2) = s.z;
+    return r;
+}
+
+inline Mat4 rotation(Quat q)
+{
+    float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+    Mat4 r;
+    r(0, 0) = 1.f - 2.f * (yy + zz);
+    r(0, 1) = 2.f * (xy - wz);
+    r(0, 2) = 2.f * (xz + wy);
+    r(1, 0) = 2.f * (xy + wz);
+    r(1, 1) = 1.f - 2.f * (xx + zz);
+    r(1, 2) = 2.f * (yz - wx);
+    r(2, 0) = 2.f * (xz - wy);
+    r(2, 1) = 2.f * (yz + wx);
+    r(2, 2) = 1.f - 2.f * (xx + yy);
+    return r;
+}
+
+// translation * rotation * scaling, without the multiplications.
+inline Mat4 compose(Vec3 t, Quat q, Vec3 s)
+{
+    Mat4 r = rotation(q);
+    for (int row = 0; row < 3; row++) {
+        r(row, 0) *= s.x;
+        r(row, 1) *= s.y;
+        r(row, 2) *= s.z;
+    }
+    r(0, 3) = t.x;
+    r(1, 3) = t.y;
+    r(2, 3) = t.z;
+    return r;
+}
+
+// Inverse of a matrix without projection, e.g. a camera's world
+// transform. The upper 3x3 must be invertible.
+inline Mat4 inverseAffine(const Mat4& a)
+{
+    float c00 = a(1, 1) * a(2, 2) - a(1, 2) * a(2, 1);
+    float c01 = a(1, 2) * a(2, 0) - a(1, 0) * a(2, 2);
+    float c02 = a(1, 0) * a(2, 1) - a(1, 1) * a(2, 0);
+    float det = a(0, 0) * c00 + a(0, 1) * c01 + a(0, 2) * c02;
+    float s = 1.f / det;
+
+    Mat4 r;
+    r(0, 0) = c00 * s;
+    r(1, 0) = c01 * s;
+    r(2, 0) = c02 * s;
+    r(0, 1) = (a(0, 2) * a(2, 1) - a(0, 1) * a(2, 2)) * s;
+    r(1, 1) = (a(0, 0) * a(2, 2) - a(0, 2) * a(2, 0)) * s;
+    r(2, 1) = (a(0, 1) * a(2, 0) - a(0, 0) * a(2, 1)) * s;
+    r(0, 2) = (a(0, 1) * a(1, 2) - a(0, 2) * a(1, 1)) * s;
+    r(1, 2) = (a(0, 2) * a(1, 0) - a(0, 0) * a(1, 2)) * s;
+    r(2, 2) = (a(0, 0) * a(1, 1) - a(0, 1) * a(1, 0)) * s;
+
+    Vec3 t = transformVector(r, Vec3{a(0, 3), a(1, 3), a(2, 3)});
+    r(0, 3) = -t.x;
+    r(1, 3) = -t.y;
+    r(2, 3) = -t.z;
+    return r;
+}
+
+// A right-handed view matrix looking from eye at target.
+inline Mat4 lookAt(Vec3 eye, Vec3 target, Vec3 up)
+{
+    Vec3 f = normalize(target - eye);
+    Vec3 s = normalize(cross(f, up));
+    Vec3 u = cross(s, f);
+
+    Mat4 r;
+    r(0, 0) = s.x;
+    r(0, 1) = s.y;
+    r(0, 2) = s.z;
+    r(1, 0) = u.x;
+    r(1, 1) = u.y;
+    r(1, 2) = u.z;
+    r(2, 0) = -f.x;
+    r(2, 1) = -f.y;
+    r(2, 2) = -f.z;
+    r(0, 3) = -dot(s, eye);
+    r(1, 3) = -dot(u, eye);
+    r(2, 3) = dot(f, eye);
+    return r;
+}
+
+// Projections for right-handed view space into Vulkan clip space: depth
+// from 0 at the near plane to 1 at the far one, and y pointing down.
+inline Mat4 perspective(float fovY, float aspect, float zNear, float zFar)
+{
+    float f = 1.f / std::tan(fovY * 0.5f);
+
+    Mat4 r;
+    r(0, 0) = f / aspect;
+    r(1, 1) = -f;
+    r(2, 2) = zFar / (zNear - zFar);
+    r(2, 3) = zNear * zFar / (zNear - zFar);
+    r(3, 2) = -1.f;
+    r(3, 3) = 0.f;
+    return r;
+}
+
+inline Mat4 orthographic(
+    float left, float right, float bottom, float top, float zNear, float zFar)
+{
+    Mat4 r;
+    r(0, 0) = 2.f / (right - left);
+    r(1, 1) = -2.f / (top - bottom);
+    r(2, 2) = 1.f / (zNear - zFar);
+    r(0, 3) = -(right + left) / (right - left);
+    r(1, 3) = (top + bottom) / (top - bottom);
+    r(2, 3) = zNear / (zNear - zFar);
+    return r;
+}
+
+} // namespace rr
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <math.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+namespace rr {
+
+// Instruction sets the batch kernels are compiled for. Higher levels process
+// more elements per instruction: 1, 4 and 8.
+enum class SimdLevel {
+    Scalar,
+    Sse,
+    // AVX2 with FMA.
+    Avx2,
+};
+
+const char* toString(SimdLevel level);
+
+// The highest level the CPU and OS support and the library was built with.
+SimdLevel detectSimdLevel();
+// The level the batch functions use; detectSimdLevel() until set.
+SimdLevel simdLevel();
+// Clamped to detectSimdLevel(), e.g. to compare against the scalar path.
+void setSimdLevel(SimdLevel level);
+
+// Structure-of-arrays views, one array per component, so the kernels load
+// the same component of consecutive elements into one register. They do not
+// own the arrays, which need no particular alignment.
+
+// One array per element of Mat4::m.
+struct Mat4Soa {
+    float* m[16] {};
+};
+
+struct Vec3Soa {
+    float* x = nullptr;
+    float* y = nullptr;
+    float* z = nullptr;
+};
+
+struct QuatSoa {
+    float* x = nullptr;
+    float* y = nullptr;
+    float* z = nullptr;
+    float* w = nullptr;
+};
+
+struct TransformSoa {
+    Vec3Soa translation;
+    QuatSoa rotation;
+    Vec3Soa scale;
+};
+
+struct Aabb {
+    Vec3 min;
+    Vec3 max;
+};
+
+struct AabbSoa {
+    Vec3Soa min;
+    Vec3Soa max;
+};
+
+// Owns the arrays of a view. Each array is 32-byte aligned and padded to a
+// multiple of eight elements.
+class SoaStorage {
+public:
+    SoaStorage() = default;
+    SoaStorage(size_t size, uint32_t arrayCount);
+
+    size_t size() const;
+    float* array(uint32_t index) const;
+
+private:
+    struct AlignedDelete {
+        void operator()(float* p) const;
+    };
+
+    std::unique_ptr<float[], AlignedDelete> _data;
+    size_t _size = 0;
+    size_t _stride = 0;
+    uint32_t _arrayCount = 0;
+};
+
+class Mat4Batch {
+public:
+    Mat4Batch() = default;
+    explicit Mat4Batch(size_t size);
+
+    size_t size() const;
+    const Mat4Soa& soa() const;
+    Mat4 get(size_t index) const;
+    void set(size_t index, const Mat4& value);
+
+private:
+    SoaStorage _storage;
+    Mat4Soa _soa;
+};
+
+class TransformBatch {
+public:
+    TransformBatch() = default;
+    // Identity transforms.
+    explicit TransformBatch(size_t size);
+
+    size_t size() const;
+    const TransformSoa& soa() const;
+    void set(size_t index, Vec3 translation, Quat rotation, Vec3 scale);
+
+private:
+    SoaStorage _storage;
+    TransformSoa _soa;
+};
+
+class Vec3Batch {
+public:
+    Vec3Batch() = default;
+    explicit Vec3Batch(size_t size);
+
+    size_t size() const;
+    const Vec3Soa& soa() const;
+    Vec3 get(size_t index) const;
+    void set(size_t index, Vec3 value);
+
+private:
+    SoaStorage _storage;
+    Vec3Soa _soa;
+};
+
+class AabbBatch {
+public:
+    AabbBatch() = default;
+    explicit AabbBatch(size_t size);
+
+    size_t size() const;
+    const AabbSoa& soa() const;
+    Aabb get(size_t index) const;
+    void set(size_t index, const Aabb& value);
+
+private:
+    SoaStorage _storage;
+    AabbSoa _soa;
+};
+
+// Batch kernels over count elements of the views, at simdLevel(). The
+// elements past the last full register are done by the scalar kernels.
+// Outputs may be the same arrays as inputs of the same element, except where
+// noted.
+
+// out[i] = compose(translation[i], rotation[i], scale[i]). Rotations must be
+// unit quaternions.
+void composeTransforms(
+    const TransformSoa& transforms, const Mat4Soa& out, size_t count);
+
+// out[i] = a[i] * b[i]. out may be b but not a.
+void multiplyMatrices(
+    const Mat4Soa& a, const Mat4Soa& b, const Mat4Soa& out, size_t count);
+
+// out[i] = m * in[i], e.g. a view-projection applied to every world matrix.
+void transformMatrices(
+    const Mat4& m, const Mat4Soa& in, const Mat4Soa& out, size_t count);
+
+// World matrices of a transform hierarchy. Nodes are ordered by depth:
+// nodes levelOffsets[k] to levelOffsets[k + 1] are at depth k, the last
+// offset is the node count, and the nodes at depth 0 are roots whose world
+// matrix is their local one. Every other node has its parent, at a lower
+// depth, in parents; world[i] = world[parents[i]] * local[i]. Each level is
+// one batch, with the parents' matrices gathered into registers; ordering
+// each level's nodes by parent, as a breadth-first traversal does, keeps the
+// gathers within few cache lines.
+void composeHierarchy(
+    std::span<const uint32_t> parents,
+    std::span<const uint32_t> levelOffsets,
+    const Mat4Soa& local,
+    const Mat4Soa& world);
+
+// World-space bounds of local boxes under affine matrices, from the
+// transformed center and the extent transformed by the absolute matrix:
+// the bounds of the eight transformed corners, without transforming them.
+void transformAabbs(
+    const Mat4Soa& matrices,
+    const AabbSoa& local,
+    const AabbSoa& world,
+    size_t count);
+
+// The bounds of points, or of boxes. Empty input gives min at +infinity and
+// max at -infinity.
+Aabb bounds(const Vec3Soa& points, size_t count);
+Aabb bounds(const AabbSoa& boxes, size_t count);
+
+} // namespace rr
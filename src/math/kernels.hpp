@@ -0,0 +1,64 @@
+#pragma once
+
+#include <math_batch.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+// A table of batch kernels per instruction set, filled from the templates in
+// kernels_impl.hpp. Each kernel processes elements begin to end, which must
+// be a multiple of width apart.
+
+namespace rr {
+
+struct BatchKernels {
+    size_t width = 1;
+
+    void (*composeTransforms)(
+        const TransformSoa& transforms,
+        const Mat4Soa& out,
+        size_t begin,
+        size_t end) = nullptr;
+    void (*multiplyMatrices)(
+        const Mat4Soa& a,
+        const Mat4Soa& b,
+        const Mat4Soa& out,
+        size_t begin,
+        size_t end) = nullptr;
+    // out[i] = a[indices[i]] * b[i].
+    void (*multiplyGathered)(
+        const Mat4Soa& a,
+        const uint32_t* indices,
+        const Mat4Soa& b,
+        const Mat4Soa& out,
+        size_t begin,
+        size_t end) = nullptr;
+    void (*transformMatrices)(
+        const Mat4& m,
+        const Mat4Soa& in,
+        const Mat4Soa& out,
+        size_t begin,
+        size_t end) = nullptr;
+    void (*transformAabbs)(
+        const Mat4Soa& matrices,
+        const AabbSoa& local,
+        const AabbSoa& world,
+        size_t begin,
+        size_t end) = nullptr;
+    // Lowers bounds.min to the minimum of lo and raises bounds.max to the
+    // maximum of hi.
+    void (*bounds)(
+        const Vec3Soa& lo,
+        const Vec3Soa& hi,
+        Aabb& bounds,
+        size_t begin,
+        size_t end) = nullptr;
+};
+
+const BatchKernels& scalarKernels();
+#ifdef RR_MATH_X86
+const BatchKernels& sseKernels();
+const BatchKernels& avx2Kernels();
+#endif
+
+} // namespace rr
@@ -0,0 +1,272 @@
+// The batch kernels, written once against a lanes type L that provides:
+//
+//   L::V, a register of floats, and L::Index, a register of indices
+//   L::width, the elements per register
+//   load, store, set1, add, sub, mul, fmadd (a * b + c), min, max and abs
+//   loadIndex, and gather, which loads base[index] per lane
+//
+// Every instruction set's file includes this file inside a namespace of its
+// own, after defining its lanes type there, so no function is shared between
+// files compiled with different instruction set flags; the linker could
+// otherwise keep an AVX2 copy of one for every caller. For the same reason
+// the kernels only call L, never inline functions of rr or std.
+//
+// No include guard: the file is meant to be included more than once.
+
+template<typename L>
+void composeTransforms(
+    const TransformSoa& transforms,
+    const Mat4Soa& out,
+    size_t begin,
+    size_t end)
+{
+    using V = typename L::V;
+    V zero = L::set1(0.f);
+    V one = L::set1(1.f);
+    V two = L::set1(2.f);
+
+    for (size_t i = begin; i < end; i += L::width) {
+        V qx = L::load(transforms.rotation.x + i);
+        V qy = L::load(transforms.rotation.y + i);
+        V qz = L::load(transforms.rotation.z + i);
+        V qw = L::load(transforms.rotation.w + i);
+        V sx = L::load(transforms.scale.x + i);
+        V sy = L::load(transforms.scale.y + i);
+        V sz = L::load(transforms.scale.z + i);
+
+        V xx = L::mul(qx, qx);
+        V yy = L::mul(qy, qy);
+        V zz = L::mul(qz, qz);
+        V xy = L::mul(qx, qy);
+        V xz = L::mul(qx, qz);
+        V yz = L::mul(qy, qz);
+        V wx = L::mul(qw, qx);
+        V wy = L::mul(qw, qy);
+        V wz = L::mul(qw, qz);
+
+        L::store(out.m[0] + i,
+            L::mul(L::sub(one, L::mul(two, L::add(yy, zz))), sx));
+        L::store(out.m[1] + i, L::mul(L::mul(two, L::add(xy, wz)), sx));
+        L::store(out.m[2] + i, L::mul(L::mul(two, L::sub(xz, wy)), sx));
+        L::store(out.m[3] + i, zero);
+
+        L::store(out.m[4] + i, L::mul(L::mul(two, L::sub(xy, wz)), sy));
+        L::store(out.m[5] + i,
+            L::mul(L::sub(one, L::mul(two, L::add(xx, zz))), sy));
+        L::store(out.m[6] + i, L::mul(L::mul(two, L::add(yz, wx)), sy));
+        L::store(out.m[7] + i, zero);
+
+        L::store(out.m[8] + i, L::mul(L::mul(two, L::add(xz, wy)), sz));
+        L::store(out.m[9] + i, L::mul(L::mul(two, L::sub(yz, wx)), sz));
+        L::store(out.m[10] + i,
+            L::mul(L::sub(one, L::mul(two, L::add(xx, yy))), sz));
+        L::store(out.m[11] + i, zero);
+
+        L::store(out.m[12] + i, L::load(transforms.translation.x + i));
+        L::store(out.m[13] + i, L::load(transforms.translation.y + i));
+        L::store(out.m[14] + i, L::load(transforms.translation.z + i));
+        L::store(out.m[15] + i, one);
+    }
+}
+
+// out[i] = A * b[i] for elements begin to end, where loadA(i, a) loads the
+// elements of the A of element i into a. Each column of b is loaded before
+// that column of out is stored, so out may be b.
+template<typename L, typename LoadA>
+void multiplyLoop(
+    LoadA loadA,
+    const Mat4Soa& b,
+    const Mat4Soa& out,
+    size_t begin,
+    size_t end)
+{
+    using V = typename L::V;
+    V a[16];
+    for (size_t i = begin; i < end; i += L::width) {
+        loadA(i, a);
+        for (int c = 0; c < 4; c++) {
+            V b0 = L::load(b.m[c * 4 + 0] + i);
+            V b1 = L::load(b.m[c * 4 + 1] + i);
+            V b2 = L::load(b.m[c * 4 + 2] + i);
+            V b3 = L::load(b.m[c * 4 + 3] + i);
+            for (int r = 0; r < 4; r++) {
+                V v = L::mul(a[r], b0);
+                v = L::fmadd(a[4 + r], b1, v);
+                v = L::fmadd(a[8 + r], b2, v);
+                v = L::fmadd(a[12 + r], b3, v);
+                L::store(out.m[c * 4 + r] + i, v);
+            }
+        }
+    }
+}
+
+template<typename L>
+void multiplyMatrices(
+    const Mat4Soa& a,
+    const Mat4Soa& b,
+    const Mat4Soa& out,
+    size_t begin,
+    size_t end)
+{
+    auto load = [&](size_t i, typename L::V* am) {
+        for (int k = 0; k < 16; k++) {
+            am[k] = L::load(a.m[k] + i);
+        }
+    };
+    multiplyLoop<L>(load, b, out, begin, end);
+}
+
+template<typename L>
+void multiplyGathered(
+    const Mat4Soa& a,
+    const uint32_t* indices,
+    const Mat4Soa& b,
+    const Mat4Soa& out,
+    size_t begin,
+    size_t end)
+{
+    auto gather = [&](size_t i, typename L::V* am) {
+        typename L::Index index = L::loadIndex(indices + i);
+        for (int k = 0; k < 16; k++) {
+            am[k] = L::gather(a.m[k], index);
+        }
+    };
+    multiplyLoop<L>(gather, b, out, begin, end);
+}
+
+template<typename L>
+void transformMatrices(
+    const Mat4& m,
+    const Mat4Soa& in,
+    const Mat4Soa& out,
+    size_t begin,
+    size_t end)
+{
+    // A copy the stores to out cannot alias, so the broadcasts are hoisted
+    // out of the loop.
+    float elements[16];
+    for (int k = 0; k < 16; k++) {
+        elements[k] = m.m[k];
+    }
+    auto broadcast = [&](size_t, typename L::V* am) {
+        for (int k = 0; k < 16; k++) {
+            am[k] = L::set1(elements[k]);
+        }
+    };
+    multiplyLoop<L>(broadcast, in, out, begin, end);
+}
+
+template<typename L>
+void transformAabbs(
+    const Mat4Soa& matrices,
+    const AabbSoa& local,
+    const AabbSoa& world,
+    size_t begin,
+    size_t end)
+{
+    using V = typename L::V;
+    V half = L::set1(0.5f);
+
+    for (size_t i = begin; i < end; i += L::width) {
+        V minX = L::load(local.min.x + i);
+        V minY = L::load(local.min.y + i);
+        V minZ = L::load(local.min.z + i);
+        V maxX = L::load(local.max.x + i);
+        V maxY = L::load(local.max.y + i);
+        V maxZ = L::load(local.max.z + i);
+
+        V cx = L::mul(L::add(minX, maxX), half);
+        V cy = L::mul(L::add(minY, maxY), half);
+        V cz = L::mul(L::add(minZ, maxZ), half);
+        V ex = L::mul(L::sub(maxX, minX), half);
+        V ey = L::mul(L::sub(maxY, minY), half);
+        V ez = L::mul(L::sub(maxZ, minZ), half);
+
+        V center[3];
+        V extent[3];
+        for (int r = 0; r < 3; r++) {
+            V m0 = L::load(matrices.m[r] + i);
+            V m1 = L::load(matrices.m[4 + r] + i);
+            V m2 = L::load(matrices.m[8 + r] + i);
+            V m3 = L::load(matrices.m[12 + r] + i);
+            center[r] = L::fmadd(m0, cx,
+                L::fmadd(m1, cy, L::fmadd(m2, cz, m3)));
+            extent[r] = L::fmadd(L::abs(m0), ex,
+                L::fmadd(L::abs(m1), ey, L::mul(L::abs(m2), ez)));
+        }
+
+        L::store(world.min.x + i, L::sub(center[0], extent[0]));
+        L::store(world.min.y + i, L::sub(center[1], extent[1]));
+        L::store(world.min.z + i, L::sub(center[2], extent[2]));
+        L::store(world.max.x + i, L::add(center[0], extent[0]));
+        L::store(world.max.y + i, L::add(center[1], extent[1]));
+        L::store(world.max.z + i, L::add(center[2], extent[2]));
+    }
+}
+
+template<typename L>
+void reduceMin(typename L::V v, float& result)
+{
+    float lanes[L::width];
+    L::store(lanes, v);
+    for (size_t j = 0; j < L::width; j++) {
+        result = lanes[j] < result ? lanes[j] : result;
+    }
+}
+
+template<typename L>
+void reduceMax(typename L::V v, float& result)
+{
+    float lanes[L::width];
+    L::store(lanes, v);
+    for (size_t j = 0; j < L::width; j++) {
+        result = lanes[j] > result ? lanes[j] : result;
+    }
+}
+
+template<typename L>
+void bounds(
+    const Vec3Soa& lo,
+    const Vec3Soa& hi,
+    Aabb& result,
+    size_t begin,
+    size_t end)
+{
+    using V = typename L::V;
+    V minX = L::set1(result.min.x);
+    V minY = L::set1(result.min.y);
+    V minZ = L::set1(result.min.z);
+    V maxX = L::set1(result.max.x);
+    V maxY = L::set1(result.max.y);
+    V maxZ = L::set1(result.max.z);
+
+    for (size_t i = begin; i < end; i += L::width) {
+        minX = L::min(minX, L::load(lo.x + i));
+        minY = L::min(minY, L::load(lo.y + i));
+        minZ = L::min(minZ, L::load(lo.z + i));
+        maxX = L::max(maxX, L::load(hi.x + i));
+        maxY = L::max(maxY, L::load(hi.y + i));
+        maxZ = L::max(maxZ, L::load(hi.z + i));
+    }
+
+    reduceMin<L>(minX, result.min.x);
+    reduceMin<L>(minY, result.min.y);
+    reduceMin<L>(minZ, result.min.z);
+    reduceMax<L>(maxX, result.max.x);
+    reduceMax<L>(maxY, result.max.y);
+    reduceMax<L>(maxZ, result.max.z);
+}
+
+template<typename L>
+BatchKernels makeKernels()
+{
+    return BatchKernels{
+        .width = L::width,
+        .composeTransforms = composeTransforms<L>,
+        .multiplyMatrices = multiplyMatrices<L>,
+        .multiplyGathered = multiplyGathered<L>,
+        .transformMatrices = transformMatrices<L>,
+        .transformAabbs = transformAabbs<L>,
+        .bounds = bounds<L>,
+    };
+}
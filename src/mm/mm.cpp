@@ -86,15 +86,27 @@ void MemoryMap::map(const std::filesystem::path& path)
 
     auto fileSize = lseek(fd, 0, SEEK_END);
     if (fileSize == -1) {
+        int lseekErrno = errno;
+        close(fd);
+        errno = lseekErrno;
         checkErrno();
     }
-    _len = fileSize;
+
+    // mmap rejects zero-length mappings; an empty file maps to nothing.
+    if (fileSize == 0) {
+        close(fd);
+        return;
+    }
 
     void* addr = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    int mmapErrno = errno;
+    close(fd);
     if (addr == MAP_FAILED) {
+        errno = mmapErrno;
         checkErrno();
     }
     _addr = addr;
+    _len = fileSize;
 #elif defined(_WIN32)
     HANDLE fileHandle = CreateFileW(
         path.c_str(),
@@ -2,6 +2,7 @@
 
 #include <error.hpp>
 
+#include <cstdlib>
 #include <cstring>
 
 #define LEN_AND_STRING(STR) std::strlen(STR), STR
@@ -130,7 +131,12 @@ WindowSize XcbWindow::size() const
 {
     auto cookie = xcb_get_geometry(_connection.ptr(), _window);
     auto* reply = xcb_get_geometry_reply(_connection.ptr(), cookie, nullptr);
-    return {.width = reply->width, .height = reply->height};
+    if (!reply) {
+        throw Error{} << "cannot get window geometry";
+    }
+    auto size = WindowSize{.width = reply->width, .height = reply->height};
+    std::free(reply);
+    return size;
 }
 
 std::optional<ev::Event> XcbWindow::poll() const